@@ -15,6 +15,8 @@ GLOBAL_DEFINES += MODULE_VERSION=$(BOOTLOADER_VERSION)
 GLOBAL_DEFINES += MODULE_FUNCTION=$(MODULE_FUNCTION_BOOTLOADER)
 GLOBAL_DEFINES += MODULE_DEPENDENCY=0,0,0
 GLOBAL_DEFINES += MODULE_DEPENDENCY2=0,0,0
+# use the smaller byte-at-a-time CRC32 table
+GLOBAL_DEFINES += CRC32_SLICES=1
 
 ifeq ($(MONO_MFG_FIRMWARE_AT_USER_PART),y)
 GLOBAL_DEFINES += MONO_MFG_FIRMWARE_AT_USER_PART
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation, either
+# version 3 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see <http://www.gnu.org/licenses/>.
+#
+
+# Creates a delta patch (see services/inc/delta_patch.h) that updates a module installed on a
+# device to a new version of the module. The patch is sent to the device instead of the new
+# module binary, for example with `particle flash <device> patch.bin`.
+#
+# Usage: create_patch.py installed.bin new.bin patch.bin
+#
+# Both input files are module binaries as produced by the build, ending with the CRC of the
+# module. The patch only applies to a device on which the first module is installed.
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'PDLT'
+VERSION = 1
+HEADER = struct.Struct('<4sB3xIIII')
+
+COPY = 0x01
+INSERT = 0x02
+
+# A match shorter than this takes more space as a COPY command than as inserted data
+MIN_MATCH = 8
+# Number of source positions kept for each MIN_MATCH byte sequence
+MAX_CANDIDATES = 16
+
+def varint(value):
+    out = bytearray()
+    while True:
+        b = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return out
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7f) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+def match_length(source, src_pos, target, tgt_pos):
+    n = 0
+    limit = min(len(source) - src_pos, len(target) - tgt_pos)
+    # Compare in blocks first, then byte by byte
+    while n + 64 <= limit and source[src_pos + n:src_pos + n + 64] == target[tgt_pos + n:tgt_pos + n + 64]:
+        n += 64
+    while n < limit and source[src_pos + n] == target[tgt_pos + n]:
+        n += 1
+    return n
+
+def index_source(source):
+    index = {}
+    for i in range(len(source) - MIN_MATCH + 1):
+        positions = index.setdefault(source[i:i + MIN_MATCH], [])
+        if len(positions) < MAX_CANDIDATES:
+            positions.append(i)
+    return index
+
+def diff(source, target):
+    """Generates the commands that produce the target from the source"""
+    index = index_source(source)
+    commands = bytearray()
+    literal = bytearray()
+    src_end = 0 # End of the previous COPY in the source
+    tgt_end = 0 # End of the previous COPY in the target
+    pos = 0
+    while pos < len(target):
+        best_len = 0
+        best_off = 0
+        # Code that hasn't changed usually follows the previous match at the same distance,
+        # even if a few bytes in between are different
+        expected = src_end + (pos - tgt_end)
+        if expected < len(source):
+            best_len = match_length(source, expected, target, pos)
+            best_off = expected
+        for off in index.get(bytes(target[pos:pos + MIN_MATCH]), ()):
+            n = match_length(source, off, target, pos)
+            if n > best_len:
+                best_len = n
+                best_off = off
+        if best_len < MIN_MATCH:
+            literal.append(target[pos])
+            pos += 1
+            continue
+        if literal:
+            commands.append(INSERT)
+            commands += varint(len(literal))
+            commands += literal
+            literal = bytearray()
+        commands.append(COPY)
+        commands += varint(zigzag(best_off - src_end))
+        commands += varint(best_len)
+        src_end = best_off + best_len
+        pos += best_len
+        tgt_end = pos
+    if literal:
+        commands.append(INSERT)
+        commands += varint(len(literal))
+        commands += literal
+    return commands
+
+def module_crc(module):
+    if len(module) < 4:
+        raise ValueError('module is too short')
+    crc, = struct.unpack('>I', module[-4:])
+    if zlib.crc32(module[:-4]) & 0xffffffff != crc:
+        raise ValueError('module CRC mismatch')
+    return crc
+
+def create_patch(source_module, target):
+    """Creates a patch that produces the target from the source module"""
+    source = source_module[:-4]
+    header = HEADER.pack(MAGIC, VERSION, len(source), module_crc(source_module), len(target),
+            zlib.crc32(target) & 0xffffffff)
+    return header + diff(source, target)
+
+def apply_patch(source_module, patch):
+    """Applies a patch the way the device does"""
+    magic, version, source_size, source_crc, target_size, target_crc = HEADER.unpack_from(patch)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a patch')
+    source = source_module[:-4]
+    if len(source) != source_size or module_crc(source_module) != source_crc:
+        raise ValueError('the patch is for a different module')
+    target = bytearray()
+    src_end = 0
+    pos = HEADER.size
+    while len(target) < target_size:
+        cmd = patch[pos]
+        pos += 1
+        if cmd == COPY:
+            delta, pos = read_varint(patch, pos)
+            length, pos = read_varint(patch, pos)
+            off = src_end + ((delta >> 1) ^ -(delta & 1))
+            target += source[off:off + length]
+            src_end = off + length
+        elif cmd == INSERT:
+            length, pos = read_varint(patch, pos)
+            target += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError('unknown command 0x%02x' % cmd)
+    if pos != len(patch) or zlib.crc32(target) & 0xffffffff != target_crc:
+        raise ValueError('invalid patch')
+    return bytes(target)
+
+def main():
+    parser = argparse.ArgumentParser(description='Create a delta patch for a firmware module')
+    parser.add_argument('source', help='module binary installed on the device')
+    parser.add_argument('target', help='new module binary')
+    parser.add_argument('patch', help='patch file to create')
+    args = parser.parse_args()
+    with open(args.source, 'rb') as f:
+        source = f.read()
+    with open(args.target, 'rb') as f:
+        target = f.read()
+    try:
+        patch = create_patch(source, target)
+        if apply_patch(source, patch) != target:
+            raise ValueError('the patch doesn\'t reproduce the target')
+    except ValueError as e:
+        print('%s: %s' % (parser.prog, e), file=sys.stderr)
+        return 1
+    with open(args.patch, 'wb') as f:
+        f.write(patch)
+    print('%s: %d bytes, %.1f%% of the module' % (args.patch, len(patch), len(patch) * 100.0 / max(len(target), 1)))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation, either
+# version 3 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see <http://www.gnu.org/licenses/>.
+#
+
+# Converts binary log records (see services/inc/binary_log.h) to text. The format strings and
+# category names are looked up in the ELF files of the firmware modules that produced the records.
+#
+# Usage: decode_binary_log.py -e system-part1.elf -e user-part.elf records.bin
+#
+# The input file is a sequence of records, as returned by BinaryLogBuffer::read(). Requires
+# pyelftools.
+
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+HEADER = struct.Struct('<HBBI')
+WORD_SIZE_MASK = 0x0f
+FLAG_TRUNCATED = 0x80
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L)?(.)', re.S)
+
+LEVEL_NAMES = [(60, 'PANIC'), (50, 'ERROR'), (40, 'WARN'), (30, 'INFO'), (0, 'TRACE')]
+
+class Strings:
+    """Null-terminated strings stored in the loadable sections of ELF files"""
+    def __init__(self, files):
+        self.sections = []
+        for f in files:
+            elf = ELFFile(open(f, 'rb'))
+            for s in elf.iter_sections():
+                if s['sh_type'] == 'SHT_PROGBITS' and s['sh_addr'] and s['sh_size']:
+                    self.sections.append((s['sh_addr'], s.data()))
+            self.little_endian = elf.little_endian
+
+    def get(self, addr):
+        for start, data in self.sections:
+            if start <= addr < start + len(data):
+                offs = addr - start
+                end = data.find(b'\0', offs)
+                if end < 0:
+                    end = len(data)
+                return data[offs:end].decode('utf-8', 'replace')
+        return None
+
+class Reader:
+    def __init__(self, data, byte_order):
+        self.data = data
+        self.pos = 0
+        self.byte_order = byte_order
+
+    def read(self, size):
+        if self.pos + size > len(self.data):
+            raise EOFError()
+        d = self.data[self.pos:self.pos + size]
+        self.pos += size
+        return d
+
+    def integer(self, size, signed=False):
+        return int.from_bytes(self.read(size), self.byte_order, signed=signed)
+
+    def double(self):
+        return struct.unpack(('<' if self.byte_order == 'little' else '>') + 'd', self.read(8))[0]
+
+def integer_size(length, conv, word_size):
+    if conv == 'p':
+        return word_size
+    if length in ('ll', 'j'):
+        return 8
+    if length in ('l', 'z', 't') and conv != 'c':
+        return word_size
+    return 4
+
+def format_message(fmt, r, word_size):
+    """Formats the arguments read from a record according to a C format string. Returns the
+    message and a flag telling whether all arguments were found in the record"""
+    out = []
+    try:
+        format_arguments(fmt, r, word_size, out)
+    except EOFError:
+        return ''.join(out), False
+    return ''.join(out), True
+
+def format_arguments(fmt, r, word_size, out):
+    pos = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, precision, length, conv = m.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+        if width == '*':
+            width = r.integer(4, signed=True)
+            if width < 0:
+                flags += '-'
+                width = -width
+        if precision == '*':
+            precision = r.integer(4, signed=True)
+            if precision < 0:
+                precision = None
+        elif precision == '':
+            precision = 0
+        spec = '%' + flags + (str(width) if width is not None else '')
+        if conv == 's':
+            n = r.integer(1)
+            out.append((spec + 's') % r.read(n).decode('utf-8', 'replace'))
+        elif conv == 'p':
+            out.append((spec + '#x') % r.integer(word_size))
+        elif conv == 'c':
+            out.append((spec + 'c') % chr(r.integer(4)))
+        elif conv in 'diouxX':
+            value = r.integer(integer_size(length, conv, word_size), signed=(conv in 'di'))
+            if precision is not None:
+                spec += '.' + str(precision)
+            out.append((spec + ('d' if conv in 'iu' else conv)) % value)
+        elif conv in 'eEfFgG':
+            if precision is not None:
+                spec += '.' + str(precision)
+            out.append((spec + conv) % r.double())
+        elif conv in 'aA':
+            value = r.double().hex()
+            out.append(value.upper() if conv == 'A' else value)
+        elif conv != 'n':
+            raise EOFError() # Unknown conversion, the remaining arguments can't be located
+    out.append(fmt[pos:])
+
+def decode_records(data, strings):
+    byte_order = 'little' if strings.little_endian else 'big'
+    header = HEADER if strings.little_endian else struct.Struct('>HBBI')
+    offs = 0
+    while offs + header.size <= len(data):
+        size, level, flags, time = header.unpack_from(data, offs)
+        if size < header.size or offs + size > len(data):
+            raise ValueError('Invalid record at offset %d' % offs)
+        word_size = flags & WORD_SIZE_MASK
+        r = Reader(data[offs + header.size:offs + size], byte_order)
+        offs += size
+        fmt_addr = r.integer(word_size)
+        cat_addr = r.integer(word_size)
+        fmt = strings.get(fmt_addr)
+        if fmt is None:
+            yield time, level, None, '<unknown format string 0x%x>' % fmt_addr
+            continue
+        category = strings.get(cat_addr) if cat_addr else None
+        msg, complete = format_message(fmt, r, word_size)
+        if not complete or flags & FLAG_TRUNCATED:
+            msg += '~'
+        yield time, level, category, msg
+
+def level_name(level):
+    return next(name for l, name in LEVEL_NAMES if level >= l)
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert binary log records to text')
+    parser.add_argument('-e', '--elf', action='append', required=True, help='ELF file of a firmware module')
+    parser.add_argument('records', help='file with binary log records')
+    args = parser.parse_args()
+    strings = Strings(args.elf)
+    with open(args.records, 'rb') as f:
+        data = f.read()
+    for time, level, category, msg in decode_records(data, strings):
+        line = '%010u ' % time
+        if category:
+            line += '[%s] ' % category
+        line += '%s: %s' % (level_name(level), msg)
+        print(line)
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -108,12 +108,38 @@ namespace CoAPCode {
 namespace CoAPOption {
 	enum Enum {
 		NONE = 0,
+		ETAG = 4,
 		LOCATION_PATH = 8,
 		URI_PATH = 11,
-		URI_QUERY = 15
+		URI_QUERY = 15,
+		BLOCK2 = 23,
+		BLOCK1 = 27,
+		SIZE2 = 28
 	};
 }
 
+/**
+ * The value of a Block1 or Block2 option of a block-wise transfer (RFC 7959).
+ */
+struct CoAPBlock
+{
+	static const uint8_t MAX_SZX = 6;
+
+	uint32_t num;	// the index of the block
+	bool more;		// set when further blocks follow this one
+	uint8_t szx;	// the block size is 2^(szx+4)
+
+	size_t size() const
+	{
+		return size_t(16) << szx;
+	}
+
+	size_t offset() const
+	{
+		return num * size();
+	}
+};
+
 namespace CoAPType {
   enum Enum {
     CON,
@@ -188,6 +214,41 @@ public:
     static CoAPType::Enum type(const unsigned char *message);
     static size_t option_decode(unsigned char **option);
 
+    /**
+     * Finds the first instance of an option in a message.
+     * @param value Receives a pointer to the option value.
+     * @param length Receives the length of the option value.
+     * @return {@code true} if the option was found.
+     */
+    static bool find_option(const uint8_t* message, size_t message_length, CoAPOption::Enum option,
+    		const uint8_t** value, size_t* length);
+
+    /**
+     * Decodes a Block1 or Block2 option in a message.
+     * @return {@code true} if the message has a valid option of the given kind.
+     */
+    static bool block(const uint8_t* message, size_t message_length, CoAPOption::Enum option, CoAPBlock& block);
+
+    /**
+     * Encodes the value of a Block1 or Block2 option, using the fewest bytes possible.
+     * @return The length of the value, 0 to 3 bytes.
+     */
+    static size_t block_value(uint8_t* buf, const CoAPBlock& block)
+    {
+    	const uint32_t value = (block.num << 4) | (block.more ? 0x08 : 0) | (block.szx & 0x07);
+    	size_t length = 0;
+    	if (value > 0xFFFF) {
+    		buf[length++] = uint8_t(value >> 16);
+    	}
+    	if (value > 0xFF) {
+    		buf[length++] = uint8_t(value >> 8);
+    	}
+    	if (value) {
+    		buf[length++] = uint8_t(value);
+    	}
+    	return length;
+    }
+
     /**
      * Computes the length indicator for a value encoded in CoAP.
      * Values less than 13 are encoded directly. Values between 13 and 268 (inclusive) are encoded as 13 (and later as a single byte extended option)
@@ -32,6 +32,13 @@ namespace FileTransfer {
         };
     };
 
+    namespace Flag {
+        enum Enum {
+            COMPRESSED = 0x01, // the file is deflate-compressed, the chunks hold the compressed data
+            STREAMED = 0x02, // set by the storage when the chunks are processed in order, so the transfer can't be resumed
+        };
+    };
+
     struct __attribute__((packed)) Chunk
     {
         uint16_t size;
@@ -54,14 +61,18 @@ namespace FileTransfer {
          * 2 means application-provided storage
          */
         Store::Enum store;
-        uint8_t reserved;       // padding
+
+        /**
+         * Combination of the Flag values.
+         */
+        uint8_t flags;
     };
 
     PARTICLE_STATIC_ASSERT(Chunk_size, sizeof(Chunk)==12);
 
     struct Descriptor : public Chunk
     {
-        Descriptor() { size = sizeof(*this); }
+        Descriptor() { size = sizeof(*this); flags = 0; }
 
         /**
          * The length of the file data.
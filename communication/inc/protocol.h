@@ -4,6 +4,7 @@
 #include "service_debug.h"
 #include "protocol_defs.h"
 #include "ping.h"
+#include "event_loop_stats.h"
 #include "chunked_transfer.h"
 #include "spark_descriptor.h"
 #include "spark_protocol_functions.h"
@@ -84,6 +85,10 @@ class Protocol
 
 		  virtual system_tick_t millis();
 
+		  virtual int save_transfer_state(const void* data, size_t length);
+
+		  virtual int restore_transfer_state(void* data, size_t max_length);
+
 	} chunkedTransferCallbacks;
 
 	/**
@@ -163,6 +168,11 @@ protected:
 	 */
 	CompletionHandlerMap<message_id_t> ack_handlers;
 
+	/**
+	 * Statistics of the iterations of the event loop.
+	 */
+	EventLoopStats loop_stats;
+
 
 	void set_protocol_flags(int flags)
 	{
@@ -255,11 +265,31 @@ protected:
 	ProtocolError generate_and_send_description(MessageChannel& channel, Message& message,
 												size_t header_size, int desc_flags);
 
+	/**
+	 * @brief Sends a describe message that has been generated
+	 *
+	 * @param complete Set when the message completes the description, in which case the
+	 * state of the description is persisted once it has been sent.
+	 */
+	ProtocolError send_describe_message(MessageChannel& channel, Message& message,
+										int desc_flags, bool complete);
+
 	/**
 	 * Produces and transmits (PIGGYBACK) a describe message.
+	 * A description that doesn't fit in a single message is sent block-wise (RFC 7959 Block2).
 	 * @param desc_flags Flags describing the information to provide. A combination of {@code DESCRIBE_APPLICATION) and {@code DESCRIBE_SYSTEM) flags.
+	 * A request with the ETag of the current description is answered with 2.03 Valid and no payload.
+	 * @param block The Block2 option of the request, or {@code nullptr} if the request has none.
+	 * @param etag The ETag option of the request, or {@code nullptr} if the request has none.
+	 */
+	ProtocolError send_description(token_t token, message_id_t msg_id, int desc_flags,
+								   const CoAPBlock* block = nullptr, const uint32_t* etag = nullptr);
+
+	/**
+	 * Computes the hash of the description with the given flags, which is sent as its ETag.
+	 * @return {@code false} if the description can't be hashed.
 	 */
-	ProtocolError send_description(token_t token, message_id_t msg_id, int desc_flags);
+	bool description_hash(int desc_flags, uint32_t& hash);
 
 	/**
 	 * Decodes and dispatches a received message to its handler.
@@ -305,6 +335,7 @@ public:
 			last_ack_handlers_update(0),
 			initialized(false)
 	{
+		publisher.set_batch_size(PUBLISH_EVENT_BATCH_SIZE);
 	}
 
 	virtual void init(const char *id,
@@ -370,11 +401,16 @@ public:
 
 	/**
 	 * no-arg version of event loop for those callers that don't care about the message.
+	 * Handles the messages that have been received, up to {@code PROTOCOL_EVENT_LOOP_MAX_MESSAGES}
+	 * messages or {@code PROTOCOL_EVENT_LOOP_TIME_BUDGET} milliseconds, so that messages pipelined
+	 * by the server are not handled one per iteration of the system loop.
+	 * @return {@code false} on error.
 	 */
-	bool event_loop()
+	bool event_loop();
+
+	const EventLoopStats& event_loop_stats() const
 	{
-		CoAPMessageType::Enum message;
-		return !event_loop(message);
+		return loop_stats;
 	}
 
 	/**
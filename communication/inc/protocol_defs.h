@@ -1,5 +1,6 @@
 	#pragma once
 
+#include <cstddef>
 #include <functional>
 #include "system_tick_hal.h"
 
@@ -18,7 +19,11 @@ namespace particle { namespace protocol {
 #define PRODUCT_FIRMWARE_VERSION (0xffff)
 #endif
 
-#define MAX_SUBSCRIPTIONS (6)       // 2 system and 4 application
+// Maximum number of event subscriptions, including the 2 used by the system. Each subscription
+// takes about 100 bytes of RAM, platforms short on RAM can lower it.
+#ifndef MAX_SUBSCRIPTIONS
+#define MAX_SUBSCRIPTIONS (16)
+#endif
 
 enum ProtocolError
 {
@@ -81,6 +86,87 @@ const unsigned SEND_EVENT_ACK_TIMEOUT = 20000;
     #define PROTOCOL_BUFFER_SIZE 800
 #endif
 
+// The most messages handled in one iteration of the protocol event loop, and the time in milliseconds
+// after which an iteration stops handling further messages. Setting the maximum to 1 handles one
+// message per iteration.
+#ifndef PROTOCOL_EVENT_LOOP_MAX_MESSAGES
+    #define PROTOCOL_EVENT_LOOP_MAX_MESSAGES 16
+#endif
+
+#ifndef PROTOCOL_EVENT_LOOP_TIME_BUDGET
+    #define PROTOCOL_EVENT_LOOP_TIME_BUDGET 20
+#endif
+
+// Publish rate limits for application and system events: the number of events that can be sent
+// in each interval, and the interval in milliseconds
+#ifndef PUBLISH_EVENT_BURST
+    #define PUBLISH_EVENT_BURST 4
+#endif
+
+#ifndef PUBLISH_EVENT_INTERVAL
+    #define PUBLISH_EVENT_INTERVAL 1000
+#endif
+
+#ifndef PUBLISH_SYSTEM_EVENT_BURST
+    #define PUBLISH_SYSTEM_EVENT_BURST 255
+#endif
+
+#ifndef PUBLISH_SYSTEM_EVENT_INTERVAL
+    #define PUBLISH_SYSTEM_EVENT_INTERVAL 65536
+#endif
+
+// Number of rate limited events held until they can be sent (0 - rate limited events are dropped)
+#ifndef PUBLISH_EVENT_QUEUE_SIZE
+    #define PUBLISH_EVENT_QUEUE_SIZE 0
+#endif
+
+// Maximum number of events sent together in a single datagram (0 - each event is sent as it is published).
+// Batching needs a channel that can combine messages in a datagram, and adds up to PUBLISH_EVENT_BATCH_WINDOW
+// milliseconds to the time taken to send an event.
+#ifndef PUBLISH_EVENT_BATCH_SIZE
+    #define PUBLISH_EVENT_BATCH_SIZE 0
+#endif
+
+// Time in milliseconds an event waits for other events to be sent in the same datagram
+#ifndef PUBLISH_EVENT_BATCH_WINDOW
+    #define PUBLISH_EVENT_BATCH_WINDOW 1000
+#endif
+
+// Bytes added to each message by the secure channel (DTLS record header, explicit nonce and tag)
+const size_t PROTOCOL_RECORD_OVERHEAD = 29;
+
+// Maximum number of confirmable client messages awaiting acknowledgement at once (0 - no limit)
+#ifndef PROTOCOL_COAP_WINDOW_SIZE
+    #define PROTOCOL_COAP_WINDOW_SIZE 0
+#endif
+
+// Number of blocks and the size of the data in each block for the size classes of the CoAP message pool.
+// Acknowledgements and the truncated copies of server requests use the small blocks. The blocks take
+// static RAM whether they are used or not; messages that don't fit are allocated on the heap.
+#ifndef COAP_MESSAGE_POOL_SMALL_BLOCKS
+    #define COAP_MESSAGE_POOL_SMALL_BLOCKS 4
+#endif
+
+#ifndef COAP_MESSAGE_POOL_SMALL_BLOCK_SIZE
+    #define COAP_MESSAGE_POOL_SMALL_BLOCK_SIZE 40
+#endif
+
+#ifndef COAP_MESSAGE_POOL_MEDIUM_BLOCKS
+    #define COAP_MESSAGE_POOL_MEDIUM_BLOCKS 2
+#endif
+
+#ifndef COAP_MESSAGE_POOL_MEDIUM_BLOCK_SIZE
+    #define COAP_MESSAGE_POOL_MEDIUM_BLOCK_SIZE 160
+#endif
+
+#ifndef COAP_MESSAGE_POOL_LARGE_BLOCKS
+    #define COAP_MESSAGE_POOL_LARGE_BLOCKS 1
+#endif
+
+#ifndef COAP_MESSAGE_POOL_LARGE_BLOCK_SIZE
+    #define COAP_MESSAGE_POOL_LARGE_BLOCK_SIZE (PROTOCOL_BUFFER_SIZE + 40)
+#endif
+
 
 namespace ChunkReceivedCode {
   enum Enum {
@@ -108,7 +108,11 @@ struct SparkCallbacks
 
   	enum PersistType
 	{
-  		PERSIST_SESSION = 0
+  		PERSIST_SESSION = 0,
+  		/**
+  		 * The state of an interrupted firmware transfer. Saving zero bytes clears the state.
+  		 */
+  		PERSIST_TRANSFER = 1
 	};
 	int (*save)(const void* data, size_t length, uint8_t type, void* reserved);
 	/**
@@ -335,12 +339,21 @@ typedef enum protocol_status_flag {
     PROTOCOL_STATUS_HAS_PENDING_CLIENT_MESSAGES = 0x01
 } protocol_status_flag;
 
+/**
+ * Number of buckets in the event loop histograms of `protocol_status`. Bucket 0 counts the value 0
+ * and bucket `i` counts the values from `2^(i-1)` to `2^i - 1`. The last bucket also counts all
+ * larger values.
+ */
+#define PROTOCOL_STATUS_HISTOGRAM_SIZE 8
+
 /**
  * Protocol status.
  */
 typedef struct protocol_status {
     uint16_t size; ///< Size of this structure.
     uint32_t flags; ///< Status flags (see `protocol_status_flag`).
+    uint32_t loop_messages[PROTOCOL_STATUS_HISTOGRAM_SIZE]; ///< Histogram of the messages handled per event loop iteration.
+    uint32_t loop_latency[PROTOCOL_STATUS_HISTOGRAM_SIZE]; ///< Histogram of the event loop iteration durations, in milliseconds.
 } protocol_status;
 
 /**
@@ -21,9 +21,12 @@
 #include "service_debug.h"
 #include "coap.h"
 #include <algorithm>
+#include <new>
 
 namespace particle { namespace protocol {
 
+const uint32_t ChunkedTransfer::PREPARE_RESUME;
+
 ProtocolError ChunkedTransfer::handle_update_begin(
         token_t token, Message& message, MessageChannel& channel)
 {
@@ -38,9 +41,9 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 
         if (fast_ota_override) {
             if (fast_ota_value) {
-                flags |= (1<<0); // enabled
+                flags |= FAST_OTA; // enabled
             } else {
-                flags &= ~(1<<0); // disabled
+                flags &= ~FAST_OTA; // disabled
             }
             DEBUG("Fast OTA: %s", fast_ota_value?"enabled":"disabled");
         }
@@ -50,6 +53,8 @@ ProtocolError ChunkedTransfer::handle_update_begin(
         file.store = FileTransfer::Store::Enum(decode_uint8(queue + 15));
         file.file_address = decode_uint32(queue + 16);
         file.chunk_address = file.file_address;
+        // the chunks hold a deflate-compressed module, decompressed as they are saved
+        file.flags = (flags & COMPRESSED) ? FileTransfer::Flag::COMPRESSED : 0;
     }
     else
     {
@@ -58,6 +63,7 @@ ProtocolError ChunkedTransfer::handle_update_begin(
         file.store = FileTransfer::Store::FIRMWARE;
         file.file_address = 0;
         file.chunk_address = 0;
+        file.flags = 0;
     }
     // check the parameters only
     bool success = !callbacks->prepare_for_firmware_update(file, 1, NULL);
@@ -78,28 +84,43 @@ ProtocolError ChunkedTransfer::handle_update_begin(
 
     if (success)
     {
-        if (!callbacks->prepare_for_firmware_update(file, 0, NULL))
+        chunk_size = file.chunk_size; // save chunk size since the descriptor size is overwritten
+        Message updateReady;
+        channel.create(updateReady);
+        release_transfer_state();
+        // only fast OTA tracks the chunks received, so only a fast OTA transfer can be resumed.
+        // The decompressor state isn't persisted, so neither can a compressed transfer.
+        persist_transfer = (flags & FAST_OTA) && !(file.flags & FileTransfer::Flag::COMPRESSED) &&
+                alloc_transfer_state();
+        if (!persist_transfer)
         {
-            DEBUG("starting file length %d chunks %d chunk_size %d",
-                    file.file_length, file.chunk_count(file.chunk_size),
-                    file.chunk_size);
-            last_chunk_millis = callbacks->millis();
-            chunk_index = 0;
-            chunk_size = file.chunk_size; // save chunk size since the descriptor size is overwritten
-            updating = 1;
-            Message updateReady;
-            channel.create(updateReady);
             // updateReady will have the maximum capacity
             int offset = updateReady.capacity() - chunk_bitmap_size();
             bitmap = queue+offset; // this relies on the fact that we know the channels use a static buffer
-
-            // when not in fast OTA mode, the chunk missing buffer is set to 1 since the protocol
-            // handles missing chunks one by one. Also we don't know the actual size of the file to
-            // know the correct size of the bitmap.
-            set_chunks_received(flags & 1 ? 0 : 0xFF);
+        }
+        const bool resumed = persist_transfer && restore_state() &&
+                !callbacks->prepare_for_firmware_update(file, PREPARE_RESUME, NULL);
+        if (resumed || !callbacks->prepare_for_firmware_update(file, 0, NULL))
+        {
+            DEBUG("%s file length %d chunks %d chunk_size %d", resumed ? "resuming" : "starting",
+                    file.file_length, file.chunk_count(chunk_size),
+                    chunk_size);
+            last_chunk_millis = callbacks->millis();
+            chunk_index = 0;
+            updating = 1;
+            if (!resumed)
+            {
+                // when not in fast OTA mode, the chunk missing buffer is set to 1 since the protocol
+                // handles missing chunks one by one. Also we don't know the actual size of the file to
+                // know the correct size of the bitmap.
+                set_chunks_received(flags & FAST_OTA ? 0 : 0xFF);
+                // the chunks of an earlier transfer were erased
+                clear_persisted_state();
+            }
+            start_pipeline();
 
             // send update_reaady - use fast OTA if available
-            size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1), channel.is_unreliable());
+            size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & FAST_OTA), channel.is_unreliable());
             updateReady.set_length(size);
             updateReady.set_confirm_received(true);
             error = channel.send(updateReady);
@@ -170,27 +191,32 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
     {
         payload++;
         const uint8_t* chunk = queue + payload;
-        file.chunk_size = message.length() - payload;
-        file.chunk_address = file.file_address + (chunk_index * chunk_size);
+        const uint16_t size = message.length() - payload;
         if (chunk_index >= MAX_CHUNKS)
         {
             WARN("invalid chunk index %d", chunk_index);
             return NO_ERROR;
         }
-        uint32_t crc = callbacks->calculate_crc(chunk, file.chunk_size);
+        uint32_t crc = callbacks->calculate_crc(chunk, size);
         uint16_t response_size = 0;
         bool crc_valid = (crc == given_crc);
         DEBUG("chunk idx=%d crc=%d fast=%d updating=%d", chunk_index,
                 crc_valid, fast_ota, updating);
         if (crc_valid)
         {
-            callbacks->save_firmware_chunk(file, chunk, NULL);
+            // a chunk that was sent again is not written again
+            const bool save = !fast_ota ||
+                    (!is_chunk_received(chunk_index) && !is_chunk_pending(chunk_index));
+            if (save)
+            {
+                // the chunk is saved later, so the response is not delayed by the write
+                stage_chunk(chunk_index, chunk, size);
+            }
             if (!fast_ota)
             {
                 // message is confirmable for regular OTA or when
                 response_size = Messages::chunk_received(response.buf(), 0, token, ChunkReceivedCode::OK, channel.is_unreliable());
             }
-            flag_chunk_received(chunk_index);
             chunk_index++;
         }
         else
@@ -253,6 +279,7 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
     Message response;
 
     DEBUG("update done received");
+    save_pending_chunks();
     chunk_index_t index = next_chunk_missing(0);
     bool missing = index != NO_CHUNKS_MISSING;
     uint8_t* queue = message.buf();
@@ -276,6 +303,12 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
     {
         DEBUG("update done - all done!");
         reset_updating();
+        stop_pipeline();
+        if (persist_transfer)
+        {
+            persist_transfer = false;
+            clear_persisted_state();
+        }
         callbacks->finish_firmware_update(file, UpdateFlag::SUCCESS, NULL);
     }
     else
@@ -335,8 +368,10 @@ ProtocolError ChunkedTransfer::send_missing_chunks(MessageChannel& channel,
 
 ProtocolError ChunkedTransfer::idle(MessageChannel& channel)
 {
-    /* Timeout to resend missing chunks removed.
-     * Leaving idle() here in case we need to add something in the future. */
+    /* Timeout to resend missing chunks removed. */
+    // save a received chunk while waiting for the next one
+    if (pending_count)
+        save_pending_chunk();
     return NO_ERROR;
 }
 
@@ -346,10 +381,182 @@ void ChunkedTransfer::cancel()
     {
         // was updating but had an error, inform the client
         WARN("handle received message failed - aborting transfer");
+        // the persisted state is kept, so the transfer is resumed when the same file is sent again.
+        // The chunks dropped from the buffers were never flagged, so they are requested again
+        stop_pipeline();
         callbacks->finish_firmware_update(file, 0, NULL);
     }
 }
 
+void ChunkedTransfer::start_pipeline()
+{
+    stop_pipeline();
+    chunk_buffers = new(std::nothrow) uint8_t[2 * chunk_size];
+    if (chunk_buffers)
+    {
+        pending[0].data = chunk_buffers;
+        pending[1].data = chunk_buffers + chunk_size;
+    }
+    // without the buffers, chunks are saved as they are received
+}
+
+void ChunkedTransfer::stop_pipeline()
+{
+    delete[] chunk_buffers;
+    chunk_buffers = nullptr;
+    pending_count = 0;
+    pending_first = 0;
+}
+
+void ChunkedTransfer::save_chunk(chunk_index_t index, const uint8_t* chunk, uint16_t size)
+{
+    file.chunk_size = size;
+    file.chunk_address = file.file_address + (index * chunk_size);
+    // a chunk is only flagged once it is saved, so that a chunk that is still waiting in
+    // the buffers or couldn't be saved is reported as missing
+    if (callbacks->save_firmware_chunk(file, chunk, NULL))
+    {
+        // the chunk is requested again with the missing chunks. This is how a delta patch,
+        // which can only be applied in order, recovers from chunks received too far ahead of
+        // a lost one
+        WARN("chunk %d not saved", index);
+        clear_chunk_received(index);
+    }
+    else
+    {
+        flag_chunk_received(index);
+        if (persist_transfer)
+        {
+            if (file.flags & FileTransfer::Flag::STREAMED)
+            {
+                // the storage processes the chunks in order, so the transfer can't be resumed
+                persist_transfer = false;
+                clear_persisted_state();
+            }
+            else
+            {
+                persist_state();
+            }
+        }
+    }
+}
+
+void ChunkedTransfer::stage_chunk(chunk_index_t index, const uint8_t* chunk, uint16_t size)
+{
+    if (!chunk_buffers || size > chunk_size)
+    {
+        save_chunk(index, chunk, size);
+        return;
+    }
+    if (pending_count == 2)
+    {
+        // both buffers are in use, so the oldest chunk has to be saved now
+        save_pending_chunk();
+    }
+    PendingChunk& p = pending[(pending_first + pending_count) % 2];
+    memcpy(p.data, chunk, size);
+    p.size = size;
+    p.index = index;
+    pending_count++;
+}
+
+void ChunkedTransfer::save_pending_chunk()
+{
+    const PendingChunk& p = pending[pending_first];
+    pending_first = (pending_first + 1) % 2;
+    pending_count--;
+    save_chunk(p.index, p.data, p.size);
+}
+
+void ChunkedTransfer::save_pending_chunks()
+{
+    while (pending_count)
+        save_pending_chunk();
+}
+
+bool ChunkedTransfer::is_chunk_pending(chunk_index_t index) const
+{
+    for (unsigned i = 0; i < pending_count; i++)
+    {
+        if (pending[(pending_first + i) % 2].index == index)
+            return true;
+    }
+    return false;
+}
+
+bool ChunkedTransfer::alloc_transfer_state()
+{
+    transfer_state = new(std::nothrow) uint8_t[transfer_state_size()];
+    if (!transfer_state)
+        return false;
+    bitmap = transfer_state + sizeof(PersistedState);
+    init_transfer_state();
+    return true;
+}
+
+void ChunkedTransfer::release_transfer_state()
+{
+    if (transfer_state && bitmap == transfer_state + sizeof(PersistedState))
+        bitmap = nullptr;
+    delete[] transfer_state;
+    transfer_state = nullptr;
+    persist_transfer = false;
+}
+
+void ChunkedTransfer::init_transfer_state()
+{
+    PersistedState* state = (PersistedState*)transfer_state;
+    state->file_length = file.file_length;
+    state->file_address = file.file_address;
+    state->chunk_size = chunk_size;
+    state->store = file.store;
+    state->flags = file.flags;
+    state->checksum = 0;
+}
+
+/**
+ * Persists the bitmap of the chunks saved. Called after each chunk is saved, so a reset
+ * loses at most the chunks waiting in the buffers.
+ */
+void ChunkedTransfer::persist_state()
+{
+    const size_t length = transfer_state_size();
+    PersistedState* state = (PersistedState*)transfer_state;
+    state->checksum = 0;
+    state->checksum = callbacks->calculate_crc(transfer_state, length);
+    if (callbacks->save_transfer_state(transfer_state, length))
+    {
+        // the bitmap doesn't fit the persistent storage
+        persist_transfer = false;
+    }
+}
+
+void ChunkedTransfer::clear_persisted_state()
+{
+    callbacks->save_transfer_state(nullptr, 0);
+}
+
+/**
+ * Restores the bitmap of chunks saved by an earlier transfer of the same file.
+ */
+bool ChunkedTransfer::restore_state()
+{
+    const size_t length = transfer_state_size();
+    PersistedState* state = (PersistedState*)transfer_state;
+    bool restored = false;
+    if (callbacks->restore_transfer_state(transfer_state, length) == int(length) &&
+            state->file_length == file.file_length && state->file_address == file.file_address &&
+            state->chunk_size == chunk_size && state->store == file.store &&
+            state->flags == file.flags)
+    {
+        const uint32_t checksum = state->checksum;
+        state->checksum = 0;
+        restored = (checksum == callbacks->calculate_crc(transfer_state, length));
+    }
+    if (!restored)
+        init_transfer_state();
+    return restored;
+}
 
 chunk_index_t ChunkedTransfer::next_chunk_missing(chunk_index_t start)
 {
@@ -64,6 +64,41 @@ public:
 		  virtual uint32_t calculate_crc(const unsigned char *buf, uint32_t buflen)=0;
 
 		  virtual system_tick_t millis()=0;
+
+		  /**
+		   * Persists the state of the transfer so that it can be resumed after a reset.
+		   * Saving zero bytes clears the state.
+		   * @return 0 on success
+		   */
+		  virtual int save_transfer_state(const void* data, size_t length)=0;
+
+		  /**
+		   * Restores the persisted state of the transfer.
+		   * @return the number of bytes restored
+		   */
+		  virtual int restore_transfer_state(void* data, size_t max_length)=0;
+	};
+
+	/**
+	 * Flag passed to prepare_for_firmware_update() to continue writing a file that was
+	 * partially written before a reset, without erasing the chunks already written.
+	 */
+	static const uint32_t PREPARE_RESUME = 2;
+
+	/**
+	 * Flags of the UpdateBegin request.
+	 */
+	enum UpdateBeginFlag
+	{
+		/**
+		 * The chunks are sent without waiting for each to be acknowledged, and the missing
+		 * chunks are requested once the server sends UpdateDone.
+		 */
+		FAST_OTA = 0x01,
+		/**
+		 * The file is a deflate-compressed module.
+		 */
+		COMPRESSED = 0x02
 	};
 
 private:
@@ -85,11 +120,52 @@ private:
 
 	uint8_t* bitmap;
 
+	/**
+	 * A chunk that passed the CRC check and is waiting to be saved. Received chunks are
+	 * copied to one of two buffers, so the next chunk can be received and checked while
+	 * the previous chunk is written.
+	 */
+	struct PendingChunk
+	{
+		uint8_t* data;
+		uint16_t size;
+		chunk_index_t index;
+	};
+
+	PendingChunk pending[2];
+	uint8_t pending_count;
+	uint8_t pending_first;
+	uint8_t* chunk_buffers;
+
+	/**
+	 * The persisted state of a transfer, followed by the chunk bitmap.
+	 */
+	struct __attribute__((packed)) PersistedState
+	{
+		uint32_t file_length;
+		uint32_t file_address;
+		uint16_t chunk_size;
+		uint8_t store;
+		uint8_t flags;
+		uint32_t checksum;
+	};
+
+	/**
+	 * Holds the PersistedState and the bitmap of a fast OTA transfer, so that the state
+	 * is persisted without copying the bitmap.
+	 */
+	uint8_t* transfer_state;
+
 	Callbacks* callbacks;
 
 	bool fast_ota_override;
 	bool fast_ota_value;
 
+	/**
+	 * Set when the state of the transfer is persisted after each chunk saved.
+	 */
+	bool persist_transfer;
+
 protected:
 
 	unsigned chunk_bitmap_size()
@@ -108,6 +184,11 @@ protected:
 		chunk_bitmap()[idx >> 3] |= uint8_t(1 << (idx & 7));
 	}
 
+	inline void clear_chunk_received(chunk_index_t idx)
+	{
+		chunk_bitmap()[idx >> 3] &= ~uint8_t(1 << (idx & 7));
+	}
+
 	inline bool is_chunk_received(chunk_index_t idx)
 	{
 		return (chunk_bitmap()[idx >> 3] & uint8_t(1 << (idx & 7)));
@@ -115,11 +196,40 @@ protected:
 
 	chunk_index_t next_chunk_missing(chunk_index_t start);
 	void set_chunks_received(uint8_t value);
+
+	void start_pipeline();
+	void stop_pipeline();
+	void save_chunk(chunk_index_t index, const uint8_t* chunk, uint16_t size);
+	void save_pending_chunk();
+	void save_pending_chunks();
+	void stage_chunk(chunk_index_t index, const uint8_t* chunk, uint16_t size);
+	bool is_chunk_pending(chunk_index_t index) const;
+
+	size_t transfer_state_size()
+	{
+		return sizeof(PersistedState) + chunk_bitmap_size();
+	}
+
+	bool alloc_transfer_state();
+	void release_transfer_state();
+	void init_transfer_state();
+	void persist_state();
+	void clear_persisted_state();
+	bool restore_state();
+
 public:
 
 	ChunkedTransfer() :
-			updating(false), callbacks(nullptr), fast_ota_override(false), fast_ota_value(true)
+			updating(false), bitmap(nullptr), pending_count(0), pending_first(0), chunk_buffers(nullptr),
+			transfer_state(nullptr), callbacks(nullptr), fast_ota_override(false), fast_ota_value(true),
+			persist_transfer(false)
+	{
+	}
+
+	~ChunkedTransfer()
 	{
+		stop_pipeline();
+		release_transfer_state();
 	}
 
 	void init(Callbacks* callbacks)
@@ -130,6 +240,8 @@ public:
 	void reset()
 	{
 		reset_updating();
+		stop_pipeline();
+		release_transfer_state();
 		bitmap = nullptr;
 		last_chunk_millis = 0;
 	}
@@ -155,6 +267,14 @@ public:
 		return updating;
 	}
 
+	/**
+	 * The number of received chunks that have not yet been saved.
+	 */
+	unsigned pending_chunks() const
+	{
+		return pending_count;
+	}
+
 	void reset_updating(void)
 	{
 		updating = false;
@@ -88,5 +88,80 @@ size_t CoAP::option_decode(unsigned char **option) {
     return option_length;
 }
 
+namespace {
+
+/**
+ * Decodes an option delta or length nibble and its extended bytes, if any.
+ * @return {@code false} if the value is malformed or doesn't fit in the message.
+ */
+bool decode_option_value(unsigned nibble, const uint8_t*& p, const uint8_t* end, size_t& value) {
+    if (nibble < 13) {
+        value = nibble;
+    } else if (nibble == 13) {
+        if (end - p < 1) {
+            return false;
+        }
+        value = *p++ + 13;
+    } else if (nibble == 14) {
+        if (end - p < 2) {
+            return false;
+        }
+        value = ((p[0] << 8) | p[1]) + 269;
+        p += 2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool CoAP::find_option(const uint8_t* message, size_t message_length, CoAPOption::Enum option,
+        const uint8_t** value, size_t* length) {
+    const uint8_t* const end = message + message_length;
+    if (message_length < 4) {
+        return false;
+    }
+    const uint8_t* p = message + 4 + (message[0] & 0x0F);
+    size_t number = 0;
+    while (p < end && *p != 0xFF) {
+        const uint8_t nibbles = *p++;
+        size_t delta, option_length;
+        if (!decode_option_value(nibbles >> 4, p, end, delta) ||
+                !decode_option_value(nibbles & 0x0F, p, end, option_length) ||
+                size_t(end - p) < option_length) {
+            return false;
+        }
+        number += delta;
+        if (number == size_t(option)) {
+            *value = p;
+            *length = option_length;
+            return true;
+        }
+        if (number > size_t(option)) {
+            break;  // options are sorted by their number
+        }
+        p += option_length;
+    }
+    return false;
+}
+
+bool CoAP::block(const uint8_t* message, size_t message_length, CoAPOption::Enum option, CoAPBlock& block) {
+    const uint8_t* value = nullptr;
+    size_t length = 0;
+    if (!find_option(message, message_length, option, &value, &length) || length > 3) {
+        return false;
+    }
+    uint32_t v = 0;
+    for (size_t i = 0; i < length; ++i) {
+        v = (v << 8) | value[i];
+    }
+    block.num = v >> 4;
+    block.more = v & 0x08;
+    block.szx = v & 0x07;
+    // SZX 7 is reserved
+    return block.szx <= CoAPBlock::MAX_SZX;
+}
+
 }
 }
@@ -34,6 +34,218 @@ bool is_ack_or_reset(const uint8_t* buf, size_t len)
 	return type==CoAPType::ACK || type==CoAPType::RESET;
 }
 
+uint16_t CoAPMessageIndex::find_slot(message_id_t id) const
+{
+	uint16_t slot = slot_for(id);
+	while (slots[slot] && !slots[slot]->matches(id))
+		slot = next_slot(slot);
+	return slot;
+}
+
+bool CoAPMessageIndex::reserve(size_t size)
+{
+	// keep the load factor at or below 3/4 so probe sequences stay short
+	size_t required = capacity ? capacity : INITIAL_CAPACITY;
+	while (required*3/4<size)
+		required *= 2;
+	if (required==capacity)
+		return true;
+	if (required>0x8000)
+		return false;
+	CoAPMessage** table = (CoAPMessage**)calloc(required, sizeof(CoAPMessage*));
+	if (!table)
+		return false;
+	CoAPMessage** old = slots;
+	const uint16_t old_capacity = capacity;
+	slots = table;
+	capacity = required;
+	shift = 16-__builtin_ctz(required);
+	for (uint16_t i=0; i<old_capacity; i++) {
+		if (old[i])
+			slots[find_slot(old[i]->get_id())] = old[i];
+	}
+	free(old);
+	return true;
+}
+
+bool CoAPMessageIndex::insert(CoAPMessage* msg)
+{
+	if (!reserve(count+1))
+		return false;
+	slots[find_slot(msg->get_id())] = msg;
+	count++;
+	return true;
+}
+
+CoAPMessage* CoAPMessageIndex::remove(message_id_t id)
+{
+	if (!count)
+		return nullptr;
+	uint16_t slot = find_slot(id);
+	CoAPMessage* msg = slots[slot];
+	if (!msg)
+		return nullptr;
+	slots[slot] = nullptr;
+	count--;
+	// shift back the following entries of the probe sequence so that no tombstones are needed
+	uint16_t next = next_slot(slot);
+	while (slots[next]) {
+		const uint16_t home = slot_for(slots[next]->get_id());
+		// the entry can move to the empty slot unless its home lies cyclically in (slot, next]
+		if ((next>slot) ? (home<=slot || home>next) : (home<=slot && home>next)) {
+			slots[slot] = slots[next];
+			slots[next] = nullptr;
+			slot = next;
+		}
+		next = next_slot(next);
+	}
+	return msg;
+}
+
+bool CoAPTimerQueue::reserve(size_t size)
+{
+	if (size<=capacity)
+		return true;
+	if (size>=CoAPMessage::NO_TIMER)
+		return false;
+	CoAPMessage** entries = (CoAPMessage**)realloc(heap, size*sizeof(CoAPMessage*));
+	if (!entries)
+		return false;
+	heap = entries;
+	capacity = size;
+	return true;
+}
+
+void CoAPTimerQueue::sift_up(uint16_t index)
+{
+	CoAPMessage* msg = heap[index];
+	while (index>0) {
+		const uint16_t parent = (index-1)/2;
+		if (!expires_before(msg, heap[parent]))
+			break;
+		place(heap[parent], index);
+		index = parent;
+	}
+	place(msg, index);
+}
+
+void CoAPTimerQueue::sift_down(uint16_t index)
+{
+	CoAPMessage* msg = heap[index];
+	for (;;) {
+		uint16_t child = index*2+1;
+		if (child>=count)
+			break;
+		if (child+1<count && expires_before(heap[child+1], heap[child]))
+			child++;
+		if (!expires_before(heap[child], msg))
+			break;
+		place(heap[child], index);
+		index = child;
+	}
+	place(msg, index);
+}
+
+void CoAPTimerQueue::update(CoAPMessage* msg)
+{
+	const uint16_t index = msg->get_timer_index();
+	if (index>0 && expires_before(msg, heap[(index-1)/2]))
+		sift_up(index);
+	else
+		sift_down(index);
+}
+
+void CoAPTimerQueue::remove(CoAPMessage* msg)
+{
+	const uint16_t index = msg->get_timer_index();
+	msg->set_timer_index(CoAPMessage::NO_TIMER);
+	if (index!=--count) {
+		place(heap[count], index);
+		update(heap[index]);
+	}
+}
+
+ProtocolError CoAPMessageStore::add(CoAPMessage& message)
+{
+	// trying to add exactly the same message
+	if (from_id(message.get_id())==&message)
+		return NO_ERROR;
+
+	clear_message(message.get_id());
+	if (message.is_stored())
+		return INVALID_STATE;
+	// reserve room in the timer queue for every message so deferred messages can always be scheduled
+	if (!messages.insert(&message))
+		return INSUFFICIENT_STORAGE;
+	if (!timers.reserve(messages.slot_count()))
+	{
+		messages.remove(message.get_id());
+		return INSUFFICIENT_STORAGE;
+	}
+	message.set_stored(true);
+	if (message.is_deferred())
+	{
+		if (deferred_tail)
+			deferred_tail->set_next(&message);
+		else
+			deferred_head = &message;
+		deferred_tail = &message;
+	}
+	else
+	{
+		timers.push(&message);
+	}
+	if (message.get_type()==CoAPType::CON)
+		confirmable++;
+	return NO_ERROR;
+}
+
+void CoAPMessageStore::remove(CoAPMessage* message)
+{
+	messages.remove(message->get_id());
+	if (message->get_timer_index()!=CoAPMessage::NO_TIMER)
+	{
+		timers.remove(message);
+	}
+	else
+	{
+		CoAPMessage* prev = nullptr;
+		for (CoAPMessage* msg = deferred_head; msg!=message; msg = msg->get_next())
+			prev = msg;
+		if (prev)
+			prev->set_next(message->get_next());
+		else
+			deferred_head = message->get_next();
+		if (deferred_tail==message)
+			deferred_tail = prev;
+	}
+	if (message->is_in_flight())
+		in_flight--;
+	if (message->get_type()==CoAPType::CON)
+		confirmable--;
+	message->removed();
+}
+
+void CoAPMessageStore::clear()
+{
+	timers.clear();
+	for (uint16_t i=0; i<messages.slot_count(); i++)
+	{
+		CoAPMessage* msg = messages.at(i);
+		if (msg)
+		{
+			msg->removed();
+			delete msg;
+		}
+	}
+	messages.clear();
+	deferred_head = nullptr;
+	deferred_tail = nullptr;
+	confirmable = 0;
+	in_flight = 0;
+	set_window_size(window_size);
+}
+
 ProtocolError CoAPMessageStore::send_message(CoAPMessage* msg, Channel& channel)
 {
 	Message m((uint8_t*)msg->get_data(), msg->get_data_length(), msg->get_data_length());
@@ -46,14 +258,44 @@ ProtocolError CoAPMessageStore::send_message(CoAPMessage* msg, Channel& channel)
  */
 bool CoAPMessageStore::retransmit(CoAPMessage* msg, Channel& channel, system_tick_t now)
 {
+	if (msg->is_in_flight())
+		congestion_backoff(*msg);
 	bool retransmit = (msg->prepare_retransmit(now));
 	if (retransmit)
 	{
+		transmitted(*msg);
 		send_message(msg, channel);
 	}
 	return retransmit;
 }
 
+void CoAPMessageStore::acknowledged(const CoAPMessage& msg)
+{
+	if (!window_size)
+		return;
+	if (recovering && int16_t(msg.get_id()-recovery_id)>0)
+		recovering = false;
+	if (window<window_size && ++acked>=window)
+	{
+		window++;
+		acked = 0;
+	}
+}
+
+void CoAPMessageStore::congestion_backoff(const CoAPMessage& msg)
+{
+	if (!window_size)
+		return;
+	// messages sent before the last reduction belong to the same window
+	if (recovering && int16_t(msg.get_id()-recovery_id)<=0)
+		return;
+	window = window>1 ? window/2 : 1;
+	acked = 0;
+	recovering = true;
+	recovery_id = last_sent_id;
+	DEBUG("congestion window reduced to %d", window);
+}
+
 void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
 {
 	g_unacknowledgedMessageCounter++;
@@ -67,23 +309,39 @@ void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
  */
 void CoAPMessageStore::process(system_tick_t time, Channel& channel)
 {
-	CoAPMessage* msg = head;
-	CoAPMessage* prev = nullptr;
-	while (msg!=nullptr)
+	CoAPMessage* msg;
+	while ((msg = timers.top())!=nullptr && time_has_passed(time, msg->get_timeout()))
 	{
-		if (time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
+		if (retransmit(msg, channel, time))
 		{
-			remove(msg, prev);
-			message_timeout(*msg, channel);
-			delete msg;
-			msg = (prev==nullptr) ? head : prev->get_next();
+			timers.update(msg);
 		}
 		else
 		{
-			prev = msg;
-			msg = msg->get_next();
+			remove(msg);
+			message_timeout(*msg, channel);
+			delete msg;
 		}
 	}
+	send_deferred(time, channel);
+}
+
+void CoAPMessageStore::send_deferred(system_tick_t time, Channel& channel)
+{
+	while (deferred_head && can_transmit())
+	{
+		CoAPMessage* msg = deferred_head;
+		// the message stays deferred and is sent again from the next call to process()
+		if (send_message(msg, channel))
+			break;
+		deferred_head = msg->get_next();
+		if (!deferred_head)
+			deferred_tail = nullptr;
+		msg->set_next(nullptr);
+		msg->prepare_retransmit(time);
+		transmitted(*msg);
+		timers.push(msg);
+	}
 }
 
 
@@ -108,11 +366,33 @@ ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
 			coapmsg->prepare_retransmit(time);
 		else
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
-		add(*coapmsg);
+		const ProtocolError error = add(*coapmsg);
+		if (error)
+		{
+			delete coapmsg;
+			return error;
+		}
+		transmitted(*coapmsg);
 	}
 	return NO_ERROR;
 }
 
+ProtocolError CoAPMessageStore::defer(Message& msg, system_tick_t time)
+{
+	if (!msg.has_id())
+		return MISSING_MESSAGE_ID;
+
+	DEBUG("deferring message id=%x", msg.get_id());
+	CoAPMessage* coapmsg = CoAPMessage::create(msg);
+	if (coapmsg==nullptr)
+		return INSUFFICIENT_STORAGE;
+	coapmsg->set_deferred(time);
+	const ProtocolError error = add(*coapmsg);
+	if (error)
+		delete coapmsg;
+	return error;
+}
+
 /**
  * Notifies the message store that a message has been received.
  */
@@ -134,7 +414,15 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 			channel.command(Channel::DISCARD_SESSION, nullptr);
 		}
 		DEBUG("recieved ACK for message id=%x", id);
-		if (!clear_message(id)) {		// message didn't exist, means it's already been acknoweldged or is unknown.
+		CoAPMessage* acked = from_id(id);
+		if (acked) {
+			if (msgtype==CoAPType::ACK && acked->is_in_flight()) {
+				acknowledged(*acked);
+			}
+			remove(acked);
+			delete acked;
+		}
+		else {		// message didn't exist, means it's already been acknoweldged or is unknown.
 			msg.set_length(0);
 		}
 	}
@@ -159,22 +447,16 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 			// the timeout here is ideally purely academic since the application will respond immediately with an ACK/RESET
 			// which will be stored in place of this message, with it's own timeout.
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
-			add(*coapmsg);
+			const ProtocolError error = add(*coapmsg);
+			if (error)
+			{
+				delete coapmsg;
+				return error;
+			}
 		}
 	}
 	// else it's a NON message - pass through
 	return NO_ERROR;
 }
 
-bool CoAPMessageStore::has_unacknowledged_requests() const
-{
-	// TODO: Use a message counter
-	for (const CoAPMessage* msg = head; msg != nullptr; msg = msg->get_next()) {
-		if (is_confirmable((uint8_t*)msg->get_data()))
-			return true;
-	}
-
-	return false;
-}
-
 }}
@@ -22,7 +22,9 @@
 #include "coap.h"
 #include "timer_hal.h"
 #include "stdlib.h"
+#include "string.h"
 #include "service_debug.h"
+#include "coap_message_pool.h"
 
 namespace particle
 {
@@ -101,8 +103,8 @@ public:
 
 private:
 	/**
-	 * Messages are stored as a singly-linked list.
-	 * This pointer is the next message in the list, or nullptr if this is the last message in the list.
+	 * Messages waiting for room in the window of the message store are queued in a singly-linked list.
+	 * This pointer is the next message in the queue, or nullptr if this is the last message in the queue.
 	 */
 	CoAPMessage* next;
 
@@ -123,8 +125,16 @@ private:
 	 */
 	uint8_t transmit_count;
 
-	// padding
-	// uint8_t reserved;
+	/**
+	 * Flags describing how the message is held by a message store. See the Flag enum.
+	 */
+	uint8_t flags;
+
+	/**
+	 * The position of this message in the timer queue of the message store.
+	 */
+	uint16_t timer_index;
+
 	std::function<void(Delivery)>* delivered;
 
 
@@ -140,6 +150,19 @@ private:
 
 	static uint16_t message_count;
 
+	enum Flag
+	{
+		STORED = 0x01,		// the message is held by a message store
+		IN_FLIGHT = 0x02	// the message counts towards the in-flight window of the message store
+	};
+
+	inline void set_flag(Flag flag, bool set) {
+		if (set)
+			flags |= flag;
+		else
+			flags &= ~flag;
+	}
+
 	/**
 	 * Notification that the message has been delivered to the server.
 	 */
@@ -159,15 +182,40 @@ public:
 
 
 	/**
-	 * The number of outstanding messages allowed.
+	 * The number of outstanding messages allowed by RFC 7252. The number of
+	 * messages in flight is configured per message store.
+	 * @see CoAPMessageStore::set_window_size()
 	 */
 	static const uint8_t NSTART = 1;
 
+	/**
+	 * The value of the timer index when the message is not in a timer queue.
+	 */
+	static const uint16_t NO_TIMER = 0xFFFF;
 
-	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), id(id_), transmit_count(0), delivered(nullptr), data_len(0) {
+
+	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), id(id_), transmit_count(0), flags(0), timer_index(NO_TIMER), delivered(nullptr), data_len(0) {
 		message_count++;
 	}
 
+	/**
+	 * CoAPMessage instances are allocated from the message pool.
+	 */
+	static void* operator new(size_t size) noexcept
+	{
+		return CoAPMessagePool::instance().allocate(size);
+	}
+
+	static void* operator new(size_t, void* ptr) noexcept
+	{
+		return ptr;
+	}
+
+	static void operator delete(void* ptr)
+	{
+		CoAPMessagePool::instance().free(ptr);
+	}
+
 	/**
 	 * Create a new CoAPMessage from the given Message instance. The returned CoAPMessage is dynamically allocated
 	 * and has an independent lifetime from the Message
@@ -176,7 +224,7 @@ public:
 	static CoAPMessage* create(Message& msg, size_t data_len = 0)
 	{
 		size_t len = data_len && data_len<msg.length() ? data_len : msg.length();
-		uint8_t* memory = new uint8_t[sizeof(CoAPMessage)+len];
+		void* memory = CoAPMessagePool::instance().allocate(sizeof(CoAPMessage)+len);
 		if (memory) {
 			CoAPMessage* coapmsg = new (memory)CoAPMessage(msg.get_id());		// in-place new
 			coapmsg->set_data(msg.buf(), len);
@@ -196,8 +244,15 @@ public:
 	inline void set_next(CoAPMessage* next) { this->next = next; }
 	inline bool matches(message_id_t id) const { return this->id==id; }
 	inline message_id_t get_id() const { return id; }
-	inline void removed() { next = nullptr; }
+	inline void removed() { next = nullptr; flags = 0; }
 	inline system_tick_t get_timeout() const { return timeout; }
+	inline uint8_t get_transmit_count() const { return transmit_count; }
+	inline bool is_stored() const { return flags & STORED; }
+	inline void set_stored(bool stored) { set_flag(STORED, stored); }
+	inline bool is_in_flight() const { return flags & IN_FLIGHT; }
+	inline void set_in_flight(bool in_flight) { set_flag(IN_FLIGHT, in_flight); }
+	inline uint16_t get_timer_index() const { return timer_index; }
+	inline void set_timer_index(uint16_t index) { timer_index = index; }
 
 	inline void set_delivered_handler(std::function<void(Delivery)>* handler) { this->delivered = handler; }
 
@@ -256,6 +311,25 @@ public:
 	const uint8_t* get_data() const { return data; }
 	uint16_t get_data_length() const { return data_len; }
 
+	/**
+	 * Holds back this message until the message store has room in the window.
+	 * The message is sent on the first call to process() after the given time
+	 * once there is room.
+	 */
+	void set_deferred(system_tick_t time)
+	{
+		timeout = time;
+		transmit_count = 0;
+	}
+
+	/**
+	 * Determines if this is a confirmable message that has not yet been sent.
+	 */
+	bool is_deferred() const
+	{
+		return transmit_count==0 && get_type()==CoAPType::CON;
+	}
+
 	/**
 	 * Sets the time when this message expires.
 	 */
@@ -293,53 +367,279 @@ inline bool time_has_passed(system_tick_t now, system_tick_t tick)
 
 
 
+/**
+ * An open-addressed hash table of CoAP messages keyed by message ID, using linear probing.
+ */
+class CoAPMessageIndex
+{
+	CoAPMessage** slots;
+	uint16_t capacity;
+	uint16_t count;
+	uint8_t shift;
+
+	static const uint16_t INITIAL_CAPACITY = 8;
+
+	/**
+	 * Fibonacci hashing. Message IDs are mostly allocated sequentially, which would
+	 * otherwise form long clusters of occupied slots.
+	 */
+	inline uint16_t slot_for(message_id_t id) const
+	{
+		return uint16_t(id*40503u)>>shift;
+	}
+
+	inline uint16_t next_slot(uint16_t slot) const
+	{
+		return (slot+1) & (capacity-1);
+	}
+
+	/**
+	 * Finds the slot containing the message with the given ID, or the empty slot where it would be inserted.
+	 */
+	uint16_t find_slot(message_id_t id) const;
+
+public:
+	CoAPMessageIndex() : slots(nullptr), capacity(0), count(0), shift(16) {}
+
+	~CoAPMessageIndex()
+	{
+		free(slots);
+	}
+
+	CoAPMessageIndex(const CoAPMessageIndex&) = delete;
+	CoAPMessageIndex& operator=(const CoAPMessageIndex&) = delete;
+
+	/**
+	 * Ensures that the index can hold the given number of messages without growing.
+	 * @return false if the memory could not be allocated.
+	 */
+	bool reserve(size_t size);
+
+	/**
+	 * Adds a message to the index. The index must not contain a message with the same ID.
+	 * @return false if the memory could not be allocated.
+	 */
+	bool insert(CoAPMessage* msg);
+
+	/**
+	 * Retrieves the message with the given ID, or nullptr if there is no such message.
+	 */
+	CoAPMessage* find(message_id_t id) const
+	{
+		if (!count)
+			return nullptr;
+		return slots[find_slot(id)];
+	}
+
+	/**
+	 * Removes the message with the given ID and returns it, or nullptr if there is no such message.
+	 */
+	CoAPMessage* remove(message_id_t id);
+
+	uint16_t size() const { return count; }
+
+	/**
+	 * The number of slots in the table. Slots may be iterated with at().
+	 */
+	uint16_t slot_count() const { return capacity; }
+
+	CoAPMessage* at(uint16_t slot) const { return slots[slot]; }
+
+	/**
+	 * Removes all messages from the index. The memory for the table is retained.
+	 */
+	void clear()
+	{
+		if (slots)
+			memset(slots, 0, capacity*sizeof(CoAPMessage*));
+		count = 0;
+	}
+};
+
+/**
+ * A binary min-heap of CoAP messages ordered by their timeout.
+ * Each message records its position in the heap so it can be removed or rescheduled in O(log n).
+ */
+class CoAPTimerQueue
+{
+	CoAPMessage** heap;
+	uint16_t capacity;
+	uint16_t count;
+
+	static inline bool expires_before(const CoAPMessage* a, const CoAPMessage* b)
+	{
+		return int32_t(a->get_timeout()-b->get_timeout())<0;
+	}
+
+	inline void place(CoAPMessage* msg, uint16_t index)
+	{
+		heap[index] = msg;
+		msg->set_timer_index(index);
+	}
+
+	void sift_up(uint16_t index);
+	void sift_down(uint16_t index);
+
+public:
+	CoAPTimerQueue() : heap(nullptr), capacity(0), count(0) {}
+
+	~CoAPTimerQueue()
+	{
+		free(heap);
+	}
+
+	CoAPTimerQueue(const CoAPTimerQueue&) = delete;
+	CoAPTimerQueue& operator=(const CoAPTimerQueue&) = delete;
+
+	/**
+	 * Ensures that the queue can hold the given number of messages without growing.
+	 * @return false if the memory could not be allocated.
+	 */
+	bool reserve(size_t size);
+
+	/**
+	 * Adds a message to the queue. There must be room reserved for the message.
+	 */
+	void push(CoAPMessage* msg)
+	{
+		SPARK_ASSERT(count<capacity);
+		place(msg, count++);
+		sift_up(msg->get_timer_index());
+	}
+
+	/**
+	 * Retrieves the message that expires first, or nullptr if the queue is empty.
+	 */
+	CoAPMessage* top() const
+	{
+		return count ? heap[0] : nullptr;
+	}
+
+	/**
+	 * Restores the heap order after the timeout of a message in the queue has changed.
+	 */
+	void update(CoAPMessage* msg);
+
+	void remove(CoAPMessage* msg);
+
+	void clear()
+	{
+		for (uint16_t i=0; i<count; i++)
+			heap[i]->set_timer_index(CoAPMessage::NO_TIMER);
+		count = 0;
+	}
+};
+
 /**
  * A mix-in class that provides message resending for reliable delivery of messages.
+ *
+ * Messages are indexed by ID so that acknowledgements are matched in constant time,
+ * and sent messages are kept in a queue ordered by their timeout so that processing
+ * only touches the messages that are due.
  */
 class CoAPMessageStore
 {
 	LOG_CATEGORY("comm.coap");
 
 	/**
-	 * The head of the list of messages.
+	 * All messages in the store, keyed by message ID.
+	 */
+	CoAPMessageIndex messages;
+
+	/**
+	 * The messages that have been sent or are waiting to expire, ordered by timeout.
+	 */
+	CoAPTimerQueue timers;
+
+	/**
+	 * The queue of confirmable messages waiting for room in the window, oldest first.
+	 */
+	CoAPMessage* deferred_head;
+	CoAPMessage* deferred_tail;
+
+	/**
+	 * The number of confirmable messages in the store.
+	 */
+	uint16_t confirmable;
+
+	/**
+	 * The maximum number of confirmable messages that may be awaiting acknowledgement
+	 * at once. 0 means the number of messages in flight is not limited.
+	 */
+	uint8_t window_size;
+
+	/**
+	 * The current congestion window. This is reduced when messages time out and grows
+	 * back up to `window_size` as messages are acknowledged.
+	 */
+	uint8_t window;
+
+	/**
+	 * The number of confirmable messages that have been sent and are awaiting acknowledgement.
+	 */
+	uint8_t in_flight;
+
+	/**
+	 * The number of acknowledgements received since the congestion window last grew.
+	 */
+	uint8_t acked;
+
+	/**
+	 * Set after the congestion window is reduced until a message sent after the reduction
+	 * is acknowledged. Further timeouts of messages from the same window do not reduce it again.
+	 */
+	bool recovering;
+
+	/**
+	 * The ID of the last message sent before the congestion window was reduced.
+	 */
+	message_id_t recovery_id;
+
+	/**
+	 * The ID of the last confirmable message transmitted for the first time.
+	 */
+	message_id_t last_sent_id;
+
+	/**
+	 * Removes a message from the index, and from the timer or deferred queue.
+	 */
+	void remove(CoAPMessage* message);
+
+	void message_timeout(CoAPMessage& msg, Channel& channel);
+
+	/**
+	 * Sends the deferred messages that fit in the window.
 	 */
-	CoAPMessage* head;
+	void send_deferred(system_tick_t time, Channel& channel);
 
 	/**
-	 * Retrieves the message with the given ID and the previous message.
-	 * If no message exists with the given id, nullptr is returned.
+	 * Counts a confirmable message towards the window when it is first transmitted.
 	 */
-	CoAPMessage* for_id(message_id_t id, CoAPMessage*& prev) const
+	void transmitted(CoAPMessage& msg)
 	{
-		prev = nullptr;
-		CoAPMessage* next = head;
-		while (next)
+		if (!msg.is_in_flight() && msg.get_type()==CoAPType::CON)
 		{
-			if (next->matches(id))
-				return next;
-			prev = next;
-			next = next->get_next();
+			msg.set_in_flight(true);
+			in_flight++;
+			last_sent_id = msg.get_id();
 		}
-		return nullptr;
 	}
 
 	/**
-	 * Removes a message given the message to remove and the previous entry in the list.
+	 * Grows the congestion window by one message for each window's worth of acknowledgements.
 	 */
-	void remove(CoAPMessage* message, CoAPMessage* previous)
-	{
-		if (previous)
-			previous->set_next(message->get_next());
-		else
-			head = message->get_next();
-		message->removed();
-	}
+	void acknowledged(const CoAPMessage& msg);
 
-	void message_timeout(CoAPMessage& msg, Channel& channel);
+	/**
+	 * Halves the congestion window when a message in flight has to be retransmitted.
+	 */
+	void congestion_backoff(const CoAPMessage& msg);
 
 public:
 
-	CoAPMessageStore() : head(nullptr) {}
+	CoAPMessageStore() : deferred_head(nullptr), deferred_tail(nullptr), confirmable(0),
+			window_size(0), window(0), in_flight(0), acked(0),
+			recovering(false), recovery_id(0), last_sent_id(0) {}
 
 	~CoAPMessageStore() {
 		clear();
@@ -347,10 +647,64 @@ public:
 
 	bool has_messages() const
 	{
-		return head!=nullptr;
+		return messages.size()!=0;
+	}
+
+	bool has_unacknowledged_requests() const
+	{
+		return confirmable!=0;
+	}
+
+	/**
+	 * Sets the maximum number of confirmable messages that can be awaiting
+	 * acknowledgement at once. Further confirmable messages are held in the store
+	 * and sent as earlier messages are acknowledged.
+	 * @param size	The window size, or 0 to send all messages immediately.
+	 */
+	void set_window_size(uint8_t size)
+	{
+		window_size = size;
+		window = size;
+		acked = 0;
+		recovering = false;
+	}
+
+	uint8_t get_window_size() const
+	{
+		return window_size;
+	}
+
+	/**
+	 * Retrieves the current congestion window, which is at most the window size.
+	 */
+	uint8_t get_congestion_window() const
+	{
+		return window;
+	}
+
+	/**
+	 * Retrieves the number of confirmable messages that are awaiting acknowledgement.
+	 */
+	uint8_t get_in_flight() const
+	{
+		return in_flight;
+	}
+
+	/**
+	 * Determines if another confirmable message can be sent without exceeding the window.
+	 */
+	bool can_transmit() const
+	{
+		return !window_size || in_flight<window;
 	}
 
-	bool has_unacknowledged_requests() const;
+	/**
+	 * Determines if there are confirmable messages waiting for room in the window.
+	 */
+	bool has_deferred() const
+	{
+		return deferred_head!=nullptr;
+	}
 
 	/**
 	 * Retrieves the current confirmable message that is still
@@ -359,9 +713,7 @@ public:
 	 */
 	CoAPMessage* from_id(message_id_t id) const
 	{
-		CoAPMessage* prev;
-		CoAPMessage* next = for_id(id, prev);
-		return next;
+		return messages.find(id);
 	}
 
 	ProtocolError add(CoAPMessage* message)
@@ -372,19 +724,7 @@ public:
 	/**
 	 * Adds a message to this message store.
 	 */
-	ProtocolError add(CoAPMessage& message)
-	{
-		// trying to add exactly the same message
-		if (from_id(message.get_id())==&message)
-			return NO_ERROR;
-
-		clear_message(message.get_id());
-		if (message.get_next())
-			return INVALID_STATE;
-		message.set_next(head);
-		head = &message;
-		return NO_ERROR;
-	}
+	ProtocolError add(CoAPMessage& message);
 
 	/**
 	 * Removes a message from the store with the given id.
@@ -393,10 +733,9 @@ public:
 	 */
 	CoAPMessage* remove(message_id_t msg_id)
 	{
-		CoAPMessage* prev;
-		CoAPMessage* msg = for_id(msg_id, prev);
+		CoAPMessage* msg = messages.find(msg_id);
 		if (msg) {
-			remove(msg, prev);
+			remove(msg);
 		}
 		return msg;
 	}
@@ -427,6 +766,12 @@ public:
 	 */
 	ProtocolError send(Message& msg, system_tick_t time);
 
+	/**
+	 * Stores a confirmable message that cannot be sent yet because the window is full.
+	 * The message is sent from process() once there is room in the window.
+	 */
+	ProtocolError defer(Message& msg, system_tick_t time);
+
 	/**
 	 * Notifies the message store that a message has been received.
 	 */
@@ -442,13 +787,7 @@ public:
 	/**
 	 * Removes all knowledge of any messages.
 	 */
-	void clear()
-	{
-		while (head!=nullptr)
-		{
-			delete remove(head->get_id());
-		}
-	}
+	void clear();
 
 };
 
@@ -523,6 +862,7 @@ public:
 
 	CoAPReliableChannel(M m=0) : millis(m) {
 		delegateChannel.init(this);
+		client.set_window_size(PROTOCOL_COAP_WINDOW_SIZE);
 	}
 
 	void set_millis(M m) {
@@ -533,6 +873,14 @@ public:
 		return client;
 	}
 
+	/**
+	 * Sets the number of confirmable client messages that can be in flight at once.
+	 * @see CoAPMessageStore::set_window_size()
+	 */
+	void set_window_size(uint8_t size) {
+		client.set_window_size(size);
+	}
+
 	const CoAPMessageStore& server_messages() const {
 		return server;
 	}
@@ -562,6 +910,9 @@ public:
 
 		// determine the type of message.
 		CoAPMessageStore& store = msg.is_request() ? client : server;
+		// new messages queue behind the deferred ones so that they are sent in order
+		if (msg.get_type()==CoAPType::CON && (!store.can_transmit() || store.has_deferred()))
+			return store.defer(msg, millis());
 		ProtocolError error = store.send(msg, millis());
 		if (!error)
 			error = channel::send(msg);
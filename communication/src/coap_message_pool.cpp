@@ -0,0 +1,99 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "coap_message_pool.h"
+#include "communication_diagnostic.h"
+
+#include <new>
+
+namespace particle { namespace protocol {
+
+namespace {
+
+// Room for the block header and alignment that SimpleBasePool adds to each block
+const size_t BLOCK_OVERHEAD = 3*sizeof(uintptr_t);
+
+constexpr size_t pool_size(size_t block_size, size_t blocks)
+{
+	return (block_size+BLOCK_OVERHEAD)*blocks;
+}
+
+uintptr_t small_storage[pool_size(COAP_MESSAGE_POOL_SMALL_BLOCK_SIZE, COAP_MESSAGE_POOL_SMALL_BLOCKS)/sizeof(uintptr_t)+1];
+uintptr_t medium_storage[pool_size(COAP_MESSAGE_POOL_MEDIUM_BLOCK_SIZE, COAP_MESSAGE_POOL_MEDIUM_BLOCKS)/sizeof(uintptr_t)+1];
+uintptr_t large_storage[pool_size(COAP_MESSAGE_POOL_LARGE_BLOCK_SIZE, COAP_MESSAGE_POOL_LARGE_BLOCKS)/sizeof(uintptr_t)+1];
+
+} // namespace
+
+CoAPMessagePool::CoAPMessagePool() :
+		pools{
+			{ (uint8_t*)small_storage, sizeof(small_storage), COAP_MESSAGE_POOL_SMALL_BLOCK_SIZE, COAP_MESSAGE_POOL_SMALL_BLOCKS },
+			{ (uint8_t*)medium_storage, sizeof(medium_storage), COAP_MESSAGE_POOL_MEDIUM_BLOCK_SIZE, COAP_MESSAGE_POOL_MEDIUM_BLOCKS },
+			{ (uint8_t*)large_storage, sizeof(large_storage), COAP_MESSAGE_POOL_LARGE_BLOCK_SIZE, COAP_MESSAGE_POOL_LARGE_BLOCKS }
+		},
+		in_use(0),
+		max_in_use(0),
+		exhausted(0)
+{
+}
+
+CoAPMessagePool& CoAPMessagePool::instance()
+{
+	static CoAPMessagePool pool;
+	return pool;
+}
+
+void* CoAPMessagePool::allocate(size_t size)
+{
+	void* ptr = nullptr;
+	for (Pool& p: pools) {
+		if (size<=p.block_size) {
+			// always allocate the whole block so that any free block can be reused
+			if (p.in_use<p.blocks && (ptr = p.pool.alloc(p.block_size))!=nullptr) {
+				p.in_use++;
+				if (++in_use>max_in_use) {
+					max_in_use = in_use;
+					g_coapMessagePoolHighWaterMark = max_in_use;
+				}
+				return ptr;
+			}
+			break;
+		}
+	}
+	exhausted++;
+	g_coapMessagePoolExhaustedCounter++;
+	return new(std::nothrow) uint8_t[size];
+}
+
+void CoAPMessagePool::free(void* ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	for (Pool& p: pools) {
+		if (p.contains(ptr)) {
+			p.pool.free(ptr);
+			p.in_use--;
+			in_use--;
+			return;
+		}
+	}
+	delete[] (uint8_t*)ptr;
+}
+
+}}
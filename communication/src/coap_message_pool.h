@@ -0,0 +1,115 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "protocol_defs.h"
+#include "simple_pool_allocator.h"
+
+namespace particle { namespace protocol {
+
+/**
+ * Fixed size blocks of memory for CoAP messages, split into a few size classes.
+ * Each size class is a SimpleStaticPool that only ever allocates blocks of one size,
+ * so freed blocks are always reused as a whole and the pool does not fragment.
+ * When the blocks of a size class are exhausted the heap is used instead.
+ */
+class CoAPMessagePool
+{
+public:
+	enum SizeClass
+	{
+		SMALL,
+		MEDIUM,
+		LARGE,
+		SIZE_CLASS_COUNT
+	};
+
+	/**
+	 * Allocates a block of at least the given size. Returns nullptr if there is no memory available.
+	 */
+	void* allocate(size_t size);
+
+	/**
+	 * Frees a block allocated with allocate().
+	 */
+	void free(void* ptr);
+
+	/**
+	 * The number of blocks of a size class that are currently allocated.
+	 */
+	uint16_t blocks_in_use(SizeClass size_class) const
+	{
+		return pools[size_class].in_use;
+	}
+
+	/**
+	 * The maximum number of blocks of all size classes that have been allocated at the same time.
+	 */
+	uint16_t high_water_mark() const
+	{
+		return max_in_use;
+	}
+
+	/**
+	 * The number of allocations that could not be served from the pool and used the heap.
+	 */
+	uint32_t exhausted_count() const
+	{
+		return exhausted;
+	}
+
+	static CoAPMessagePool& instance();
+
+private:
+	struct Pool
+	{
+		SimpleStaticPool pool;
+		uint8_t* begin;
+		size_t length;
+		uint16_t block_size;
+		uint16_t blocks;
+		uint16_t in_use;
+
+		Pool(uint8_t* storage, size_t size, uint16_t block_size, uint16_t blocks) :
+				pool(storage, size),
+				begin(storage),
+				length(size),
+				block_size(block_size),
+				blocks(blocks),
+				in_use(0) {
+		}
+
+		bool contains(const void* ptr) const
+		{
+			return ptr>=begin && ptr<begin+length;
+		}
+	};
+
+	Pool pools[SIZE_CLASS_COUNT];
+	uint16_t in_use;
+	uint16_t max_in_use;
+	uint32_t exhausted;
+
+	CoAPMessagePool();
+};
+
+}}
@@ -1,4 +1,7 @@
 #include "communication_diagnostic.h"
 
 particle::SimpleIntegerDiagnosticData g_rateLimitedEventsCounter(DIAG_ID_CLOUD_RATE_LIMITED_EVENTS, DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_deferredEventsCounter(DIAG_ID_CLOUD_DEFERRED_EVENTS, DIAG_NAME_CLOUD_DEFERRED_EVENTS);
 particle::SimpleIntegerDiagnosticData g_unacknowledgedMessageCounter(DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES, DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES);
+particle::SimpleIntegerDiagnosticData g_coapMessagePoolHighWaterMark(DIAG_ID_CLOUD_MESSAGE_POOL_HIGH_WATER_MARK, DIAG_NAME_CLOUD_MESSAGE_POOL_HIGH_WATER_MARK);
+particle::SimpleIntegerDiagnosticData g_coapMessagePoolExhaustedCounter(DIAG_ID_CLOUD_MESSAGE_POOL_EXHAUSTED, DIAG_NAME_CLOUD_MESSAGE_POOL_EXHAUSTED);
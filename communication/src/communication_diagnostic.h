@@ -1,4 +1,7 @@
 #include "spark_wiring_diagnostics.h"
 
 extern particle::SimpleIntegerDiagnosticData g_rateLimitedEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_deferredEventsCounter;
 extern particle::SimpleIntegerDiagnosticData g_unacknowledgedMessageCounter;
+extern particle::SimpleIntegerDiagnosticData g_coapMessagePoolHighWaterMark;
+extern particle::SimpleIntegerDiagnosticData g_coapMessagePoolExhaustedCounter;
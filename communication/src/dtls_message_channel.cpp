@@ -33,6 +33,7 @@ LOG_SOURCE_CATEGORY("comm.dtls")
 #include "timer_hal.h"
 #include <stdio.h>
 #include <string.h>
+#include <new>
 #include "dtls_session_persist.h"
 
 namespace particle { namespace protocol {
@@ -235,6 +236,20 @@ ProtocolError DTLSMessageChannel::init(
  */
 inline int DTLSMessageChannel::send(const uint8_t* data, size_t len)
 {
+	if (batch)
+	{
+		if (!move_session && len && data[0]==23 && len<=PROTOCOL_BUFFER_SIZE)
+		{
+			if (batch_length+len > PROTOCOL_BUFFER_SIZE && send_batch() < 0)
+				return -1;
+			memcpy(batch+batch_length, data, len);
+			batch_length += len;
+			return len;
+		}
+		// keep the records in order
+		if (send_batch() < 0)
+			return -1;
+	}
 	if (move_session && len && data[0]==23)
 	{
 		// buffer for a new packet that contains the device ID length and a byte for the length appended to the existing data.
@@ -253,8 +268,28 @@ inline int DTLSMessageChannel::send(const uint8_t* data, size_t len)
 		return callbacks.send(data, len, callbacks.tx_context);
 }
 
+/**
+ * Sends the records collected in the batch buffer as one datagram.
+ */
+int DTLSMessageChannel::send_batch()
+{
+	if (!batch_length)
+		return 0;
+	const int result = callbacks.send(batch, batch_length, callbacks.tx_context);
+	batch_length = 0;
+	return result;
+}
+
+void DTLSMessageChannel::end_batch()
+{
+	delete[] batch;
+	batch = nullptr;
+	batch_length = 0;
+}
+
 void DTLSMessageChannel::reset_session()
 {
+	end_batch();
 	cancel_move_session();
 	mbedtls_ssl_session_reset(&ssl_context);
 	sessionPersist.clear(callbacks.save);
@@ -315,6 +350,7 @@ void DTLSMessageChannel::dispose()
 	mbedtls_ssl_free (&ssl_context);
 	delete this->server_public;
 	server_public_len = 0;
+	end_batch();
 }
 
 
@@ -527,7 +563,7 @@ bool DTLSMessageChannel::is_unreliable()
 
 ProtocolError DTLSMessageChannel::command(Command command, void* arg)
 {
-	LOG(INFO,"session cmd (CLS,DIS,MOV,LOD,SAV): %d", command);
+	LOG(INFO,"session cmd (CLS,DIS,MOV,LOD,SAV,BEG,END): %d", command);
 	switch (command)
 	{
 	case CLOSE:
@@ -549,6 +585,25 @@ ProtocolError DTLSMessageChannel::command(Command command, void* arg)
 	case SAVE_SESSION:
 		sessionPersist.save(callbacks.save);
 		break;
+
+	case BEGIN_BATCH:
+		if (!batch)
+		{
+			batch = new(std::nothrow) uint8_t[PROTOCOL_BUFFER_SIZE];
+			if (!batch)
+				return INSUFFICIENT_STORAGE;
+		}
+		break;
+
+	case END_BATCH:
+		if (batch)
+		{
+			const int result = send_batch();
+			end_batch();
+			if (result < 0)
+				return IO_ERROR_GENERIC_SEND;
+		}
+		break;
 	}
 	return NO_ERROR;
 }
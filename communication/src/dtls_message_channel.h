@@ -103,6 +103,13 @@ private:
 	bool move_session;
 	const uint8_t* device_id;
 
+	/**
+	 * Application data records written while a batch is open. They are sent
+	 * in a single datagram when the batch ends or the buffer is full.
+	 */
+	uint8_t* batch;
+	size_t batch_length;
+
     void init();
     void dispose();
 
@@ -121,8 +128,12 @@ private:
 
 	void reset_session();
 
+	int send_batch();
+
+	void end_batch();
+
  public:
-	DTLSMessageChannel() : coap_state(nullptr), move_session(false) {}
+	DTLSMessageChannel() : coap_state(nullptr), move_session(false), batch(nullptr), batch_length(0) {}
 
 	ProtocolError init(const uint8_t* core_private, size_t core_private_len,
 		const uint8_t* core_public, size_t core_public_len,
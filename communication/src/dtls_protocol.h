@@ -83,6 +83,7 @@ public:
 		case ProtocolCommands::DISCONNECT:
 			result = wait_confirmable();
 			ack_handlers.clear();
+			publisher.clear();
 			break;
 		case ProtocolCommands::WAKE:
 			wake();
@@ -90,6 +91,7 @@ public:
 			break;
 		case ProtocolCommands::TERMINATE:
 			ack_handlers.clear();
+			publisher.clear();
 			result = NO_ERROR;
 			break;
 		case ProtocolCommands::FORCE_PING: {
@@ -111,6 +113,7 @@ public:
 		if (channel.has_unacknowledged_client_requests()) {
 			status->flags |= PROTOCOL_STATUS_HAS_PENDING_CLIENT_MESSAGES;
 		}
+		loop_stats.get(status);
 		return NO_ERROR;
 	}
 
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "protocol_defs.h"
+#include "spark_protocol_functions.h"
+
+#include <stddef.h>
+#include <string.h>
+
+namespace particle { namespace protocol {
+
+/**
+ * Histograms of the number of messages handled in each iteration of the protocol event loop
+ * and of the duration of the iterations.
+ */
+class EventLoopStats
+{
+public:
+	static const size_t HISTOGRAM_SIZE = PROTOCOL_STATUS_HISTOGRAM_SIZE;
+
+	EventLoopStats()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		memset(messages_, 0, sizeof(messages_));
+		memset(latency_, 0, sizeof(latency_));
+	}
+
+	void update(unsigned messages, system_tick_t duration)
+	{
+		++messages_[bucket(messages)];
+		++latency_[bucket(duration)];
+	}
+
+	/**
+	 * Copies the histograms to the status, if the caller's structure has room for them.
+	 */
+	void get(protocol_status* status) const
+	{
+		if (status->size >= offsetof(protocol_status, loop_latency) + sizeof(status->loop_latency))
+		{
+			memcpy(status->loop_messages, messages_, sizeof(messages_));
+			memcpy(status->loop_latency, latency_, sizeof(latency_));
+		}
+	}
+
+	const uint32_t* messages() const
+	{
+		return messages_;
+	}
+
+	const uint32_t* latency() const
+	{
+		return latency_;
+	}
+
+	/**
+	 * Determines the bucket that counts the given value: 0 for 0, and the bit length of the value
+	 * otherwise, up to the last bucket.
+	 */
+	static size_t bucket(uint32_t value)
+	{
+		size_t b = 0;
+		while (value && b < HISTOGRAM_SIZE - 1)
+		{
+			value >>= 1;
+			++b;
+		}
+		return b;
+	}
+
+private:
+	uint32_t messages_[HISTOGRAM_SIZE];
+	uint32_t latency_[HISTOGRAM_SIZE];
+};
+
+}}
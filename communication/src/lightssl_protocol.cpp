@@ -32,6 +32,7 @@ int LightSSLProtocol::command(ProtocolCommands::Enum command, uint32_t data)
     break;
   case ProtocolCommands::TERMINATE:
     ack_handlers.clear();
+    publisher.clear();
     result = NO_ERROR;
     break;
   }
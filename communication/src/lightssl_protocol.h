@@ -83,6 +83,7 @@ public:
 	{
 		SPARK_ASSERT(status);
 		status->flags = 0;
+		loop_stats.get(status);
 		return 0;
 	}
 
@@ -128,21 +128,15 @@ public:
 		return len;
 	}
 
-	bool content_equals(Message& msg)
+	bool content_equals(const Message& msg) const
 	{
 		return msg.length()==this->length() &&
 				memcmp(msg.buf(), this->buf(),this->length())==0;
 	}
 
-	Message& operator=(const Message& msg)
-	{
-		this->buffer = msg.buffer;
-		this->buffer_length = msg.buffer_length;
-		this->message_length = msg.message_length;
-		this->id = msg.id;
-		this->confirm_received = msg.confirm_received;
-		return *this;
-	}
+	// The buffer is referenced, not copied
+	Message(const Message& msg) = default;
+	Message& operator=(const Message& msg) = default;
 
 };
 
@@ -173,6 +167,17 @@ struct Channel
 		 * Save session - saves the session to persistent store.
 		 */
 		SAVE_SESSION = 4,
+
+		/**
+		 * Begin a batch - messages sent until the batch ends may be
+		 * sent to the server together in a single datagram.
+		 */
+		BEGIN_BATCH = 5,
+
+		/**
+		 * End a batch - sends the messages held since the batch began.
+		 */
+		END_BATCH = 6,
 	};
 
 
@@ -33,6 +33,14 @@ CoAPMessageType::Enum Messages::decodeType(const uint8_t* buf, size_t length)
 	size_t path_idx = 5 + (buf[0] & 0x0F);
     if (path_idx<length)
 		 path = buf[path_idx];
+    // the Uri-Path is usually the first option, but options with a lower number such as ETag may precede it
+    if (path_idx<length && (buf[path_idx-1] >> 4) < CoAPOption::URI_PATH)
+    {
+        const uint8_t* value = nullptr;
+        size_t value_len = 0;
+        if (CoAP::find_option(buf, length, CoAPOption::URI_PATH, &value, &value_len) && value_len)
+            path = value[0];
+    }
 
 	switch (CoAP::code(buf))
 	{
@@ -249,6 +257,41 @@ size_t Messages::content(uint8_t* buf, uint16_t message_id, uint8_t token)
 	return 6;
 }
 
+size_t Messages::description(uint8_t* buf, uint16_t message_id, uint8_t token, const uint32_t* etag, const CoAPBlock* block,
+		size_t total_size)
+{
+	size_t size = CoAP::header(buf, CoAPType::ACK, CoAPCode::CONTENT, 1, &token, message_id);
+	CoAPOption::Enum previous = CoAPOption::NONE;
+	if (etag) {
+		const uint8_t value[4] = { uint8_t(*etag >> 24), uint8_t(*etag >> 16), uint8_t(*etag >> 8), uint8_t(*etag) };
+		size += CoAP::add_option(buf + size, previous, CoAPOption::ETAG, value, sizeof(value));
+		previous = CoAPOption::ETAG;
+	}
+	if (block) {
+		uint8_t value[3];
+		const size_t value_len = CoAP::block_value(value, *block);
+		size += CoAP::add_option(buf + size, previous, CoAPOption::BLOCK2, value, value_len);
+		// the server can tell the whole size of the description from any block
+		uint8_t size2[4];
+		size_t size2_len = 0;
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			if (size2_len || (total_size >> shift) & 0xff) {
+				size2[size2_len++] = uint8_t(total_size >> shift);
+			}
+		}
+		size += CoAP::add_option(buf + size, CoAPOption::BLOCK2, CoAPOption::SIZE2, size2, size2_len);
+	}
+	buf[size++] = 0xff; // payload marker
+	return size;
+}
+
+size_t Messages::description_valid(uint8_t* buf, uint16_t message_id, uint8_t token, uint32_t etag)
+{
+	size_t size = CoAP::header(buf, CoAPType::ACK, CoAPCode::NOT_MODIFIED, 1, &token, message_id);
+	const uint8_t value[4] = { uint8_t(etag >> 24), uint8_t(etag >> 16), uint8_t(etag >> 8), uint8_t(etag) };
+	size += CoAP::add_option(buf + size, CoAPOption::NONE, CoAPOption::ETAG, value, sizeof(value));
+	return size;
+}
 
 size_t Messages::keep_alive(uint8_t* buf)
 {
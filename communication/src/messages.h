@@ -164,6 +164,17 @@ public:
         return content(buf, message_id, token);
     }
 
+    // The maximum size of a description header, up to and including the payload marker
+    static const size_t description_header_size = 21;
+
+    // Encodes a 2.05 Content description header with optional ETag and Block2 options. A block
+    // is followed by a Size2 option with the total size of the description
+    static size_t description(uint8_t* buf, message_id_t message_id, token_t token, const uint32_t* etag, const CoAPBlock* block,
+            size_t total_size = 0);
+
+    // Encodes a 2.03 Valid response confirming that the server's description with the given ETag is current
+    static size_t description_valid(uint8_t* buf, message_id_t message_id, token_t token, uint32_t etag);
+
 };
 
 
@@ -25,6 +25,8 @@ LOG_SOURCE_CATEGORY("comm.protocol")
 #include "subscriptions.h"
 #include "functions.h"
 
+#include <algorithm>
+
 namespace particle { namespace protocol {
 
 /**
@@ -73,13 +75,30 @@ ProtocolError Protocol::handle_received_message(Message& message,
 	{
 		// 4 bytes header, 1 byte token, 2 bytes Uri-Path
 		// 2 bytes optional single character Uri-Query for describe flags
+		// optional Block2 option when the server fetches a large description block-wise
 		int descriptor_type = DESCRIBE_DEFAULT;
-		if (message.length()>8 && queue[8] <= DESCRIBE_MAX) {
-			descriptor_type = queue[8];
-		} else if (message.length() > 8) {
-			LOG(WARN, "Invalid DESCRIBE flags %02x", queue[8]);
+		const uint8_t* query = nullptr;
+		size_t query_len = 0;
+		if (CoAP::find_option(queue, message.length(), CoAPOption::URI_QUERY, &query, &query_len)) {
+			if (query_len == 1 && query[0] <= DESCRIBE_MAX) {
+				descriptor_type = query[0];
+			} else {
+				LOG(WARN, "Invalid DESCRIBE flags %02x", query_len ? query[0] : 0);
+			}
 		}
-		error = send_description(token, msg_id, descriptor_type);
+		CoAPBlock block;
+		const bool has_block = CoAP::block(queue, message.length(), CoAPOption::BLOCK2, block);
+		// optional ETag of the description the server already has
+		const uint8_t* etag_value = nullptr;
+		size_t etag_len = 0;
+		uint32_t etag = 0;
+		const bool has_etag = CoAP::find_option(queue, message.length(), CoAPOption::ETAG, &etag_value, &etag_len) &&
+				etag_len == sizeof(etag);
+		if (has_etag) {
+			etag = (etag_value[0] << 24) | (etag_value[1] << 16) | (etag_value[2] << 8) | etag_value[3];
+		}
+		error = send_description(token, msg_id, descriptor_type, has_block ? &block : nullptr,
+				has_etag ? &etag : nullptr);
 		break;
 	}
 
@@ -290,6 +309,8 @@ int Protocol::begin()
 
 	// FIXME: Pending completion handlers should be cancelled at the end of a previous session
 	ack_handlers.clear();
+	// the events held back by the rate limiter or for a batch belong to the previous session
+	publisher.clear();
 	last_ack_handlers_update = callbacks.millis();
 
 	uint32_t channel_flags = 0;
@@ -416,9 +437,17 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 	ack_handlers.update(t - last_ack_handlers_update);
 	last_ack_handlers_update = t;
 
+	// Send the rate limited events that can be sent now
+	ProtocolError error = publisher.process(channel, t);
+	if (error)
+	{
+		LOG(ERROR,"Event loop error %d", error);
+		return error;
+	}
+
 	Message message;
 	message_type = CoAPMessageType::NONE;
-	ProtocolError error = channel.receive(message);
+	error = channel.receive(message);
 	if (!error)
 	{
 		if (message.length())
@@ -442,6 +471,31 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 	return error;
 }
 
+bool Protocol::event_loop()
+{
+	const system_tick_t start = callbacks.millis();
+	unsigned messages = 0;
+	ProtocolError error = NO_ERROR;
+	for (;;)
+	{
+		// The channel doesn't block, so an empty receive means that no more messages are ready.
+		// That pass also runs the idle processing
+		CoAPMessageType::Enum message_type;
+		error = event_loop(message_type);
+		if (error || message_type == CoAPMessageType::NONE)
+		{
+			break;
+		}
+		if (++messages >= PROTOCOL_EVENT_LOOP_MAX_MESSAGES ||
+				(callbacks.millis() - start) >= PROTOCOL_EVENT_LOOP_TIME_BUDGET)
+		{
+			break;
+		}
+	}
+	loop_stats.update(messages, callbacks.millis() - start);
+	return !error;
+}
+
 void Protocol::build_describe_message(Appender& appender, int desc_flags)
 {
 	// diagnostics must be requested in isolation to be a binary packet
@@ -523,8 +577,6 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, Message& message,
                                                       size_t header_size, int desc_flags)
 {
-    ProtocolError error;
-
     BufferAppender appender((message.buf() + header_size), (message.capacity() - header_size));
     build_describe_message(appender, desc_flags);
 
@@ -541,12 +593,20 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
         SPARK_ASSERT(!appender.overflowed());
     }
 
+    return send_describe_message(channel, message, desc_flags, true);
+}
+
+ProtocolError Protocol::send_describe_message(MessageChannel& channel, Message& message,
+                                              int desc_flags, bool complete)
+{
+    ProtocolError error;
+
     LOG(INFO, "Posting '%s%s%s' describe message", desc_flags & DESCRIBE_SYSTEM ? "S" : "",
         desc_flags & DESCRIBE_APPLICATION ? "A" : "", desc_flags & DESCRIBE_METRICS ? "M" : "");
 
     error = channel.send(message);
 
-    if (error == NO_ERROR && descriptor.app_state_selector_info &&
+    if (error == NO_ERROR && complete && descriptor.app_state_selector_info &&
         (desc_flags & DESCRIBE_APPLICATION || desc_flags & DESCRIBE_SYSTEM))
     {
         this->channel.command(Channel::SAVE_SESSION);
@@ -585,20 +645,112 @@ ProtocolError Protocol::post_description(int desc_flags)
     return generate_and_send_description(channel, message, header_size, desc_flags);
 }
 
+bool Protocol::description_hash(int desc_flags, uint32_t& hash)
+{
+    // the metrics change all the time, so there is no point in validating them
+    if (!descriptor.app_state_selector_info || !callbacks.calculate_crc || desc_flags == DESCRIBE_METRICS)
+    {
+        return false;
+    }
+    // the checksums are kept current by the system as functions, variables and modules change
+    uint32_t chk[3];
+    chk[0] = desc_flags & (DESCRIBE_APPLICATION | DESCRIBE_SYSTEM);
+    chk[1] = (desc_flags & DESCRIBE_APPLICATION) ? descriptor.app_state_selector_info(
+            SparkAppStateSelector::DESCRIBE_APP, SparkAppStateUpdate::COMPUTE, 0, nullptr) : 0;
+    chk[2] = (desc_flags & DESCRIBE_SYSTEM) ? descriptor.app_state_selector_info(
+            SparkAppStateSelector::DESCRIBE_SYSTEM, SparkAppStateUpdate::COMPUTE, 0, nullptr) : 0;
+    hash = callbacks.calculate_crc((const uint8_t*)chk, sizeof(chk));
+    return true;
+}
+
 /**
  * Produces and transmits (PIGGYBACK) a describe message.
  * @param desc_flags Flags describing the information to provide. A combination of {@code
  * DESCRIBE_APPLICATION) and {@code DESCRIBE_SYSTEM) flags.
+ * @param block The Block2 option of the request, or {@code nullptr} if the request has none.
+ * @param etag The ETag option of the request, or {@code nullptr} if the request has none.
  */
-ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int desc_flags)
+ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int desc_flags,
+                                         const CoAPBlock* block, const uint32_t* etag)
 {
     Message message;
     channel.create(message);
     uint8_t* buf = message.buf();
     message.set_id(msg_id);
-    size_t desc = Messages::description(buf, msg_id, token);
 
-    return generate_and_send_description(channel, message, desc, desc_flags);
+    uint32_t hash = 0;
+    const bool has_hash = description_hash(desc_flags, hash);
+    if (has_hash && etag && *etag == hash)
+    {
+        // The server's copy of the description is current, so only the hash is sent back
+        LOG(INFO, "Describe message is unchanged");
+        message.set_length(Messages::description_valid(buf, msg_id, token, hash));
+        return send_describe_message(channel, message, desc_flags, true);
+    }
+
+    if (!has_hash)
+    {
+        // The blocks of a description are generated one request at a time, so the server relies on
+        // the ETag to tell whether the description changed during the transfer. A description that
+        // can't be hashed, such as the metrics that change all the time, is sent in a single message
+        if (block)
+        {
+            LOG(WARN, "Describe message can't be sent block-wise");
+            message.set_length(Messages::coded_ack(buf, token, CoAPCode::BAD_OPTION,
+                                                   uint8_t(msg_id >> 8), uint8_t(msg_id & 0xff)));
+            return channel.send(message);
+        }
+        const size_t header_size = Messages::description(buf, msg_id, token, nullptr, nullptr);
+        return generate_and_send_description(channel, message, header_size, desc_flags);
+    }
+
+    // Use the largest block size that fits in the message, or the size requested by the server
+    // if that is smaller
+    CoAPBlock response = { 0, false, CoAPBlock::MAX_SZX };
+    const size_t max_block_size = message.capacity() - Messages::description_header_size;
+    while (response.szx && response.size() > max_block_size)
+    {
+        --response.szx;
+    }
+    if (block)
+    {
+        if (block->szx < response.szx)
+        {
+            response.szx = block->szx;
+        }
+        response.num = block->offset() / response.size();
+    }
+
+    // Most descriptions fit in a single response. One that doesn't is sent block-wise, starting
+    // with the first block, which is already at the start of the window, and the server requests
+    // the remaining blocks. Each of them is regenerated, keeping only the requested block in RAM
+    uint8_t* const payload = buf + Messages::description_header_size;
+    WindowAppender appender(payload, block ? response.size() : max_block_size, response.offset());
+    build_describe_message(appender, desc_flags);
+    const size_t total_size = appender.dataSize();
+    if (!block && total_size <= max_block_size)
+    {
+        const size_t header_size = Messages::description(buf, msg_id, token, &hash, nullptr);
+        memmove(buf + header_size, payload, total_size);
+        message.set_length(header_size + total_size);
+        return send_describe_message(channel, message, desc_flags, true);
+    }
+    if (response.num && response.offset() >= total_size)
+    {
+        LOG(WARN, "Describe block %u is out of range", (unsigned)response.num);
+        message.set_length(Messages::coded_ack(buf, token, CoAPCode::BAD_OPTION,
+                                               uint8_t(msg_id >> 8), uint8_t(msg_id & 0xff)));
+        return channel.send(message);
+    }
+    response.more = (total_size > response.offset() + response.size());
+    const size_t size = std::min(total_size - response.offset(), response.size());
+
+    const size_t header_size = Messages::description(buf, msg_id, token, &hash, &response, total_size);
+    memmove(buf + header_size, payload, size);
+    message.set_length(header_size + size);
+    LOG(TRACE, "Describe block %u of %u bytes", (unsigned)response.num, (unsigned)total_size);
+
+    return send_describe_message(channel, message, desc_flags, !response.more);
 }
 
 int Protocol::ChunkedTransferCallbacks::prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void* reserved)
@@ -626,6 +778,20 @@ system_tick_t Protocol::ChunkedTransferCallbacks::millis()
 	return callbacks->millis();
 }
 
+int Protocol::ChunkedTransferCallbacks::save_transfer_state(const void* data, size_t length)
+{
+	if (!callbacks->save)
+		return -1;
+	return callbacks->save(data, length, SparkCallbacks::PERSIST_TRANSFER, nullptr);
+}
+
+int Protocol::ChunkedTransferCallbacks::restore_transfer_state(void* data, size_t max_length)
+{
+	if (!callbacks->restore)
+		return 0;
+	return callbacks->restore(data, max_length, SparkCallbacks::PERSIST_TRANSFER, nullptr);
+}
+
 int Protocol::get_describe_data(spark_protocol_describe_data* data, void* reserved)
 {
 	data->maximum_size = 768;  // a conservative guess based on dtls and lightssl encryption overhead and the CoAP data
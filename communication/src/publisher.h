@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <new>
+
 #include "protocol_defs.h"
 #include "events.h"
 #include "message_channel.h"
@@ -34,57 +38,103 @@ namespace protocol
 
 class Protocol;
 
+/**
+ * Limits the rate of events to a number of events in each interval. The bucket holds a token
+ * for each event that can be sent, and is refilled once the interval has elapsed since the
+ * first token was taken from the full bucket.
+ */
+class TokenBucket
+{
+public:
+	TokenBucket(uint16_t burst, system_tick_t interval) :
+			burst(burst),
+			tokens(burst),
+			interval(interval),
+			last(0)
+	{
+	}
+
+	/**
+	 * Returns true if there is a token in the bucket.
+	 */
+	bool available(system_tick_t now)
+	{
+		refill(now);
+		return tokens;
+	}
+
+	/**
+	 * Takes a token from the bucket. Returns false if the bucket is empty.
+	 */
+	bool take(system_tick_t now)
+	{
+		refill(now);
+		if (!tokens)
+			return false;
+		tokens--;
+		return true;
+	}
+
+	/**
+	 * Restarts the interval after which the bucket is refilled.
+	 */
+	void restart(system_tick_t now)
+	{
+		if (tokens < burst)
+			last = now;
+	}
+
+private:
+	uint16_t burst;
+	uint16_t tokens;
+	system_tick_t interval;
+	system_tick_t last;		// the time the current interval started
+
+	void refill(system_tick_t now)
+	{
+		// a full bucket starts a new interval when the first token is taken
+		if (tokens >= burst || now - last >= interval)
+		{
+			tokens = burst;
+			last = now;
+		}
+	}
+};
+
 class Publisher
 {
 public:
 	explicit Publisher(Protocol* protocol) :
-			protocol(protocol)
+			protocol(protocol),
+			application_events(PUBLISH_EVENT_BURST, PUBLISH_EVENT_INTERVAL),
+			system_events(PUBLISH_SYSTEM_EVENT_BURST, PUBLISH_SYSTEM_EVENT_INTERVAL),
+			deferred_count(0),
+			batch_limit(0),
+			batch_count(0),
+			batch_size(0),
+			batch_started(0)
 	{
 	}
 
+	~Publisher()
+	{
+		clear();
+	}
+
 	inline bool is_system(const char* event_name)
 	{
 		return !strncmp(event_name, "spark", 5) || !strncmp(event_name, "particle", 8);
 	}
 
+	/**
+	 * Takes a token for an event of the given class. Returns true if the event is rate limited.
+	 */
 	bool is_rate_limited(bool is_system_event, system_tick_t millis)
 	{
-		if (is_system_event)
-		{
-			static uint16_t lastMinute = 0;
-			static uint8_t eventsThisMinute = 0;
-
-			uint16_t currentMinute = uint16_t(millis >> 16);
-			if (currentMinute == lastMinute)
-			{      // == handles millis() overflow
-				if (eventsThisMinute == 255)
-					return true;
-			}
-			else
-			{
-				lastMinute = currentMinute;
-				eventsThisMinute = 0;
-			}
-			eventsThisMinute++;
-		}
-		else
-		{
-			static system_tick_t recent_event_ticks[5] =
-			{ (system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000 };
-			static int evt_tick_idx = 0;
-
-			system_tick_t now = recent_event_ticks[evt_tick_idx] = millis;
-			evt_tick_idx++;
-			evt_tick_idx %= 5;
-			if (now - recent_event_ticks[evt_tick_idx] < 1000)
-			{
-				// exceeded allowable burst of 4 events per second
-				return true;
-			}
-		}
-		return false;
+		if (bucket(is_system_event).take(millis))
+			return false;
+		rejected(is_system_event, millis);
+		return true;
 	}
 
 	ProtocolError send_event(MessageChannel& channel, const char* event_name,
@@ -92,14 +142,21 @@ public:
 			system_tick_t time, CompletionHandler handler)
 	{
 		bool is_system_event = is_system(event_name);
-		bool rate_limited = is_rate_limited(is_system_event, time);
-		if (rate_limited) {
+		TokenBucket& tokens = bucket(is_system_event);
+		// events of the same class that are waiting to be sent go first
+		bool rate_limited = has_deferred(is_system_event) || !tokens.available(time);
+		if (rate_limited && deferred_count == PUBLISH_EVENT_QUEUE_SIZE) {
+			rejected(is_system_event, time);
 			g_rateLimitedEventsCounter++;
 			return BANDWIDTH_EXCEEDED;
 		}
 
 		Message message;
-		channel.create(message);
+		ProtocolError error = channel.create(message);
+		if (error) {
+			handler.setError(toSystemError(error));
+			return error;
+		}
 		bool confirmable = channel.is_unreliable();
 		if (flags & EventType::NO_ACK) {
 			confirmable = false;
@@ -109,6 +166,184 @@ public:
 		size_t msglen = Messages::event(message.buf(), 0, event_name, data, ttl,
 				event_type, confirmable);
 		message.set_length(msglen);
+		if (rate_limited) {
+			if (!store(message, is_system_event, flags, handler, deferred[deferred_count])) {
+				g_rateLimitedEventsCounter++;
+				return BANDWIDTH_EXCEEDED;
+			}
+			deferred_count++;
+			g_deferredEventsCounter++;
+			return NO_ERROR;
+		}
+		if (batch_limit) {
+			error = make_room_in_batch(channel, message.length());
+			if (error) {
+				handler.setError(toSystemError(error));
+				return error;
+			}
+			if (fits_in_batch(message.length()) &&
+					store(message, is_system_event, flags, handler, batch[batch_count])) {
+				tokens.take(time);
+				return add_to_batch(channel, time);
+			}
+			// send it on its own
+		}
+		error = send(channel, message, flags, handler);
+		if (!error) {
+			tokens.take(time);
+		}
+		return error;
+	}
+
+	/**
+	 * Sends the deferred events that are no longer rate limited, and the batch of events
+	 * once it has waited long enough for more events.
+	 */
+	ProtocolError process(MessageChannel& channel, system_tick_t time)
+	{
+		bool blocked[2] = { false, false };
+		size_t i = 0;
+		while (i < deferred_count)
+		{
+			DeferredEvent& event = deferred[i];
+			TokenBucket& tokens = bucket(event.is_system);
+			if (blocked[event.is_system] || !tokens.available(time))
+			{
+				// keep the events of this class in order
+				blocked[event.is_system] = true;
+				i++;
+				continue;
+			}
+			ProtocolError error;
+			if (batch_limit) {
+				error = make_room_in_batch(channel, event.length);
+				if (error) {
+					return error;
+				}
+				if (!fits_in_batch(event.length)) {
+					// no message buffer to send the batch, the event waits for it to be sent
+					return NO_ERROR;
+				}
+				batch[batch_count] = std::move(event);
+				event.data = nullptr;
+				tokens.take(time);
+				error = add_to_batch(channel, time);
+			} else {
+				error = send_stored(channel, event);
+				if (event.data)
+				{
+					// no message buffer, the event is sent on a later iteration of the event loop
+					return NO_ERROR;
+				}
+				if (!error)
+				{
+					tokens.take(time);
+				}
+			}
+			remove_deferred(i);
+			if (error)
+			{
+				return error;
+			}
+		}
+		if (batch_count && time - batch_started >= PUBLISH_EVENT_BATCH_WINDOW)
+		{
+			return send_batch(channel);
+		}
+		return NO_ERROR;
+	}
+
+	/**
+	 * Discards the deferred events and the events waiting to be sent in a batch.
+	 */
+	void clear()
+	{
+		while (deferred_count)
+		{
+			deferred[0].handler.setError(SYSTEM_ERROR_CANCELLED);
+			remove_deferred(0);
+		}
+		for (size_t i = 0; i < batch_count; i++)
+		{
+			batch[i].handler.setError(SYSTEM_ERROR_CANCELLED);
+			release(batch[i]);
+		}
+		batch_count = 0;
+		batch_size = 0;
+	}
+
+	/**
+	 * Sets the maximum number of events sent together in a single datagram, up to
+	 * PUBLISH_EVENT_BATCH_SIZE. Events are sent as they are published when this is 0.
+	 */
+	void set_batch_size(size_t size)
+	{
+		batch_limit = std::min(size, batch.size());
+	}
+
+	size_t deferred_events() const
+	{
+		return deferred_count;
+	}
+
+	size_t batched_events() const
+	{
+		return batch_count;
+	}
+
+private:
+	/**
+	 * An encoded event message that is waiting to be sent.
+	 */
+	struct DeferredEvent
+	{
+		uint8_t* data;
+		uint16_t length;
+		uint8_t flags;
+		bool is_system;
+		CompletionHandler handler;
+	};
+
+	Protocol* protocol;
+	TokenBucket application_events;
+	TokenBucket system_events;
+	std::array<DeferredEvent, PUBLISH_EVENT_QUEUE_SIZE> deferred;
+	size_t deferred_count;
+	std::array<DeferredEvent, PUBLISH_EVENT_BATCH_SIZE> batch;
+	size_t batch_limit;
+	size_t batch_count;
+	size_t batch_size;				// the size of the datagram for the batch
+	system_tick_t batch_started;	// the time the first event was added to the batch
+
+	TokenBucket& bucket(bool is_system_event)
+	{
+		return is_system_event ? system_events : application_events;
+	}
+
+	/**
+	 * Called when an event is rejected because of the rate limit. An application that keeps
+	 * publishing faster than the limit allows stays limited until it slows down.
+	 */
+	void rejected(bool is_system_event, system_tick_t time)
+	{
+		if (!is_system_event)
+		{
+			application_events.restart(time);
+		}
+	}
+
+	bool has_deferred(bool is_system_event) const
+	{
+		for (size_t i = 0; i < deferred_count; i++)
+		{
+			if (deferred[i].is_system == is_system_event)
+				return true;
+		}
+		return false;
+	}
+
+	ProtocolError send(MessageChannel& channel, Message& message, int flags, CompletionHandler& handler)
+	{
 		const ProtocolError result = channel.send(message);
 		if (result == NO_ERROR) {
 			// Register completion handler only if acknowledgement was requested explicitly
@@ -117,12 +352,158 @@ public:
 			} else {
 			    handler.setResult();
 			}
+		} else {
+			handler.setError(toSystemError(result));
 		}
 		return result;
 	}
 
-private:
-	Protocol* protocol;
+	/**
+	 * Copies the encoded event so that it can be sent later.
+	 */
+	bool store(Message& message, bool is_system_event, int flags, CompletionHandler& handler,
+			DeferredEvent& event)
+	{
+		uint8_t* data = new(std::nothrow) uint8_t[message.length()];
+		if (!data) {
+			return false;
+		}
+		memcpy(data, message.buf(), message.length());
+		event.data = data;
+		event.length = message.length();
+		event.flags = flags;
+		event.is_system = is_system_event;
+		event.handler = std::move(handler);
+		return true;
+	}
+
+	void release(DeferredEvent& event)
+	{
+		delete[] event.data;
+		event.data = nullptr;
+	}
+
+	/**
+	 * Sends a stored event. The event is kept if no message could be created for it.
+	 */
+	ProtocolError send_stored(MessageChannel& channel, DeferredEvent& event)
+	{
+		Message message;
+		const ProtocolError error = channel.create(message);
+		if (error) {
+			return error;
+		}
+		memcpy(message.buf(), event.data, event.length);
+		message.set_length(event.length);
+		release(event);
+		return send(channel, message, event.flags, event.handler);
+	}
+
+	/**
+	 * Removes the given number of events, which have been sent, from the front of the batch.
+	 */
+	void remove_batched(size_t count)
+	{
+		if (!count)
+		{
+			return;
+		}
+		batch_size = 0;
+		for (size_t i = count; i < batch_count; i++)
+		{
+			batch[i - count] = std::move(batch[i]);
+			batch[i].data = nullptr;
+			batch_size += batch[i - count].length + PROTOCOL_RECORD_OVERHEAD;
+		}
+		batch_count -= count;
+	}
+
+	void remove_deferred(size_t index)
+	{
+		release(deferred[index]);
+		for (size_t i = index + 1; i < deferred_count; i++)
+		{
+			deferred[i - 1] = std::move(deferred[i]);
+		}
+		deferred_count--;
+	}
+
+	/**
+	 * Returns true if a message of the given length can be added to the batch.
+	 */
+	bool fits_in_batch(size_t length) const
+	{
+		return !batch_count || (batch_count < batch_limit &&
+				batch_size + length + PROTOCOL_RECORD_OVERHEAD <= PROTOCOL_BUFFER_SIZE);
+	}
+
+	/**
+	 * Sends the batch if a message of the given length would not fit in the same datagram.
+	 */
+	ProtocolError make_room_in_batch(MessageChannel& channel, size_t length)
+	{
+		if (!fits_in_batch(length))
+		{
+			return send_batch(channel);
+		}
+		return NO_ERROR;
+	}
+
+	/**
+	 * Adds the last stored event to the batch, and sends the batch when it is full.
+	 */
+	ProtocolError add_to_batch(MessageChannel& channel, system_tick_t time)
+	{
+		if (!batch_count)
+		{
+			batch_started = time;
+		}
+		batch_size += batch[batch_count].length + PROTOCOL_RECORD_OVERHEAD;
+		if (++batch_count >= batch_limit)
+		{
+			return send_batch(channel);
+		}
+		return NO_ERROR;
+	}
+
+	/**
+	 * Sends the events in the batch. The channel sends them in as few datagrams as it can.
+	 */
+	ProtocolError send_batch(MessageChannel& channel)
+	{
+		// if the channel cannot batch messages they are sent one by one
+		channel.command(Channel::BEGIN_BATCH);
+		ProtocolError error = NO_ERROR;
+		size_t sent = 0;
+		while (sent < batch_count)
+		{
+			error = send_stored(channel, batch[sent]);
+			if (batch[sent].data)
+			{
+				// no message buffer, the rest of the batch is sent on a later iteration of the event loop
+				error = NO_ERROR;
+				break;
+			}
+			sent++;
+			if (error)
+			{
+				break;
+			}
+		}
+		if (error)
+		{
+			// the channel failed, the events that were not sent are discarded
+			for (size_t i = sent; i < batch_count; i++)
+			{
+				batch[i].handler.setError(toSystemError(error));
+				release(batch[i]);
+			}
+			sent = batch_count;
+		}
+		remove_batched(sent);
+		const ProtocolError end_error = channel.command(Channel::END_BATCH);
+		return error ? error : end_error;
+	}
 
 	void add_ack_handler(message_id_t msg_id, CompletionHandler handler);
 };
@@ -0,0 +1,201 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "protocol_defs.h"
+#include "events.h"
+
+namespace particle { namespace protocol {
+
+/**
+ * A radix tree of subscription filters. Finds the handlers whose filter is a prefix of an
+ * event name in time proportional to the length of the name, rather than the number of
+ * subscriptions.
+ *
+ * The filters are not copied. Each node refers to a part of the filter of one of the
+ * handlers the tree was built from, so the tree must be rebuilt whenever the handlers change.
+ */
+class SubscriptionIndex
+{
+public:
+	typedef uint8_t index_t;
+
+	static const index_t NONE = 0xFF;
+
+	// the root, plus at most one leaf and one split node for each filter
+	static const size_t MAX_NODES = MAX_SUBSCRIPTIONS * 2 + 1;
+
+	static_assert(MAX_NODES < NONE, "MAX_SUBSCRIPTIONS is too large for the subscription index");
+
+	SubscriptionIndex()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		node_count = 0;
+		add_node(NONE, 0, 0);
+	}
+
+	/**
+	 * Rebuilds the tree from the filters of the given handlers. Handlers without a
+	 * handler function are unused and skipped.
+	 */
+	void build(const FilteringEventHandler* handlers, size_t count)
+	{
+		clear();
+		for (size_t i = 0; i < count; i++)
+		{
+			if (handlers[i].handler)
+				insert(handlers, index_t(i));
+		}
+	}
+
+	/**
+	 * Calls the callback with the index of each handler whose filter is a prefix of the
+	 * given event name.
+	 */
+	template<typename F> void match(const FilteringEventHandler* handlers, const char* name,
+			size_t length, F callback) const
+	{
+		index_t node = 0;
+		size_t pos = 0;
+		for (;;)
+		{
+			for (index_t h = nodes[node].matches; h != NONE; h = next_match[h])
+				callback(h);
+			if (pos == length)
+				break;
+			node = find_child(handlers, node, name[pos]);
+			if (node == NONE)
+				break;
+			const Node& n = nodes[node];
+			if (n.length > length - pos || memcmp(label(handlers, n), name + pos, n.length))
+				break;
+			pos += n.length;
+		}
+	}
+
+private:
+	struct Node
+	{
+		index_t handler;	// the handler whose filter holds the label of this node
+		uint8_t start;		// offset of the label in the filter
+		uint8_t length;		// length of the label
+		index_t child;		// first child node
+		index_t sibling;	// next node with the same parent
+		index_t matches;	// first handler whose filter ends at this node
+	};
+
+	Node nodes[MAX_NODES];
+	index_t next_match[MAX_SUBSCRIPTIONS];
+	index_t node_count;
+
+	static const char* label(const FilteringEventHandler* handlers, const Node& node)
+	{
+		return handlers[node.handler].filter + node.start;
+	}
+
+	index_t add_node(index_t handler, uint8_t start, uint8_t length)
+	{
+		Node& node = nodes[node_count];
+		node.handler = handler;
+		node.start = start;
+		node.length = length;
+		node.child = NONE;
+		node.sibling = NONE;
+		node.matches = NONE;
+		return node_count++;
+	}
+
+	index_t find_child(const FilteringEventHandler* handlers, index_t node, char c) const
+	{
+		index_t child = nodes[node].child;
+		while (child != NONE && label(handlers, nodes[child])[0] != c)
+			child = nodes[child].sibling;
+		return child;
+	}
+
+	/**
+	 * Adds the handler to the end of the handlers matched at the node, so that handlers with
+	 * the same filter are matched in the order they were added.
+	 */
+	void add_match(index_t node, index_t handler)
+	{
+		next_match[handler] = NONE;
+		index_t* p = &nodes[node].matches;
+		while (*p != NONE)
+			p = &next_match[*p];
+		*p = handler;
+	}
+
+	void insert(const FilteringEventHandler* handlers, index_t handler)
+	{
+		const char* filter = handlers[handler].filter;
+		const size_t length = strnlen(filter, sizeof(handlers[handler].filter));
+		index_t node = 0;
+		size_t pos = 0;
+		while (pos < length)
+		{
+			const index_t child = find_child(handlers, node, filter[pos]);
+			if (child == NONE)
+			{
+				const index_t leaf = add_node(handler, pos, length - pos);
+				nodes[leaf].sibling = nodes[node].child;
+				nodes[node].child = leaf;
+				node = leaf;
+				break;
+			}
+			Node& c = nodes[child];
+			const char* l = label(handlers, c);
+			size_t common = 1;
+			while (common < c.length && pos + common < length && l[common] == filter[pos + common])
+				common++;
+			if (common < c.length)
+			{
+				// split the child so that the common part of the label is a node of its own
+				const index_t split = add_node(c.handler, c.start, common);
+				Node& s = nodes[split];
+				s.child = child;
+				s.sibling = c.sibling;
+				index_t* link = &nodes[node].child;
+				while (*link != child)
+					link = &nodes[*link].sibling;
+				*link = split;
+				c.start += common;
+				c.length -= common;
+				c.sibling = NONE;
+				node = split;
+			}
+			else
+			{
+				node = child;
+			}
+			pos += common;
+		}
+		add_match(node, handler);
+	}
+};
+
+}}
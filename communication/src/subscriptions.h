@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include "subscription_index.h"
+
 namespace particle
 {
 namespace protocol
@@ -36,6 +38,35 @@ public:
 
 private:
 	FilteringEventHandler event_handlers[MAX_SUBSCRIPTIONS];
+	SubscriptionIndex index;
+	// handlers matching the event being dispatched, indexed by slot
+	uint32_t* dispatched;
+	bool compact_pending;
+
+	/**
+	 * Moves the handlers to the front of the array, keeping their order.
+	 */
+	void compact()
+	{
+		const int NUM_HANDLERS = sizeof(event_handlers)
+				/ sizeof(FilteringEventHandler);
+		int dest = 0;
+		for (int i = 0; i < NUM_HANDLERS; i++)
+		{
+			if (NULL != event_handlers[i].handler)
+			{
+				if (dest != i)
+				{
+					memcpy(event_handlers + dest, event_handlers + i,
+							sizeof(event_handlers[i]));
+					memset(event_handlers + i, 0,
+							sizeof(event_handlers[i]));
+				}
+				dest++;
+			}
+		}
+		compact_pending = false;
+	}
 
 protected:
 
@@ -60,7 +91,9 @@ protected:
 
 public:
 
-	Subscriptions()
+	Subscriptions() :
+			dispatched(nullptr),
+			compact_pending(false)
 	{
 		memset(&event_handlers, 0, sizeof(event_handlers));
 	}
@@ -150,28 +183,26 @@ public:
 		// null terminate event name string
 		event_name[event_name_length] = 0;
 
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (NULL == event_handlers[i].handler)
-			{
-				break;
-			}
-			const size_t MAX_FILTER_LENGTH = sizeof(event_handlers[i].filter);
-			const size_t filter_length = strnlen(event_handlers[i].filter,
-					MAX_FILTER_LENGTH);
+		// collect the matching handlers first, so that they are called in the order they were added
+		uint32_t matched[(MAX_SUBSCRIPTIONS + 31) / 32] = {};
+		index.match(event_handlers, (const char*) event_name, event_name_length,
+				[&matched](unsigned i) { matched[i / 32] |= 1u << (i % 32); });
 
-			if (event_name_length < filter_length)
-			{
-				// does not match this filter, try the next event handler
-				continue;
-			}
-
-			const int cmp = memcmp(event_handlers[i].filter, event_name,
-					filter_length);
-			if (0 == cmp)
+		// the handlers may subscribe and unsubscribe, so the slots are not compacted until
+		// all the matching handlers have been called
+		dispatched = matched;
+		for (unsigned w = 0; w < sizeof(matched) / sizeof(matched[0]); w++)
+		{
+			// the bits are reread since an earlier handler may have taken a slot
+			while (matched[w])
 			{
+				const unsigned i = w * 32 + __builtin_ctz(matched[w]);
+				matched[w] &= matched[w] - 1;
+				if (NULL == event_handlers[i].handler)
+				{
+					// removed by an earlier handler
+					continue;
+				}
 				// don't call the handler directly, use a callback for it.
 				if (!call_event_handler)
 				{
@@ -195,7 +226,12 @@ public:
 							(const char*) data, NULL);
 				}
 			}
-			// else continue the for loop to try the next handler
+		}
+		dispatched = nullptr;
+		if (compact_pending)
+		{
+			compact();
+			index.build(event_handlers, MAX_SUBSCRIPTIONS);
 		}
 		return NO_ERROR;
 	}
@@ -227,26 +263,20 @@ public:
 		{
 			const int NUM_HANDLERS = sizeof(event_handlers)
 					/ sizeof(FilteringEventHandler);
-			int dest = 0;
 			for (int i = 0; i < NUM_HANDLERS; i++)
 			{
 				if (!strcmp(event_name, event_handlers[i].filter))
 				{
 					memset(&event_handlers[i], 0, sizeof(event_handlers[i]));
 				}
-				else
-				{
-					if (dest != i)
-					{
-						memcpy(event_handlers + dest, event_handlers + i,
-								sizeof(event_handlers[i]));
-						memset(event_handlers + i, 0,
-								sizeof(event_handlers[i]));
-					}
-					dest++;
-				}
 			}
+			// the slots of the event being dispatched must stay where they are
+			if (dispatched)
+				compact_pending = true;
+			else
+				compact();
 		}
+		index.build(event_handlers, MAX_SUBSCRIPTIONS);
 	}
 
 	/**
@@ -306,6 +336,12 @@ public:
 				memcpy(event_handlers[i].device_id, id, id_len);
 				event_handlers[i].device_id[id_len] = 0;
 				event_handlers[i].scope = scope;
+				if (dispatched)
+				{
+					// a new handler doesn't receive the event being dispatched
+					dispatched[i / 32] &= ~(1u << (i % 32));
+				}
+				index.build(event_handlers, MAX_SUBSCRIPTIONS);
 				return NO_ERROR;
 			}
 		}
@@ -254,6 +254,16 @@ bool HAL_Feature_Get(HAL_Feature feature);
  */
 extern void module_user_init_hook(void);
 
+/**
+ * Offset of the state of an interrupted firmware transfer in the system backup memory.
+ * The DTLS session is stored at offset 0.
+ */
+#define HAL_SYSTEM_BACKUP_TRANSFER_OFFSET (1024)
+/**
+ * Maximum size of the firmware transfer state, enough for the bitmap of 2048 chunks.
+ */
+#define HAL_SYSTEM_BACKUP_TRANSFER_SIZE (16 + 256)
+
 int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, void* reserved);
 int HAL_System_Backup_Restore(size_t offset, void* buffer, size_t max_length, size_t* length, void* reserved);
 
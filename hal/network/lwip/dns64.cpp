@@ -16,6 +16,7 @@
  */
 
 #include "dns64.h"
+#include "dns_cache.h"
 
 #include "socket_hal_posix.h"
 
@@ -25,8 +26,6 @@
 #include "lwiplock.h"
 #include "lwip_util.h"
 
-#include "lwip/dns.h"
-
 LOG_SOURCE_CATEGORY("net.dns64")
 
 #ifndef DEBUG_DNS64
@@ -128,9 +127,6 @@ struct Record { // RFC 1035, 4.1.3
 // Maximum size of a UDP message
 const size_t MAX_MESSAGE_SIZE = 512; // RFC 1035, 2.3.4
 
-// Value of the TTL field sent in all response messages
-const uint32_t DEFAULT_TTL = 0; // Do not cache (RFC 1035, 4.1.3)
-
 // Timeout for select() in milliseconds
 const unsigned SOCKET_RECV_TIMEOUT = 1000;
 
@@ -193,7 +189,7 @@ ssize_t writeRecord(char* data, size_t size, const Record& r) {
     Record rr = {};
     rr.type = lwip_htons(r.type);
     rr.cls = lwip_htons(r.cls);
-    rr.ttl = lwip_htons(r.ttl);
+    rr.ttl = lwip_htonl(r.ttl);
     rr.rdlength = lwip_htons(r.rdlength);
     memcpy(data, &rr, sizeof(Record));
     return sizeof(Record);
@@ -279,10 +275,6 @@ int socketToSystemError(int error) {
     return SYSTEM_ERROR_IO; // TODO
 }
 
-int lwipToSystemError(int error) {
-    return SYSTEM_ERROR_NETWORK; // TODO
-}
-
 uint16_t systemToDnsError(int error) {
     switch (error) {
     case SYSTEM_ERROR_NOT_FOUND:
@@ -320,7 +312,6 @@ struct Dns64::Query {
     sockaddr_in6 srcAddr;
     Header h;
     Question q;
-    uint16_t type;
 };
 
 int Dns64::init(if_t iface, const ip6_addr_t& prefix, uint16_t port) {
@@ -410,11 +401,10 @@ int Dns64::processQuery(char* data, size_t size, const sockaddr_in6& srcAddr) {
     int ret = parseQuery(data, size, q.get(), &name);
     if (ret == 0) {
         // Perform a DNS lookup
-        q->type = q->q.qtype; // Try getting an address of the requested type first
-        ip_addr_t addr = {};
-        ret = getHostByName(name, &addr, q.get());
+        DnsCache::Result result = {};
+        ret = getHostByName(name, &result, q.get());
         if (ret == GetHostByNameResult::DONE) {
-            ret = sendResponse(addr, name, *q, ctx_.get());
+            ret = sendResponse(result, name, *q, ctx_.get());
             if (ret < 0) {
                 LOG_DEBUG(ERROR, "Unable to send response: %d", ret);
             }
@@ -466,13 +456,16 @@ int Dns64::parseQuery(char* data, size_t size, Query* q, const char** name) {
     return 0;
 }
 
-int Dns64::sendResponse(const ip_addr_t& addr, const char* name, const Query& q, Context* ctx) {
+int Dns64::sendResponse(const DnsCache::Result& result, const char* name, const Query& q, Context* ctx) {
     ip_addr_t raddr = {}; // Resolved address
-    if (q.q.qtype == Type::AAAA && IP_IS_V4(&addr)) {
-        const auto addr6 = transformAddress(*ip_2_ip4(&addr), ctx->prefix);
+    if (q.q.qtype == Type::AAAA && (result.types & DnsCache::IPV6)) {
+        ip_addr_copy(raddr, result.addr6);
+    } else if (q.q.qtype == Type::AAAA) {
+        // The host has no IPv6 address, synthesize one (RFC 6147, 5.1.7)
+        const auto addr6 = transformAddress(*ip_2_ip4(&result.addr4), ctx->prefix);
         ip_addr_copy_from_ip6(raddr, addr6);
     } else {
-        ip_addr_copy(raddr, addr);
+        ip_addr_copy(raddr, result.addr4);
     }
     const size_t addrSize = IPADDR_SIZE(&raddr); // Size of the serialized IP address
     // Allocate a buffer for response data
@@ -503,7 +496,7 @@ int Dns64::sendResponse(const ip_addr_t& addr, const char* name, const Query& q,
     Record r = {};
     r.type = IP_IS_V6(&raddr) ? Type::AAAA : Type::A;
     r.cls = Class::IN;
-    r.ttl = DEFAULT_TTL;
+    r.ttl = result.ttl / 1000; // The clients may cache the answer for as long as we do
     r.rdlength = addrSize;
     data += CHECK(writeRecord(data, end - data, r));
     if (end - data < (ptrdiff_t)addrSize) {
@@ -546,48 +539,32 @@ int Dns64::sendErrorResponse(int error, const char* name, const Query& q, Contex
     return 0;
 }
 
-int Dns64::getHostByName(const char* name, ip_addr_t* addr, Query* q) {
-    const uint8_t addrType = (q->type == Type::A) ? LWIP_DNS_ADDRTYPE_IPV4 : LWIP_DNS_ADDRTYPE_IPV6;
-    LwipTcpIpCoreLock lock; // LwIP's DNS client API is not thread-safe
-    const auto lwipRet = dns_gethostbyname_addrtype(name, addr, Dns64::dnsCallback, q, addrType);
-    lock.unlock();
-    if (lwipRet == ERR_INPROGRESS) {
+int Dns64::getHostByName(const char* name, DnsCache::Result* result, Query* q) {
+    // For an AAAA query, the IPv4 address is looked up in parallel so that an IPv6 address can
+    // be synthesized if the host doesn't have one
+    const unsigned types = (q->q.qtype == Type::A) ? DnsCache::IPV4 : DnsCache::ANY;
+    const int ret = DnsCache::instance()->lookup(name, types, result, Dns64::dnsCallback, q);
+    if (ret == DnsCache::PENDING) {
         return GetHostByNameResult::PENDING;
-    } else if (lwipRet != ERR_OK) {
-        return lwipToSystemError(lwipRet);
+    } else if (ret < 0) {
+        return ret;
     }
     return GetHostByNameResult::DONE;
 }
 
-void Dns64::dnsCallback(const char* name, const ip_addr_t* addr, void* data) {
-    DEBUG("dns_found_callback: name: %s, address: %s", name ? name : "NULL", addr ? IPADDR_NTOA(addr) : "NULL");
+void Dns64::dnsCallback(int error, const char* name, const DnsCache::Result& result, void* data) {
+    DEBUG("DNS lookup completed: name: %s, result: %d", name, error);
     std::unique_ptr<Query> q(static_cast<Query*>(data));
-    if (!name) {
-        return;
-    }
     const auto ctx = q->ctx.lock();
     if (!ctx) {
         return;
     }
-    int ret = 0;
-    if (addr) {
-        ret = sendResponse(*addr, name, *q, ctx.get());
-    } else if (q->type == Type::AAAA) {
-        q->type = Type::A; // Try getting an IPv4 address
-        ip_addr_t addr = {};
-        ret = getHostByName(name, &addr, q.get());
-        if (ret == GetHostByNameResult::DONE) {
-            ret = sendResponse(addr, name, *q, ctx.get());
-            if (ret < 0) {
-                LOG_DEBUG(ERROR, "Unable to send response: %d", ret);
-            }
-        } else if (ret == GetHostByNameResult::PENDING) {
-            q.release(); // The query is being processed asynchronously
-        } else {
-            LOG_DEBUG(ERROR, "Unable to resolve hostname: %d", ret);
+    int ret = error;
+    if (ret == 0) {
+        ret = sendResponse(result, name, *q, ctx.get());
+        if (ret < 0) {
+            LOG_DEBUG(ERROR, "Unable to send response: %d", ret);
         }
-    } else {
-        ret = SYSTEM_ERROR_NOT_FOUND;
     }
     if (ret < 0) {
         ret = sendErrorResponse(ret, name, *q, ctx.get());
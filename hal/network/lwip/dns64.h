@@ -18,6 +18,7 @@
 #pragma once
 
 #include "ifapi.h"
+#include "dns_cache.h"
 
 #include "runnable.h"
 
@@ -56,12 +57,12 @@ private:
     int processQuery(char* data, size_t size, const sockaddr_in6& srcAddr);
     static int parseQuery(char* data, size_t size, Query* q, const char** name);
 
-    static int sendResponse(const ip_addr_t& addr, const char* name, const Query& q, Context* ctx);
+    static int sendResponse(const DnsCache::Result& result, const char* name, const Query& q, Context* ctx);
     static int sendErrorResponse(int error, const char* name, const Query& q, Context* ctx);
 
-    static int getHostByName(const char* name, ip_addr_t* addr, Query* q);
+    static int getHostByName(const char* name, DnsCache::Result* result, Query* q);
 
-    static void dnsCallback(const char* name, const ip_addr_t* addr, void* data);
+    static void dnsCallback(int error, const char* name, const DnsCache::Result& result, void* data);
 };
 
 inline Dns64::~Dns64() {
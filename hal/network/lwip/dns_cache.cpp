@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_cache.h"
+
+#include "timer_hal.h"
+#include "concurrent_hal.h"
+#include "system_error.h"
+#include "logging.h"
+#include "c_string.h"
+
+#include "lwiplock.h"
+
+#include "lwip/dns.h"
+
+#include <algorithm>
+#include <new>
+#include <strings.h>
+
+LOG_SOURCE_CATEGORY("net.dnscache")
+
+namespace particle {
+
+namespace net {
+
+namespace {
+
+const unsigned ADDRESS_TYPES[] = { DnsCache::IPV4, DnsCache::IPV6 };
+
+// Index of the address of the given type in a cache entry
+inline unsigned typeIndex(unsigned type) {
+    return (type == DnsCache::IPV4) ? 0 : 1;
+}
+
+inline bool isExpired(system_tick_t expires, system_tick_t now) {
+    return (int32_t)(expires - now) <= 0;
+}
+
+// lwIP reports a negative answer from the server and a query that timed out in the same way.
+// Before giving up on a server, lwIP waits for 1, 1, 2, ..., DNS_MAX_RETRIES - 1 intervals of its
+// timer, the first of which may be cut short, so a query that fails sooner was answered
+const system_tick_t MIN_QUERY_TIMEOUT = DNS_MAX_RETRIES * (DNS_MAX_RETRIES - 1) / 2 * DNS_TMR_INTERVAL;
+
+struct BlockingLookup {
+    os_semaphore_t sem;
+    DnsCache::Result* result;
+    int error;
+};
+
+} // particle::net::
+
+const system_tick_t DnsCache::POSITIVE_TTL;
+const system_tick_t DnsCache::NEGATIVE_TTL;
+const size_t DnsCache::MAX_ENTRIES;
+
+struct DnsCache::Waiter {
+    Waiter* next;
+    unsigned types;
+    unsigned preferred;
+    Callback callback;
+    void* data;
+};
+
+struct DnsCache::Entry {
+    Entry* next;
+    CString name;
+    ip_addr_t addr[2];
+    system_tick_t expires[2];
+    system_tick_t queried[2]; // Times at which the pending queries were issued
+    unsigned found; // Types for which an address has been found
+    unsigned known; // Types for which a result is available
+    unsigned pending; // Types being queried
+    unsigned stale; // Pending types whose results must not be cached
+    Waiter* waiters;
+
+    explicit Entry(const char* name) :
+            next(nullptr),
+            name(name),
+            addr(),
+            expires(),
+            queried(),
+            found(0),
+            known(0),
+            pending(0),
+            stale(0),
+            waiters(nullptr) {
+    }
+
+    bool isDone(unsigned types, unsigned preferred) const {
+        return (known & types) == types || (found & preferred);
+    }
+
+    unsigned waiterTypes() const {
+        unsigned types = 0;
+        for (auto w = waiters; w; w = w->next) {
+            types |= w->types;
+        }
+        return types;
+    }
+};
+
+int DnsCache::lookup(const char* name, unsigned types, Result* result, Callback callback, void* data, unsigned preferred) {
+    types &= ANY;
+    preferred &= types;
+    if (!name || !*name || !types || !result) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const LwipTcpIpCoreLock lock; // LwIP's DNS client API is not thread-safe
+    auto entry = find(name);
+    if (!entry) {
+        entry = create(name);
+        if (!entry) {
+            return SYSTEM_ERROR_NO_MEMORY;
+        }
+    }
+    // Drop the expired results
+    const auto now = HAL_Timer_Get_Milli_Seconds();
+    for (const auto type: ADDRESS_TYPES) {
+        if ((entry->known & type) && isExpired(entry->expires[typeIndex(type)], now)) {
+            entry->known &= ~type;
+            entry->found &= ~type;
+        }
+    }
+    // Query the addresses that are not known and are not being queried already, including the ones
+    // other lookups of this host are waiting for
+    const unsigned missing = (types | entry->waiterTypes()) & ~entry->known & ~entry->pending;
+    for (const auto type: ADDRESS_TYPES) {
+        if (missing & type) {
+            query(entry, type);
+        }
+    }
+    if (entry->isDone(types, preferred)) {
+        getResult(entry, types, now, result);
+        return resultError(*result);
+    }
+    if (!callback) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const auto w = new(std::nothrow) Waiter();
+    if (!w) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    w->types = types;
+    w->preferred = preferred;
+    w->callback = callback;
+    w->data = data;
+    w->next = entry->waiters;
+    entry->waiters = w;
+    return PENDING;
+}
+
+int DnsCache::lookup(const char* name, unsigned types, Result* result, unsigned preferred) {
+    BlockingLookup ctx = {};
+    ctx.result = result;
+    if (os_semaphore_create(&ctx.sem, 1, 0) != 0) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    int ret = lookup(name, types, result, [](int error, const char* name, const Result& result, void* data) {
+        const auto ctx = static_cast<BlockingLookup*>(data);
+        *ctx->result = result;
+        ctx->error = error;
+        os_semaphore_give(ctx->sem, false);
+    }, &ctx, preferred);
+    if (ret == PENDING) {
+        os_semaphore_take(ctx.sem, CONCURRENT_WAIT_FOREVER, false);
+        ret = ctx.error;
+    }
+    os_semaphore_destroy(ctx.sem);
+    return ret;
+}
+
+void DnsCache::clear() {
+    const LwipTcpIpCoreLock lock;
+    const auto now = HAL_Timer_Get_Milli_Seconds();
+    for (auto entry = entries_; entry;) {
+        const auto next = entry->next;
+        if (entry->pending || entry->waiters) {
+            // The entry is still in use. Keep the results for the lookups in progress but don't
+            // use them for new lookups, nor cache the results of the queries sent to the old servers
+            for (auto& expires: entry->expires) {
+                expires = now;
+            }
+            entry->stale = entry->pending;
+        } else {
+            remove(entry);
+        }
+        entry = next;
+    }
+}
+
+DnsCache* DnsCache::instance() {
+    static DnsCache cache;
+    return &cache;
+}
+
+DnsCache::Entry* DnsCache::find(const char* name) const {
+    for (auto entry = entries_; entry; entry = entry->next) {
+        if (strcasecmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+DnsCache::Entry* DnsCache::create(const char* name) {
+    if (count_ >= MAX_ENTRIES) {
+        // Evict the oldest entry that is not in use
+        Entry* oldest = nullptr;
+        for (auto entry = entries_; entry; entry = entry->next) {
+            if (!entry->pending && !entry->waiters) {
+                oldest = entry;
+            }
+        }
+        if (oldest) {
+            remove(oldest);
+        }
+    }
+    const auto entry = new(std::nothrow) Entry(name);
+    if (!entry || !entry->name) {
+        delete entry;
+        return nullptr;
+    }
+    entry->next = entries_;
+    entries_ = entry;
+    ++count_;
+    return entry;
+}
+
+int DnsCache::query(Entry* entry, unsigned type) {
+    ip_addr_t addr = {};
+    entry->pending |= type;
+    entry->queried[typeIndex(type)] = HAL_Timer_Get_Milli_Seconds();
+    const auto lwipRet = (type == IPV4) ?
+            dns_gethostbyname_addrtype(entry->name, &addr, dnsCallback4, entry, LWIP_DNS_ADDRTYPE_IPV4) :
+            dns_gethostbyname_addrtype(entry->name, &addr, dnsCallback6, entry, LWIP_DNS_ADDRTYPE_IPV6);
+    if (lwipRet == ERR_INPROGRESS) {
+        return PENDING;
+    }
+    if (lwipRet == ERR_OK) {
+        // The address was in lwIP's table
+        complete(entry, type, &addr, POSITIVE_TTL);
+    } else {
+        // Not an answer from the server, so the failure is only reported to the current lookups
+        LOG_DEBUG(ERROR, "Unable to resolve hostname: %d", (int)lwipRet);
+        complete(entry, type, nullptr, 0);
+    }
+    return DONE;
+}
+
+void DnsCache::queryDone(Entry* entry, unsigned type, const ip_addr_t* addr) {
+    system_tick_t ttl = POSITIVE_TTL;
+    if (!addr) {
+        // Don't cache a query that timed out
+        const system_tick_t elapsed = HAL_Timer_Get_Milli_Seconds() - entry->queried[typeIndex(type)];
+        ttl = (elapsed < MIN_QUERY_TIMEOUT) ? NEGATIVE_TTL : 0;
+    }
+    complete(entry, type, addr, ttl);
+}
+
+void DnsCache::complete(Entry* entry, unsigned type, const ip_addr_t* addr, system_tick_t ttl) {
+    const auto i = typeIndex(type);
+    if (entry->stale & type) {
+        entry->stale &= ~type;
+        ttl = 0;
+    }
+    entry->pending &= ~type;
+    entry->known |= type;
+    if (addr) {
+        entry->found |= type;
+        ip_addr_copy(entry->addr[i], *addr);
+    } else {
+        entry->found &= ~type;
+    }
+    entry->expires[i] = HAL_Timer_Get_Milli_Seconds() + ttl;
+    notify(entry);
+}
+
+void DnsCache::notify(Entry* entry) {
+    const auto now = HAL_Timer_Get_Milli_Seconds();
+    for (Waiter** w = &entry->waiters; *w;) {
+        const auto waiter = *w;
+        if (!entry->isDone(waiter->types, waiter->preferred)) {
+            w = &waiter->next;
+            continue;
+        }
+        *w = waiter->next;
+        Result result = {};
+        getResult(entry, waiter->types, now, &result);
+        waiter->callback(resultError(result), entry->name, result, waiter->data);
+        delete waiter;
+    }
+}
+
+void DnsCache::remove(Entry* entry) {
+    for (Entry** e = &entries_; *e; e = &(*e)->next) {
+        if (*e == entry) {
+            *e = entry->next;
+            delete entry;
+            --count_;
+            break;
+        }
+    }
+}
+
+void DnsCache::getResult(const Entry* entry, unsigned types, system_tick_t now, Result* result) {
+    *result = Result();
+    result->types = entry->found & types;
+    result->ttl = POSITIVE_TTL;
+    for (const auto type: ADDRESS_TYPES) {
+        // A lookup completed by a preferred type doesn't wait for the other ones
+        if (!(types & entry->known & type)) {
+            continue;
+        }
+        const auto i = typeIndex(type);
+        const int32_t ttl = entry->expires[i] - now;
+        result->ttl = std::min<system_tick_t>(result->ttl, std::max<int32_t>(ttl, 0));
+        if (entry->found & type) {
+            ip_addr_copy((type == IPV4) ? result->addr4 : result->addr6, entry->addr[i]);
+        }
+    }
+}
+
+int DnsCache::resultError(const Result& result) {
+    if (!result.types) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    return DONE;
+}
+
+void DnsCache::dnsCallback4(const char* name, const ip_addr_t* addr, void* data) {
+    instance()->queryDone(static_cast<Entry*>(data), IPV4, addr);
+}
+
+void DnsCache::dnsCallback6(const char* name, const ip_addr_t* addr, void* data) {
+    instance()->queryDone(static_cast<Entry*>(data), IPV6, addr);
+}
+
+} // particle::net
+
+} // particle
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "system_tick_hal.h"
+
+#include "lwip/ip_addr.h"
+
+#include <cstddef>
+
+namespace particle {
+
+namespace net {
+
+/**
+ * Resolver cache shared by netdb_getaddrinfo() and the DNS64 service.
+ *
+ * The A and AAAA records of a host are queried in parallel via the lwIP DNS client, and
+ * concurrent lookups of the same host share the queries in flight. Negative answers are cached
+ * as well, so that repeated connection attempts don't resolve the same name over and over.
+ *
+ * lwIP's DNS client keeps the answers for the TTL received from the upstream server, but doesn't
+ * expose it. The entries of this cache are therefore kept for a short fixed time, after which
+ * the lookup goes through lwIP again and is answered from its table while the upstream TTL
+ * hasn't expired.
+ */
+class DnsCache {
+public:
+    enum AddressType {
+        IPV4 = 0x01,
+        IPV6 = 0x02,
+        ANY = IPV4 | IPV6
+    };
+
+    enum LookupResult {
+        DONE = 0,
+        PENDING = 1
+    };
+
+    // Time for which a resolved address is cached, in milliseconds
+    static const system_tick_t POSITIVE_TTL = 30000;
+    // Time for which a negative answer from the server is cached, in milliseconds
+    static const system_tick_t NEGATIVE_TTL = 10000;
+    // Maximum number of cached hosts
+    static const size_t MAX_ENTRIES = 8;
+
+    struct Result {
+        ip_addr_t addr4;
+        ip_addr_t addr6;
+        unsigned types; // Types of the addresses that have been found
+        system_tick_t ttl; // Time for which the result remains valid, in milliseconds
+    };
+
+    typedef void (*Callback)(int error, const char* name, const Result& result, void* data);
+
+    /**
+     * Looks up the addresses of the given types.
+     *
+     * Returns `DONE` if the result is available immediately, in which case the callback is not
+     * called, `PENDING` if the callback will be called from the lwIP thread when the queries
+     * complete, or a negative result code. `SYSTEM_ERROR_NOT_FOUND` is reported if none of the
+     * requested types could be resolved.
+     *
+     * The lookup completes as soon as an address of one of the `preferred` types is found, without
+     * waiting for the other queries. These keep running and their results are cached.
+     */
+    int lookup(const char* name, unsigned types, Result* result, Callback callback, void* data, unsigned preferred = 0);
+
+    /**
+     * Looks up the addresses of the given types, blocking until the queries complete.
+     *
+     * Must not be called from the lwIP thread.
+     */
+    int lookup(const char* name, unsigned types, Result* result, unsigned preferred = 0);
+
+    /**
+     * Drops all cached results, e.g. when the DNS server configuration changes.
+     */
+    void clear();
+
+    static DnsCache* instance();
+
+private:
+    struct Entry;
+    struct Waiter;
+
+    Entry* entries_ = nullptr;
+    size_t count_ = 0;
+
+    DnsCache() = default;
+
+    Entry* find(const char* name) const;
+    Entry* create(const char* name);
+    int query(Entry* entry, unsigned type);
+    void queryDone(Entry* entry, unsigned type, const ip_addr_t* addr);
+    void complete(Entry* entry, unsigned type, const ip_addr_t* addr, system_tick_t ttl);
+    void notify(Entry* entry);
+    void remove(Entry* entry);
+
+    static void getResult(const Entry* entry, unsigned types, system_tick_t now, Result* result);
+    static int resultError(const Result& result);
+
+    static void dnsCallback4(const char* name, const ip_addr_t* addr, void* data);
+    static void dnsCallback6(const char* name, const ip_addr_t* addr, void* data);
+};
+
+} // particle::net
+
+} // particle
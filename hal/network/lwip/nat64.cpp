@@ -68,14 +68,31 @@ uint16_t nextBoundId(uint16_t id, uint16_t min, uint16_t max) {
     return id;
 }
 
+bool canTranslateInPlace(pbuf* p, uint16_t ipHeaderLen) {
+    /* The packet is rewritten in place if nothing else references it and there is room in
+     * front of the transport header for the translated IP header and the link headers.
+     *
+     * This is safe even if the translated packet can't be sent right away: while the address
+     * of the next hop is being resolved, etharp_query() and nd6_queue_packet() only take a
+     * reference to a PBUF_RAM or PBUF_POOL packet instead of copying it. With a reference
+     * count of 1 here, the queue is the only other owner of the pbuf once it's been output,
+     * so the input hooks must not move its payload back to the original IP header (which
+     * has been overwritten by the translated one anyway). The caller only releases its own
+     * reference to the packet, and the queue keeps it alive until it's sent or dropped */
+    const uint16_t hlen = ipHeaderLen + PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN;
+    if (p->ref != 1 || pbuf_add_header(p, hlen)) {
+        return false;
+    }
+    pbuf_remove_header(p, hlen);
+    return true;
+}
+
 /* UDP_MIN: 2 minutes (as defined in [RFC4787]) */
 #if PLATFORM_ID != PLATFORM_BORON && PLATFORM_ID != PLATFORM_BSOM && PLATFORM_ID != PLATFORM_B5SOM
 const uint32_t DEFAULT_UDP_NAT_LIFETIME = 120 * 1000;
 #else
 const uint32_t DEFAULT_UDP_NAT_LIFETIME = HAL_PLATFORM_CELLULAR_CLOUD_KEEPALIVE_INTERVAL + 60 * 1000;
 #endif // PLATFORM_ID == PLATFORM_BORON && PLATFORM_ID != PLATFORM_BSOM && PLATFORM_ID != PLATFORM_B5SOM
-const uint16_t DEFAULT_UDP_NAT_MIN_PORT = 40000;
-const uint16_t DEFAULT_UDP_NAT_MAX_PORT = 49000;
 
 /* ICMP_DEFAULT: 60 seconds (as defined in [RFC5508]) */
 const uint32_t DEFAULT_ICMP_NAT_LIFETIME = 60 * 1000;
@@ -95,7 +112,7 @@ Nat64::Nat64() {
     IP6_ADDR(&pref64_, PP_HTONL(0x64ff9b), 0, 0, 0);
     unsigned int rVal;
     particle::Random::genSecure((char*)&rVal, sizeof(rVal));
-    udpNextPort_ = rVal % (DEFAULT_UDP_NAT_MAX_PORT - DEFAULT_UDP_NAT_MIN_PORT) + DEFAULT_UDP_NAT_MIN_PORT;
+    udpNextPort_ = rVal % (NAT64_UDP_MAX_PORT - NAT64_UDP_MIN_PORT) + NAT64_UDP_MIN_PORT;
 }
 
 Nat64::~Nat64() {
@@ -153,8 +170,12 @@ int Nat64::ip4Input(pbuf* p, ip_hdr* header, netif* in) {
     if (proto != L4_PROTO_NONE) {
         const uint16_t hlen = IPH_HL_BYTES(header);
         pbuf_remove_header(p, hlen);
-        r = natInput(ip_current_src_addr(), ip_current_dest_addr(), proto, p, in, header);
-        pbuf_add_header_force(p, hlen);
+        bool inPlace = false;
+        r = natInput(ip_current_src_addr(), ip_current_dest_addr(), proto, p, in, header, &inPlace);
+        /* See canTranslateInPlace() */
+        if (!inPlace) {
+            pbuf_add_header_force(p, hlen);
+        }
     }
 
     return r;
@@ -166,6 +187,7 @@ int Nat64::ip6Input(pbuf* p, ip6_hdr* header, netif* in) {
 
     uint16_t headerLen = IP6_HLEN;
     L4Protocol proto;
+    bool inPlace = false;
 
     /* Skip the fixed header */
     pbuf_remove_header(p, IP6_HLEN);
@@ -218,15 +240,19 @@ int Nat64::ip6Input(pbuf* p, ip6_hdr* header, netif* in) {
 
     proto = ipProtoToL4Protocol(*nexth);
     if (proto != L4_PROTO_NONE) {
-        r = natInput(ip_current_src_addr(), ip_current_dest_addr(), proto, p, in, header);
+        r = natInput(ip_current_src_addr(), ip_current_dest_addr(), proto, p, in, header, &inPlace);
     }
 
 cleanup:
-    pbuf_add_header_force(p, headerLen);
+    /* The payload of a packet translated in place points to the headers of the translated
+     * packet, which may still be queued for output, see canTranslateInPlace() */
+    if (!inPlace) {
+        pbuf_add_header_force(p, headerLen);
+    }
     return r;
 }
 
-int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto, pbuf* p, netif* in, void* ipheader) {
+int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto, pbuf* p, netif* in, void* ipheader, bool* inPlace) {
     IpTransportAddress srcAddr;
     IpTransportAddress dstAddr;
     srcAddr.setAddress(*src);
@@ -271,13 +297,13 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
                   IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
                   IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
         /* Lookup session */
-        session = bib->lookupSession(srcAddr, dstAddr);
+        session = sessionTable_.lookup(bib, srcAddr, dstAddr);
 
         /* FIXME: flag to enable full-cone NAT */
         if (!session && dstAddr.isV6()) {
             /* Attempt to create a new session */
             LOG_DEBUG(TRACE, "No matching session found, trying to create one");
-            session = bib->addSession(dstAddr, protoLifetime, *pool_);
+            session = sessionTable_.add(bib, dstAddr, protoLifetime, *pool_);
         } else if (!session && dstAddr.isV4()) {
             LOG_DEBUG(WARN, "Not creating a new session, full-cone NAT is not enabled");
         }
@@ -300,13 +326,35 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
         return 0;
     }
 
-    /* Copy UDP packet */
-    pbuf* q = pbuf_clone(PBUF_IP, PBUF_RAM, p);
-    if (!q) {
-        LOG_DEBUG(ERROR, "Failed to duplicate pkt for translation");
+    /* The fields of the original IP header are read before translating, as the translated
+     * header may overwrite it */
+    uint8_t hl = 0;
+    uint8_t tos = 0;
+    if (srcAddr.isV6()) {
+        ip6_hdr* ip6hdr = (ip6_hdr*)ipheader;
+        hl = IP6H_HOPLIM(ip6hdr) - 1;
+        tos = IP6H_TC(ip6hdr);
+    } else {
+        ip_hdr* ip4hdr = (ip_hdr*)ipheader;
+        hl = IPH_TTL(ip4hdr) - 1;
+        tos = IPH_TOS(ip4hdr);
+    }
+    if (hl == 0) {
         /* Consume */
         return 1;
     }
+
+    /* Copy UDP packet, unless it can be translated in place */
+    pbuf* q = p;
+    *inPlace = canTranslateInPlace(p, srcAddr.isV6() ? IP_HLEN : IP6_HLEN);
+    if (!*inPlace) {
+        q = pbuf_clone(PBUF_IP, PBUF_RAM, p);
+        if (!q) {
+            LOG_DEBUG(ERROR, "Failed to duplicate pkt for translation");
+            /* Consume */
+            return 1;
+        }
+    }
     if (srcAddr.isV6()) {
         /* IPv6 -> IPv4 */
         if (proto == L4_PROTO_UDP) {
@@ -319,17 +367,10 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
 #endif /* CHECKSUM_GEN_UDP */
         }
 
-        ip6_hdr* ip6hdr = (ip6_hdr*)ipheader;
-        uint8_t hl = IP6H_HOPLIM(ip6hdr) - 1;
-        if (hl == 0) {
-            pbuf_free(q);
-            /* Consume */
-            return 1;
-        }
         LOG_DEBUG(TRACE, "Translated IPv4 pkt out");
         ip4_output(q, &session->src4().address(),
                    &session->dst4().address(),
-                   hl, IP6H_TC(ip6hdr), proto);
+                   hl, tos, proto);
     } else {
         /* IPv4 -> IPv6 */
         if (proto == L4_PROTO_UDP) {
@@ -342,14 +383,6 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
 #endif /* CHECKSUM_GEN_UDP */
         }
 
-        ip_hdr* ip4hdr = (ip_hdr*)ipheader;
-        uint8_t hl = IPH_TTL(ip4hdr) - 1;
-        if (hl == 0) {
-            pbuf_free(q);
-            /* Consume */
-            return 1;
-        }
-
         LOG_DEBUG(TRACE, "Translated IPv6 pkt out");
         /* FIXME: zones should be cleared before being stored in the session
          * Removing zones here for now immediately before sending.
@@ -362,16 +395,18 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
         /* Just in case */
         auto outif = ip6_route(&src, &dst);
         if (outif != in) {
-            ip6_output(q, &src, &dst, hl, IPH_TOS(ip4hdr), proto);
+            ip6_output(q, &src, &dst, hl, tos, proto);
         } else {
             LOG_DEBUG(WARN, "Not outputting translated packet on the same interface it was received");
             if (rule_->inside()) {
-                ip6_output_if_src(q, &src, &dst, hl, IPH_TOS(ip4hdr), proto, rule_->inside());
+                ip6_output_if_src(q, &src, &dst, hl, tos, proto, rule_->inside());
             }
 
         }
     }
-    pbuf_free(q);
+    if (q != p) {
+        pbuf_free(q);
+    }
 
     /* Packet handled by NAT64 */
     /* Consume */
@@ -413,13 +448,7 @@ bool Nat64::filter(const IpTransportAddress& src, const IpTransportAddress& dst,
 
 BibEntry* Nat64::lookupBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto) {
     BibTable& tbl = proto == L4_PROTO_UDP ? udpBibTable_ : icmpBibTable_;
-    const IpTransportAddress& addr = src.isV6() ? src : dst;
-    for (auto entry = tbl.front(); entry != nullptr; entry = entry->next) {
-        if (entry->matches(addr)) {
-            return entry;
-        }
-    }
-    return nullptr;
+    return tbl.lookup(src.isV6() ? src : dst);
 }
 
 BibEntry* Nat64::addBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto) {
@@ -448,7 +477,10 @@ BibEntry* Nat64::addBib(const IpTransportAddress& src, const IpTransportAddress&
                         BibEntry* bib = static_cast<BibEntry*>(pool_->alloc(NAT64_ENTRY_SIZE));
                         if (bib) {
                             new (bib) BibEntry(src, src4);
-                            tbl.pushFront(bib);
+                            tbl.add(bib);
+                            if (proto == L4_PROTO_UDP) {
+                                udpPorts_.set(src4.port(), true);
+                            }
                             return bib;
                         }
                     }
@@ -474,18 +506,14 @@ bool Nat64::findNextL4Id(Ip4TransportAddress& src, L4Protocol proto) {
 }
 
 bool Nat64::findNextUdpPort(Ip4TransportAddress& src) {
-    uint16_t port = udpNextPort_;
-    do {
-        src.setPort(port);
-        if (!lookupBib(src, src, L4_PROTO_UDP)) {
-            udpNextPort_ = nextBoundId(port, DEFAULT_UDP_NAT_MIN_PORT, DEFAULT_UDP_NAT_MAX_PORT);
-            return true;
-        }
-
-        port = nextBoundId(port, DEFAULT_UDP_NAT_MIN_PORT, DEFAULT_UDP_NAT_MAX_PORT);
-    } while(port != udpNextPort_);
+    const int port = udpPorts_.findFree(udpNextPort_);
+    if (port < 0) {
+        return false;
+    }
 
-    return false;
+    src.setPort(port);
+    udpNextPort_ = nextBoundId(port, NAT64_UDP_MIN_PORT, NAT64_UDP_MAX_PORT);
+    return true;
 }
 
 bool Nat64::findNextIcmpId(Ip4TransportAddress& src) {
@@ -504,35 +532,22 @@ bool Nat64::findNextIcmpId(Ip4TransportAddress& src) {
 }
 
 void Nat64::timeout(uint32_t dt) {
-    for (auto bib = udpBibTable_.front(), p = static_cast<BibEntry*>(nullptr); bib != nullptr;) {
-        if (bib->timeout(dt, *pool_)) {
-            LOG_DEBUG(TRACE, "UDP BIB %s#%u <-> %s#%u timed out",
-                      IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
-                      IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
-
-            auto popped = udpBibTable_.pop(bib, p);
-            bib = popped->next;
-            pool_->free(popped);
-        } else {
-            p = bib;
-            bib = bib->next;
-        }
-    }
+    sessionTable_.timeout(dt, *pool_);
 
-    for (auto bib = icmpBibTable_.front(), p = static_cast<BibEntry*>(nullptr); bib != nullptr;) {
-        if (bib->timeout(dt, *pool_)) {
-            LOG_DEBUG(TRACE, "ICMP BIB %s#%u <-> %s#%u timed out",
-                      IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
-                      IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
+    udpBibTable_.removeEmpty([this](BibEntry* bib) {
+        LOG_DEBUG(TRACE, "UDP BIB %s#%u <-> %s#%u timed out",
+                  IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
+                  IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
+        udpPorts_.set(bib->dst4().port(), false);
+        pool_->free(bib);
+    });
 
-            auto popped = udpBibTable_.pop(bib, p);
-            bib = popped->next;
-            pool_->free(popped);
-        } else {
-            p = bib;
-            bib = bib->next;
-        }
-    }
+    icmpBibTable_.removeEmpty([this](BibEntry* bib) {
+        LOG_DEBUG(TRACE, "ICMP BIB %s#%u <-> %s#%u timed out",
+                  IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
+                  IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
+        pool_->free(bib);
+    });
 }
 
 void Nat64::enableSessionTimer() {
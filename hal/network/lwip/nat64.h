@@ -143,10 +143,15 @@ class BibEntry;
 class SessionEntry;
 class RuleEntry;
 
-using BibTable = particle::IntrusiveList<BibEntry>;
-using SessionTable = particle::IntrusiveList<SessionEntry>;
 using RuleTable = particle::IntrusiveList<RuleEntry>;
 
+/* Number of buckets in the hash indexes of the BIB and session tables */
+static const size_t NAT64_HASH_SIZE = 32;
+
+/* Range of the UDP ports allocated for the BIB entries */
+static const uint16_t NAT64_UDP_MIN_PORT = 40000;
+static const uint16_t NAT64_UDP_MAX_PORT = 49000;
+
 template <typename DerivedT>
 class ListNode {
 public:
@@ -163,16 +168,17 @@ public:
     bool matches(const IpTransportAddress& addr) const;
     bool empty() const;
 
-    SessionEntry* lookupSession(const IpTransportAddress& src, const IpTransportAddress& dst);
-    SessionEntry* addSession(const Ip6TransportAddress& dst, uint32_t lifetime, particle::SimpleAllocator& allocator);
+    void sessionAdded();
+    void sessionRemoved();
 
-    bool timeout(uint32_t dt, particle::SimpleAllocator& allocator);
+    /* ListNode::next links the entries of a bucket of the IPv6 index, this one of the IPv4 index */
+    BibEntry* next4;
 
 private:
     Ip6TransportAddress src6_;
     Ip4TransportAddress dst4_;
 
-    SessionTable sessions_;
+    uint16_t sessions_;
 };
 
 class SessionEntry : public ListNode<SessionEntry> {
@@ -200,6 +206,63 @@ private:
     uint32_t lifetime_;
 };
 
+/* BIB entries indexed both by the IPv6 transport address of the inside host and by the IPv4
+ * transport address it is translated to */
+class BibTable {
+public:
+    BibTable();
+
+    BibEntry* lookup(const IpTransportAddress& addr) const;
+    void add(BibEntry* bib);
+
+    /* Unlinks the entries without sessions and passes each of them to the callback */
+    template <typename FuncT>
+    void removeEmpty(FuncT removed);
+
+private:
+    BibEntry* v6_[NAT64_HASH_SIZE];
+    BibEntry* v4_[NAT64_HASH_SIZE];
+
+    static size_t bucket(const ip6_addr_t& addr, uint16_t l4Id);
+    static size_t bucket(const ip4_addr_t& addr, uint16_t l4Id);
+};
+
+/* Sessions of all the BIB entries, indexed by the BIB entry and the transport address of the
+ * outside host */
+class SessionTable {
+public:
+    SessionTable() = default;
+
+    SessionEntry* lookup(BibEntry* bib, const IpTransportAddress& src, const IpTransportAddress& dst) const;
+    SessionEntry* add(BibEntry* bib, const Ip6TransportAddress& dst, uint32_t lifetime, particle::SimpleAllocator& allocator);
+
+    void timeout(uint32_t dt, particle::SimpleAllocator& allocator);
+
+private:
+    particle::IntrusiveList<SessionEntry> buckets_[NAT64_HASH_SIZE];
+
+    static size_t bucket(const BibEntry* bib, uint32_t addr, uint16_t l4Id);
+};
+
+/* Tracks which IDs of a range are in use, so that a free one is found without looking up
+ * the BIB for every candidate */
+template <uint16_t MinId, uint16_t MaxId>
+class L4IdBitmap {
+public:
+    L4IdBitmap();
+
+    /* Returns the first free ID starting from the given one and wrapping around the range,
+     * or -1 if all of them are in use */
+    int findFree(uint16_t from) const;
+    void set(uint16_t id, bool used);
+
+private:
+    static const size_t SIZE = MaxId - MinId + 1;
+    static const size_t WORDS = (SIZE + 31) / 32;
+
+    uint32_t bits_[WORDS];
+};
+
 static const size_t NAT64_ENTRY_SIZE = std::max(sizeof(BibEntry), sizeof(SessionEntry));
 
 class Nat64 {
@@ -217,7 +280,7 @@ public:
     int ip6Input(pbuf* p, ip6_hdr* header, netif* in);
 
 protected:
-    int natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto, pbuf* p, netif* in, void* ipheader);
+    int natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto, pbuf* p, netif* in, void* ipheader, bool* inPlace);
     bool filter(const IpTransportAddress& src, const IpTransportAddress& dst, netif* in) const;
 
     BibEntry* lookupBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto);
@@ -244,9 +307,11 @@ private:
     ip6_addr_t pref64_;
 
     BibTable udpBibTable_;
+    L4IdBitmap<NAT64_UDP_MIN_PORT, NAT64_UDP_MAX_PORT> udpPorts_;
     uint16_t udpNextPort_;
     BibTable icmpBibTable_;
     uint16_t icmpNextId_;
+    SessionTable sessionTable_;
 
     std::unique_ptr<SimpleAllocedPool> pool_;
 };
@@ -409,8 +474,10 @@ inline netif* Rule::outside() const {
 
 /* BibEntry */
 inline BibEntry::BibEntry(const Ip6TransportAddress& src6, const Ip4TransportAddress& dst4)
-        : src6_(src6),
-          dst4_(dst4) {
+        : next4(nullptr),
+          src6_(src6),
+          dst4_(dst4),
+          sessions_(0) {
 }
 
 inline const Ip6TransportAddress& BibEntry::src6() const {
@@ -432,12 +499,101 @@ inline bool BibEntry::matches(const IpTransportAddress& addr) const {
 }
 
 inline bool BibEntry::empty() const {
-    return sessions_.front() == nullptr;
+    return sessions_ == 0;
+}
+
+inline void BibEntry::sessionAdded() {
+    ++sessions_;
+}
+
+inline void BibEntry::sessionRemoved() {
+    --sessions_;
+}
+
+/* BibTable */
+inline BibTable::BibTable()
+        : v6_(),
+          v4_() {
 }
 
-inline SessionEntry* BibEntry::lookupSession(const IpTransportAddress& src, const IpTransportAddress& dst) {
-    for (auto* s = sessions_.front(); s != nullptr; s = s->next) {
-        if (s->matches(src, dst)) {
+inline size_t BibTable::bucket(const ip6_addr_t& addr, uint16_t l4Id) {
+    const uint32_t h = (addr.addr[0] ^ addr.addr[1] ^ addr.addr[2] ^ addr.addr[3] ^ l4Id) * 0x9e3779b1;
+    return (h >> 16) % NAT64_HASH_SIZE;
+}
+
+inline size_t BibTable::bucket(const ip4_addr_t& addr, uint16_t l4Id) {
+    const uint32_t h = (addr.addr ^ l4Id) * 0x9e3779b1;
+    return (h >> 16) % NAT64_HASH_SIZE;
+}
+
+inline BibEntry* BibTable::lookup(const IpTransportAddress& addr) const {
+    if (addr.isV6()) {
+        for (auto* e = v6_[bucket(*ip_2_ip6(&addr.address()), addr.l4Id())]; e != nullptr; e = e->next) {
+            if (e->src6() == addr) {
+                return e;
+            }
+        }
+    } else if (addr.isV4()) {
+        for (auto* e = v4_[bucket(*ip_2_ip4(&addr.address()), addr.l4Id())]; e != nullptr; e = e->next4) {
+            if (e->dst4() == addr) {
+                return e;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+inline void BibTable::add(BibEntry* bib) {
+    auto& front6 = v6_[bucket(bib->src6().address(), bib->src6().l4Id())];
+    bib->next = front6;
+    front6 = bib;
+    auto& front4 = v4_[bucket(bib->dst4().address(), bib->dst4().l4Id())];
+    bib->next4 = front4;
+    front4 = bib;
+}
+
+template <typename FuncT>
+inline void BibTable::removeEmpty(FuncT removed) {
+    for (auto& front: v6_) {
+        for (BibEntry** e = &front; *e != nullptr;) {
+            BibEntry* bib = *e;
+            if (!bib->empty()) {
+                e = &bib->next;
+                continue;
+            }
+            *e = bib->next;
+            for (BibEntry** e4 = &v4_[bucket(bib->dst4().address(), bib->dst4().l4Id())]; *e4 != nullptr; e4 = &(*e4)->next4) {
+                if (*e4 == bib) {
+                    *e4 = bib->next4;
+                    break;
+                }
+            }
+            removed(bib);
+        }
+    }
+}
+
+/* SessionTable */
+inline size_t SessionTable::bucket(const BibEntry* bib, uint32_t addr, uint16_t l4Id) {
+    const uint32_t h = ((uint32_t)(uintptr_t)bib ^ addr ^ l4Id) * 0x9e3779b1;
+    return (h >> 16) % NAT64_HASH_SIZE;
+}
+
+inline SessionEntry* SessionTable::lookup(BibEntry* bib, const IpTransportAddress& src, const IpTransportAddress& dst) const {
+    /* The outside host is the destination of the packets from the IPv6 side and the source of
+     * the ones from the IPv4 side. Its IPv4 address is embedded in the last word of the IPv6 one */
+    size_t b = 0;
+    if (src.isV6()) {
+        b = bucket(bib, ip_2_ip6(&dst.address())->addr[3], dst.l4Id());
+    } else if (src.isV4()) {
+        b = bucket(bib, ip_2_ip4(&src.address())->addr, src.l4Id());
+    } else {
+        return nullptr;
+    }
+
+    for (auto* s = buckets_[b].front(); s != nullptr; s = s->next) {
+        if (s->bib() == bib && s->matches(src, dst)) {
             return s;
         }
     }
@@ -445,12 +601,13 @@ inline SessionEntry* BibEntry::lookupSession(const IpTransportAddress& src, cons
     return nullptr;
 }
 
-inline SessionEntry* BibEntry::addSession(const Ip6TransportAddress& dst, uint32_t lifetime, particle::SimpleAllocator& allocator) {
+inline SessionEntry* SessionTable::add(BibEntry* bib, const Ip6TransportAddress& dst, uint32_t lifetime, particle::SimpleAllocator& allocator) {
     auto sess = (SessionEntry*)allocator.alloc(NAT64_ENTRY_SIZE);
     if (sess) {
-        new(sess) SessionEntry(this, dst);
+        new(sess) SessionEntry(bib, dst);
         sess->setLifetime(lifetime);
-        sessions_.pushFront(sess);
+        buckets_[bucket(bib, dst.address().addr[3], dst.l4Id())].pushFront(sess);
+        bib->sessionAdded();
         return sess;
     }
 
@@ -459,25 +616,64 @@ inline SessionEntry* BibEntry::addSession(const Ip6TransportAddress& dst, uint32
     return nullptr;
 }
 
-inline bool BibEntry::timeout(uint32_t dt, particle::SimpleAllocator& allocator) {
+inline void SessionTable::timeout(uint32_t dt, particle::SimpleAllocator& allocator) {
     using namespace particle::net;
-    for (auto s = sessions_.front(), p = static_cast<SessionEntry*>(nullptr); s != nullptr;) {
-        if (s->timeout(dt)) {
-            LOG_DEBUG(TRACE, "Session timed out %s#%u <-> %s#%u, %s#%u <-> %s#%u",
-                      IP6ADDR_NTOA(&s->src6().address()), s->src6().l4Id(),
-                      IP6ADDR_NTOA(&s->dst6().address()), s->dst6().l4Id(),
-                      IP4ADDR_NTOA(&s->src4().address()), s->src4().l4Id(),
-                      IP4ADDR_NTOA(&s->dst4().address()), s->dst4().l4Id());
-            auto popped = sessions_.pop(s, p);
-            s = popped->next;
-            allocator.free(popped);
-        } else {
-            p = s;
-            s = s->next;
+    for (auto& sessions: buckets_) {
+        for (auto s = sessions.front(), p = static_cast<SessionEntry*>(nullptr); s != nullptr;) {
+            if (s->timeout(dt)) {
+                LOG_DEBUG(TRACE, "Session timed out %s#%u <-> %s#%u, %s#%u <-> %s#%u",
+                          IP6ADDR_NTOA(&s->src6().address()), s->src6().l4Id(),
+                          IP6ADDR_NTOA(&s->dst6().address()), s->dst6().l4Id(),
+                          IP4ADDR_NTOA(&s->src4().address()), s->src4().l4Id(),
+                          IP4ADDR_NTOA(&s->dst4().address()), s->dst4().l4Id());
+                auto popped = sessions.pop(s, p);
+                s = popped->next;
+                popped->bib()->sessionRemoved();
+                allocator.free(popped);
+            } else {
+                p = s;
+                s = s->next;
+            }
         }
     }
+}
+
+/* L4IdBitmap */
+template <uint16_t MinId, uint16_t MaxId>
+inline L4IdBitmap<MinId, MaxId>::L4IdBitmap()
+        : bits_() {
+    /* The bits past the end of the range are never free */
+    if (SIZE % 32) {
+        bits_[WORDS - 1] = ~0u << (SIZE % 32);
+    }
+}
 
-    return empty();
+template <uint16_t MinId, uint16_t MaxId>
+inline int L4IdBitmap<MinId, MaxId>::findFree(uint16_t from) const {
+    const size_t start = from - MinId;
+    /* The word containing the starting ID is checked again at the end for the IDs preceding it */
+    for (size_t i = 0; i <= WORDS; ++i) {
+        const size_t w = (start / 32 + i) % WORDS;
+        uint32_t free = ~bits_[w];
+        if (i == 0) {
+            free &= ~0u << (start % 32);
+        }
+        if (free) {
+            return MinId + w * 32 + __builtin_ctz(free);
+        }
+    }
+
+    return -1;
+}
+
+template <uint16_t MinId, uint16_t MaxId>
+inline void L4IdBitmap<MinId, MaxId>::set(uint16_t id, bool used) {
+    const size_t i = id - MinId;
+    if (used) {
+        bits_[i / 32] |= (1u << (i % 32));
+    } else {
+        bits_[i / 32] &= ~(1u << (i % 32));
+    }
 }
 
 /* SessionEntry */
@@ -23,10 +23,79 @@
 
 /* netdb_hal_impl.h should get included from netdb_hal.h automagically */
 #include "netdb_hal.h"
+#include "dns_cache.h"
 #include <lwip/sockets.h>
 #include <errno.h>
 #include <algorithm>
 
+using namespace particle::net;
+
+namespace {
+
+/* Appends an entry for the resolved address to the list of results */
+int appendAddrInfo(const ip_addr_t& addr, const char* servname, const struct addrinfo* hints,
+                   struct addrinfo*** next) {
+    char host[IPADDR_STRLEN_MAX] = {};
+    if (!ipaddr_ntoa_r(&addr, host, sizeof(host))) {
+        return EAI_FAIL;
+    }
+    struct addrinfo h = {};
+    if (hints) {
+        h = *hints;
+    }
+    h.ai_family = IP_IS_V6(&addr) ? AF_INET6 : AF_INET;
+    h.ai_flags |= AI_NUMERICHOST;
+    const int r = lwip_getaddrinfo(host, servname, &h, *next);
+    if (r == 0) {
+        *next = &(**next)->ai_next;
+    }
+    return r;
+}
+
+/* Resolves the hostname via the resolver cache, looking up the IPv4 and IPv6 addresses in parallel */
+int getAddrInfoCached(const char* hostname, const char* servname, const struct addrinfo* hints,
+                      struct addrinfo** res) {
+    const int family = hints ? hints->ai_family : AF_UNSPEC;
+    unsigned types = DnsCache::ANY;
+    if (family == AF_INET) {
+        types = DnsCache::IPV4;
+    } else if (family == AF_INET6) {
+        types = DnsCache::IPV6;
+    } else if (family != AF_UNSPEC) {
+        return EAI_FAMILY;
+    }
+    /* With explicit AF_UNSPEC hints the IPv6 address goes first. Without hints, the IPv4 one is
+     * preferred, as with lwIP's default address type, and the lookup doesn't wait for the IPv6
+     * address once it's been found */
+    const bool ipv6First = hints != nullptr;
+    DnsCache::Result result = {};
+    if (DnsCache::instance()->lookup(hostname, types, &result, ipv6First ? 0 : DnsCache::IPV4) < 0) {
+        return EAI_FAIL;
+    }
+    const ip_addr_t* addrs[2] = {};
+    if (result.types & DnsCache::IPV4) {
+        addrs[ipv6First ? 1 : 0] = &result.addr4;
+    }
+    if (result.types & DnsCache::IPV6) {
+        addrs[ipv6First ? 0 : 1] = &result.addr6;
+    }
+    *res = nullptr;
+    struct addrinfo** next = res;
+    for (const auto addr: addrs) {
+        if (addr) {
+            const int r = appendAddrInfo(*addr, servname, hints, &next);
+            if (r != 0) {
+                lwip_freeaddrinfo(*res);
+                *res = nullptr;
+                return r;
+            }
+        }
+    }
+    return 0;
+}
+
+} /* anonymous */
+
 struct hostent* netdb_gethostbyname(const char *name) {
     return lwip_gethostbyname(name);
 }
@@ -42,6 +111,12 @@ void netdb_freeaddrinfo(struct addrinfo* ai) {
 
 int netdb_getaddrinfo(const char* hostname, const char* servname,
                       const struct addrinfo* hints, struct addrinfo** res) {
+    /* Names are resolved through the resolver cache, addresses are parsed by lwIP */
+    ip_addr_t addr = {};
+    if (hostname && res && !(hints && (hints->ai_flags & AI_NUMERICHOST)) && !ipaddr_aton(hostname, &addr)) {
+        return getAddrInfoCached(hostname, servname, hints, res);
+    }
+
     /* Change the behavior when AF_UNSPEC is used */
     if (hints && hints->ai_family == AF_UNSPEC) {
         struct addrinfo h = *hints;
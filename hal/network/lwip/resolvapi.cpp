@@ -16,6 +16,7 @@
  */
 
 #include "resolvapi.h"
+#include "dns_cache.h"
 #include "lwiplock.h"
 #include "ipsockaddr.h"
 #include <lwip/dns.h>
@@ -190,6 +191,8 @@ int resolv_event_handler_del(resolv_event_handler_cookie_t cookie) {
 
 void dns_list_change_callback_handler(u8_t numdns, const ip_addr_t *dnsserver) {
     LOG(INFO, "DNS server list changed");
+    /* The cached results may have come from the previous servers */
+    DnsCache::instance()->clear();
     for (EventHandlerList* h = s_eventHandlerList; h != nullptr; h = h->next) {
         if (h->handler) {
             /* FIXME */
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "modem_bringup.h"
+
+#include "at_parser.h"
+#include "at_response.h"
+
+#include "spark_wiring_diagnostics.h"
+
+#include "timer_hal.h"
+#include "delay_hal.h"
+#include "system_error.h"
+#include "logging.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstring>
+
+LOG_SOURCE_CATEGORY("ncp.bringup")
+
+namespace particle {
+
+namespace {
+
+const int NO_PHASE = -1;
+
+const char* const PHASE_NAMES[] = {
+    "power on",
+    "AT",
+    "config",
+    "restart",
+    "SIM",
+    "muxer"
+};
+
+static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == (size_t)ModemBringupPhase::COUNT,
+        "Phase names don't match the phases");
+
+// Times of the last bring-up
+AtomicIntegerDiagnosticData g_totalTimeDiag(DIAG_ID_NETWORK_CELLULAR_INIT_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_TIME);
+
+AtomicIntegerDiagnosticData g_phaseTimeDiag[] = {
+    { DIAG_ID_NETWORK_CELLULAR_INIT_POWER_ON_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_POWER_ON_TIME },
+    { DIAG_ID_NETWORK_CELLULAR_INIT_AT_READY_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_AT_READY_TIME },
+    { DIAG_ID_NETWORK_CELLULAR_INIT_CONFIG_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_CONFIG_TIME },
+    { DIAG_ID_NETWORK_CELLULAR_INIT_RESTART_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_RESTART_TIME },
+    { DIAG_ID_NETWORK_CELLULAR_INIT_SIM_READY_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_SIM_READY_TIME },
+    { DIAG_ID_NETWORK_CELLULAR_INIT_MUXER_TIME, DIAG_NAME_NETWORK_CELLULAR_INIT_MUXER_TIME }
+};
+
+static_assert(sizeof(g_phaseTimeDiag) / sizeof(g_phaseTimeDiag[0]) == (size_t)ModemBringupPhase::COUNT,
+        "Diagnostic sources don't match the phases");
+
+inline system_tick_t millis() {
+    return HAL_Timer_Get_Milli_Seconds();
+}
+
+inline bool isExpired(system_tick_t time, system_tick_t now) {
+    return (int32_t)(time - now) <= 0;
+}
+
+inline unsigned remainingTime(system_tick_t until, system_tick_t now) {
+    return isExpired(until, now) ? 0 : until - now;
+}
+
+inline system_tick_t earliest(system_tick_t t1, system_tick_t t2) {
+    return isExpired(t1, t2) ? t1 : t2;
+}
+
+} // particle::
+
+const unsigned ModemBringup::MIN_PROBE_PERIOD;
+const unsigned ModemBringup::MAX_PROBE_PERIOD;
+const unsigned ModemBringup::MIN_POWER_POLL_PERIOD;
+const unsigned ModemBringup::MAX_POWER_POLL_PERIOD;
+const unsigned ModemBringup::RESTART_PROBE_TIMEOUT;
+
+ModemBringup::ModemBringup() :
+        phaseTime_(),
+        phaseStart_(0),
+        parser_(nullptr),
+        powerState_(nullptr),
+        powerStateData_(nullptr),
+        phase_(NO_PHASE),
+        simReady_(false) {
+}
+
+void ModemBringup::init(AtParser* parser, PowerStateCallback powerState, void* data) {
+    parser_ = parser;
+    powerState_ = powerState;
+    powerStateData_ = data;
+}
+
+int ModemBringup::addUrcHandlers() {
+    CHECK_TRUE(parser_, SYSTEM_ERROR_INVALID_STATE);
+    // +CPIN: <code>
+    CHECK(parser_->addUrcHandler("+CPIN", cpinUrcHandler, this));
+    return 0;
+}
+
+int ModemBringup::waitPowerState(bool on, unsigned timeout) {
+    CHECK_TRUE(powerState_, SYSTEM_ERROR_INVALID_STATE);
+    const auto t1 = millis();
+    unsigned period = MIN_POWER_POLL_PERIOD;
+    for (;;) {
+        if (powerState_(powerStateData_) == on) {
+            return 0;
+        }
+        const auto t = millis() - t1;
+        if (t >= timeout) {
+            break;
+        }
+        HAL_Delay_Milliseconds(std::min(period, timeout - t));
+        period = std::min(period * 2, MAX_POWER_POLL_PERIOD);
+    }
+    return SYSTEM_ERROR_TIMEOUT;
+}
+
+int ModemBringup::waitAtResponse(unsigned timeout, unsigned maxPeriod) {
+    CHECK_TRUE(parser_, SYSTEM_ERROR_INVALID_STATE);
+    const auto end = millis() + timeout;
+    unsigned period = std::min(MIN_PROBE_PERIOD, maxPeriod);
+    for (;;) {
+        const auto next = millis() + period;
+        const int r = parser_->execCommand(period, "AT");
+        if (r == AtResponse::OK) {
+            return 0;
+        }
+        if (r < 0 && r != SYSTEM_ERROR_TIMEOUT) {
+            return r;
+        }
+        if (isExpired(end, millis())) {
+            break;
+        }
+        // Don't send the next probe before the period elapses if the modem replied with an error
+        CHECK(idle(next));
+        period = std::min(period * 2, maxPeriod);
+    }
+    return SYSTEM_ERROR_TIMEOUT;
+}
+
+int ModemBringup::waitRestart(unsigned downTimeout, unsigned upTimeout) {
+    CHECK_TRUE(parser_, SYSTEM_ERROR_INVALID_STATE);
+    // Probing the modem right after the reset command may get a response from the modem that is
+    // about to restart. Wait until it stops responding
+    const auto end = millis() + downTimeout;
+    for (;;) {
+        const auto next = millis() + MIN_PROBE_PERIOD;
+        // Any response means that the modem is still up
+        const int r = parser_->execCommand(RESTART_PROBE_TIMEOUT, "AT");
+        if (r == SYSTEM_ERROR_TIMEOUT) {
+            break;
+        }
+        if (r < 0) {
+            return r;
+        }
+        if (isExpired(end, millis())) {
+            // The modem may have restarted between the probes
+            LOG(WARN, "Modem didn't stop responding after the reset command");
+            break;
+        }
+        CHECK(idle(next));
+    }
+    parser_->reset();
+    return waitAtResponse(upTimeout);
+}
+
+int ModemBringup::waitSimReady(unsigned timeout) {
+    CHECK_TRUE(parser_, SYSTEM_ERROR_INVALID_STATE);
+    // The SIM state may have changed since the last report
+    simReady_ = false;
+    const auto end = millis() + timeout;
+    unsigned period = MIN_PROBE_PERIOD;
+    for (;;) {
+        const auto next = millis() + period;
+        // The +CPIN line of the response is processed by the URC handler
+        const int r = parser_->execCommand(MAX_PROBE_PERIOD, "AT+CPIN?");
+        if (r < 0 && r != SYSTEM_ERROR_TIMEOUT) {
+            return r;
+        }
+        if (simReady_) {
+            return 0;
+        }
+        if (isExpired(end, millis())) {
+            break;
+        }
+        // Wait for the next probe or the +CPIN URC, whichever comes first
+        CHECK(idle(earliest(next, end)));
+        if (simReady_) {
+            return 0;
+        }
+        period = std::min(period * 2, MAX_PROBE_PERIOD);
+    }
+    return SYSTEM_ERROR_TIMEOUT;
+}
+
+void ModemBringup::enterPhase(ModemBringupPhase phase) {
+    const auto now = millis();
+    if (phase_ != NO_PHASE) {
+        phaseTime_[phase_] += now - phaseStart_;
+    } else {
+        // A new bring-up
+        resetStats();
+    }
+    phase_ = (int)phase;
+    phaseStart_ = now;
+}
+
+void ModemBringup::finish() {
+    if (phase_ != NO_PHASE) {
+        phaseTime_[phase_] += millis() - phaseStart_;
+        phase_ = NO_PHASE;
+    }
+    LOG(INFO, "Modem bring-up took %u ms", (unsigned)totalTime());
+    for (int i = 0; i < (int)ModemBringupPhase::COUNT; ++i) {
+        if (phaseTime_[i]) {
+            LOG(TRACE, "%s: %u ms", PHASE_NAMES[i], (unsigned)phaseTime_[i]);
+        }
+        g_phaseTimeDiag[i] = phaseTime_[i];
+    }
+    g_totalTimeDiag = totalTime();
+}
+
+void ModemBringup::resetStats() {
+    memset(phaseTime_, 0, sizeof(phaseTime_));
+    phase_ = NO_PHASE;
+}
+
+system_tick_t ModemBringup::phaseTime(ModemBringupPhase phase) const {
+    return phaseTime_[(int)phase];
+}
+
+system_tick_t ModemBringup::totalTime() const {
+    system_tick_t t = 0;
+    for (const auto v: phaseTime_) {
+        t += v;
+    }
+    return t;
+}
+
+int ModemBringup::idle(system_tick_t until) {
+    // Process the URCs while waiting
+    for (;;) {
+        const auto t = remainingTime(until, millis());
+        if (t == 0) {
+            break;
+        }
+        const int r = parser_->processUrc(t);
+        if (r > 0) {
+            // Let the caller check the updated state
+            break;
+        }
+        if (r < 0 && r != SYSTEM_ERROR_TIMEOUT && r != SYSTEM_ERROR_WOULD_BLOCK) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+int ModemBringup::cpinUrcHandler(AtResponseReader* reader, const char* prefix, void* data) {
+    const auto self = (ModemBringup*)data;
+    char code[33] = {};
+    const int r = CHECK(reader->scanf("+CPIN: %32[^\r\n]", code));
+    CHECK_TRUE(r == 1, SYSTEM_ERROR_AT_RESPONSE_UNEXPECTED);
+    self->simReady_ = !strcmp(code, "READY");
+    return 0;
+}
+
+} // particle
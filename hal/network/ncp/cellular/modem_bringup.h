@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "system_tick_hal.h"
+
+namespace particle {
+
+class AtParser;
+class AtResponseReader;
+
+/**
+ * Phases of the modem bring-up.
+ */
+enum class ModemBringupPhase {
+    POWER_ON, ///< Waiting for V_INT after the power-on sequence
+    AT_READY, ///< Waiting for the modem to respond to AT commands
+    CONFIG, ///< Configuring the modem
+    RESTART, ///< Waiting for the modem to restart after a configuration change
+    SIM_READY, ///< Waiting for the SIM card
+    MUXER, ///< Starting the multiplexer
+    COUNT ///< Number of phases
+};
+
+/**
+ * Readiness probes used to bring up the modem.
+ *
+ * Instead of sleeping for the worst case time the modem may need to power on, restart or
+ * initialize its SIM card, the probes return as soon as the modem signals that it's ready: V_INT
+ * goes high, the modem echoes an AT command or reports `+CPIN: READY`. The probe period starts
+ * short and is doubled on every unsuccessful attempt, so that a modem that is quick to respond
+ * isn't kept waiting and a slow one isn't flooded with commands.
+ *
+ * The time spent in each phase of the bring-up is recorded. Once the modem is ready or has failed
+ * to start, the times are logged and published as the `net:cell:init` diagnostics.
+ */
+class ModemBringup {
+public:
+    /**
+     * Callback returning the current state of V_INT.
+     */
+    typedef bool (*PowerStateCallback)(void* data);
+
+    /**
+     * Initial period of the readiness probes in milliseconds.
+     */
+    static const unsigned MIN_PROBE_PERIOD = 100;
+    /**
+     * Default maximum period of the readiness probes in milliseconds.
+     */
+    static const unsigned MAX_PROBE_PERIOD = 1000;
+    /**
+     * Initial period of the V_INT polling in milliseconds.
+     */
+    static const unsigned MIN_POWER_POLL_PERIOD = 10;
+    /**
+     * Maximum period of the V_INT polling in milliseconds.
+     */
+    static const unsigned MAX_POWER_POLL_PERIOD = 100;
+    /**
+     * Time in milliseconds after which a modem that doesn't respond to AT is considered to be
+     * restarting.
+     */
+    static const unsigned RESTART_PROBE_TIMEOUT = 1000;
+
+    ModemBringup();
+
+    /**
+     * Sets the parser used to probe the modem and the callback reading V_INT.
+     */
+    void init(AtParser* parser, PowerStateCallback powerState, void* data);
+
+    /**
+     * Registers the URC handlers used by the probes.
+     *
+     * Needs to be called every time the parser is reinitialized.
+     */
+    int addUrcHandlers();
+
+    /**
+     * Waits until V_INT is in the given state.
+     */
+    int waitPowerState(bool on, unsigned timeout);
+
+    /**
+     * Waits until the modem responds to AT commands.
+     */
+    int waitAtResponse(unsigned timeout, unsigned maxPeriod = MAX_PROBE_PERIOD);
+
+    /**
+     * Waits until the modem restarts after a reset command.
+     *
+     * The modem confirms the command before restarting, so the modem first needs to stop
+     * responding, for at most `downTimeout` milliseconds, before the restarted modem is probed for
+     * up to `upTimeout` milliseconds.
+     */
+    int waitRestart(unsigned downTimeout, unsigned upTimeout);
+
+    /**
+     * Waits until the SIM card is ready.
+     *
+     * The SIM state is queried with `AT+CPIN?` and also updated by the `+CPIN` URC that some
+     * modems send when the SIM card has been initialized.
+     */
+    int waitSimReady(unsigned timeout);
+
+    /**
+     * Starts the given phase of the bring-up, ending the current one.
+     *
+     * The time spent in a phase is accumulated if the phase is entered more than once. Entering a
+     * phase after `finish()` starts recording a new bring-up.
+     */
+    void enterPhase(ModemBringupPhase phase);
+
+    /**
+     * Ends the current phase of the bring-up, and logs and publishes the time spent in each phase.
+     */
+    void finish();
+
+    /**
+     * Clears the recorded times.
+     */
+    void resetStats();
+
+    /**
+     * Returns the time spent in the given phase in milliseconds.
+     */
+    system_tick_t phaseTime(ModemBringupPhase phase) const;
+
+    /**
+     * Returns the total time spent bringing up the modem in milliseconds.
+     */
+    system_tick_t totalTime() const;
+
+    /**
+     * Returns `true` if the modem has reported that the SIM card is ready.
+     */
+    bool simReady() const;
+
+private:
+    system_tick_t phaseTime_[(int)ModemBringupPhase::COUNT];
+    system_tick_t phaseStart_;
+    AtParser* parser_;
+    PowerStateCallback powerState_;
+    void* powerStateData_;
+    int phase_;
+    bool simReady_;
+
+    int idle(system_tick_t until);
+
+    static int cpinUrcHandler(AtResponseReader* reader, const char* prefix, void* data);
+};
+
+inline bool ModemBringup::simReady() const {
+    return simReady_;
+}
+
+} // particle
@@ -127,6 +127,9 @@ int SaraNcpClient::init(const NcpClientConfig& conf) {
     decltype(muxerAtStream_) muxStrm(new(std::nothrow) decltype(muxerAtStream_)::element_type(&muxer_, UBLOX_NCP_AT_CHANNEL));
     CHECK_TRUE(muxStrm, SYSTEM_ERROR_NO_MEMORY);
     CHECK(muxStrm->init(UBLOX_NCP_AT_CHANNEL_RX_BUFFER_SIZE));
+    bringup_.init(&parser_, [](void* data) {
+        return static_cast<SaraNcpClient*>(data)->modemPowerState();
+    }, this);
     CHECK(initParser(serial.get()));
     serial_ = std::move(serial);
     muxerAtStream_ = std::move(muxStrm);
@@ -162,6 +165,8 @@ int SaraNcpClient::initParser(Stream* stream) {
             .commandTerminator(AtCommandTerminator::CRLF);
     parser_.destroy();
     CHECK(parser_.init(std::move(parserConf)));
+    // +CPIN: <code>
+    CHECK(bringup_.addUrcHandlers());
     // +CREG: <stat>[,<lac>,<ci>[,<AcTStatus>]]
     CHECK(parser_.addUrcHandler("+CREG", [](AtResponseReader* reader, const char* prefix, void* data) -> int {
         const auto self = (SaraNcpClient*)data;
@@ -256,7 +261,14 @@ int SaraNcpClient::on() {
         return 0;
     }
     // Power on the modem
+    bringup_.resetStats();
+    bringup_.enterPhase(ModemBringupPhase::POWER_ON);
+    NAMED_SCOPE_GUARD(bringupGuard, {
+        bringup_.finish();
+    });
     CHECK(modemPowerOn());
+    // The bring-up is ended by waitReady()
+    bringupGuard.dismiss();
     CHECK(waitReady());
     return 0;
 }
@@ -616,28 +628,14 @@ int SaraNcpClient::checkParser() {
     return 0;
 }
 
-int SaraNcpClient::waitAtResponse(unsigned int timeout, unsigned int period) {
-    const auto t1 = HAL_Timer_Get_Milli_Seconds();
-    for (;;) {
-        const int r = parser_.execCommand(period, "AT");
-        if (r < 0 && r != SYSTEM_ERROR_TIMEOUT) {
-            return r;
-        }
-        if (r == AtResponse::OK) {
-            return 0;
-        }
-        const auto t2 = HAL_Timer_Get_Milli_Seconds();
-        if (t2 - t1 >= timeout) {
-            break;
-        }
-    }
-    return SYSTEM_ERROR_TIMEOUT;
-}
-
 int SaraNcpClient::waitReady() {
     if (ready_) {
         return 0;
     }
+    bringup_.enterPhase(ModemBringupPhase::AT_READY);
+    NAMED_SCOPE_GUARD(bringupGuard, {
+        bringup_.finish();
+    });
     muxer_.stop();
     CHECK(serial_->setBaudRate(UBLOX_NCP_DEFAULT_SERIAL_BAUDRATE));
     CHECK(initParser(serial_.get()));
@@ -645,7 +643,7 @@ int SaraNcpClient::waitReady() {
     CHECK(modemSetUartState(true));
     skipAll(serial_.get(), 1000);
     parser_.reset();
-    ready_ = waitAtResponse(20000) == 0;
+    ready_ = bringup_.waitAtResponse(20000) == 0;
 
     if (ready_) {
         // start power on timer for memory issue power off delays, assume not registered
@@ -665,6 +663,10 @@ int SaraNcpClient::waitReady() {
         LOG(ERROR, "No response from NCP");
     }
 
+    // The time spent resetting a modem that failed to start is not part of the bring-up
+    bringupGuard.dismiss();
+    bringup_.finish();
+
     if (!ready_) {
         // Disable voltage translator
         modemSetUartState(false);
@@ -751,34 +753,28 @@ int SaraNcpClient::selectSimCard() {
     }
 
     if (reset) {
+        bringup_.enterPhase(ModemBringupPhase::RESTART);
         if (conf_.ncpIdentifier() != PLATFORM_NCP_SARA_R410) {
             // U201
             const int r = CHECK_PARSER(parser_.execCommand("AT+CFUN=16"));
             CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-            HAL_Delay_Milliseconds(1000);
+            CHECK(bringup_.waitRestart(1000, 20000));
         } else {
             // R410
             const int r = CHECK_PARSER(parser_.execCommand("AT+CFUN=15"));
             CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-            HAL_Delay_Milliseconds(10000);
+            CHECK(bringup_.waitRestart(10000, 20000));
         }
-
-        CHECK(waitAtResponse(20000));
     }
 
     // Using numeric CME ERROR codes
     // int r = CHECK_PARSER(parser_.execCommand("AT+CMEE=1"));
     // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
 
-    int simState = 0;
-    for (unsigned i = 0; i < 10; ++i) {
-        simState = checkSimCard();
-        if (!simState) {
-            break;
-        }
-        HAL_Delay_Milliseconds(1000);
-    }
-    return simState;
+    bringup_.enterPhase(ModemBringupPhase::SIM_READY);
+    CHECK(checkSimCard());
+    bringup_.enterPhase(ModemBringupPhase::CONFIG);
+    return 0;
 }
 
 int SaraNcpClient::changeBaudRate(unsigned int baud) {
@@ -789,6 +785,8 @@ int SaraNcpClient::changeBaudRate(unsigned int baud) {
 }
 
 int SaraNcpClient::initReady() {
+    bringup_.enterPhase(ModemBringupPhase::CONFIG);
+
     // Select either internal or external SIM card slot depending on the configuration
     CHECK(selectSimCard());
 
@@ -801,7 +799,7 @@ int SaraNcpClient::initReady() {
         CHECK(changeBaudRate(UBLOX_NCP_RUNTIME_SERIAL_BAUDRATE_U2));
         // Check that the modem is responsive at the new baudrate
         skipAll(serial_.get(), 1000);
-        CHECK(waitAtResponse(10000));
+        CHECK(bringup_.waitAtResponse(10000));
     }
 
     if (ncpId() == PLATFORM_NCP_SARA_R410) {
@@ -841,10 +839,11 @@ int SaraNcpClient::initReady() {
             }
         }
         if (reset) {
+            bringup_.enterPhase(ModemBringupPhase::RESTART);
             const int respCfun = CHECK_PARSER(parser_.execCommand("AT+CFUN=15"));
             CHECK_TRUE(respCfun == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-            HAL_Delay_Milliseconds(10000);
-            CHECK(waitAtResponse(20000));
+            CHECK(bringup_.waitRestart(10000, 20000));
+            bringup_.enterPhase(ModemBringupPhase::CONFIG);
         }
 
         // Force Cat M1-only mode
@@ -867,7 +866,7 @@ int SaraNcpClient::initReady() {
 
         // Force eDRX mode to be disabled. AT+CEDRXS=0 doesn't seem disable eDRX completely, so
         // so we're disabling it for each reported RAT individually
-        Vector<unsigned> acts;
+        Vector<unsigned, spark::DefaultAllocator, 4> acts; // The modem reports a few RATs at most
         resp = parser_.sendCommand("AT+CEDRXS?");
         while (resp.hasNextLine()) {
             unsigned act = 0;
@@ -901,6 +900,7 @@ int SaraNcpClient::initReady() {
     }
 
     // Send AT+CMUX and initialize multiplexer
+    bringup_.enterPhase(ModemBringupPhase::MUXER);
     r = CHECK_PARSER(parser_.execCommand("AT+CMUX=0,0,,1509,,,,,"));
     CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
 
@@ -944,9 +944,9 @@ int SaraNcpClient::initReady() {
     CHECK(initParser(muxerAtStream_.get()));
 
     if (conf_.ncpIdentifier() != PLATFORM_NCP_SARA_R410) {
-        CHECK(waitAtResponse(10000));
+        CHECK(bringup_.waitAtResponse(10000));
     } else {
-        CHECK(waitAtResponse(20000, 5000));
+        CHECK(bringup_.waitAtResponse(20000, 5000));
     }
     ncpState(NcpState::ON);
     LOG_DEBUG(TRACE, "Muxer AT channel live");
@@ -957,18 +957,11 @@ int SaraNcpClient::initReady() {
 }
 
 int SaraNcpClient::checkSimCard() {
-    auto resp = parser_.sendCommand("AT+CPIN?");
-    char code[33] = {};
-    int r = CHECK_PARSER(resp.scanf("+CPIN: %32[^\n]", code));
-    CHECK_TRUE(r == 1, SYSTEM_ERROR_AT_RESPONSE_UNEXPECTED);
-    r = CHECK_PARSER(resp.readResult());
+    // The SIM card may take a few seconds to initialize after the modem has started
+    CHECK(bringup_.waitSimReady(10000));
+    const int r = parser_.execCommand("AT+CCID");
     CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-    if (!strcmp(code, "READY")) {
-        r = parser_.execCommand("AT+CCID");
-        CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-        return 0;
-    }
-    return SYSTEM_ERROR_UNKNOWN;
+    return 0;
 }
 
 int SaraNcpClient::configureApn(const CellularNetworkConfig& conf) {
@@ -1208,7 +1201,7 @@ int SaraNcpClient::modemInit() const {
     return 0;
 }
 
-int SaraNcpClient::modemPowerOn() const {
+int SaraNcpClient::modemPowerOn() {
     if (!modemPowerState()) {
         LOG(TRACE, "Powering modem on");
         // Perform power-on sequence depending on the NCP type
@@ -1228,16 +1221,8 @@ int SaraNcpClient::modemPowerOn() const {
             HAL_GPIO_Write(UBPWR, 1);
         }
 
-        bool powerGood;
         // Verify that the module was powered up by checking the VINT pin up to 1 sec
-        for (unsigned i = 0; i < 10; i++) {
-            powerGood = modemPowerState();
-            if (powerGood) {
-                break;
-            }
-            HAL_Delay_Milliseconds(100);
-        }
-        if (powerGood) {
+        if (bringup_.waitPowerState(true, 1000) == 0) {
             LOG(TRACE, "Modem powered on");
         } else {
             LOG(ERROR, "Failed to power on modem");
@@ -1294,16 +1279,8 @@ int SaraNcpClient::modemPowerOff() {
             HAL_GPIO_Write(UBPWR, 1);
         }
 
-        bool powerGood;
         // Verify that the module was powered down by checking the VINT pin up to 10 sec
-        for (unsigned i = 0; i < 100; i++) {
-            powerGood = modemPowerState();
-            if (!powerGood) {
-                break;
-            }
-            HAL_Delay_Milliseconds(100);
-        }
-        if (!powerGood) {
+        if (bringup_.waitPowerState(false, 10000) == 0) {
             LOG(TRACE, "Modem powered off");
         } else {
             LOG(ERROR, "Failed to power off modem");
@@ -1331,10 +1308,9 @@ int SaraNcpClient::modemHardReset(bool powerOff) {
         HAL_GPIO_Write(UBRST, 0);
         HAL_Delay_Milliseconds(50);
         HAL_GPIO_Write(UBRST, 1);
-        HAL_Delay_Milliseconds(1000);
 
         // NOTE: powerOff argument is ignored, modem will restart automatically
-        // in all cases
+        // in all cases. Its readiness is probed with AT commands by waitReady()
     } else {
         // If memory issue is present, ensure we don't force a power off too soon
         // to avoid hitting the 124 day memory housekeeping issue
@@ -1346,10 +1322,9 @@ int SaraNcpClient::modemHardReset(bool powerOff) {
         HAL_GPIO_Write(UBRST, 0);
         HAL_Delay_Milliseconds(10000);
         HAL_GPIO_Write(UBRST, 1);
-        // Just in case waiting here for one more second,
-        // won't hurt, we've already waited for 10
-        HAL_Delay_Milliseconds(1000);
-        // IMPORTANT: R4 is powered-off after applying RESET!
+        // IMPORTANT: R4 is powered-off after applying RESET! Wait up to one more second
+        // for VINT to confirm that
+        bringup_.waitPowerState(false, 1000);
         if (!powerOff) {
             LOG(TRACE, "Powering on the modem after the hard reset");
             return modemPowerOn();
@@ -20,6 +20,7 @@
 #include <cstdlib>
 
 #include "network/ncp/cellular/cellular_ncp_client.h"
+#include "network/ncp/cellular/modem_bringup.h"
 #include "platform_ncp.h"
 
 #include "at_parser.h"
@@ -67,6 +68,7 @@ public:
 
 private:
     AtParser parser_;
+    ModemBringup bringup_;
     std::unique_ptr<SerialStream> serial_;
     RecursiveMutex mutex_;
     CellularNcpClientConfig conf_;
@@ -100,7 +102,6 @@ private:
     int checkParser();
     int waitReady();
     int initReady();
-    int waitAtResponse(unsigned int timeout, unsigned int period = 1000);
     int selectSimCard();
     int checkSimCard();
     int configureApn(const CellularNetworkConfig& conf);
@@ -116,7 +117,7 @@ private:
     int processEventsImpl();
 
     int modemInit() const;
-    int modemPowerOn() const;
+    int modemPowerOn();
     int modemPowerOff();
     int modemHardReset(bool powerOff = false);
     bool modemPowerState() const;
@@ -382,9 +382,19 @@ static hal_update_complete_t flash_bootloader(hal_module_t* mod, uint32_t module
 int HAL_FLASH_OTA_Validate(hal_module_t* mod, bool userDepsOptional, module_validation_flags_t flags, void* reserved)
 {
     hal_module_t module;
+    flash_crc32_stats_t crcBefore = {};
+    FLASH_GetCRC32Stats(&crcBefore);
 
     bool module_fetched = fetch_module(&module, &module_ota, userDepsOptional, flags);
 
+    if (flags & MODULE_VALIDATION_INTEGRITY)
+    {
+        flash_crc32_stats_t crcAfter = {};
+        FLASH_GetCRC32Stats(&crcAfter);
+        LOG_DEBUG(TRACE, "OTA module CRC: %u bytes verified in %u us", (unsigned)(crcAfter.bytes - crcBefore.bytes),
+                (unsigned)(crcAfter.time_us - crcBefore.time_us));
+    }
+
     if (mod) 
     {
         memcpy(mod, &module, sizeof(hal_module_t));
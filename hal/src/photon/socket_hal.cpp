@@ -331,7 +331,8 @@ private:
     tcp_server_client_t* clients[WICED_MAXIMUM_NUMBER_OF_SERVER_SOCKETS];
 
     os_mutex_recursive_t accept_lock;
-    spark::Vector<int> to_accept;
+    // Clients waiting for next_accept(). There is normally at most one per socket, so they are kept inline
+    spark::Vector<int, spark::DefaultAllocator, WICED_MAXIMUM_NUMBER_OF_SERVER_SOCKETS> to_accept;
 };
 
 void tcp_server_client_t::close() {
@@ -1705,6 +1705,14 @@ int HAL_Core_Enter_Panic_Mode(void* reserved)
 
 retained_system SessionPersistDataOpaque session;
 
+typedef struct TransferPersistData
+{
+	uint16_t size;
+	uint8_t data[HAL_SYSTEM_BACKUP_TRANSFER_SIZE];
+} TransferPersistData;
+
+retained_system TransferPersistData transfer;
+
 int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, void* reserved)
 {
 	if (offset==0 && length==sizeof(SessionPersistDataOpaque))
@@ -1712,6 +1720,14 @@ int HAL_System_Backup_Save(size_t offset, const void* buffer, size_t length, voi
 		memcpy(&session, buffer, length);
 		return 0;
 	}
+	if (offset==HAL_SYSTEM_BACKUP_TRANSFER_OFFSET && length<=sizeof(transfer.data))
+	{
+		// saving zero bytes clears the state
+		if (length)
+			memcpy(transfer.data, buffer, length);
+		transfer.size = length;
+		return 0;
+	}
 	return -1;
 }
 
@@ -1723,6 +1739,12 @@ int HAL_System_Backup_Restore(size_t offset, void* buffer, size_t max_length, si
 		memcpy(buffer, &session, sizeof(session));
 		return 0;
 	}
+	if (offset==HAL_SYSTEM_BACKUP_TRANSFER_OFFSET && transfer.size && transfer.size<=sizeof(transfer.data) && max_length>=transfer.size)
+	{
+		*length = transfer.size;
+		memcpy(buffer, transfer.data, transfer.size);
+		return 0;
+	}
 	return -1;
 }
 
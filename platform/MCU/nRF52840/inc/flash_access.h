@@ -65,6 +65,24 @@ uint16_t FLASH_ModuleVersion(flash_device_t flashDeviceID, uint32_t startAddress
 bool FLASH_isUserModuleInfoValid(uint8_t flashDeviceID, uint32_t startAddress, uint32_t expectedAddress);
 bool FLASH_VerifyCRC32(flash_device_t flashDeviceID, uint32_t startAddress, uint32_t length);
 
+/**
+ * Updates the CRC with the data in the given region of flash. Serial flash is read in large blocks.
+ * @param crc   the CRC to update. Set to 0 to start a new CRC.
+ * @return 0 on success
+ */
+int FLASH_ComputeCRC32(flash_device_t flashDeviceID, uint32_t startAddress, uint32_t length, uint32_t* crc);
+
+/**
+ * Time spent verifying module CRCs since reset.
+ */
+typedef struct flash_crc32_stats_t {
+    uint32_t count;         // number of verifications
+    uint32_t bytes;         // total number of bytes verified
+    uint32_t time_us;       // total time spent, in microseconds
+} flash_crc32_stats_t;
+
+void FLASH_GetCRC32Stats(flash_crc32_stats_t* stats);
+
 // Old routine signature for Photon
 void FLASH_ClearFlags(void);
 void FLASH_Erase(void);
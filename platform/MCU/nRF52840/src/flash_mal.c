@@ -38,6 +38,9 @@
 
 #define MAX_COPY_LENGTH     256
 
+// size of the blocks read from serial flash when computing a CRC
+#define CRC_READ_LENGTH     512
+
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -575,49 +578,89 @@ bool FLASH_isUserModuleInfoValid(uint8_t flashDeviceID, uint32_t startAddress, u
             && (module_info->platform_id==PLATFORM_ID));
 }
 
-bool FLASH_VerifyCRC32(uint8_t flashDeviceID, uint32_t startAddress, uint32_t length)
+static flash_crc32_stats_t crc32_stats;
+
+int FLASH_ComputeCRC32(flash_device_t flashDeviceID, uint32_t startAddress, uint32_t length, uint32_t* crc)
 {
-    if(flashDeviceID == FLASH_INTERNAL && length > 0)
+    if (flashDeviceID == FLASH_INTERNAL)
     {
-        uint32_t expectedCRC = __REV((*(__IO uint32_t*) (startAddress + length)));
-        uint32_t computedCRC = Compute_CRC32((uint8_t*)startAddress, length, NULL);
-
-        if (expectedCRC == computedCRC)
-        {
-            return true;
-        }
+        *crc = Compute_CRC32((const uint8_t*)startAddress, length, crc);
+        return 0;
     }
 #ifdef USE_SERIAL_FLASH
-    else if(flashDeviceID == FLASH_SERIAL && length > 0)
+    else if (flashDeviceID == FLASH_SERIAL)
     {
-        uint8_t serialFlashData[4]; // FIXME: Use XIP or a larger buffer
-        hal_exflash_read((startAddress + length), serialFlashData, 4);
-        uint32_t expectedCRC = (uint32_t)(serialFlashData[3] | (serialFlashData[2] << 8) | (serialFlashData[1] << 16) | (serialFlashData[0] << 24));
-
-        uint32_t endAddress = startAddress + length;
-        uint32_t len = 0;
-        uint32_t computedCRC = 0;
-
-        do {
-            len = endAddress - startAddress;
-            if (len > sizeof(serialFlashData)) {
-                len = sizeof(serialFlashData);
+        uint32_t buffer[CRC_READ_LENGTH / sizeof(uint32_t)];
+        const uint32_t endAddress = startAddress + length;
+        while (startAddress < endAddress)
+        {
+            // read up to the next block boundary, so that all reads after the first one are aligned
+            uint32_t len = CRC_READ_LENGTH - (startAddress % CRC_READ_LENGTH);
+            if (len > endAddress - startAddress)
+            {
+                len = endAddress - startAddress;
             }
-            hal_exflash_read(startAddress, serialFlashData, len);
-
-            computedCRC = Compute_CRC32(serialFlashData, len, &computedCRC);
-
+            if (hal_exflash_read(startAddress, (uint8_t*)buffer, len))
+            {
+                return -1;
+            }
+            *crc = Compute_CRC32((const uint8_t*)buffer, len, crc);
             startAddress += len;
-        } while (startAddress < endAddress);
+        }
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+bool FLASH_VerifyCRC32(uint8_t flashDeviceID, uint32_t startAddress, uint32_t length)
+{
+    if (length == 0)
+    {
+        return false;
+    }
+#ifdef USE_SERIAL_FLASH
+    if (flashDeviceID == FLASH_INTERNAL && startAddress >= EXTERNAL_FLASH_XIP_BASE)
+    {
+        // modules mapped through XIP are read with bulk transfers rather than through the XIP cache
+        flashDeviceID = FLASH_SERIAL;
+        startAddress -= EXTERNAL_FLASH_XIP_BASE;
+    }
+#endif
 
-        if (expectedCRC == computedCRC)
+    const uint32_t startTicks = SYSTEM_TICK_COUNTER;
+    uint8_t crcData[4];
+    if (flashDeviceID == FLASH_INTERNAL)
+    {
+        memcpy(crcData, (const uint8_t*)(startAddress + length), sizeof(crcData));
+    }
+#ifdef USE_SERIAL_FLASH
+    else if (flashDeviceID == FLASH_SERIAL)
+    {
+        if (hal_exflash_read(startAddress + length, crcData, sizeof(crcData)))
         {
-            return true;
+            return false;
         }
+    }
 #endif
+    else
+    {
+        return false;
     }
+    // the CRC is stored big endian after the module
+    const uint32_t expectedCRC = (uint32_t)(crcData[3] | (crcData[2] << 8) | (crcData[1] << 16) | (crcData[0] << 24));
+    uint32_t computedCRC = 0;
+    const bool valid = !FLASH_ComputeCRC32(flashDeviceID, startAddress, length, &computedCRC) && expectedCRC == computedCRC;
+
+    crc32_stats.count++;
+    crc32_stats.bytes += length;
+    crc32_stats.time_us += (SYSTEM_TICK_COUNTER - startTicks) / SYSTEM_US_TICKS;
+    return valid;
+}
 
-    return false;
+void FLASH_GetCRC32Stats(flash_crc32_stats_t* stats)
+{
+    *stats = crc32_stats;
 }
 
 void FLASH_ClearFlags(void)
@@ -139,6 +139,66 @@ private:
     size_t dataSize_;
 };
 
+// Buffer appender that stores only the part of the data that falls within the window
+// [offset, offset + size) and counts the total size of the data. Regenerating some content
+// with successive windows allows it to be transferred in parts without holding all of it in RAM
+class WindowAppender: public Appender {
+public:
+    WindowAppender(uint8_t* buf, size_t size, size_t offset) :
+            buf_(buf),
+            bufSize_(size),
+            offset_(offset),
+            dataSize_(0) {
+    }
+
+    virtual bool append(const uint8_t* data, size_t size) override {
+        const size_t end = dataSize_ + size;
+        if (end > offset_ && dataSize_ < offset_ + bufSize_) {
+            const size_t skip = (dataSize_ < offset_) ? offset_ - dataSize_ : 0;
+            const size_t pos = dataSize_ + skip - offset_;
+            size_t n = size - skip;
+            if (n > bufSize_ - pos) {
+                n = bufSize_ - pos;
+            }
+            memcpy(buf_ + pos, data + skip, n);
+        }
+        dataSize_ = end;
+        return true;
+    }
+
+    uint8_t* buffer() const {
+        return buf_;
+    }
+
+    size_t bufferSize() const {
+        return bufSize_;
+    }
+
+    size_t offset() const {
+        return offset_;
+    }
+
+    // Returns the number of bytes stored in the buffer
+    size_t size() const {
+        if (dataSize_ <= offset_) {
+            return 0;
+        }
+        const size_t n = dataSize_ - offset_;
+        return (n < bufSize_) ? n : bufSize_;
+    }
+
+    // Returns the total size of the data, including the parts outside of the window
+    size_t dataSize() const {
+        return dataSize_;
+    }
+
+private:
+    uint8_t* const buf_;
+    const size_t bufSize_;
+    const size_t offset_;
+    size_t dataSize_;
+};
+
 } // namespace particle
 
 #endif // defined(__cplusplus)
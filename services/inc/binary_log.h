@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Binary log records keep the arguments of a log message instead of the formatted text. The
+    format string and the category are stored as addresses, so the text can only be
+    reconstructed by the firmware itself or by a tool that has access to its ELF file (see
+    build/decode_binary_log.py).
+
+    Record layout (all fields are in the native byte order of the device):
+
+        log_binary_header
+        format string address (word)
+        category name address (word, 0 if no category)
+        arguments
+
+    The arguments are stored in the order of the conversion specifications of the format string:
+
+        d, i, o, u, x, X, c - 4 bytes; 8 bytes with the ll and j modifiers, one word with the l,
+            z and t modifiers
+        p - one word
+        e, E, f, F, g, G, a, A - 8 bytes (double)
+        s - 1 byte length followed by the characters, without the terminating null
+        * (width or precision) - 4 bytes
+
+    A word is the size of a pointer on the device, see LOG_BINARY_WORD_SIZE_MASK.
+*/
+
+#define LOG_BINARY_WORD_SIZE_MASK 0x0f // log_binary_header::flags: size of a pointer
+#define LOG_BINARY_FLAG_TRUNCATED 0x80 // log_binary_header::flags: some arguments didn't fit the record
+
+#define LOG_BINARY_MAX_STRING_LENGTH 255
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct __attribute__((packed)) log_binary_header {
+    uint16_t size; // Record size, including this header
+    uint8_t level; // Log level
+    uint8_t flags; // Record flags
+    uint32_t time; // Timestamp
+} log_binary_header;
+
+// Decoded record attributes
+typedef struct log_binary_info {
+    int level;
+    uint32_t time;
+    const char* category;
+} log_binary_info;
+
+// Returns the string located at the given address of the firmware that produced a record
+typedef const char* (*log_binary_resolve_fn)(uint64_t addr, void* data);
+
+// Encodes a log message into a binary record. Returns the record size, or a negative result
+// code in case of an error
+int log_binary_encode(char* buf, size_t size, int level, const char* category, uint32_t time,
+        const char* fmt, va_list args);
+
+// Formats the message stored in a binary record. If `resolve` is NULL, the addresses stored
+// in the record are used as is, which is only valid for records produced by the running firmware.
+// Returns the length of the message, or a negative result code in case of an error
+int log_binary_decode(const char* data, size_t size, char* buf, size_t bufSize, log_binary_info* info,
+        log_binary_resolve_fn resolve, void* resolveData);
+
+#ifdef __cplusplus
+} // extern "C"
+
+#include "spark_wiring_interrupts.h"
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle {
+
+/**
+ * Ring buffer of binary log records.
+ *
+ * When the buffer is full, the oldest records are discarded to make room for new ones. The
+ * buffer can be written from interrupt handlers.
+ */
+class BinaryLogBuffer {
+public:
+    BinaryLogBuffer(char* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            head_(0),
+            tail_(0),
+            used_(0),
+            dropped_(0) {
+    }
+
+    ~BinaryLogBuffer() {
+        stop();
+    }
+
+    // Starts collecting the log messages of the given level and higher
+    void start(int level = LOG_LEVEL_ALL) {
+        log_set_binary_callback(logRecord, level, this, nullptr);
+    }
+
+    void stop() {
+        log_set_binary_callback(nullptr, LOG_LEVEL_NONE, nullptr, nullptr);
+    }
+
+    // Appends a record to the buffer
+    void write(const char* data, size_t size) {
+        if (size > size_) {
+            ++dropped_;
+            return;
+        }
+        ATOMIC_BLOCK() {
+            while (size_ - used_ < size) {
+                uint16_t n = 0;
+                copyFrom(tail_, (char*)&n, sizeof(n));
+                tail_ = (tail_ + n) % size_;
+                used_ -= n;
+                ++dropped_;
+            }
+            copyTo(head_, data, size);
+            head_ = (head_ + size) % size_;
+            used_ += size;
+        }
+    }
+
+    // Takes the oldest record from the buffer. Returns the record size, 0 if the buffer is
+    // empty, or SYSTEM_ERROR_TOO_LARGE if the record doesn't fit the destination buffer
+    int read(char* data, size_t size) {
+        int result = 0;
+        ATOMIC_BLOCK() {
+            uint16_t n = 0;
+            if (used_) {
+                copyFrom(tail_, (char*)&n, sizeof(n));
+            }
+            if (n > size) {
+                result = SYSTEM_ERROR_TOO_LARGE;
+            } else if (n) {
+                copyFrom(tail_, data, n);
+                tail_ = (tail_ + n) % size_;
+                used_ -= n;
+                result = n;
+            }
+        }
+        return result;
+    }
+
+    // Moves all records to a queue that provides a `pushBack(void*, uint16_t)` method, such as
+    // fs::FileQueue. Each record becomes a separate queue entry
+    template<typename QueueT>
+    int flush(QueueT& queue) {
+        char data[LOG_MAX_STRING_LENGTH];
+        int n = 0;
+        while ((n = read(data, sizeof(data))) > 0) {
+            const int ret = queue.pushBack(data, n);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        return n;
+    }
+
+    // Returns the number of bytes used by the records
+    size_t size() const {
+        return used_;
+    }
+
+    // Returns the number of records discarded because the buffer was full
+    unsigned dropped() const {
+        return dropped_;
+    }
+
+private:
+    char* buf_;
+    size_t size_;
+    volatile size_t head_;
+    volatile size_t tail_;
+    volatile size_t used_;
+    volatile unsigned dropped_;
+
+    void copyTo(size_t offs, const char* data, size_t size) {
+        const size_t n = std::min(size, size_ - offs);
+        memcpy(buf_ + offs, data, n);
+        memcpy(buf_, data + n, size - n);
+    }
+
+    void copyFrom(size_t offs, char* data, size_t size) const {
+        const size_t n = std::min(size, size_ - offs);
+        memcpy(data, buf_ + offs, n);
+        memcpy(data + n, buf_, size - n);
+    }
+
+    static void logRecord(const char* data, size_t size, void* ctx) {
+        static_cast<BinaryLogBuffer*>(ctx)->write(data, size);
+    }
+};
+
+} // namespace particle
+
+#endif // defined(__cplusplus)
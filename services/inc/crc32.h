@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of lookup tables used to compute the CRC. With 8 tables (8KB) the CRC is computed
+ * 8 bytes at a time. A single table (1KB) computes the CRC a byte at a time, which suits modules
+ * where code size matters more than speed, such as the bootloader.
+ */
+#ifndef CRC32_SLICES
+#define CRC32_SLICES 8
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Updates a CRC32 (IEEE 802.3) with more data. Pass 0 as the initial CRC, and the result of
+ * the previous call to continue computing the CRC of a stream of data.
+ */
+uint32_t crc32_update(uint32_t crc, const void* data, size_t size);
+
+/**
+ * Computes the CRC32 (IEEE 802.3) of the given data.
+ */
+uint32_t crc32_compute(const void* data, size_t size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
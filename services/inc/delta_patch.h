@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    A delta patch describes a module binary (the target) in terms of a module that is already
+    installed on the device (the source), so that an update which changes a small part of a
+    module only needs to transfer that part. Patches are generated by build/create_patch.py.
+
+    Patch layout (all integers are little-endian):
+
+        offset  size  field
+        0       4     magic, "PDLT"
+        4       1     format version (1)
+        5       3     reserved, 0
+        8       4     size of the source module, excluding its CRC
+        12      4     CRC32 of the source module, as stored at the end of the module
+        16      4     size of the target
+        20      4     CRC32 of the target
+        24            commands
+
+    The commands are applied in order until the entire target has been produced:
+
+        0x01 COPY    offset, length  - copies bytes of the source. The offset is relative to the
+                                       end of the previous COPY command (or to the start of the
+                                       source for the first one), and is zigzag encoded
+        0x02 INSERT  length, data    - inserts the bytes that follow the command
+
+    Offsets and lengths are variable-length integers, 7 bits per byte, least significant group
+    first, with the high bit set in all bytes except the last.
+
+    The patch is applied as a stream: the commands may be split across any number of calls to
+    DeltaPatch::update(), and the target is written in order, so no more than a small fixed
+    buffer is needed regardless of the size of the module.
+*/
+
+namespace particle {
+
+/**
+ * Provides access to the source module and receives the target produced by a patch.
+ */
+class DeltaPatchHandler {
+public:
+    virtual ~DeltaPatchHandler() = default;
+
+    /**
+     * Called when the patch header has been read. Finds the module the patch applies to, and
+     * prepares the storage for the target.
+     *
+     * @return 0 on success, or a negative result code if the source module isn't installed.
+     */
+    virtual int begin(uint32_t sourceSize, uint32_t sourceCrc, uint32_t targetSize) = 0;
+
+    /**
+     * Reads the source module.
+     */
+    virtual int read(uint32_t offset, uint8_t* data, size_t size) = 0;
+
+    /**
+     * Writes the next part of the target.
+     */
+    virtual int write(const uint8_t* data, size_t size) = 0;
+};
+
+/**
+ * Applies a delta patch.
+ */
+class DeltaPatch {
+public:
+    static const uint32_t MAGIC = 0x544c4450; // "PDLT"
+    static const uint8_t VERSION = 1;
+    static const size_t HEADER_SIZE = 24;
+
+    /**
+     * The size of the buffer used to copy parts of the source to the target.
+     */
+    static const size_t BUFFER_SIZE = 128;
+
+    enum Command {
+        COPY = 0x01,
+        INSERT = 0x02
+    };
+
+    explicit DeltaPatch(DeltaPatchHandler* handler);
+
+    /**
+     * Applies the next part of the patch.
+     *
+     * @return 0 on success, or a negative result code. The patch can't be applied further after
+     *      an error.
+     */
+    int update(const uint8_t* data, size_t size);
+
+    /**
+     * Checks that the entire target has been produced and that its CRC matches the one in the
+     * patch header.
+     */
+    int finish();
+
+    /**
+     * Returns the number of bytes of the patch applied so far.
+     */
+    size_t patchSize() const {
+        return patchSize_;
+    }
+
+    /**
+     * Returns the number of bytes of the target written so far.
+     */
+    size_t targetWritten() const {
+        return targetWritten_;
+    }
+
+    /**
+     * Returns the size of the target, or 0 if the header hasn't been read yet.
+     */
+    size_t targetSize() const {
+        return targetSize_;
+    }
+
+    /**
+     * Returns `true` if the data starts with the magic number of a patch.
+     */
+    static bool isPatch(const uint8_t* data, size_t size);
+
+private:
+    enum State {
+        HEADER,
+        COMMAND,
+        COPY_OFFSET,
+        COPY_LENGTH,
+        INSERT_LENGTH,
+        INSERT_DATA,
+        DONE,
+        FAILED
+    };
+
+    DeltaPatchHandler* handler_;
+    uint8_t buf_[BUFFER_SIZE];
+    State state_;
+    size_t patchSize_;
+    uint32_t sourceSize_;
+    uint32_t sourceCrc_;
+    uint32_t targetSize_;
+    uint32_t targetCrc_;
+    uint32_t targetWritten_;
+    uint32_t crc_; // CRC of the target written so far
+    uint32_t sourceOffset_; // End of the previous COPY command
+    uint32_t copyOffset_;
+    uint32_t length_; // Length of the current command
+    uint32_t value_; // Variable-length integer being decoded
+    unsigned shift_;
+
+    int readHeader(const uint8_t* data, size_t size, size_t* consumed);
+    int readValue(uint8_t b, bool* complete);
+    int copy();
+    int write(const uint8_t* data, size_t size);
+    void commandDone();
+    int fail(int error);
+};
+
+} // namespace particle
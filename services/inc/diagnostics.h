@@ -48,6 +48,13 @@
 #define DIAG_NAME_NETWORK_CELLULAR_CELL_GLOBAL_IDENTITY_MOBILE_NETWORK_CODE "net:cell:cgi:mnc"
 #define DIAG_NAME_NETWORK_CELLULAR_CELL_GLOBAL_IDENTITY_LOCATION_AREA_CODE "net:cell:cgi:lac"
 #define DIAG_NAME_NETWORK_CELLULAR_CELL_GLOBAL_IDENTITY_CELL_ID "net:cell:cgi:ci"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_TIME "net:cell:init"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_POWER_ON_TIME "net:cell:init:pwr"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_AT_READY_TIME "net:cell:init:at"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_CONFIG_TIME "net:cell:init:cfg"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_RESTART_TIME "net:cell:init:rst"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_SIM_READY_TIME "net:cell:init:sim"
+#define DIAG_NAME_NETWORK_CELLULAR_INIT_MUXER_TIME "net:cell:init:mux"
 #define DIAG_NAME_CLOUD_CONNECTION_STATUS "cloud:stat"
 #define DIAG_NAME_CLOUD_CONNECTION_ERROR_CODE "cloud:err"
 #define DIAG_NAME_CLOUD_DISCONNECTS "cloud:dconn"
@@ -56,6 +63,11 @@
 #define DIAG_NAME_CLOUD_REPEATED_MESSAGES "coap:resend"
 #define DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES "coap:unack"
 #define DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS "pub:limit"
+#define DIAG_NAME_CLOUD_DEFERRED_EVENTS "pub:defer"
+#define DIAG_NAME_CLOUD_MESSAGE_POOL_HIGH_WATER_MARK "coap:pool:max"
+#define DIAG_NAME_CLOUD_MESSAGE_POOL_EXHAUSTED "coap:pool:exh"
+#define DIAG_NAME_LOG_QUEUE_OVERFLOWS "log:ovf"
+#define DIAG_NAME_LOG_DROPPED_MESSAGES "log:drop"
 #define DIAG_NAME_SYSTEM_TOTAL_RAM "sys:tram"
 #define DIAG_NAME_SYSTEM_USED_RAM "sys:uram"
 
@@ -93,6 +105,13 @@ typedef enum diag_id {
     DIAG_ID_NETWORK_CELLULAR_CELL_GLOBAL_IDENTITY_MOBILE_NETWORK_CODE = 41, // net:cell:cgi:mnc
     DIAG_ID_NETWORK_CELLULAR_CELL_GLOBAL_IDENTITY_LOCATION_AREA_CODE = 42, // net:cell:cgi:lac
     DIAG_ID_NETWORK_CELLULAR_CELL_GLOBAL_IDENTITY_CELL_ID = 43, // net:cell:cgi:ci
+    DIAG_ID_NETWORK_CELLULAR_INIT_TIME = 49, // net:cell:init
+    DIAG_ID_NETWORK_CELLULAR_INIT_POWER_ON_TIME = 50, // net:cell:init:pwr
+    DIAG_ID_NETWORK_CELLULAR_INIT_AT_READY_TIME = 51, // net:cell:init:at
+    DIAG_ID_NETWORK_CELLULAR_INIT_CONFIG_TIME = 52, // net:cell:init:cfg
+    DIAG_ID_NETWORK_CELLULAR_INIT_RESTART_TIME = 53, // net:cell:init:rst
+    DIAG_ID_NETWORK_CELLULAR_INIT_SIM_READY_TIME = 54, // net:cell:init:sim
+    DIAG_ID_NETWORK_CELLULAR_INIT_MUXER_TIME = 55, // net:cell:init:mux
     DIAG_ID_CLOUD_CONNECTION_STATUS = 10, // cloud:stat
     DIAG_ID_CLOUD_CONNECTION_ERROR_CODE = 13, // cloud:err
     DIAG_ID_CLOUD_DISCONNECTS = 14, // cloud:dconn
@@ -101,6 +120,11 @@ typedef enum diag_id {
     DIAG_ID_CLOUD_REPEATED_MESSAGES = 21, // coap:resend
     DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES = 22, // coap:unack
     DIAG_ID_CLOUD_RATE_LIMITED_EVENTS = 20, // pub:throttle
+    DIAG_ID_CLOUD_DEFERRED_EVENTS = 46, // pub:defer
+    DIAG_ID_CLOUD_MESSAGE_POOL_HIGH_WATER_MARK = 44, // coap:pool:max
+    DIAG_ID_CLOUD_MESSAGE_POOL_EXHAUSTED = 45, // coap:pool:exh
+    DIAG_ID_LOG_QUEUE_OVERFLOWS = 47, // log:ovf
+    DIAG_ID_LOG_DROPPED_MESSAGES = 48, // log:drop
     DIAG_ID_SYSTEM_TOTAL_RAM = 25, // sys:tram
     DIAG_ID_SYSTEM_USED_RAM = 26, // sys:uram
     DIAG_ID_USER = 32768 // Base value for application-specific source IDs
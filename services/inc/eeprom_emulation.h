@@ -22,6 +22,7 @@
 
 #include <cstring>
 #include <memory>
+#include <new>
 #include <vector>
 #include <limits>
 
@@ -47,6 +48,15 @@
  * Reading involves going through the list of valid records in the
  * active page looking for the last record with a specified index.
  *
+ * To avoid scanning the whole page on every read and write, a RAM index
+ * holding the latest value of each byte is built from the active page
+ * in init(). It is extended with the records appended by each write and
+ * rebuilt after a page swap, so reads are a copy from RAM and writes
+ * know where to append without scanning. The index costs capacity()
+ * bytes of heap and can be disabled with the UseIndex template
+ * parameter. When it can't be allocated, reads and writes fall back to
+ * scanning the page.
+ *
  * When writing a new value and there is no more room in the current
  * page to append new records, a page swap occurs as follows:
  * - The alternate page is erased if necessary
@@ -91,7 +101,7 @@
  *
  */
 
-template <typename Store, uintptr_t PageBase1, size_t PageSize1, uintptr_t PageBase2, size_t PageSize2>
+template <typename Store, uintptr_t PageBase1, size_t PageSize1, uintptr_t PageBase2, size_t PageSize2, bool UseIndex = true>
 class EEPROMEmulation
 {
 public:
@@ -179,6 +189,10 @@ public:
         {
             clear();
         }
+        else
+        {
+            buildIndex();
+        }
     }
 
     // Read the latest value of a byte of EEPROM in data or 0xFF if the
@@ -222,6 +236,7 @@ public:
         writePageStatus(LogicalPage::Page1, PageHeader::ACTIVE);
 
         updateActivePage();
+        buildIndex();
     }
 
     // Returns number of bytes that can be stored in EEPROM
@@ -337,6 +352,12 @@ public:
     // Iterate through a page to extract the latest value of each address
     void readRange(Index indexBegin, Data *data, uint16_t length)
     {
+        if(hasIndex() && (size_t)indexBegin + length <= capacity())
+        {
+            std::memcpy(data, &index[indexBegin], length);
+            return;
+        }
+
         std::memset(data, FLASH_ERASED, length);
 
         Index indexEnd = indexBegin + length;
@@ -359,23 +380,44 @@ public:
             return;
         }
 
-        // Read existing values for range
-        std::unique_ptr<Data[]> existingData(new Data[length]);
-        // don't write anything if memory is full
-        if(!existingData)
+        Address writeAddressBegin;
+        bool success;
+        std::unique_ptr<Data[]> existingData;
+        const Data *existing;
+
+        if(hasIndex())
         {
-            return;
+            // The index already knows the existing values and where
+            // the next record goes
+            existing = &index[indexBegin];
+            writeAddressBegin = indexEndAddress;
+            success = !indexHasInvalidRecords;
         }
+        else
+        {
+            // Read existing values for range
+            existingData.reset(new (std::nothrow) Data[length]);
+            // don't write anything if memory is full
+            if(!existingData)
+            {
+                return;
+            }
+            existing = existingData.get();
 
-        Address writeAddressBegin;
-
-        // Read the data and make sure there are no previous invalid
-        // records before starting to write
-        bool success = readRangeAndFindEmpty(getActivePage(),
-                existingData.get(), indexBegin, length, writeAddressBegin);
+            // Read the data and make sure there are no previous invalid
+            // records before starting to write
+            success = readRangeAndFindEmpty(getActivePage(),
+                    existingData.get(), indexBegin, length, writeAddressBegin);
+        }
 
         // Write records for all new values
-        success = success && writeRangeChanged(writeAddressBegin, indexBegin, data, existingData.get(), length);
+        success = success && writeRangeChanged(writeAddressBegin, indexBegin, data, existing, length);
+
+        // Add the records that were written to the index
+        if(success && hasIndex())
+        {
+            updateIndex();
+        }
 
         // If any writes failed because the page was full or a marginal
         // write error occured, do a page swap then write all the
@@ -682,10 +724,12 @@ public:
             if(success)
             {
                 updateActivePage();
+                buildIndex();
                 return true;
             }
         }
 
+        buildIndex();
         return false;
     }
 
@@ -750,10 +794,81 @@ public:
         }
     }
 
+    // Whether reads and writes can use the RAM index of the active page
+    bool hasIndex()
+    {
+        return UseIndex && index;
+    }
+
+    // Rebuild the RAM index from the records of the active page
+    void buildIndex()
+    {
+        if(!UseIndex)
+        {
+            return;
+        }
+
+        if(getActivePage() == LogicalPage::NoPage)
+        {
+            index.reset();
+            return;
+        }
+
+        if(!index)
+        {
+            // Without an index, reads and writes scan the page instead
+            index.reset(new (std::nothrow) Data[capacity()]);
+            if(!index)
+            {
+                return;
+            }
+        }
+
+        std::memset(index.get(), FLASH_ERASED, capacity());
+        indexEndAddress = getPageBegin(getActivePage()) + sizeof(PageHeader);
+        indexHasInvalidRecords = false;
+
+        updateIndex();
+    }
+
+    // Add the valid records following the last indexed record to the
+    // index. Like forEachValidRecord, stop at the first record that
+    // isn't valid.
+    void updateIndex()
+    {
+        Address endAddress = getPageEnd(getActivePage());
+
+        while(indexEndAddress < endAddress)
+        {
+            const Record &record = *(const Record *) store.dataAt(indexEndAddress);
+            if(!record.valid())
+            {
+                indexHasInvalidRecords = !record.empty();
+                return;
+            }
+
+            // Records beyond the capacity can't be written anymore and
+            // are only read by scanning the page
+            if(record.index < capacity())
+            {
+                index[record.index] = record.data;
+            }
+
+            indexEndAddress += sizeof(Record);
+        }
+    }
+
     // Hardware-dependent interface to read, erase and program memory
     Store store;
 
 protected:
     LogicalPage activePage;
     LogicalPage alternatePage;
+
+    // Latest value of each byte in the active page
+    std::unique_ptr<Data[]> index;
+    // Address following the last valid record of the active page
+    Address indexEndAddress;
+    // Whether a record that isn't valid follows the last valid record
+    bool indexHasInvalidRecords;
 };
@@ -193,6 +193,9 @@ typedef void (*log_write_callback_type)(const char *data, size_t size, int level
 // Callback invoked to check whether logging is enabled for particular level and category (used by log_enabled())
 typedef int (*log_enabled_callback_type)(int level, const char *category, void *reserved);
 
+// Callback for binary logging (used by log_message(), see binary_log.h)
+typedef void (*log_binary_callback_type)(const char *data, size_t size, void *callback_data);
+
 // Generates log message
 void log_message(int level, const char *category, LogAttributes *attr, void *reserved, const char *fmt, ...);
 
@@ -222,6 +225,11 @@ const char* log_level_name(int level, void *reserved);
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
         log_enabled_callback_type log_enabled, void *reserved);
 
+// Sets the callback for binary logging. While the callback is set, log_message() encodes the
+// messages of the given level and higher into binary records instead of formatting them, and
+// the message callback is not invoked
+void log_set_binary_callback(log_binary_callback_type callback, int level, void *callback_data, void *reserved);
+
 extern void HAL_Delay_Microseconds(uint32_t delay);
 
 #ifdef __cplusplus
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+
+/**
+ * Bounded lock-free queue with multiple producers and a single consumer.
+ *
+ * Producers reserve an element, fill in its value and commit it. Reserving and committing
+ * don't block and can be done from any thread or interrupt handler. The consumer takes
+ * the committed values in the order they were reserved.
+ *
+ * Each element carries a sequence number telling whether it is free for the producers or
+ * ready for the consumer (see Dmitry Vyukov's bounded MPMC queue).
+ */
+template<typename T, size_t SizeT>
+class MpscQueue {
+public:
+    static_assert(SizeT > 0 && (SizeT & (SizeT - 1)) == 0, "Queue size must be a power of 2");
+
+    // Element of the queue reserved by a producer
+    class Element {
+    public:
+        T value;
+
+    private:
+        std::atomic<size_t> seq;
+
+        friend class MpscQueue;
+    };
+
+    MpscQueue() :
+            head_(0),
+            tail_(0) {
+        for (size_t i = 0; i < SizeT; ++i) {
+            elems_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Reserves an element at the back of the queue. Returns `nullptr` if the queue is full
+    Element* reserve() {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Element& elem = elems_[pos & (SizeT - 1)];
+            const size_t seq = elem.seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return &elem;
+                }
+            } else if (diff < 0) {
+                return nullptr; // The consumer hasn't taken this element yet
+            } else {
+                pos = head_.load(std::memory_order_relaxed); // Another producer took this element
+            }
+        }
+    }
+
+    // Makes an element returned by reserve() available to the consumer
+    void commit(Element* elem) {
+        elem->seq.store(elem->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Returns the value at the front of the queue, or `nullptr` if the queue is empty or the
+    // front element is still being filled in. Can only be called by the consumer
+    T* front() {
+        Element& elem = elems_[tail_ & (SizeT - 1)];
+        if (elem.seq.load(std::memory_order_acquire) != tail_ + 1) {
+            return nullptr;
+        }
+        return &elem.value;
+    }
+
+    // Frees the element at the front of the queue. Can only be called by the consumer
+    void pop() {
+        Element& elem = elems_[tail_ & (SizeT - 1)];
+        elem.seq.store(tail_ + SizeT, std::memory_order_release);
+        ++tail_;
+    }
+
+    static constexpr size_t size() {
+        return SizeT;
+    }
+
+private:
+    Element elems_[SizeT];
+    std::atomic<size_t> head_;
+    size_t tail_;
+};
+
+} // namespace particle
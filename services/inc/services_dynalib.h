@@ -110,6 +110,9 @@ DYNALIB_FN(55, services, pb_encode_varint, bool(pb_ostream_t*, pb_uint64_t))
 # define BASE_IDX 40
 #endif
 
+DYNALIB_FN(BASE_IDX + 0, services, log_set_binary_callback, void(log_binary_callback_type, int, void*, void*))
+DYNALIB_FN(BASE_IDX + 1, services, log_binary_decode, int(const char*, size_t, char*, size_t, log_binary_info*, log_binary_resolve_fn, void*))
+
 DYNALIB_END(services)
 
 #endif	/* SERVICES_DYNALIB_H */
@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binary_log.h"
+
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+
+namespace {
+
+static_assert(sizeof(void*) == sizeof(long) && sizeof(void*) == sizeof(size_t) &&
+        sizeof(void*) == sizeof(ptrdiff_t), "Unsupported word size");
+static_assert(sizeof(void*) <= LOG_BINARY_WORD_SIZE_MASK, "Unsupported word size");
+
+enum class Length {
+    NONE,
+    HH,
+    H,
+    L,
+    LL,
+    J,
+    Z,
+    T,
+    BIG_L
+};
+
+// Conversion specification of a format string
+struct Conversion {
+    const char* begin; // Points to the '%' character
+    const char* flags; // Points to the flag characters
+    size_t flagsLength;
+    int width; // Literal width, or -1
+    int precision; // Literal precision, or -1
+    bool starWidth;
+    bool starPrecision;
+    Length length;
+    char type; // Conversion character
+};
+
+// Finds the next conversion specification. Returns the position after the specification, or
+// nullptr if there are no more specifications
+const char* nextConversion(const char* fmt, Conversion* conv) {
+    fmt = strchr(fmt, '%');
+    if (!fmt) {
+        return nullptr;
+    }
+    conv->begin = fmt++;
+    conv->flags = fmt;
+    while (*fmt && strchr("-+ #0", *fmt)) {
+        ++fmt;
+    }
+    conv->flagsLength = fmt - conv->flags;
+    conv->width = -1;
+    conv->starWidth = false;
+    if (*fmt == '*') {
+        conv->starWidth = true;
+        ++fmt;
+    } else if (*fmt >= '0' && *fmt <= '9') {
+        conv->width = strtol(fmt, (char**)&fmt, 10);
+    }
+    conv->precision = -1;
+    conv->starPrecision = false;
+    if (*fmt == '.') {
+        ++fmt;
+        if (*fmt == '*') {
+            conv->starPrecision = true;
+            ++fmt;
+        } else {
+            conv->precision = strtol(fmt, (char**)&fmt, 10); // "%.f" has zero precision
+        }
+    }
+    conv->length = Length::NONE;
+    switch (*fmt) {
+    case 'h':
+        conv->length = (*++fmt == 'h') ? (++fmt, Length::HH) : Length::H;
+        break;
+    case 'l':
+        conv->length = (*++fmt == 'l') ? (++fmt, Length::LL) : Length::L;
+        break;
+    case 'j':
+        conv->length = Length::J;
+        ++fmt;
+        break;
+    case 'z':
+        conv->length = Length::Z;
+        ++fmt;
+        break;
+    case 't':
+        conv->length = Length::T;
+        ++fmt;
+        break;
+    case 'L':
+        conv->length = Length::BIG_L;
+        ++fmt;
+        break;
+    default:
+        break;
+    }
+    conv->type = *fmt;
+    if (*fmt) {
+        ++fmt;
+    }
+    return fmt;
+}
+
+bool isIntegerType(char type) {
+    return type && strchr("diouxXc", type);
+}
+
+bool isFloatType(char type) {
+    return type && strchr("eEfFgGaA", type);
+}
+
+// Returns the size of an integer argument in a record
+size_t integerSize(const Conversion& conv, size_t wordSize) {
+    if (conv.type == 'p') {
+        return wordSize;
+    }
+    switch (conv.length) {
+    case Length::LL:
+    case Length::J:
+        return 8;
+    case Length::L:
+    case Length::Z:
+    case Length::T:
+        return (conv.type == 'c') ? 4 : wordSize;
+    default:
+        return 4;
+    }
+}
+
+class Writer {
+public:
+    Writer(char* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            pos_(0) {
+    }
+
+    bool write(const void* data, size_t size) {
+        if (size_ - pos_ < size) {
+            return false;
+        }
+        memcpy(buf_ + pos_, data, size);
+        pos_ += size;
+        return true;
+    }
+
+    bool writeInteger(uint64_t val, size_t size) {
+        if (size == 4) {
+            const uint32_t v = val;
+            return write(&v, sizeof(v));
+        }
+        return write(&val, sizeof(val));
+    }
+
+    size_t pos() const {
+        return pos_;
+    }
+
+private:
+    char* buf_;
+    size_t size_;
+    size_t pos_;
+};
+
+class Reader {
+public:
+    Reader(const char* data, size_t size) :
+            data_(data),
+            size_(size),
+            pos_(0) {
+    }
+
+    bool read(void* data, size_t size) {
+        if (size_ - pos_ < size) {
+            return false;
+        }
+        memcpy(data, data_ + pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+    // Reads an integer of the given size and extends it to 64 bits
+    bool readInteger(uint64_t* val, size_t size, bool isSigned) {
+        if (size == 4) {
+            uint32_t v = 0;
+            if (!read(&v, sizeof(v))) {
+                return false;
+            }
+            *val = isSigned ? (uint64_t)(int64_t)(int32_t)v : v;
+            return true;
+        }
+        return read(val, sizeof(uint64_t));
+    }
+
+    const char* data() const {
+        return data_ + pos_;
+    }
+
+    bool skip(size_t size) {
+        if (size_ - pos_ < size) {
+            return false;
+        }
+        pos_ += size;
+        return true;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+};
+
+class Formatter {
+public:
+    Formatter(char* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            len_(0) {
+        if (size_) {
+            buf_[0] = '\0';
+        }
+    }
+
+    template<typename... ArgsT>
+    void printf(const char* fmt, ArgsT... args) {
+        const size_t avail = (len_ < size_) ? size_ - len_ : 0;
+        const int n = snprintf(avail ? buf_ + len_ : nullptr, avail, fmt, args...);
+        if (n > 0) {
+            len_ += n;
+        }
+    }
+
+    void append(const char* str, size_t size) {
+        if (len_ < size_) {
+            const size_t n = std::min(size, size_ - len_ - 1);
+            memcpy(buf_ + len_, str, n);
+            buf_[len_ + n] = '\0';
+        }
+        len_ += size;
+    }
+
+    // Returns the length of the formatted string. The string is marked with a '~' character
+    // if it didn't fit the buffer, similarly to log_message()
+    int finish(bool truncated) {
+        if (truncated) {
+            append("~", 1);
+        }
+        if (size_ && len_ > size_ - 1) {
+            if (size_ >= 2) {
+                buf_[size_ - 2] = '~';
+            }
+            len_ = size_ - 1;
+        }
+        return len_;
+    }
+
+private:
+    char* buf_;
+    size_t size_;
+    size_t len_;
+};
+
+// Builds a format string for a single argument from a parsed conversion specification. The
+// width and precision passed via '*' are substituted with their values
+void makeSpec(char* spec, size_t size, const Conversion& conv, const char* flags, bool hasWidth, int width,
+        bool hasPrecision, int precision, const char* length, char type) {
+    int n = snprintf(spec, size, "%%%.*s%s", (int)conv.flagsLength, conv.flags, flags);
+    if (hasWidth) {
+        n += snprintf(spec + n, size - n, (width < 0) ? "-%d" : "%d", std::abs(width));
+    }
+    if (hasPrecision) {
+        n += snprintf(spec + n, size - n, ".%d", precision);
+    }
+    snprintf(spec + n, size - n, "%s%c", length, type);
+}
+
+} // namespace
+
+int log_binary_encode(char* buf, size_t size, int level, const char* category, uint32_t time,
+        const char* fmt, va_list args) {
+    log_binary_header h = {};
+    h.level = level;
+    h.flags = sizeof(void*);
+    h.time = time;
+    Writer w(buf, size);
+    if (!w.write(&h, sizeof(h)) || !w.write(&fmt, sizeof(fmt)) || !w.write(&category, sizeof(category))) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    Conversion conv = {};
+    const char* f = fmt;
+    bool ok = true;
+    while ((f = nextConversion(f, &conv))) {
+        if (conv.type == '%') {
+            continue;
+        }
+        if (conv.starWidth) {
+            ok = ok && w.writeInteger(va_arg(args, int), 4);
+        }
+        if (conv.starPrecision) {
+            const int precision = va_arg(args, int);
+            conv.precision = precision;
+            ok = ok && w.writeInteger(precision, 4);
+        }
+        if (conv.type == 's') {
+            const char* s = va_arg(args, const char*);
+            if (!s) {
+                s = "(null)";
+            }
+            const size_t maxLen = (conv.precision >= 0) ? std::min(conv.precision, LOG_BINARY_MAX_STRING_LENGTH) :
+                    LOG_BINARY_MAX_STRING_LENGTH;
+            const uint8_t n = strnlen(s, maxLen);
+            ok = ok && w.write(&n, sizeof(n)) && w.write(s, n);
+        } else if (conv.type == 'p') {
+            const uintptr_t p = (uintptr_t)va_arg(args, void*);
+            ok = ok && w.writeInteger(p, sizeof(p));
+        } else if (isIntegerType(conv.type)) {
+            uint64_t val = 0;
+            switch (conv.length) {
+            case Length::LL:
+                val = va_arg(args, long long);
+                break;
+            case Length::J:
+                val = va_arg(args, intmax_t);
+                break;
+            case Length::L:
+                val = (conv.type == 'c') ? va_arg(args, wint_t) : va_arg(args, long);
+                break;
+            case Length::Z:
+                val = va_arg(args, size_t);
+                break;
+            case Length::T:
+                val = va_arg(args, ptrdiff_t);
+                break;
+            default:
+                val = va_arg(args, int);
+                break;
+            }
+            ok = ok && w.writeInteger(val, integerSize(conv, sizeof(void*)));
+        } else if (isFloatType(conv.type)) {
+            const double val = (conv.length == Length::BIG_L) ? va_arg(args, long double) : va_arg(args, double);
+            ok = ok && w.write(&val, sizeof(val));
+        } else if (conv.type == 'n') {
+            va_arg(args, void*); // Not supported
+        } else {
+            break; // Unknown conversion, the remaining arguments can't be located
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    h.size = w.pos();
+    if (!ok) {
+        h.flags |= LOG_BINARY_FLAG_TRUNCATED;
+    }
+    memcpy(buf, &h, sizeof(h));
+    return h.size;
+}
+
+int log_binary_decode(const char* data, size_t size, char* buf, size_t bufSize, log_binary_info* info,
+        log_binary_resolve_fn resolve, void* resolveData) {
+    Reader r(data, size);
+    log_binary_header h = {};
+    if (!r.read(&h, sizeof(h)) || h.size > size) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    const size_t wordSize = h.flags & LOG_BINARY_WORD_SIZE_MASK;
+    if (wordSize != 4 && wordSize != 8) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    r = Reader(data + sizeof(h), h.size - sizeof(h));
+    uint64_t fmtAddr = 0, catAddr = 0;
+    if (!r.readInteger(&fmtAddr, wordSize, false) || !r.readInteger(&catAddr, wordSize, false)) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    const char* const fmt = resolve ? resolve(fmtAddr, resolveData) : (const char*)(uintptr_t)fmtAddr;
+    if (!fmt) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    if (info) {
+        info->level = h.level;
+        info->time = h.time;
+        info->category = !catAddr ? nullptr : resolve ? resolve(catAddr, resolveData) : (const char*)(uintptr_t)catAddr;
+    }
+    Formatter out(buf, bufSize);
+    Conversion conv = {};
+    const char* f = fmt;
+    const char* end = nullptr;
+    bool ok = true;
+    while (ok && (end = nextConversion(f, &conv))) {
+        out.append(f, conv.begin - f);
+        f = end;
+        if (conv.type == '%') {
+            out.append("%", 1);
+            continue;
+        }
+        char spec[32];
+        uint64_t val = 0;
+        int width = conv.width;
+        int precision = conv.precision;
+        if (conv.starWidth) {
+            ok = r.readInteger(&val, 4, true);
+            width = (int)val;
+        }
+        if (ok && conv.starPrecision) {
+            ok = r.readInteger(&val, 4, true);
+            precision = (int)val;
+        }
+        if (!ok) {
+            break;
+        }
+        const bool hasWidth = conv.starWidth || width >= 0;
+        const bool hasPrecision = precision >= 0; // Negative precision is ignored
+        if (conv.type == 's') {
+            uint8_t n = 0;
+            ok = r.read(&n, sizeof(n));
+            const char* const s = r.data();
+            ok = ok && r.skip(n);
+            if (ok) {
+                makeSpec(spec, sizeof(spec), conv, "", hasWidth, width, false, 0, ".*", 's');
+                out.printf(spec, (int)n, s);
+            }
+        } else if (conv.type == 'p') {
+            ok = r.readInteger(&val, wordSize, false);
+            if (ok) {
+                makeSpec(spec, sizeof(spec), conv, "#", hasWidth, width, false, 0, "ll", 'x');
+                out.printf(spec, (unsigned long long)val);
+            }
+        } else if (conv.type == 'c') {
+            ok = r.readInteger(&val, 4, false);
+            if (ok) {
+                makeSpec(spec, sizeof(spec), conv, "", hasWidth, width, false, 0, "", 'c');
+                out.printf(spec, (int)val);
+            }
+        } else if (isIntegerType(conv.type)) {
+            ok = r.readInteger(&val, integerSize(conv, wordSize), conv.type == 'd' || conv.type == 'i');
+            if (ok) {
+                makeSpec(spec, sizeof(spec), conv, "", hasWidth, width, hasPrecision, precision, "ll", conv.type);
+                out.printf(spec, (long long)val);
+            }
+        } else if (isFloatType(conv.type)) {
+            double d = 0;
+            ok = r.read(&d, sizeof(d));
+            if (ok) {
+                makeSpec(spec, sizeof(spec), conv, "", hasWidth, width, hasPrecision, precision, "", conv.type);
+                out.printf(spec, d);
+            }
+        } else if (conv.type != 'n') {
+            ok = false;
+        }
+    }
+    if (ok) {
+        out.append(f, strlen(f));
+    }
+    return out.finish(!ok || (h.flags & LOG_BINARY_FLAG_TRUNCATED));
+}
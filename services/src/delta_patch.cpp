@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "delta_patch.h"
+
+#include "crc32.h"
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle {
+
+namespace {
+
+inline uint32_t readUint32(const uint8_t* data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+} // namespace
+
+const uint32_t DeltaPatch::MAGIC;
+const uint8_t DeltaPatch::VERSION;
+const size_t DeltaPatch::HEADER_SIZE;
+const size_t DeltaPatch::BUFFER_SIZE;
+
+DeltaPatch::DeltaPatch(DeltaPatchHandler* handler) :
+        handler_(handler),
+        state_(HEADER),
+        patchSize_(0),
+        sourceSize_(0),
+        sourceCrc_(0),
+        targetSize_(0),
+        targetCrc_(0),
+        targetWritten_(0),
+        crc_(0),
+        sourceOffset_(0),
+        copyOffset_(0),
+        length_(0),
+        value_(0),
+        shift_(0) {
+}
+
+int DeltaPatch::update(const uint8_t* data, size_t size) {
+    size_t pos = 0;
+    while (pos < size) {
+        const size_t start = pos;
+        switch (state_) {
+        case HEADER: {
+            size_t n = 0;
+            const int ret = readHeader(data + pos, size - pos, &n);
+            pos += n;
+            if (ret < 0) {
+                return fail(ret);
+            }
+            break;
+        }
+        case COMMAND: {
+            const uint8_t cmd = data[pos++];
+            if (cmd == COPY) {
+                state_ = COPY_OFFSET;
+            } else if (cmd == INSERT) {
+                state_ = INSERT_LENGTH;
+            } else {
+                return fail(SYSTEM_ERROR_BAD_DATA);
+            }
+            break;
+        }
+        case COPY_OFFSET:
+        case COPY_LENGTH:
+        case INSERT_LENGTH: {
+            bool complete = false;
+            const int ret = readValue(data[pos++], &complete);
+            if (ret < 0) {
+                return fail(ret);
+            }
+            if (!complete) {
+                break;
+            }
+            const uint32_t value = value_;
+            value_ = 0;
+            if (state_ == COPY_OFFSET) {
+                // Zigzag decoding
+                const int32_t delta = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+                copyOffset_ = sourceOffset_ + delta;
+                state_ = COPY_LENGTH;
+                break;
+            }
+            length_ = value;
+            if (length_ == 0 || length_ > targetSize_ - targetWritten_) {
+                return fail(SYSTEM_ERROR_BAD_DATA);
+            }
+            if (state_ == INSERT_LENGTH) {
+                state_ = INSERT_DATA;
+                break;
+            }
+            const int r = copy();
+            if (r < 0) {
+                return fail(r);
+            }
+            break;
+        }
+        case INSERT_DATA: {
+            // The inserted bytes are written straight from the patch data
+            const size_t n = std::min<size_t>(size - pos, length_);
+            const int ret = write(data + pos, n);
+            if (ret < 0) {
+                return fail(ret);
+            }
+            pos += n;
+            length_ -= n;
+            if (length_ == 0) {
+                commandDone();
+            }
+            break;
+        }
+        case DONE:
+            // Trailing data after the last command
+            return fail(SYSTEM_ERROR_TOO_LARGE);
+        default:
+            return SYSTEM_ERROR_INVALID_STATE;
+        }
+        patchSize_ += pos - start;
+    }
+    return 0;
+}
+
+int DeltaPatch::finish() {
+    if (state_ == FAILED) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    if (state_ != DONE) {
+        // The patch is incomplete
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    if (crc_ != targetCrc_) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    return 0;
+}
+
+bool DeltaPatch::isPatch(const uint8_t* data, size_t size) {
+    return size >= 4 && readUint32(data) == MAGIC;
+}
+
+int DeltaPatch::readHeader(const uint8_t* data, size_t size, size_t* consumed) {
+    // The header is collected in the copy buffer, which isn't used until the first command
+    const size_t n = std::min(size, HEADER_SIZE - patchSize_);
+    memcpy(buf_ + patchSize_, data, n);
+    *consumed = n;
+    if (patchSize_ + n < HEADER_SIZE) {
+        return 0;
+    }
+    if (readUint32(buf_) != MAGIC) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    if (buf_[4] != VERSION) {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+    sourceSize_ = readUint32(buf_ + 8);
+    sourceCrc_ = readUint32(buf_ + 12);
+    targetSize_ = readUint32(buf_ + 16);
+    targetCrc_ = readUint32(buf_ + 20);
+    const int ret = handler_->begin(sourceSize_, sourceCrc_, targetSize_);
+    if (ret < 0) {
+        return ret;
+    }
+    state_ = (targetSize_ > 0) ? COMMAND : DONE;
+    return 0;
+}
+
+int DeltaPatch::readValue(uint8_t b, bool* complete) {
+    if (shift_ > 28) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    value_ |= (uint32_t)(b & 0x7f) << shift_;
+    if (b & 0x80) {
+        shift_ += 7;
+        *complete = false;
+        return 0;
+    }
+    *complete = true;
+    shift_ = 0;
+    return 0;
+}
+
+int DeltaPatch::copy() {
+    if (copyOffset_ > sourceSize_ || length_ > sourceSize_ - copyOffset_) {
+        return SYSTEM_ERROR_OUT_OF_RANGE;
+    }
+    uint32_t offs = copyOffset_;
+    uint32_t left = length_;
+    while (left > 0) {
+        const size_t n = std::min<size_t>(left, BUFFER_SIZE);
+        int ret = handler_->read(offs, buf_, n);
+        if (ret < 0) {
+            return ret;
+        }
+        ret = write(buf_, n);
+        if (ret < 0) {
+            return ret;
+        }
+        offs += n;
+        left -= n;
+    }
+    sourceOffset_ = offs;
+    commandDone();
+    return 0;
+}
+
+int DeltaPatch::write(const uint8_t* data, size_t size) {
+    const int ret = handler_->write(data, size);
+    if (ret < 0) {
+        return ret;
+    }
+    crc_ = crc32_update(crc_, data, size);
+    targetWritten_ += size;
+    return 0;
+}
+
+void DeltaPatch::commandDone() {
+    length_ = 0;
+    state_ = (targetWritten_ == targetSize_) ? DONE : COMMAND;
+}
+
+int DeltaPatch::fail(int error) {
+    state_ = FAILED;
+    return error;
+}
+
+} // namespace particle
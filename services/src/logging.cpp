@@ -16,6 +16,7 @@
  */
 
 #include "logging.h"
+#include "binary_log.h"
 
 #include <algorithm>
 #include <cstdio>
@@ -68,6 +69,10 @@ volatile log_message_callback_type log_msg_callback = 0;
 volatile log_write_callback_type log_write_callback = 0;
 volatile log_enabled_callback_type log_enabled_callback = 0;
 
+volatile log_binary_callback_type log_binary_callback = 0;
+void* volatile log_binary_callback_data = 0;
+volatile int log_binary_level = LOG_LEVEL_NONE;
+
 } // namespace
 
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
@@ -77,7 +82,26 @@ void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_typ
     log_enabled_callback = log_enabled;
 }
 
+void log_set_binary_callback(log_binary_callback_type callback, int level, void *callback_data, void *reserved) {
+    log_binary_callback = 0;
+    log_binary_callback_data = callback_data;
+    log_binary_level = level;
+    log_binary_callback = callback;
+}
+
 void log_message_v(int level, const char *category, LogAttributes *attr, void *reserved, const char *fmt, va_list args) {
+    const log_binary_callback_type binary_callback = log_binary_callback;
+    if (binary_callback) {
+        if (level >= log_binary_level) {
+            char buf[LOG_MAX_STRING_LENGTH];
+            const uint32_t time = attr->has_time ? attr->time : HAL_Timer_Get_Milli_Seconds();
+            const int n = log_binary_encode(buf, sizeof(buf), level, category, time, fmt, args);
+            if (n > 0) {
+                binary_callback(buf, n, log_binary_callback_data);
+            }
+        }
+        return;
+    }
     const log_message_callback_type msg_callback = log_msg_callback;
     if (!msg_callback && (!log_compat_callback || level < log_compat_level)) {
         return;
@@ -211,6 +235,9 @@ void log_dump(int level, const char *category, const void *data, size_t size, in
 }
 
 int log_enabled(int level, const char *category, void *reserved) {
+    if (log_binary_callback) {
+        return (level >= log_binary_level);
+    }
     const log_enabled_callback_type enabled_callback = log_enabled_callback;
     if (enabled_callback) {
         return enabled_callback(level, category, 0);
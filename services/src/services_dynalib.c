@@ -26,6 +26,7 @@
 #include "debug.h"
 #include "jsmn.h"
 #include "logging.h"
+#include "binary_log.h"
 #include "system_error.h"
 #include "led_service.h"
 #include "diagnostics.h"
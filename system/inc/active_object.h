@@ -23,14 +23,44 @@
 
 #if PLATFORM_THREADING
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <mutex>
+#include <new>
 #include <thread>
 #include <future>
+#include <type_traits>
+#include <utility>
 
 #include "channel.h"
 #include "concurrent_hal.h"
 
+#ifndef ACTIVE_OBJECT_TASK_STORAGE_SIZE
+/**
+ * Size of the inline storage for a function object passed to ActiveObjectBase::invoke_async().
+ * Larger function objects are allocated on the heap.
+ */
+#define ACTIVE_OBJECT_TASK_STORAGE_SIZE (8 * sizeof(void*))
+#endif
+
+#ifndef ACTIVE_OBJECT_TASK_POOL_SIZE
+/**
+ * Number of preallocated asynchronous tasks per active object (at most 32). When all of them
+ * are queued, further tasks are allocated on the heap. Each task takes about 52 bytes on
+ * Cortex-M; 0 disables the pool.
+ */
+#define ACTIVE_OBJECT_TASK_POOL_SIZE 4
+#endif
+
+#ifndef ACTIVE_OBJECT_SEMAPHORE_POOL_SIZE
+/**
+ * Number of reusable completion semaphores per active object (at most 32), i.e. how many threads
+ * can wait for a synchronous call at the same time without creating a temporary semaphore.
+ */
+#define ACTIVE_OBJECT_SEMAPHORE_POOL_SIZE 4
+#endif
+
 /**
  * Configuratino data for an active object.
  */
@@ -96,152 +126,216 @@ public:
     virtual ~Message() {}
 };
 
+class ActiveObjectBase;
+
 /**
- * Abstract task. Subclasses must define invoke() and task_complete()
+ * A set of up to 32 slots that can be acquired and released from any thread without locking.
  */
-template <typename T, typename C>
-class AbstractTask : public Message
+template<size_t size>
+class ActiveObjectSlots
 {
-protected:
-    /**
-     * The function to invoke to retrieve the future result.
-     */
-    std::function<T(void)> work;
+    static_assert(size > 0 && size <= 32, "Invalid number of slots");
+
+    std::atomic<uint32_t> free_slots;
 
 public:
-    inline AbstractTask(const std::function<T()>& fn_) : work(std::move(fn_)) {}
+    ActiveObjectSlots() : free_slots((size == 32) ? 0xffffffffu : ((1u << size) - 1)) {}
 
-    void operator()() override {
-        C* that = ((C*)this);
-        that->invoke();
-        that->task_complete();
+    /**
+     * Acquires a free slot. Returns the slot index, or -1 if all slots are in use.
+     */
+    int acquire()
+    {
+        uint32_t f = free_slots.load(std::memory_order_relaxed);
+        while (f)
+        {
+            const int index = __builtin_ctz(f);
+            if (free_slots.compare_exchange_weak(f, f & ~(1u << index), std::memory_order_acquire, std::memory_order_relaxed))
+                return index;
+        }
+        return -1;
     }
 
+    void release(int index)
+    {
+        free_slots.fetch_or(1u << index, std::memory_order_release);
+    }
 };
 
 /**
  * An asynchronous task. Disposes itself when complete.
+ *
+ * The callable is stored inline if it fits in ACTIVE_OBJECT_TASK_STORAGE_SIZE bytes, otherwise
+ * it is allocated on the heap. The task itself is taken from the active object's task pool, or
+ * allocated on the heap if the pool is exhausted.
  */
-template <typename T>
-class AsyncTask : public AbstractTask<T, AsyncTask<T>>
+class AsyncTask : public Message
 {
-    using super = AbstractTask<T,AsyncTask<T>>;
+    std::aligned_storage<ACTIVE_OBJECT_TASK_STORAGE_SIZE>::type storage;
+    void* fn;
+    void (*invoke_fn)(void* fn);
+    void (*destroy_fn)(void* fn, bool heap);
+
+    /**
+     * The active object owning the pool this task was taken from, or {@code nullptr} if the task
+     * was allocated on the heap.
+     */
+    ActiveObjectBase* pool;
+
+    template<typename F> static void invoke(void* fn)
+    {
+        (*static_cast<F*>(fn))();
+    }
+
+    template<typename F> static void destroy(void* fn, bool heap)
+    {
+        if (heap)
+            delete static_cast<F*>(fn);
+        else
+            static_cast<F*>(fn)->~F();
+    }
+
+    template<typename Fn, typename F> void* construct(F&& fn_, std::true_type /* fits */)
+    {
+        return new(&storage) Fn(std::forward<F>(fn_));
+    }
+
+    template<typename Fn, typename F> void* construct(F&& fn_, std::false_type /* fits */)
+    {
+        return new Fn(std::forward<F>(fn_));
+    }
 
 public:
-    inline AsyncTask(const std::function<T()>& fn_) :  super(fn_) {}
+    template<typename F, typename Fn = typename std::decay<F>::type>
+    AsyncTask(F&& fn_, ActiveObjectBase* pool_) :
+            fn(nullptr),
+            invoke_fn(invoke<Fn>),
+            destroy_fn(destroy<Fn>),
+            pool(pool_)
+    {
+        using fits = std::integral_constant<bool, sizeof(Fn) <= sizeof(storage) && alignof(Fn) <= alignof(decltype(storage))>;
+        fn = construct<Fn>(std::forward<F>(fn_), fits());
+    }
 
-    inline void task_complete()
+    ~AsyncTask()
     {
-        delete this;
+        if (fn)
+            destroy_fn(fn, fn != &storage);
     }
 
-    inline void invoke()
+    void operator()() override
     {
-        this->work();
+        if (fn)
+            invoke_fn(fn);
+        dispose();
     }
 
+    /**
+     * Destroys the task and returns it to the pool it was taken from.
+     */
+    inline void dispose();
 };
 
 /**
- * Promises. these are used for synchronous tasks.
+ * Preallocated storage for up to {@code size} objects of type T.
  */
-template<typename T, typename C> class AbstractPromise : public AbstractTask<T,C>
+template<typename T, size_t size>
+class ActiveObjectPool
 {
+    using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
 
-    os_semaphore_t complete;
-
-protected:
-    using task = AbstractTask<T, C>;
-
-    void wait_complete()
-    {
-        os_semaphore_take(complete, CONCURRENT_WAIT_FOREVER, false);
-    }
+    Storage items[size];
+    ActiveObjectSlots<size> slots;
 
 public:
-
-    AbstractPromise(const std::function<T()>& fn_) : task(fn_), complete(nullptr)
+    /**
+     * Returns storage for an object, or {@code nullptr} if all of it is in use.
+     */
+    void* acquire()
     {
-        os_semaphore_create(&complete, 1, 0);
+        const int index = slots.acquire();
+        return (index >= 0) ? &items[index] : nullptr;
     }
 
-    virtual ~AbstractPromise()
+    void release(void* item)
     {
-        dispose();
+        slots.release(static_cast<Storage*>(item) - items);
     }
+};
 
-    inline void dispose()
+/**
+ * An empty pool, so that every object is allocated on the heap.
+ */
+template<typename T>
+class ActiveObjectPool<T, 0>
+{
+public:
+    void* acquire()
     {
-        if (complete)
-        {
-            os_semaphore_destroy(complete);
-            complete = nullptr;
-        }
+        return nullptr;
     }
 
-    inline void task_complete()
+    void release(void* item)
     {
-        os_semaphore_give(complete, false);
     }
-
 };
 
 /**
- * A promise that executes a function and returns the function result as the future
- * value.
+ * A synchronous task. Lives on the stack of the calling thread, which waits for its completion,
+ * so the callable is referenced rather than copied.
  */
-template<typename T> class SystemPromise : public AbstractPromise<T, SystemPromise<T>>
+template<typename F, typename T = typename std::result_of<F&()>::type>
+class SyncTask : public Message
 {
+    F& work;
+    os_semaphore_t complete;
+
     /**
      * The result retrieved from the function.
-     * Only valid once {@code complete} is {@code true}
+     * Only valid once {@code complete} has been given.
      */
     T result;
 
-    using super = AbstractPromise<T, SystemPromise<T>>;
-    friend typename super::task;
+public:
+    SyncTask(F& fn, os_semaphore_t sem) : work(fn), complete(sem), result() {}
 
-    void invoke()
+    void operator()() override
     {
-        this->result = this->work();
+        result = work();
+        os_semaphore_give(complete, false);
     }
 
-public:
-
-    SystemPromise(const std::function<T()>& fn_) : super(fn_) {}
-    virtual ~SystemPromise() = default;
-
     /**
      * wait for the result
      */
     T get()
     {
-        this->wait_complete();
+        os_semaphore_take(complete, CONCURRENT_WAIT_FOREVER, false);
         return result;
     }
 };
 
 /**
- * Specialization of SystemPromise that waits for execution of a function returning void.
+ * Specialization of SyncTask that waits for execution of a function returning void.
  */
-template<> class SystemPromise<void> : public AbstractPromise<void, SystemPromise<void>>
+template<typename F>
+class SyncTask<F, void> : public Message
 {
-    using super = AbstractPromise<void, SystemPromise<void>>;
-    friend typename super::task;
-
-    inline void invoke()
-    {
-        this->work();
-    }
+    F& work;
+    os_semaphore_t complete;
 
 public:
+    SyncTask(F& fn, os_semaphore_t sem) : work(fn), complete(sem) {}
 
-    SystemPromise(const std::function<void()>& fn_) : super(fn_) {}
-    virtual ~SystemPromise() = default;
+    void operator()() override
+    {
+        work();
+        os_semaphore_give(complete, false);
+    }
 
     void get()
     {
-        this->wait_complete();
+        os_semaphore_take(complete, CONCURRENT_WAIT_FOREVER, false);
     }
 };
 
@@ -264,6 +358,17 @@ protected:
 
     volatile bool started;
 
+    /**
+     * Preallocated storage for asynchronous tasks.
+     */
+    ActiveObjectPool<AsyncTask, ACTIVE_OBJECT_TASK_POOL_SIZE> tasks;
+
+    /**
+     * Completion semaphores for synchronous tasks. Created on first use and reused afterwards.
+     */
+    os_semaphore_t semaphores[ACTIVE_OBJECT_SEMAPHORE_POOL_SIZE];
+    ActiveObjectSlots<ACTIVE_OBJECT_SEMAPHORE_POOL_SIZE> semaphore_slots;
+
     /**
      * The main run loop for an active object.
      */
@@ -284,12 +389,54 @@ protected:
 
     void start_thread();
 
+    /**
+     * Acquires a completion semaphore. {@code index} is set to -1 if the semaphore is a
+     * temporary one.
+     */
+    os_semaphore_t acquire_semaphore(int& index)
+    {
+        index = semaphore_slots.acquire();
+        if (index < 0)
+        {
+            // All pooled semaphores are in use
+            os_semaphore_t sem = nullptr;
+            return os_semaphore_create(&sem, 1, 0) ? nullptr : sem;
+        }
+        if (!semaphores[index] && os_semaphore_create(&semaphores[index], 1, 0))
+        {
+            semaphores[index] = nullptr;
+            semaphore_slots.release(index);
+            return nullptr;
+        }
+        return semaphores[index];
+    }
+
+    void release_semaphore(os_semaphore_t sem, int index)
+    {
+        if (index >= 0)
+            semaphore_slots.release(index);
+        else
+            os_semaphore_destroy(sem);
+    }
+
+    friend class AsyncTask;
+
 public:
 
     ActiveObjectBase(const ActiveObjectConfiguration& config) :
             configuration(config),
             _thread(OS_THREAD_INVALID_HANDLE),
-            started(false) {
+            started(false),
+            semaphores() {
+    }
+
+    virtual ~ActiveObjectBase()
+    {
+        for (auto sem: semaphores)
+        {
+            if (sem)
+                os_semaphore_destroy(sem);
+        }
     }
 
     bool process();
@@ -306,34 +453,63 @@ public:
         return started;
     }
 
-    template<typename R> void invoke_async(const std::function<R(void)>& work)
+    /**
+     * Runs a function asynchronously on this active object's thread. Doesn't allocate memory
+     * unless the task pool is exhausted or the function object is larger than
+     * ACTIVE_OBJECT_TASK_STORAGE_SIZE.
+     */
+    template<typename F> void invoke_async(F&& work)
     {
-        auto task = new AsyncTask<R>(work);
+        void* slot = tasks.acquire();
+        auto task = slot ? new(slot) AsyncTask(std::forward<F>(work), this) : new AsyncTask(std::forward<F>(work), nullptr);
         if (task)
         {
 			Item message = task;
 			if (!put(message))
-				delete task;
+				task->dispose();
         }
 	}
 
-    template<typename R> SystemPromise<R>* invoke_future(const std::function<R(void)>& work)
+    /**
+     * Runs a function on this active object's thread and waits for its result. Doesn't
+     * allocate memory once the completion semaphores have been created.
+     *
+     * Returns a value-initialized result if the function could not be scheduled.
+     */
+    template<typename F, typename R = typename std::result_of<F&()>::type> R invoke_sync(F& work)
     {
-        auto promise = new SystemPromise<R>(work);
-        if (promise)
+        int index = -1;
+        const auto sem = acquire_semaphore(index);
+        if (!sem)
+            return R();
+        struct Release
         {
-			Item message = promise;
-			if (!put(message))
-			{
-				delete promise;
-				promise = nullptr;
-			}
-        }
-        return promise;
+            ActiveObjectBase* that;
+            os_semaphore_t sem;
+            int index;
+            ~Release() { that->release_semaphore(sem, index); }
+        } release = { this, sem, index };
+        SyncTask<F, R> task(work, sem);
+        Item message = &task;
+        if (!put(message))
+            return R();
+        return task.get();
     }
 
 };
 
+inline void AsyncTask::dispose()
+{
+    ActiveObjectBase* const p = pool;
+    if (p)
+    {
+        this->~AsyncTask();
+        p->tasks.release(this);
+    }
+    else
+        delete this;
+}
+
 
 template <size_t queue_size=50>
 class ActiveObjectChannel : public ActiveObjectBase
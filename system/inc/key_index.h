@@ -0,0 +1,155 @@
+/**
+  Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+  ******************************************************************************
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace particle {
+
+/**
+ * A hash index over the string keys of a list, such as the registered cloud functions and
+ * variables. The list keeps its entries in registration order and the index maps each key to
+ * the position of its entry, so that a key is found in constant time rather than by comparing
+ * it with every key in the list.
+ *
+ * The index uses open addressing with linear probing, and is kept at most half full. It is
+ * rebuilt from the list when it grows. Entries can only be added, as with {@code append_list}.
+ * If the index can't be allocated, lookups fall back to a linear search of the list.
+ *
+ * The index doesn't store the keys. The functions that take a {@code keyAt} argument call it
+ * with the position of an entry to get its key.
+ */
+class KeyIndex {
+public:
+    /**
+     * @param maxKeyLength The number of characters of a key that are significant, as with
+     *      {@code strncmp()}.
+     */
+    explicit KeyIndex(size_t maxKeyLength) :
+            slots_(nullptr),
+            capacity_(0),
+            maxKeyLength_(maxKeyLength) {
+    }
+
+    ~KeyIndex() {
+        free(slots_);
+    }
+
+    KeyIndex(const KeyIndex&) = delete;
+    KeyIndex& operator=(const KeyIndex&) = delete;
+
+    /**
+     * Adds the entry at the given position of the list to the index.
+     * @param pos The position of the entry.
+     * @param count The number of entries in the list, including the one being added.
+     * @param keyAt Returns the key of the entry at the given position.
+     * @return {@code false} if the index couldn't be grown. Lookups still find the entry by
+     *      searching the list.
+     */
+    template<typename KeyAtFn>
+    bool add(size_t pos, size_t count, KeyAtFn keyAt) {
+        if (count * 2 > capacity_) {
+            // Grow the index and add all the entries, including this one
+            return rebuild(count, keyAt);
+        }
+        insert(pos, keyAt(pos));
+        return true;
+    }
+
+    /**
+     * Finds a key in the list.
+     * @param count The number of entries in the list.
+     * @param keyAt Returns the key of the entry at the given position.
+     * @return The position of the entry with the given key, or -1 if there is none.
+     */
+    template<typename KeyAtFn>
+    int find(const char* key, size_t count, KeyAtFn keyAt) const {
+        if (!slots_) {
+            for (size_t i = 0; i < count; ++i) {
+                if (strncmp(keyAt(i), key, maxKeyLength_) == 0) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        const size_t mask = capacity_ - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            const uint16_t slot = slots_[i];
+            if (!slot) {
+                return -1;
+            }
+            if (strncmp(keyAt(slot - 1), key, maxKeyLength_) == 0) {
+                return slot - 1;
+            }
+        }
+    }
+
+    /**
+     * Computes the hash of the significant characters of a key (32-bit FNV-1a).
+     */
+    uint32_t hash(const char* key) const {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < maxKeyLength_ && key[i]; ++i) {
+            h = (h ^ (uint8_t)key[i]) * 16777619u;
+        }
+        return h;
+    }
+
+private:
+    // Each slot holds the position of an entry plus one, or 0 if the slot is empty
+    uint16_t* slots_;
+    size_t capacity_;
+    const size_t maxKeyLength_;
+
+    void insert(size_t pos, const char* key) {
+        const size_t mask = capacity_ - 1;
+        size_t i = hash(key) & mask;
+        while (slots_[i]) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = pos + 1;
+    }
+
+    template<typename KeyAtFn>
+    bool rebuild(size_t count, KeyAtFn keyAt) {
+        size_t capacity = 8;
+        while (capacity < count * 2) {
+            capacity *= 2;
+        }
+        uint16_t* slots = (uint16_t*)calloc(capacity, sizeof(uint16_t));
+        if (!slots) {
+            free(slots_);
+            slots_ = nullptr;
+            capacity_ = 0;
+            return false;
+        }
+        free(slots_);
+        slots_ = slots;
+        capacity_ = capacity;
+        for (size_t i = 0; i < count; ++i) {
+            insert(i, keyAt(i));
+        }
+        return true;
+    }
+};
+
+} // namespace particle
@@ -76,24 +76,21 @@ FFL(F const &func)
 #define _THREAD_CONTEXT_ASYNC_RESULT(thread, fn, result) \
     if (thread.isStarted() && !thread.isCurrentThread()) { \
         auto lambda = [=]() { (fn); }; \
-        thread.invoke_async(FFL(lambda)); \
+        thread.invoke_async(lambda); \
         return result; \
     }
 
 #define _THREAD_CONTEXT_ASYNC(thread, fn) \
     if (thread.isStarted() && !thread.isCurrentThread()) { \
         auto lambda = [=]() { (fn); }; \
-        thread.invoke_async(FFL(lambda)); \
+        thread.invoke_async(lambda); \
         return; \
     }
 
 #define SYSTEM_THREAD_CONTEXT_SYNC(fn) \
     if (SystemThread.isStarted() && !SystemThread.isCurrentThread()) { \
-        auto callable = FFL([=]() { return (fn); }); \
-        auto future = SystemThread.invoke_future(callable); \
-        auto result = future ? future->get() : 0;  \
-        delete future; \
-        return result; \
+        auto callable = [=]() { return (fn); }; \
+        return SystemThread.invoke_sync(callable); \
     }
 
 #else
@@ -52,8 +52,8 @@ BleListeningModeHandler::~BleListeningModeHandler() {
 int BleListeningModeHandler::constructControlRequestAdvData() {
     CHECK_FALSE(exited_, SYSTEM_ERROR_INVALID_STATE);
 
-    Vector<uint8_t> tempAdvData;
-    Vector<uint8_t> tempSrData;
+    AdvData tempAdvData;
+    AdvData tempSrData;
 
     // AD Flag
     CHECK_TRUE(tempAdvData.append(0x02), SYSTEM_ERROR_NO_MEMORY);
@@ -91,8 +91,8 @@ int BleListeningModeHandler::cacheUserConfigurations() {
     LOG_DEBUG(TRACE, "Cache user's BLE configurations.");
     CHECK_FALSE(exited_, SYSTEM_ERROR_INVALID_STATE);
 
-    Vector<uint8_t> tempAdvData(BLE_MAX_ADV_DATA_LEN);
-    Vector<uint8_t> tempSrData(BLE_MAX_ADV_DATA_LEN);
+    AdvData tempAdvData(BLE_MAX_ADV_DATA_LEN);
+    AdvData tempSrData(BLE_MAX_ADV_DATA_LEN);
 
     // Advertising data set by user application
     size_t len = CHECK(hal_ble_gap_get_advertising_data(tempAdvData.data(), BLE_MAX_ADV_DATA_LEN, nullptr));
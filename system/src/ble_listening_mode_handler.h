@@ -37,6 +37,9 @@ public:
     int exit();
 
 private:
+    // Advertising and scan response data never exceed BLE_MAX_ADV_DATA_LEN bytes
+    typedef Vector<uint8_t, spark::DefaultAllocator, BLE_MAX_ADV_DATA_LEN> AdvData;
+
     int constructControlRequestAdvData();
     int cacheUserConfigurations();
     int restoreUserConfigurations();
@@ -57,8 +60,8 @@ private:
 
     const uint8_t BLE_CTRL_REQ_SVC_UUID[BLE_SIG_UUID_128BIT_LEN] = {0xfc,0x36,0x6f,0x54,0x30,0x80,0xf4,0x94,0xa8,0x48,0x4e,0x5c,0x01,0x00,0xa9,0x6f};
 
-    Vector<uint8_t> preAdvData_;
-    Vector<uint8_t> preSrData_;
+    AdvData preAdvData_;
+    AdvData preSrData_;
     hal_ble_adv_params_t preAdvParams_;
     int8_t preTxPower_;
     hal_ble_conn_params_t prePpcp_;
@@ -69,8 +72,8 @@ private:
     bool restoreUserConfig_;
     static bool exited_;
 
-    Vector<uint8_t> ctrlReqAdvData_;
-    Vector<uint8_t> ctrlReqSrData_;
+    AdvData ctrlReqAdvData_;
+    AdvData ctrlReqSrData_;
 };
 
 } } /* particle::system */
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streamed_update.h"
+
+#include "ota_flash_hal.h"
+#include "endian_util.h"
+#include "system_error.h"
+#include "check.h"
+#include "logging.h"
+
+#include <cstring>
+#include <new>
+
+namespace particle { namespace system {
+
+const unsigned StreamedUpdate::MAX_STAGED_CHUNKS;
+
+StreamedUpdate::StreamedUpdate(const FileTransfer::Descriptor& file) :
+        fileAddress_(file.file_address),
+        fileLength_(file.file_length),
+        received_(0),
+        written_(0) {
+}
+
+int StreamedUpdate::save(const FileTransfer::Descriptor& file, const uint8_t* chunk) {
+    const uint32_t offset = file.chunk_address - file.file_address;
+    if (offset > received_) {
+        return stage(offset, chunk, file.chunk_size);
+    }
+    CHECK(process(offset, chunk, file.chunk_size));
+    // The chunks received ahead of this one may follow it now
+    for (;;) {
+        StagedChunk* next = nullptr;
+        for (auto& s: staged_) {
+            if (s.data && s.offset <= received_) {
+                next = &s;
+                break;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        const std::unique_ptr<uint8_t[]> data(std::move(next->data));
+        CHECK(process(next->offset, data.get(), next->size));
+    }
+    return 0;
+}
+
+unsigned StreamedUpdate::stagedChunks() const {
+    unsigned n = 0;
+    for (const auto& s: staged_) {
+        if (s.data) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+int StreamedUpdate::writeModule(const uint8_t* data, size_t size) {
+    if (HAL_FLASH_Update(data, fileAddress_ + written_, size, nullptr) != 0) {
+        return SYSTEM_ERROR_IO;
+    }
+    written_ += size;
+    return 0;
+}
+
+int StreamedUpdate::process(uint32_t offset, const uint8_t* data, size_t size) {
+    if (offset + size <= received_) {
+        // A chunk sent again
+        return 0;
+    }
+    const uint32_t skip = received_ - offset;
+    CHECK(update(data + skip, size - skip));
+    received_ += size - skip;
+    return 0;
+}
+
+int StreamedUpdate::stage(uint32_t offset, const uint8_t* data, size_t size) {
+    StagedChunk* slot = nullptr;
+    for (auto& s: staged_) {
+        if (!s.data) {
+            if (!slot) {
+                slot = &s;
+            }
+        } else if (s.offset == offset) {
+            // Already waiting for the chunks before it
+            return 0;
+        }
+    }
+    if (!slot) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    slot->data.reset(new(std::nothrow) uint8_t[size]);
+    if (!slot->data) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    memcpy(slot->data.get(), data, size);
+    slot->offset = offset;
+    slot->size = size;
+    return 0;
+}
+
+FirmwarePatch::FirmwarePatch(const FileTransfer::Descriptor& file) :
+        StreamedUpdate(file),
+        patch_(this),
+        source_(nullptr) {
+}
+
+int FirmwarePatch::begin(uint32_t sourceSize, uint32_t sourceCrc, uint32_t targetSize) {
+    source_ = findModule(sourceSize, sourceCrc);
+    if (!source_) {
+        LOG(ERROR, "The module the patch applies to isn't installed, CRC: 0x%08x", (unsigned)sourceCrc);
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    if (targetSize > HAL_OTA_FlashLength()) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    // The OTA region was erased for the size of the patch, which is usually smaller than
+    // the patched module
+    HAL_FLASH_Begin(fileAddress_, targetSize, nullptr);
+    return 0;
+}
+
+int FirmwarePatch::read(uint32_t offset, uint8_t* data, size_t size) {
+    // Modules in the internal flash are memory mapped
+    memcpy(data, source_ + offset, size);
+    return 0;
+}
+
+int FirmwarePatch::write(const uint8_t* data, size_t size) {
+    return writeModule(data, size);
+}
+
+int FirmwarePatch::finish() {
+    return patch_.finish();
+}
+
+int FirmwarePatch::update(const uint8_t* data, size_t size) {
+    return patch_.update(data, size);
+}
+
+const uint8_t* FirmwarePatch::findModule(uint32_t size, uint32_t crc) {
+    hal_system_info_t info = {};
+    info.size = sizeof(info);
+    HAL_System_Info(&info, true, nullptr);
+    const uint8_t* module = nullptr;
+    for (unsigned i = 0; i < info.module_count; ++i) {
+        const hal_module_t& m = info.modules[i];
+        if (!m.info || !m.crc || m.bounds.store != MODULE_STORE_MAIN ||
+                m.bounds.mcu_identifier != HAL_PLATFORM_MCU_DEFAULT) {
+            continue;
+        }
+        const uint8_t* start = (const uint8_t*)m.info->module_start_address;
+        const uint8_t* end = (const uint8_t*)m.info->module_end_address;
+        // The CRC is stored in big-endian order
+        if (uint32_t(end - start) == size && bigEndianToNative(m.crc->crc32) == crc) {
+            module = start;
+            break;
+        }
+    }
+    HAL_System_Info(&info, false, nullptr);
+    return module;
+}
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+
+FirmwareInflater::FirmwareInflater(const FileTransfer::Descriptor& file) :
+        StreamedUpdate(file),
+        bufOffs_(0),
+        status_(TINFL_STATUS_NEEDS_MORE_INPUT) {
+}
+
+int FirmwareInflater::init() {
+    decomp_.reset(new(std::nothrow) tinfl_decompressor);
+    buf_.reset(new(std::nothrow) uint8_t[TINFL_LZ_DICT_SIZE]);
+    if (!decomp_ || !buf_) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    tinfl_init(decomp_.get());
+    return 0;
+}
+
+int FirmwareInflater::finish() {
+    return (status_ == TINFL_STATUS_DONE) ? 0 : SYSTEM_ERROR_BAD_DATA;
+}
+
+int FirmwareInflater::update(const uint8_t* data, size_t size) {
+    const uint32_t left = fileLength_ - received();
+    if (size > left) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    size_t srcOffs = 0;
+    for (;;) {
+        size_t srcBytes = size - srcOffs;
+        size_t destBytes = TINFL_LZ_DICT_SIZE - bufOffs_;
+        status_ = tinfl_decompress(decomp_.get(), data + srcOffs, &srcBytes, buf_.get(), buf_.get() + bufOffs_,
+                &destBytes, (left > size) ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+        if (status_ < 0) {
+            return SYSTEM_ERROR_BAD_DATA;
+        }
+        srcOffs += srcBytes;
+        if (destBytes > 0) {
+            CHECK(writeModule(buf_.get() + bufOffs_, destBytes));
+            // The output buffer is also the dictionary, and wraps around
+            bufOffs_ = (bufOffs_ + destBytes) % TINFL_LZ_DICT_SIZE;
+        }
+        if (status_ != TINFL_STATUS_HAS_MORE_OUTPUT) {
+            break;
+        }
+    }
+    return 0;
+}
+
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+} } // particle::system
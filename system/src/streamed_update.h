@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "file_transfer.h"
+#include "delta_patch.h"
+#include "hal_platform.h"
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+#include "miniz.h"
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace particle { namespace system {
+
+/**
+ * A firmware binary that is processed as it is received, such as a delta patch or a compressed
+ * module, and has to be processed in order. The module produced from it is written to the OTA
+ * region, where it is validated and installed like a module received as is.
+ *
+ * A chunk received ahead of the ones before it, e.g. because an earlier chunk was lost during a
+ * fast OTA transfer, is kept in RAM until the missing chunks arrive. Up to `MAX_STAGED_CHUNKS`
+ * chunks are kept this way. A chunk that doesn't fit is rejected, and the transfer requests it
+ * again with the missing chunks.
+ */
+class StreamedUpdate {
+public:
+    static const unsigned MAX_STAGED_CHUNKS = 4;
+
+    explicit StreamedUpdate(const FileTransfer::Descriptor& file);
+    virtual ~StreamedUpdate() = default;
+
+    /**
+     * Processes a chunk of the binary.
+     */
+    int save(const FileTransfer::Descriptor& file, const uint8_t* chunk);
+
+    /**
+     * Checks that the entire module has been produced.
+     */
+    virtual int finish() = 0;
+
+    /**
+     * Returns the number of chunks waiting for the chunks before them.
+     */
+    unsigned stagedChunks() const;
+
+protected:
+    const uint32_t fileAddress_;
+    const uint32_t fileLength_;
+
+    virtual int update(const uint8_t* data, size_t size) = 0;
+
+    uint32_t received() const {
+        return received_;
+    }
+
+    // Writes the next part of the module
+    int writeModule(const uint8_t* data, size_t size);
+
+private:
+    struct StagedChunk {
+        std::unique_ptr<uint8_t[]> data;
+        uint32_t offset;
+        size_t size;
+    };
+
+    StagedChunk staged_[MAX_STAGED_CHUNKS];
+    uint32_t received_;
+    uint32_t written_;
+
+    int process(uint32_t offset, const uint8_t* data, size_t size);
+    int stage(uint32_t offset, const uint8_t* data, size_t size);
+};
+
+/**
+ * Applies a delta patch received in place of a module binary.
+ */
+class FirmwarePatch: public StreamedUpdate, DeltaPatchHandler {
+public:
+    explicit FirmwarePatch(const FileTransfer::Descriptor& file);
+
+    int begin(uint32_t sourceSize, uint32_t sourceCrc, uint32_t targetSize) override;
+    int read(uint32_t offset, uint8_t* data, size_t size) override;
+    int write(const uint8_t* data, size_t size) override;
+    int finish() override;
+
+protected:
+    int update(const uint8_t* data, size_t size) override;
+
+private:
+    DeltaPatch patch_;
+    const uint8_t* source_;
+
+    static const uint8_t* findModule(uint32_t size, uint32_t crc);
+};
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+
+/**
+ * Decompresses a deflate-compressed module. The compressor has to use a dictionary of no more
+ * than TINFL_LZ_DICT_SIZE bytes, see miniz_config.h.
+ *
+ * The file length of the transfer is the size of the compressed data.
+ */
+class FirmwareInflater: public StreamedUpdate {
+public:
+    explicit FirmwareInflater(const FileTransfer::Descriptor& file);
+
+    int init();
+    int finish() override;
+
+protected:
+    int update(const uint8_t* data, size_t size) override;
+
+private:
+    std::unique_ptr<tinfl_decompressor> decomp_;
+    std::unique_ptr<uint8_t[]> buf_;
+    size_t bufOffs_;
+    tinfl_status status_;
+};
+
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+} } // particle::system
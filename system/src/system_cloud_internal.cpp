@@ -31,6 +31,7 @@
 #include "spark_wiring_string.h"
 #include "spark_protocol_functions.h"
 #include "append_list.h"
+#include "key_index.h"
 #include "core_hal.h"
 #include "deviceid_hal.h"
 #include "ota_flash_hal.h"
@@ -93,16 +94,33 @@ ProtocolFacade* system_cloud_protocol_instance(void)
 static append_list<User_Var_Lookup_Table_t> vars(5);
 static append_list<User_Func_Lookup_Table_t> funcs(5);
 
+// The checksums of the registered variables and functions are kept current as they are registered,
+// so that computing the describe checksum on each handshake doesn't walk the tables
+static uint32_t vars_checksum = 0;
+static uint32_t funcs_checksum = 0;
+
+uint32_t var_checksum(const User_Var_Lookup_Table_t& var);
+uint32_t func_checksum(const User_Func_Lookup_Table_t& func);
+
+// Hash indices of the variables and functions by their keys, so that a cloud request finds
+// its handler without comparing its key with every registered key
+static particle::KeyIndex vars_index(USER_VAR_KEY_LENGTH);
+static particle::KeyIndex funcs_index(USER_FUNC_KEY_LENGTH);
+
+inline const char* var_key_at(size_t i)
+{
+    return vars[i].userVarKey;
+}
+
+inline const char* func_key_at(size_t i)
+{
+    return funcs[i].userFuncKey;
+}
+
 User_Var_Lookup_Table_t* find_var_by_key(const char* varKey)
 {
-    for (int i = vars.size(); i-->0; )
-    {
-        if (0 == strncmp(vars[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-        {
-            return &vars[i];
-        }
-    }
-    return NULL;
+    const int i = vars_index.find(varKey, vars.size(), var_key_at);
+    return (i >= 0) ? &vars[i] : NULL;
 }
 
 template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const char* name, const char* itemType, const T& value) {
@@ -139,23 +157,24 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
 
     if (!result) {
     	result = add_if_sufficient_describe(vars, varKey, "variable", item);
+    	if (result) {
+    		vars_index.add(vars.size() - 1, vars.size(), var_key_at);
+    	}
     }
     else {
+    	vars_checksum -= var_checksum(*result);
     	*result = item;
     }
+    if (result) {
+    	vars_checksum += var_checksum(*result);
+    }
     return result;
 }
 
 User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey)
 {
-    for (int i = funcs.size(); i-->0; )
-    {
-        if (0 == strncmp(funcs[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH))
-        {
-            return &funcs[i];
-        }
-    }
-    return NULL;
+    const int i = funcs_index.find(funcKey, funcs.size(), func_key_at);
+    return (i >= 0) ? &funcs[i] : NULL;
 }
 
 User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc)
@@ -167,10 +186,17 @@ User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const clo
 
     User_Func_Lookup_Table_t* result = find_func_by_key(funcKey);
     if (result) {
+    	funcs_checksum -= func_checksum(*result);
     	*result = item;
     }
     else {
     	result = add_if_sufficient_describe(funcs, funcKey, "function", item);
+    	if (result) {
+    		funcs_index.add(funcs.size() - 1, funcs.size(), func_key_at);
+    	}
+    }
+    if (result) {
+    	funcs_checksum += func_checksum(*result);
     }
     return result;
 }
@@ -199,32 +225,23 @@ uint32_t string_crc(const char* s)
 }
 
 /**
- * Computes the checksum of the registered functions.
+ * Computes the checksum of a registered function.
  * The function name is used to compute the checksum.
+ * The checksum of all functions is the sum of their checksums, so that it can be updated
+ * as each function is registered.
  */
-uint32_t compute_functions_checksum()
+uint32_t func_checksum(const User_Func_Lookup_Table_t& func)
 {
-	uint32_t checksum = 0;
-	for (int i = funcs.size(); i-->0; )
-    {
-		checksum += string_crc(funcs[i].userFuncKey);
-    }
-	return checksum;
+	return string_crc(func.userFuncKey);
 }
 
 /**
- * Computes the checksum of the registered variables.
+ * Computes the checksum of a registered variable.
  * The checksum is derived from the variable name and type.
  */
-uint32_t compute_variables_checksum()
+uint32_t var_checksum(const User_Var_Lookup_Table_t& var)
 {
-	uint32_t checksum = 0;
-	for (int i = vars.size(); i-->0; )
-	{
-		checksum += string_crc(vars[i].userVarKey);
-		checksum += crc(vars[i].userVarType);
-	}
-	return checksum;
+	return string_crc(var.userVarKey) + crc(var.userVarType);
 }
 
 /**
@@ -233,23 +250,32 @@ uint32_t compute_variables_checksum()
 uint32_t compute_describe_app_checksum()
 {
 	uint32_t chk[2];
-	chk[0] = compute_variables_checksum();
-	chk[1] = compute_functions_checksum();
+	chk[0] = vars_checksum;
+	chk[1] = funcs_checksum;
 	return crc(chk, sizeof(chk));
 }
 
+// The system checksum is computed from the module info once, since the modules don't change
+// other than by a firmware update
+static bool describe_system_checksum_valid = false;
+
 uint32_t compute_describe_system_checksum()
 {
+    static uint32_t checksum = 0;
+    if (describe_system_checksum_valid) {
+        return checksum;
+    }
     hal_system_info_t info;
     memset(&info, 0, sizeof(info));
     info.size = sizeof(info);
     HAL_System_Info(&info, true, NULL);
-	uint32_t checksum = info.platform_id;
+	checksum = info.platform_id;
 	for (int i=0; i<info.module_count; i++)
 	{
 		checksum += crc(info.modules[i].suffix->sha);
 	}
 	HAL_System_Info(&info, false, NULL);
+	describe_system_checksum_valid = true;
     return checksum;
 }
 
@@ -452,13 +478,22 @@ int Spark_Save(const void* buffer, size_t length, uint8_t type, void* reserved)
 		}
 		return HAL_System_Backup_Save(0, buffer, length, nullptr);
 	}
+	if (type==SparkCallbacks::PERSIST_TRANSFER)
+	{
+		return HAL_System_Backup_Save(HAL_SYSTEM_BACKUP_TRANSFER_OFFSET, buffer, length, nullptr);
+	}
 	return -1;	// eek. define a constant for this error - Unknown Type.
 }
 
 int Spark_Restore(void* buffer, size_t max_length, uint8_t type, void* reserved)
 {
+	size_t offset = 0;
+	if (type==SparkCallbacks::PERSIST_TRANSFER)
+		offset = HAL_SYSTEM_BACKUP_TRANSFER_OFFSET;
+	else if (type!=SparkCallbacks::PERSIST_SESSION)
+		return 0;
 	size_t length = 0;
-	int error = HAL_System_Backup_Restore(0, buffer, max_length, &length, nullptr);
+	int error = HAL_System_Backup_Restore(offset, buffer, max_length, &length, nullptr);
 	if (error)
 		length = 0;
 	return length;
@@ -668,6 +703,8 @@ int finish_ota_firmware_update(FileTransfer::Descriptor& file, uint32_t flags, v
     hal_module_t module;
 
     int result = Spark_Finish_Firmware_Update(file, flags, &module);
+    // the modules may have changed
+    describe_system_checksum_valid = false;
 
     if (buf && (flags & (UpdateFlag::SUCCESS | UpdateFlag::VALIDATE_ONLY)) == (UpdateFlag::SUCCESS | UpdateFlag::VALIDATE_ONLY)) {
         formatOtaUpdateStatusEventData(flags, result, &module, (uint8_t*)buf, 255);
@@ -43,10 +43,15 @@
 #include "system_network_internal.h"
 #include "bytes2hexbuf.h"
 #include "system_threading.h"
+#include "streamed_update.h"
+#include "endian_util.h"
+#include "system_error.h"
 #if HAL_PLATFORM_DCT
 #include "dct.h"
 #endif // HAL_PLATFORM_DCT
 
+#include <memory>
+
 #ifdef START_DFU_FLASHER_SERIAL_SPEED
 static uint32_t start_dfu_flasher_serial_speed = START_DFU_FLASHER_SERIAL_SPEED;
 #endif
@@ -279,6 +284,20 @@ uint32_t timeRemaining(uint32_t start, uint32_t duration)
     return (elapsed>=duration) ? 0 : duration-elapsed;
 }
 
+namespace {
+
+using namespace particle;
+using particle::system::StreamedUpdate;
+using particle::system::FirmwarePatch;
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+using particle::system::FirmwareInflater;
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+// Binary processed by the current firmware update, if it isn't written to the OTA region as is
+std::unique_ptr<StreamedUpdate> g_streamed;
+
+} // namespace
+
 void set_flag(void* flag)
 {
 	volatile uint8_t* p = (volatile uint8_t*)flag;
@@ -298,12 +317,36 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             file.file_length = HAL_OTA_FlashLength();
         }
     }
+#if !HAL_PLATFORM_COMPRESSED_BINARIES
+    if (file.flags & FileTransfer::Flag::COMPRESSED) {
+        return 1;
+    }
+#endif // !HAL_PLATFORM_COMPRESSED_BINARIES
     int result = 0;
     if (System.updatesEnabled() || System.updatesForced()) {		// application event is handled asynchronously
         if (flags & 1) {
             // only check address
 		}
 		else {
+            // flags & 2 continues a transfer interrupted by a reset, without erasing the chunks already saved
+            const bool resume = flags & 2;
+            if (resume && (file.store != FileTransfer::Store::FIRMWARE || (file.flags & FileTransfer::Flag::COMPRESSED))) {
+                // the decompressor state isn't persisted, so only a module written as is can be resumed
+                return 1;
+            }
+            g_streamed.reset();
+            uint32_t length = file.file_length;
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+            if (file.flags & FileTransfer::Flag::COMPRESSED) {
+                std::unique_ptr<FirmwareInflater> inflater(new(std::nothrow) FirmwareInflater(file));
+                if (!inflater || inflater->init() != 0) {
+                    return SYSTEM_ERROR_NO_MEMORY;
+                }
+                g_streamed = std::move(inflater);
+                // The size of the decompressed module isn't known, so the entire OTA region is erased
+                length = HAL_OTA_FlashLength();
+            }
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
             system_set_flag(SYSTEM_FLAG_OTA_UPDATE_PENDING, 0, nullptr);
             RGB.control(true);
             // Get base color used for the update process indication
@@ -312,7 +355,9 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             SPARK_FLASH_UPDATE = 1;
             TimingFlashUpdateTimeout = 0;
             system_notify_event(firmware_update, firmware_update_begin, &file);
-            HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            if (!resume) {
+                HAL_FLASH_Begin(file.file_address, length, NULL);
+            }
         }
     }
     else {
@@ -384,6 +429,21 @@ int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags,
 
     hal_module_t mod;
 
+    if (g_streamed && (flags & UpdateFlag::SUCCESS)) {
+        // The module is only complete once the entire binary has been processed
+        const int ret = g_streamed->finish();
+        if (ret < 0) {
+            LOG(ERROR, "Invalid firmware binary: %d", ret);
+            if (flags & UpdateFlag::VALIDATE_ONLY) {
+                return ret;
+            }
+            flags &= ~UpdateFlag::SUCCESS;
+        }
+    }
+    if (!(flags & UpdateFlag::VALIDATE_ONLY)) {
+        g_streamed.reset();
+    }
+
     if ((flags & (UpdateFlag::VALIDATE_ONLY | UpdateFlag::SUCCESS)) == (UpdateFlag::VALIDATE_ONLY | UpdateFlag::SUCCESS)) {
         res = HAL_FLASH_OTA_Validate(module ? (hal_module_t*)module : &mod, true, (module_validation_flags_t)(MODULE_VALIDATION_INTEGRITY | MODULE_VALIDATION_DEPENDENCIES_FULL), NULL);
         return res;
@@ -420,7 +480,20 @@ int Spark_Save_Firmware_Chunk(FileTransfer::Descriptor& file, const uint8_t* chu
     system_notify_event(firmware_update, firmware_update_progress, &file);
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
-        result = HAL_FLASH_Update(chunk, file.chunk_address, file.chunk_size, NULL);
+        if (!g_streamed && file.chunk_address == file.file_address && DeltaPatch::isPatch(chunk, file.chunk_size))
+        {
+            g_streamed.reset(new(std::nothrow) FirmwarePatch(file));
+            if (!g_streamed) {
+                return SYSTEM_ERROR_NO_MEMORY;
+            }
+        }
+        if (g_streamed) {
+            // the chunks are processed in order, so the transfer can't be resumed after a reset
+            file.flags |= FileTransfer::Flag::STREAMED;
+            result = g_streamed->save(file, chunk);
+        } else {
+            result = HAL_FLASH_Update(chunk, file.chunk_address, file.chunk_size, NULL);
+        }
         LED_Toggle(LED_RGB);
     }
     return result;
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fake_modem.h"
+
+#include "timer_hal.h"
+#include "delay_hal.h"
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+system_tick_t g_time = 0;
+
+inline bool isBefore(system_tick_t t1, system_tick_t t2) {
+    return (int32_t)(t1 - t2) < 0;
+}
+
+} // namespace
+
+system_tick_t HAL_Timer_Get_Milli_Seconds() {
+    return g_time;
+}
+
+void HAL_Delay_Milliseconds(uint32_t ms) {
+    g_time += ms;
+}
+
+namespace particle {
+
+namespace test {
+
+system_tick_t FakeClock::now() {
+    return g_time;
+}
+
+void FakeClock::advance(system_tick_t ms) {
+    g_time += ms;
+}
+
+void FakeClock::reset() {
+    g_time = 0;
+}
+
+FakeModem::FakeModem() :
+        vintTime_(0),
+        downTime_(0),
+        upTime_(0),
+        on_(false) {
+}
+
+FakeModem& FakeModem::powerOn(system_tick_t vintDelay, system_tick_t bootTime) {
+    const auto now = FakeClock::now();
+    on_ = true;
+    vintTime_ = now + vintDelay;
+    downTime_ = now;
+    upTime_ = now + bootTime;
+    return *this;
+}
+
+FakeModem& FakeModem::powerOff() {
+    on_ = false;
+    output_.clear();
+    rxBuf_.clear();
+    return *this;
+}
+
+FakeModem& FakeModem::reply(const std::string& cmd, const std::string& resp, system_tick_t delay) {
+    replies_[cmd].push_back(Reply{ resp, delay });
+    return *this;
+}
+
+FakeModem& FakeModem::restartOn(const std::string& cmd, system_tick_t downDelay, system_tick_t bootTime) {
+    restarts_[cmd] = Restart{ downDelay, bootTime };
+    return *this;
+}
+
+FakeModem& FakeModem::urc(const std::string& data, system_tick_t delay) {
+    send("\r\n" + data + "\r\n", FakeClock::now() + delay);
+    return *this;
+}
+
+bool FakeModem::vint() const {
+    return on_ && !isBefore(FakeClock::now(), vintTime_);
+}
+
+bool FakeModem::responding() const {
+    const auto now = FakeClock::now();
+    return on_ && (isBefore(now, downTime_) || !isBefore(now, upTime_));
+}
+
+unsigned FakeModem::commandCount(const std::string& cmd) const {
+    return std::count(commands_.begin(), commands_.end(), cmd);
+}
+
+int FakeModem::read(char* data, size_t size) {
+    const int n = peek(data, size);
+    rxBuf_.erase(0, n);
+    return n;
+}
+
+int FakeModem::peek(char* data, size_t size) {
+    deliver();
+    const size_t n = std::min(size, rxBuf_.size());
+    memcpy(data, rxBuf_.data(), n);
+    return n;
+}
+
+int FakeModem::skip(size_t size) {
+    deliver();
+    const size_t n = std::min(size, rxBuf_.size());
+    rxBuf_.erase(0, n);
+    return n;
+}
+
+int FakeModem::availForRead() {
+    deliver();
+    return rxBuf_.size();
+}
+
+int FakeModem::write(const char* data, size_t size) {
+    input_.append(data, size);
+    size_t pos = 0;
+    while ((pos = input_.find("\r\n")) != std::string::npos) {
+        const std::string cmd = input_.substr(0, pos);
+        input_.erase(0, pos + 2);
+        command(cmd);
+    }
+    return size;
+}
+
+int FakeModem::flush() {
+    return 0;
+}
+
+int FakeModem::availForWrite() {
+    return 1024;
+}
+
+int FakeModem::waitEvent(unsigned flags, unsigned timeout) {
+    if (flags & WRITABLE) {
+        return WRITABLE;
+    }
+    if (!(flags & READABLE)) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    deliver();
+    if (!rxBuf_.empty()) {
+        return READABLE;
+    }
+    const auto now = FakeClock::now();
+    if (!output_.empty() && output_.front().time - now <= timeout) {
+        FakeClock::advance(output_.front().time - now);
+        deliver();
+        return READABLE;
+    }
+    FakeClock::advance(timeout);
+    return SYSTEM_ERROR_TIMEOUT;
+}
+
+void FakeModem::command(const std::string& cmd) {
+    commands_.push_back(cmd);
+    if (!responding()) {
+        return;
+    }
+    const auto now = FakeClock::now();
+    std::string resp = (cmd == "AT") ? "OK" : "ERROR";
+    system_tick_t delay = 0;
+    const auto it = replies_.find(cmd);
+    if (it != replies_.end() && !it->second.empty()) {
+        auto& replies = it->second;
+        resp = replies.front().resp;
+        delay = replies.front().delay;
+        if (replies.size() > 1) {
+            replies.pop_front();
+        }
+    }
+    send(cmd + "\r\n", now);
+    send("\r\n" + resp + "\r\n", now + delay);
+    const auto r = restarts_.find(cmd);
+    if (r != restarts_.end()) {
+        downTime_ = now + delay + r->second.downDelay;
+        upTime_ = downTime_ + r->second.bootTime;
+    }
+}
+
+void FakeModem::send(const std::string& data, system_tick_t time) {
+    // Keep the output ordered by time
+    auto it = output_.begin();
+    while (it != output_.end() && !isBefore(time, it->time)) {
+        ++it;
+    }
+    output_.insert(it, Output{ time, data });
+}
+
+void FakeModem::deliver() {
+    const auto now = FakeClock::now();
+    while (!output_.empty() && !isBefore(now, output_.front().time)) {
+        rxBuf_ += output_.front().data;
+        output_.pop_front();
+    }
+}
+
+} // particle::test
+
+} // particle
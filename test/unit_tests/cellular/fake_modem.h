@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "stream.h"
+#include "system_tick_hal.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+namespace particle {
+
+namespace test {
+
+/**
+ * Fake clock returned by HAL_Timer_Get_Milli_Seconds().
+ *
+ * The clock only advances when the code under test waits, i.e. calls HAL_Delay_Milliseconds()
+ * or waits for data from a `FakeModem`, so the tests run instantly regardless of the timeouts.
+ */
+class FakeClock {
+public:
+    static system_tick_t now();
+    static void advance(system_tick_t ms);
+    static void reset();
+};
+
+/**
+ * Scripted modem connected to the AT parser via the `Stream` interface.
+ *
+ * The modem echoes every command and replies with the responses scripted for the command, or
+ * `OK` to `AT` and `ERROR` to anything else. It doesn't respond while it's powered off, booting
+ * or restarting. Data is delivered to the parser according to the fake clock.
+ */
+class FakeModem: public Stream {
+public:
+    FakeModem();
+
+    /**
+     * Powers the modem on. V_INT goes high after `vintDelay` milliseconds and the modem starts
+     * responding to commands after `bootTime` milliseconds.
+     */
+    FakeModem& powerOn(system_tick_t vintDelay, system_tick_t bootTime);
+
+    /**
+     * Powers the modem off.
+     */
+    FakeModem& powerOff();
+
+    /**
+     * Sets the next response to a command, without the surrounding newlines. The scripted
+     * responses are used in order and the last one is repeated.
+     */
+    FakeModem& reply(const std::string& cmd, const std::string& resp, system_tick_t delay = 0);
+
+    /**
+     * Makes the modem restart after it has confirmed the command. The modem stops responding
+     * `downDelay` milliseconds after the confirmation and responds again after `bootTime`
+     * milliseconds.
+     */
+    FakeModem& restartOn(const std::string& cmd, system_tick_t downDelay, system_tick_t bootTime);
+
+    /**
+     * Sends an URC `delay` milliseconds from now.
+     */
+    FakeModem& urc(const std::string& data, system_tick_t delay);
+
+    /**
+     * Returns the state of V_INT.
+     */
+    bool vint() const;
+
+    /**
+     * Returns `true` if the modem responds to commands.
+     */
+    bool responding() const;
+
+    /**
+     * Returns the number of times the modem has received the command, including the times it
+     * didn't respond.
+     */
+    unsigned commandCount(const std::string& cmd) const;
+
+    const std::vector<std::string>& commands() const;
+
+    // Reimplemented from Stream
+    int read(char* data, size_t size) override;
+    int peek(char* data, size_t size) override;
+    int skip(size_t size) override;
+    int availForRead() override;
+    int write(const char* data, size_t size) override;
+    int flush() override;
+    int availForWrite() override;
+    int waitEvent(unsigned flags, unsigned timeout) override;
+
+private:
+    struct Output {
+        system_tick_t time;
+        std::string data;
+    };
+
+    struct Reply {
+        std::string resp;
+        system_tick_t delay;
+    };
+
+    struct Restart {
+        system_tick_t downDelay;
+        system_tick_t bootTime;
+    };
+
+    std::map<std::string, std::deque<Reply>> replies_;
+    std::map<std::string, Restart> restarts_;
+    std::vector<std::string> commands_;
+    std::deque<Output> output_;
+    std::string input_;
+    std::string rxBuf_;
+    system_tick_t vintTime_;
+    system_tick_t downTime_;
+    system_tick_t upTime_;
+    bool on_;
+
+    void command(const std::string& cmd);
+    void send(const std::string& data, system_tick_t time);
+    void deliver();
+};
+
+inline const std::vector<std::string>& FakeModem::commands() const {
+    return commands_;
+}
+
+} // particle::test
+
+} // particle
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "modem_bringup.h"
+#include "fake_modem.h"
+
+#include "at_parser.h"
+#include "at_response.h"
+#include "diagnostics.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+using particle::ModemBringup;
+using particle::ModemBringupPhase;
+using particle::AtParser;
+using particle::AtParserConfig;
+using particle::AtCommandTerminator;
+using particle::AtResponse;
+using particle::test::FakeModem;
+using particle::test::FakeClock;
+
+namespace {
+
+class Fixture {
+public:
+    Fixture() {
+        FakeClock::reset();
+        REQUIRE(parser.init(AtParserConfig().stream(&modem).commandTerminator(AtCommandTerminator::CRLF)) == 0);
+        bringup.init(&parser, [](void* data) {
+            return static_cast<FakeModem*>(data)->vint();
+        }, &modem);
+        REQUIRE(bringup.addUrcHandlers() == 0);
+    }
+
+    FakeModem modem;
+    AtParser parser;
+    ModemBringup bringup;
+};
+
+// Time elapsed since the given time
+system_tick_t since(system_tick_t t) {
+    return FakeClock::now() - t;
+}
+
+int32_t diagValue(uint16_t id) {
+    const diag_source* src = nullptr;
+    REQUIRE(diag_get_source(id, &src, nullptr) == 0);
+    int32_t val = 0;
+    diag_source_get_cmd_data d = {};
+    d.size = sizeof(d);
+    d.data = &val;
+    d.data_size = sizeof(val);
+    REQUIRE(src->callback(src, DIAG_SOURCE_CMD_GET, &d) == 0);
+    return val;
+}
+
+} // namespace
+
+TEST_CASE("ModemBringup") {
+    Fixture f;
+    auto& modem = f.modem;
+    auto& parser = f.parser;
+    auto& bringup = f.bringup;
+
+    SECTION("waits for V_INT after the power-on sequence") {
+        modem.powerOn(35, 3000);
+        CHECK(bringup.waitPowerState(true, 1000) == 0);
+        CHECK(modem.vint());
+        // 10 + 20 + 40 ms
+        CHECK(FakeClock::now() == 70);
+    }
+
+    SECTION("reports a timeout if V_INT doesn't change") {
+        CHECK(bringup.waitPowerState(true, 1000) == SYSTEM_ERROR_TIMEOUT);
+        CHECK(FakeClock::now() == 1000);
+        modem.powerOn(0, 0);
+        CHECK(bringup.waitPowerState(false, 10000) == SYSTEM_ERROR_TIMEOUT);
+        CHECK(since(1000) == 10000);
+    }
+
+    SECTION("probes the modem with AT commands until it responds") {
+        modem.powerOn(0, 2500);
+        CHECK(bringup.waitAtResponse(20000) == 0);
+        // The probe period grows up to a second: 100, 200, 400, 800, 1000 ms
+        CHECK(FakeClock::now() >= 2500);
+        CHECK(FakeClock::now() <= 3500);
+        CHECK(modem.commandCount("AT") == 6);
+    }
+
+    SECTION("doesn't wait for a modem that is already up") {
+        modem.powerOn(0, 0);
+        CHECK(bringup.waitAtResponse(20000) == 0);
+        CHECK(FakeClock::now() == 0);
+        CHECK(modem.commandCount("AT") == 1);
+    }
+
+    SECTION("reports a timeout if the modem doesn't respond") {
+        CHECK(bringup.waitAtResponse(20000) == SYSTEM_ERROR_TIMEOUT);
+        CHECK(FakeClock::now() >= 20000);
+        CHECK(FakeClock::now() < 21000);
+        CHECK(modem.commandCount("AT") < 30);
+    }
+
+    SECTION("doesn't flood a modem that replies with an error") {
+        modem.powerOn(0, 0);
+        modem.reply("AT", "ERROR");
+        CHECK(bringup.waitAtResponse(5000) == SYSTEM_ERROR_TIMEOUT);
+        CHECK(modem.commandCount("AT") < 10);
+    }
+
+    SECTION("waits for the modem to restart after a reset command") {
+        modem.powerOn(0, 0);
+        modem.reply("AT+CFUN=15", "OK");
+        modem.restartOn("AT+CFUN=15", 300, 4000);
+        CHECK(parser.execCommand("AT+CFUN=15") == AtResponse::OK);
+        CHECK(bringup.waitRestart(10000, 20000) == 0);
+        // The modem that was about to restart wasn't mistaken for the restarted one
+        CHECK(FakeClock::now() >= 4300);
+        // The fixed delay used to be 10 seconds
+        CHECK(FakeClock::now() < 6000);
+        CHECK(modem.responding());
+    }
+
+    SECTION("continues if the modem doesn't seem to restart") {
+        modem.powerOn(0, 0);
+        CHECK(parser.execCommand("AT+CFUN=16") == AtResponse::ERROR);
+        CHECK(bringup.waitRestart(1000, 20000) == 0);
+        CHECK(FakeClock::now() >= 1000);
+        CHECK(FakeClock::now() < 2000);
+    }
+
+    SECTION("polls the SIM state until the SIM card is ready") {
+        modem.powerOn(0, 0);
+        modem.reply("AT+CPIN?", "+CME ERROR: 14"); // SIM busy
+        modem.reply("AT+CPIN?", "+CME ERROR: 14");
+        modem.reply("AT+CPIN?", "+CPIN: READY\r\n\r\nOK");
+        CHECK(bringup.waitSimReady(10000) == 0);
+        CHECK(bringup.simReady());
+        CHECK(modem.commandCount("AT+CPIN?") == 3);
+        // 100 + 200 ms
+        CHECK(FakeClock::now() == 300);
+    }
+
+    SECTION("returns as soon as the modem reports that the SIM card is ready") {
+        modem.powerOn(0, 0);
+        modem.reply("AT+CPIN?", "+CME ERROR: 14");
+        modem.urc("+CPIN: READY", 1700);
+        CHECK(bringup.waitSimReady(10000) == 0);
+        CHECK(FakeClock::now() == 1700);
+    }
+
+    SECTION("reports a timeout if the SIM card is not ready") {
+        modem.powerOn(0, 0);
+        modem.reply("AT+CPIN?", "+CPIN: SIM PIN\r\n\r\nOK");
+        CHECK(bringup.waitSimReady(10000) == SYSTEM_ERROR_TIMEOUT);
+        CHECK_FALSE(bringup.simReady());
+        CHECK(FakeClock::now() >= 10000);
+        CHECK(modem.commandCount("AT+CPIN?") < 20);
+    }
+
+    SECTION("records the time spent in each phase") {
+        bringup.enterPhase(ModemBringupPhase::POWER_ON);
+        FakeClock::advance(100);
+        bringup.enterPhase(ModemBringupPhase::AT_READY);
+        FakeClock::advance(2000);
+        bringup.enterPhase(ModemBringupPhase::CONFIG);
+        FakeClock::advance(300);
+        bringup.enterPhase(ModemBringupPhase::SIM_READY);
+        FakeClock::advance(500);
+        bringup.enterPhase(ModemBringupPhase::CONFIG);
+        FakeClock::advance(200);
+        bringup.finish();
+        FakeClock::advance(1000);
+        CHECK(bringup.phaseTime(ModemBringupPhase::POWER_ON) == 100);
+        CHECK(bringup.phaseTime(ModemBringupPhase::AT_READY) == 2000);
+        CHECK(bringup.phaseTime(ModemBringupPhase::CONFIG) == 500);
+        CHECK(bringup.phaseTime(ModemBringupPhase::SIM_READY) == 500);
+        CHECK(bringup.phaseTime(ModemBringupPhase::RESTART) == 0);
+        CHECK(bringup.totalTime() == 3100);
+        // The times are published as diagnostics
+        diag_command(DIAG_SERVICE_CMD_START, nullptr, nullptr);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_TIME) == 3100);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_POWER_ON_TIME) == 100);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_AT_READY_TIME) == 2000);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_CONFIG_TIME) == 500);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_SIM_READY_TIME) == 500);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_RESTART_TIME) == 0);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_MUXER_TIME) == 0);
+        // A new bring-up
+        bringup.enterPhase(ModemBringupPhase::AT_READY);
+        FakeClock::advance(400);
+        bringup.finish();
+        CHECK(bringup.phaseTime(ModemBringupPhase::POWER_ON) == 0);
+        CHECK(bringup.totalTime() == 400);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_TIME) == 400);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_POWER_ON_TIME) == 0);
+        CHECK(diagValue(DIAG_ID_NETWORK_CELLULAR_INIT_AT_READY_TIME) == 400);
+    }
+}
+
+TEST_CASE("ModemBringup sequence") {
+    Fixture f;
+    auto& modem = f.modem;
+    auto& parser = f.parser;
+    auto& bringup = f.bringup;
+
+    // SARA-R410 changing the SIM slot: power on, wait for AT, reconfigure and restart the modem,
+    // and wait for the SIM card
+    modem.reply("AT+UGPIOC=23,0,1", "OK");
+    modem.restartOn("AT+CFUN=15", 500, 5000);
+    modem.reply("AT+CFUN=15", "OK");
+    modem.reply("AT+CPIN?", "+CME ERROR: 14");
+    modem.urc("+CPIN: READY", 12000);
+
+    bringup.enterPhase(ModemBringupPhase::POWER_ON);
+    modem.powerOn(60, 4000);
+    REQUIRE(bringup.waitPowerState(true, 1000) == 0);
+    bringup.enterPhase(ModemBringupPhase::AT_READY);
+    REQUIRE(bringup.waitAtResponse(20000) == 0);
+    bringup.enterPhase(ModemBringupPhase::CONFIG);
+    REQUIRE(parser.execCommand("AT+UGPIOC=23,0,1") == AtResponse::OK);
+    bringup.enterPhase(ModemBringupPhase::RESTART);
+    REQUIRE(parser.execCommand("AT+CFUN=15") == AtResponse::OK);
+    REQUIRE(bringup.waitRestart(10000, 20000) == 0);
+    bringup.enterPhase(ModemBringupPhase::SIM_READY);
+    REQUIRE(bringup.waitSimReady(10000) == 0);
+    bringup.finish();
+
+    CHECK(bringup.phaseTime(ModemBringupPhase::POWER_ON) < 100);
+    CHECK(bringup.phaseTime(ModemBringupPhase::AT_READY) < 5000);
+    CHECK(bringup.phaseTime(ModemBringupPhase::RESTART) < 7000);
+    CHECK(bringup.totalTime() == FakeClock::now());
+    // The URC ends the wait for the SIM card
+    CHECK(FakeClock::now() == 12000);
+    // The SIM state is probed with a growing period
+    CHECK(modem.commandCount("AT+CPIN?") == 4);
+    CHECK(modem.commandCount("AT") < 30);
+}
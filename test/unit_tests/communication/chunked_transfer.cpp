@@ -0,0 +1,592 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <fstream>
+#include <vector>
+
+#include <zlib.h>
+
+#include "service_debug.h"
+#include "buffer_message_channel.h"
+#include "chunked_transfer.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+namespace {
+
+const uint16_t CHUNK_SIZE = 512;
+
+uint32_t crc32(const uint8_t* buf, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	while (length--) {
+		crc ^= *buf++;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+/**
+ * Transfer callbacks that write to a simulated flash that takes a fixed time for each write.
+ */
+struct SlowFlashCallbacks : public ChunkedTransfer::Callbacks
+{
+	std::vector<uint8_t> flash;
+	std::vector<uint32_t> prepare_flags;
+	std::vector<unsigned> chunks_written;
+	system_tick_t now = 0;
+	system_tick_t write_time;
+	bool finished = false;
+	uint8_t file_flags = 0;
+	// when set, chunks can only be saved in order, as with a delta patch
+	bool in_order = false;
+	bool resume_supported = true;
+	// the persisted transfer state, which survives a reset
+	std::vector<uint8_t> state;
+
+	SlowFlashCallbacks(size_t length, system_tick_t write_time_) : flash(length, 0xFF), write_time(write_time_) {}
+
+	int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		if (flags & 1)
+			return 0;
+		if ((flags & ChunkedTransfer::PREPARE_RESUME) && !resume_supported)
+			return 1;
+		prepare_flags.push_back(flags);
+		file_flags = data.flags;
+		if (!(flags & ChunkedTransfer::PREPARE_RESUME))
+			std::fill(flash.begin(), flash.end(), 0xFF);
+		return 0;
+	}
+
+	int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*) override
+	{
+		REQUIRE(descriptor.chunk_address + descriptor.chunk_size <= flash.size());
+		if (in_order)
+		{
+			descriptor.flags |= FileTransfer::Flag::STREAMED;
+			if (descriptor.chunk_address != chunks_written.size() * CHUNK_SIZE)
+				return 1;
+		}
+		std::copy(chunk, chunk + descriptor.chunk_size, flash.begin() + descriptor.chunk_address);
+		chunks_written.push_back(descriptor.chunk_address / CHUNK_SIZE);
+		now += write_time;
+		return 0;
+	}
+
+	int finish_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		if (!(flags & UpdateFlag::VALIDATE_ONLY))
+			finished = flags & UpdateFlag::SUCCESS;
+		return 0;
+	}
+
+	uint32_t calculate_crc(const unsigned char* buf, uint32_t buflen) override
+	{
+		return crc32(buf, buflen);
+	}
+
+	system_tick_t millis() override
+	{
+		return now;
+	}
+
+	int save_transfer_state(const void* data, size_t length) override
+	{
+		state.assign((const uint8_t*)data, (const uint8_t*)data + length);
+		return 0;
+	}
+
+	int restore_transfer_state(void* data, size_t max_length) override
+	{
+		if (state.size() > max_length)
+			return 0;
+		std::copy(state.begin(), state.end(), (uint8_t*)data);
+		return state.size();
+	}
+};
+
+/**
+ * A channel with a single static buffer, like the channels used on the device, that
+ * records when the last message was sent.
+ */
+class OtaChannel : public BufferMessageChannel<PROTOCOL_BUFFER_SIZE>
+{
+	SlowFlashCallbacks& callbacks;
+
+public:
+	system_tick_t last_send = 0;
+	// the size of the messages sent and received
+	size_t bytes = 0;
+
+	OtaChannel(SlowFlashCallbacks& callbacks_) : callbacks(callbacks_) {}
+
+	bool is_unreliable() override { return true; }
+
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+
+	ProtocolError send(Message& msg) override
+	{
+		last_send = callbacks.now;
+		bytes += msg.length();
+		return NO_ERROR;
+	}
+
+	ProtocolError receive(Message& msg) override { return NO_ERROR; }
+
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+
+	ProtocolError notify_established() override { return NO_ERROR; }
+
+	void notify_client_messages_processed() override {}
+
+	Message update_begin(bool fast_ota, uint32_t file_length, bool compressed = false)
+	{
+		Message msg;
+		create(msg);
+		uint8_t* buf = msg.buf();
+		const uint8_t header[] = { 0x41, 0x02, 0x00, 0x01, 0x01, 0xB1, 'u', 0xFF, uint8_t((fast_ota ? 1 : 0) | (compressed ? 2 : 0)),
+				uint8_t(CHUNK_SIZE >> 8), uint8_t(CHUNK_SIZE & 0xFF), uint8_t(file_length >> 24),
+				uint8_t(file_length >> 16), uint8_t(file_length >> 8), uint8_t(file_length), 0, 0, 0, 0, 0 };
+		memcpy(buf, header, sizeof(header));
+		msg.set_length(sizeof(header));
+		bytes += msg.length();
+		return msg;
+	}
+
+	Message chunk(const std::vector<uint8_t>& file, unsigned index, bool fast_ota)
+	{
+		Message msg;
+		create(msg);
+		const uint8_t* data = file.data() + index * CHUNK_SIZE;
+		const uint16_t size = std::min(size_t(CHUNK_SIZE), file.size() - index * CHUNK_SIZE);
+		const uint32_t crc = crc32(data, size);
+		uint8_t* buf = msg.buf();
+		size_t len = 0;
+		const uint8_t header[] = { 0x51, 0x02, uint8_t(index >> 8), uint8_t(index), 0x01, 0xB1, 'c',
+				0x44, uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+		memcpy(buf, header, sizeof(header));
+		len += sizeof(header);
+		if (fast_ota) {
+			buf[len++] = 0x02;
+			buf[len++] = index >> 8;
+			buf[len++] = index & 0xFF;
+		}
+		buf[len++] = 0xFF;
+		memcpy(buf + len, data, size);
+		msg.set_length(len + size);
+		bytes += msg.length();
+		return msg;
+	}
+
+	Message update_done()
+	{
+		Message msg;
+		create(msg);
+		const uint8_t header[] = { 0x41, 0x03, 0x00, 0x02, 0x01, 0xB1, 'u' };
+		memcpy(msg.buf(), header, sizeof(header));
+		msg.set_length(sizeof(header));
+		bytes += msg.length();
+		return msg;
+	}
+};
+
+/**
+ * Writes each chunk as it is received, before the response is sent, as chunks were
+ * written before they were pipelined.
+ */
+class SynchronousTransfer : public ChunkedTransfer
+{
+public:
+	ProtocolError handle_update_begin(token_t token, Message& message, MessageChannel& channel)
+	{
+		ProtocolError error = ChunkedTransfer::handle_update_begin(token, message, channel);
+		stop_pipeline();
+		return error;
+	}
+};
+
+std::vector<uint8_t> make_file(size_t length)
+{
+	std::vector<uint8_t> file(length);
+	for (size_t i = 0; i < length; i++) {
+		file[i] = uint8_t(i * 7 + (i >> 9));
+	}
+	return file;
+}
+
+/**
+ * Runs a regular OTA transfer where the server sends the next chunk one round trip after
+ * the previous chunk was acknowledged. Returns the simulated time taken.
+ */
+template<typename Transfer>
+system_tick_t transfer_file(Transfer& transfer, SlowFlashCallbacks& callbacks, const std::vector<uint8_t>& file,
+		system_tick_t rtt, size_t* bytes = nullptr, bool compressed = false)
+{
+	OtaChannel channel(callbacks);
+	transfer.init(&callbacks);
+	Message msg = channel.update_begin(false, file.size(), compressed);
+	REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+	REQUIRE(transfer.is_updating());
+	const unsigned chunks = (file.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	for (unsigned i = 0; i < chunks; i++) {
+		const system_tick_t arrival = channel.last_send + rtt;
+		while (callbacks.now < arrival) {
+			if (transfer.pending_chunks()) {
+				REQUIRE(transfer.idle(channel)==NO_ERROR);
+			} else {
+				callbacks.now++;
+			}
+		}
+		msg = channel.chunk(file, i, false);
+		REQUIRE(transfer.handle_chunk(1, msg, channel)==NO_ERROR);
+	}
+	msg = channel.update_done();
+	REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+	REQUIRE(transfer.pending_chunks()==0);
+	REQUIRE_FALSE(transfer.is_updating());
+	REQUIRE(callbacks.finished);
+	REQUIRE(callbacks.flash==file);
+	if (bytes)
+		*bytes = channel.bytes;
+	return callbacks.now;
+}
+
+/**
+ * Compresses the data with the raw deflate format and the dictionary size used by the device.
+ */
+std::vector<uint8_t> deflate_module(const std::vector<uint8_t>& data)
+{
+	z_stream strm = {};
+	REQUIRE(deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -10, 9, Z_DEFAULT_STRATEGY)==Z_OK);
+	std::vector<uint8_t> out(deflateBound(&strm, data.size()));
+	strm.next_in = const_cast<uint8_t*>(data.data());
+	strm.avail_in = data.size();
+	strm.next_out = out.data();
+	strm.avail_out = out.size();
+	REQUIRE(deflate(&strm, Z_FINISH)==Z_STREAM_END);
+	out.resize(strm.total_out);
+	deflateEnd(&strm);
+	return out;
+}
+
+std::vector<uint8_t> inflate_module(const std::vector<uint8_t>& data, size_t size)
+{
+	z_stream strm = {};
+	REQUIRE(inflateInit2(&strm, -10)==Z_OK);
+	std::vector<uint8_t> out(size);
+	strm.next_in = const_cast<uint8_t*>(data.data());
+	strm.avail_in = data.size();
+	strm.next_out = out.data();
+	strm.avail_out = out.size();
+	REQUIRE(inflate(&strm, Z_FINISH)==Z_STREAM_END);
+	inflateEnd(&strm);
+	return out;
+}
+
+/**
+ * Sends the given chunks in fast OTA mode, calling idle() between chunks.
+ */
+void send_fast_chunks(ChunkedTransfer& transfer, OtaChannel& channel, const std::vector<uint8_t>& file,
+		unsigned first, unsigned last)
+{
+	for (unsigned i = first; i < last; i++) {
+		Message msg = channel.chunk(file, i, true);
+		REQUIRE(transfer.handle_chunk(1, msg, channel)==NO_ERROR);
+		REQUIRE(transfer.idle(channel)==NO_ERROR);
+	}
+}
+
+} // namespace
+
+SCENARIO("pipelining flash writes reduces the time taken by a transfer")
+{
+	const std::vector<uint8_t> file = make_file(64 * CHUNK_SIZE - 100);
+	const system_tick_t rtt = 100;
+	const system_tick_t write_time = 60;		// typical for a 512 byte write to internal flash
+
+	SlowFlashCallbacks sync_callbacks(file.size(), write_time);
+	SynchronousTransfer sync_transfer;
+	const system_tick_t sync_time = transfer_file(sync_transfer, sync_callbacks, file, rtt);
+
+	SlowFlashCallbacks pipelined_callbacks(file.size(), write_time);
+	ChunkedTransfer pipelined_transfer;
+	const system_tick_t pipelined_time = transfer_file(pipelined_transfer, pipelined_callbacks, file, rtt);
+
+	INFO("synchronous writes: " << sync_time << " ms");
+	INFO("pipelined writes: " << pipelined_time << " ms");
+	CHECK(sync_time >= 64 * (rtt + write_time));
+	CHECK(pipelined_time < 64 * (rtt + 5));
+	CHECK(pipelined_callbacks.chunks_written.size()==64);
+}
+
+SCENARIO("the buffered chunks are saved before the missing chunks are reported")
+{
+	const unsigned chunks = 8;
+	const std::vector<uint8_t> file = make_file(chunks * CHUNK_SIZE);
+	SlowFlashCallbacks callbacks(file.size(), 1);
+	ChunkedTransfer transfer;
+	transfer.init(&callbacks);
+	OtaChannel channel(callbacks);
+	Message msg = channel.update_begin(true, file.size());
+	REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+	// chunks are pending until the update is done
+	for (unsigned i = 0; i < chunks; i += 2) {
+		msg = channel.chunk(file, i, true);
+		REQUIRE(transfer.handle_chunk(1, msg, channel)==NO_ERROR);
+	}
+	REQUIRE(transfer.pending_chunks()==2);
+
+	WHEN("a buffered chunk is sent again")
+	{
+		msg = channel.chunk(file, chunks - 2, true);
+		REQUIRE(transfer.handle_chunk(1, msg, channel)==NO_ERROR);
+
+		THEN("it is written once")
+		{
+			REQUIRE(transfer.pending_chunks()==2);
+			msg = channel.update_done();
+			REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+			REQUIRE(callbacks.chunks_written.size()==chunks / 2);
+		}
+	}
+	AND_WHEN("the update is done")
+	{
+		msg = channel.update_done();
+		REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+
+		THEN("only the chunks that were not received are missing")
+		{
+			REQUIRE(transfer.pending_chunks()==0);
+			REQUIRE(callbacks.chunks_written.size()==chunks / 2);
+			REQUIRE(transfer.is_updating());
+			for (unsigned i = 1; i < chunks; i += 2) {
+				msg = channel.chunk(file, i, true);
+				REQUIRE(transfer.handle_chunk(1, msg, channel)==NO_ERROR);
+			}
+			msg = channel.update_done();
+			REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+			REQUIRE_FALSE(transfer.is_updating());
+			REQUIRE(callbacks.finished);
+			REQUIRE(callbacks.flash==file);
+		}
+	}
+}
+
+SCENARIO("a chunk that can't be saved is requested again")
+{
+	const unsigned chunks = 8;
+	const std::vector<uint8_t> file = make_file(chunks * CHUNK_SIZE);
+	SlowFlashCallbacks callbacks(file.size(), 1);
+	callbacks.in_order = true;
+	ChunkedTransfer transfer;
+	transfer.init(&callbacks);
+	OtaChannel channel(callbacks);
+	Message msg = channel.update_begin(true, file.size());
+	REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+
+	GIVEN("a chunk is lost and the following chunks can't be saved ahead of it")
+	{
+		send_fast_chunks(transfer, channel, file, 0, 3);
+		send_fast_chunks(transfer, channel, file, 4, chunks);
+		msg = channel.update_done();
+		REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+		REQUIRE(transfer.is_updating());
+		REQUIRE(callbacks.chunks_written.size()==3);
+
+		WHEN("the missing chunks are sent again")
+		{
+			send_fast_chunks(transfer, channel, file, 3, chunks);
+			msg = channel.update_done();
+			REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+
+			THEN("the transfer completes")
+			{
+				REQUIRE_FALSE(transfer.is_updating());
+				REQUIRE(callbacks.finished);
+				REQUIRE(callbacks.flash==file);
+			}
+		}
+	}
+}
+
+SCENARIO("an interrupted fast OTA transfer is resumed after a reset")
+{
+	const unsigned chunks = 32;
+	const unsigned saved = 20;
+	const std::vector<uint8_t> file = make_file(chunks * CHUNK_SIZE - 100);
+	SlowFlashCallbacks callbacks(file.size(), 1);
+	OtaChannel channel(callbacks);
+	{
+		ChunkedTransfer transfer;
+		transfer.init(&callbacks);
+		Message msg = channel.update_begin(true, file.size());
+		REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+		send_fast_chunks(transfer, channel, file, 0, saved);
+		// two more chunks are received but not yet saved when the transfer is interrupted
+		for (unsigned i = saved; i < saved + 2; i++) {
+			msg = channel.chunk(file, i, true);
+			REQUIRE(transfer.handle_chunk(1, msg, channel)==NO_ERROR);
+		}
+		REQUIRE(transfer.pending_chunks()==2);
+		transfer.cancel();
+	}
+	REQUIRE(callbacks.chunks_written.size()==saved);
+	REQUIRE_FALSE(callbacks.state.empty());
+	callbacks.chunks_written.clear();
+
+	// the device was reset, so the transfer starts from its persisted state
+	ChunkedTransfer transfer;
+	transfer.init(&callbacks);
+
+	WHEN("the same file is sent again")
+	{
+		Message msg = channel.update_begin(true, file.size());
+		REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+		send_fast_chunks(transfer, channel, file, 0, chunks);
+		msg = channel.update_done();
+		REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+
+		THEN("only the chunks not saved before the reset are written")
+		{
+			REQUIRE(callbacks.prepare_flags.back()==ChunkedTransfer::PREPARE_RESUME);
+			REQUIRE(callbacks.chunks_written.size()==chunks - saved);
+			REQUIRE(callbacks.chunks_written.front()==saved);
+			REQUIRE_FALSE(transfer.is_updating());
+			REQUIRE(callbacks.finished);
+			REQUIRE(callbacks.flash==file);
+			REQUIRE(callbacks.state.empty());
+		}
+	}
+	AND_WHEN("the storage can't resume the transfer")
+	{
+		callbacks.resume_supported = false;
+		Message msg = channel.update_begin(true, file.size());
+		REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+		send_fast_chunks(transfer, channel, file, 0, chunks);
+		msg = channel.update_done();
+		REQUIRE(transfer.handle_update_done(1, msg, channel)==NO_ERROR);
+
+		THEN("the transfer starts over")
+		{
+			REQUIRE(callbacks.prepare_flags.back()==0);
+			REQUIRE(callbacks.chunks_written.size()==chunks);
+			REQUIRE(callbacks.finished);
+			REQUIRE(callbacks.flash==file);
+		}
+	}
+	AND_WHEN("a different file is sent")
+	{
+		const std::vector<uint8_t> other = make_file(file.size() - CHUNK_SIZE);
+		Message msg = channel.update_begin(true, other.size());
+		REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+
+		THEN("the persisted state is discarded")
+		{
+			REQUIRE(callbacks.prepare_flags.back()==0);
+			REQUIRE(callbacks.state.empty());
+			send_fast_chunks(transfer, channel, other, 0, chunks - 1);
+			REQUIRE(callbacks.chunks_written.size()==chunks - 1);
+		}
+	}
+}
+
+SCENARIO("a transfer that can't be resumed isn't persisted")
+{
+	const unsigned chunks = 8;
+	const std::vector<uint8_t> file = make_file(chunks * CHUNK_SIZE);
+	SlowFlashCallbacks callbacks(file.size(), 1);
+	ChunkedTransfer transfer;
+	transfer.init(&callbacks);
+	OtaChannel channel(callbacks);
+
+	WHEN("the storage processes the chunks in order")
+	{
+		callbacks.in_order = true;
+		Message msg = channel.update_begin(true, file.size());
+		REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+		send_fast_chunks(transfer, channel, file, 0, chunks / 2);
+
+		THEN("no state is persisted")
+		{
+			REQUIRE(callbacks.chunks_written.size()==chunks / 2);
+			REQUIRE(callbacks.state.empty());
+		}
+	}
+	AND_WHEN("the module is compressed")
+	{
+		Message msg = channel.update_begin(true, file.size(), true);
+		REQUIRE(transfer.handle_update_begin(1, msg, channel)==NO_ERROR);
+		send_fast_chunks(transfer, channel, file, 0, chunks / 2);
+
+		THEN("no state is persisted")
+		{
+			REQUIRE(callbacks.chunks_written.size()==chunks / 2);
+			REQUIRE(callbacks.state.empty());
+		}
+	}
+}
+
+SCENARIO("a compressed module is transferred as is and flagged to the storage")
+{
+	const std::vector<uint8_t> module = make_file(16 * CHUNK_SIZE);
+	const std::vector<uint8_t> compressed = deflate_module(module);
+	SlowFlashCallbacks callbacks(compressed.size(), 1);
+	ChunkedTransfer transfer;
+	transfer_file(transfer, callbacks, compressed, 1, nullptr, true);
+	REQUIRE(callbacks.file_flags==FileTransfer::Flag::COMPRESSED);
+	REQUIRE(inflate_module(callbacks.flash, module.size())==module);
+
+	SlowFlashCallbacks raw_callbacks(module.size(), 1);
+	transfer_file(transfer, raw_callbacks, module, 1);
+	REQUIRE(raw_callbacks.file_flags==0);
+}
+
+TEST_CASE("Benchmark compressed OTA transfers", "[.][benchmark]")
+{
+	// machine code is a reasonable stand-in for a firmware module
+	std::ifstream exe("/proc/self/exe", std::ios::binary);
+	std::vector<uint8_t> module(128 * 1024);
+	exe.read((char*)module.data(), module.size());
+	module.resize(exe.gcount());
+	const std::vector<uint8_t> compressed = deflate_module(module);
+	const system_tick_t rtt = 100;
+	const system_tick_t write_time = 60;		// for each CHUNK_SIZE bytes of the module
+
+	SlowFlashCallbacks raw_callbacks(module.size(), write_time);
+	ChunkedTransfer raw_transfer;
+	size_t raw_bytes = 0;
+	const system_tick_t raw_time = transfer_file(raw_transfer, raw_callbacks, module, rtt, &raw_bytes);
+
+	// a compressed chunk takes as long to save as the module data it decompresses to
+	SlowFlashCallbacks compressed_callbacks(compressed.size(), write_time * module.size() / compressed.size());
+	ChunkedTransfer compressed_transfer;
+	size_t compressed_bytes = 0;
+	const system_tick_t compressed_time = transfer_file(compressed_transfer, compressed_callbacks, compressed, rtt,
+			&compressed_bytes, true);
+	CHECK(inflate_module(compressed_callbacks.flash, module.size())==module);
+
+	WARN(module.size() << " byte module: raw transfer " << raw_time << " ms, " << raw_bytes <<
+			" bytes on the wire; compressed transfer " << compressed_time << " ms, " << compressed_bytes <<
+			" bytes on the wire");
+}
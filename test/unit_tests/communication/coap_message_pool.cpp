@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <vector>
+
+#include "coap_channel.h"
+#include "coap_message_pool.h"
+#include "communication_diagnostic.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+SCENARIO("CoAP messages are allocated from the size class that fits them")
+{
+	CoAPMessagePool& pool = CoAPMessagePool::instance();
+	const uint16_t small = pool.blocks_in_use(CoAPMessagePool::SMALL);
+	const uint16_t large = pool.blocks_in_use(CoAPMessagePool::LARGE);
+
+	GIVEN("an acknowledgement and a full size message")
+	{
+		uint8_t ack_buf[] = { 0x60, 0x00, 0x12, 0x34 };
+		Message ack(ack_buf, sizeof(ack_buf), sizeof(ack_buf));
+		ack.decode_id();
+		std::vector<uint8_t> event_buf(PROTOCOL_BUFFER_SIZE, 0xFF);
+		event_buf[0] = 0x40;
+		Message event(event_buf.data(), event_buf.size(), event_buf.size());
+		event.decode_id();
+
+		WHEN("CoAP messages are created for them")
+		{
+			CoAPMessage* ack_msg = CoAPMessage::create(ack);
+			CoAPMessage* event_msg = CoAPMessage::create(event);
+			REQUIRE(ack_msg!=nullptr);
+			REQUIRE(event_msg!=nullptr);
+
+			THEN("each message uses a block of the matching size class")
+			{
+				REQUIRE(pool.blocks_in_use(CoAPMessagePool::SMALL)==small + 1);
+				REQUIRE(pool.blocks_in_use(CoAPMessagePool::LARGE)==large + 1);
+				REQUIRE(event_msg->get_data_length()==PROTOCOL_BUFFER_SIZE);
+				REQUIRE(pool.high_water_mark()>=2);
+				REQUIRE(int(g_coapMessagePoolHighWaterMark)==pool.high_water_mark());
+			}
+			delete ack_msg;
+			delete event_msg;
+			AND_THEN("the blocks are returned to the pool when the messages are deleted")
+			{
+				REQUIRE(pool.blocks_in_use(CoAPMessagePool::SMALL)==small);
+				REQUIRE(pool.blocks_in_use(CoAPMessagePool::LARGE)==large);
+			}
+		}
+	}
+}
+
+SCENARIO("CoAP messages are allocated from the heap when the pool is exhausted")
+{
+	CoAPMessagePool& pool = CoAPMessagePool::instance();
+	const uint32_t exhausted = pool.exhausted_count();
+	const int exhausted_diag = g_coapMessagePoolExhaustedCounter;
+
+	WHEN("more messages are allocated than there are small blocks")
+	{
+		std::vector<CoAPMessage*> messages;
+		for (message_id_t id = 0; id < COAP_MESSAGE_POOL_SMALL_BLOCKS + 2; id++) {
+			CoAPMessage* msg = new CoAPMessage(id);
+			REQUIRE(msg!=nullptr);
+			messages.push_back(msg);
+		}
+		THEN("the additional messages are counted as pool exhaustion")
+		{
+			REQUIRE(pool.blocks_in_use(CoAPMessagePool::SMALL)==COAP_MESSAGE_POOL_SMALL_BLOCKS);
+			REQUIRE(pool.exhausted_count()==exhausted + 2);
+			REQUIRE(int(g_coapMessagePoolExhaustedCounter)==exhausted_diag + 2);
+		}
+		for (CoAPMessage* msg: messages) {
+			delete msg;
+		}
+		AND_THEN("all blocks can be reused once the messages are deleted")
+		{
+			REQUIRE(pool.blocks_in_use(CoAPMessagePool::SMALL)==0);
+			for (message_id_t id = 0; id < COAP_MESSAGE_POOL_SMALL_BLOCKS; id++) {
+				messages[id] = new CoAPMessage(id);
+			}
+			REQUIRE(pool.exhausted_count()==exhausted + 2);
+			for (message_id_t id = 0; id < COAP_MESSAGE_POOL_SMALL_BLOCKS; id++) {
+				delete messages[id];
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
@@ -0,0 +1,306 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <chrono>
+
+#include "coap_channel.h"
+#include "messages.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+namespace {
+
+/**
+ * A channel that counts the messages sent to it.
+ */
+struct CountingChannel : public Channel
+{
+	unsigned sent = 0;
+
+	ProtocolError receive(Message& msg) override
+	{
+		msg.set_length(0);
+		return NO_ERROR;
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		sent++;
+		return NO_ERROR;
+	}
+
+	ProtocolError command(Command cmd, void* arg) override
+	{
+		return NO_ERROR;
+	}
+};
+
+Message confirmable(uint8_t* buf, message_id_t id)
+{
+	buf[0] = 0x40;
+	buf[1] = 0x02;
+	buf[2] = id >> 8;
+	buf[3] = id & 0xFF;
+	Message msg(buf, 4, 4);
+	msg.decode_id();
+	return msg;
+}
+
+ProtocolError send_confirmable(CoAPMessageStore& store, message_id_t id, system_tick_t time)
+{
+	uint8_t buf[4];
+	Message msg = confirmable(buf, id);
+	return store.send(msg, time);
+}
+
+ProtocolError receive_ack(CoAPMessageStore& store, Channel& channel, message_id_t id)
+{
+	uint8_t buf[4];
+	Message msg(buf, sizeof(buf));
+	msg.set_length(Messages::empty_ack(buf, id >> 8, id & 0xFF));
+	return store.receive(msg, channel, 0);
+}
+
+/**
+ * The list based message store that was used before messages were indexed.
+ * Kept here as a baseline for the benchmark below.
+ */
+class ListMessageStore
+{
+	CoAPMessage* head = nullptr;
+
+	CoAPMessage* for_id(message_id_t id, CoAPMessage*& prev) const
+	{
+		prev = nullptr;
+		for (CoAPMessage* msg = head; msg; msg = msg->get_next()) {
+			if (msg->matches(id))
+				return msg;
+			prev = msg;
+		}
+		return nullptr;
+	}
+
+	void remove(CoAPMessage* msg, CoAPMessage* prev)
+	{
+		if (prev)
+			prev->set_next(msg->get_next());
+		else
+			head = msg->get_next();
+		msg->removed();
+	}
+
+public:
+	~ListMessageStore()
+	{
+		while (head) {
+			CoAPMessage* msg = head;
+			remove(msg, nullptr);
+			delete msg;
+		}
+	}
+
+	void send(Message& msg, system_tick_t time)
+	{
+		CoAPMessage* coapmsg = CoAPMessage::create(msg);
+		coapmsg->prepare_retransmit(time);
+		CoAPMessage* prev;
+		CoAPMessage* existing = for_id(coapmsg->get_id(), prev);
+		if (existing) {
+			remove(existing, prev);
+			delete existing;
+		}
+		coapmsg->set_next(head);
+		head = coapmsg;
+	}
+
+	void acknowledge(message_id_t id)
+	{
+		CoAPMessage* prev;
+		CoAPMessage* msg = for_id(id, prev);
+		if (msg) {
+			remove(msg, prev);
+			delete msg;
+		}
+	}
+
+	void process(system_tick_t time, Channel& channel)
+	{
+		for (CoAPMessage* msg = head; msg; msg = msg->get_next()) {
+			if (time_has_passed(time, msg->get_timeout()) && msg->prepare_retransmit(time)) {
+				Message m((uint8_t*)msg->get_data(), msg->get_data_length(), msg->get_data_length());
+				channel.send(m);
+			}
+		}
+	}
+};
+
+template<typename F>
+double nanoseconds_per_op(unsigned ops, F fn)
+{
+	const auto start = std::chrono::steady_clock::now();
+	fn();
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+} // namespace
+
+SCENARIO("the message store finds messages by ID when IDs collide in the index")
+{
+	REQUIRE(CoAPMessage::messages()==0);
+	GIVEN("a message store with messages whose IDs map to the same slots")
+	{
+		CoAPMessageStore store;
+		CountingChannel channel;
+		for (message_id_t id = 0; id < 64; id++) {
+			REQUIRE(send_confirmable(store, id * 1024, 0)==NO_ERROR);
+		}
+		REQUIRE(CoAPMessage::messages()==64);
+
+		WHEN("every other message is acknowledged")
+		{
+			for (message_id_t id = 0; id < 64; id += 2) {
+				REQUIRE(receive_ack(store, channel, id * 1024)==NO_ERROR);
+			}
+			THEN("only the remaining messages can be found")
+			{
+				for (message_id_t id = 0; id < 64; id++) {
+					INFO("message id " << id * 1024);
+					if (id % 2) {
+						REQUIRE(store.from_id(id * 1024)!=nullptr);
+						REQUIRE(store.from_id(id * 1024)->get_id()==id * 1024);
+					} else {
+						REQUIRE(store.from_id(id * 1024)==nullptr);
+					}
+				}
+				REQUIRE(CoAPMessage::messages()==32);
+				REQUIRE(store.has_unacknowledged_requests());
+			}
+		}
+		AND_WHEN("all messages are acknowledged")
+		{
+			for (message_id_t id = 64; id > 0; id--) {
+				REQUIRE(receive_ack(store, channel, (id - 1) * 1024)==NO_ERROR);
+			}
+			THEN("the store is empty")
+			{
+				REQUIRE_FALSE(store.has_messages());
+				REQUIRE_FALSE(store.has_unacknowledged_requests());
+				REQUIRE(CoAPMessage::messages()==0);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("processing the message store only resends the messages that are due")
+{
+	GIVEN("messages sent at different times")
+	{
+		CoAPMessageStore store;
+		CountingChannel channel;
+		for (message_id_t id = 1; id <= 10; id++) {
+			REQUIRE(send_confirmable(store, id, id * 10000)==NO_ERROR);
+		}
+
+		WHEN("the store is processed when only the oldest messages are due")
+		{
+			const system_tick_t time = store.from_id(3)->get_timeout();
+			store.process(time, channel);
+			THEN("only the due messages are resent")
+			{
+				REQUIRE(channel.sent==3);
+				for (message_id_t id = 1; id <= 3; id++) {
+					REQUIRE(store.from_id(id)->get_transmit_count()==2);
+				}
+				for (message_id_t id = 4; id <= 10; id++) {
+					REQUIRE(store.from_id(id)->get_transmit_count()==1);
+				}
+			}
+		}
+		AND_WHEN("the store is processed long after all messages are due")
+		{
+			for (int i = 0; i <= CoAPMessage::MAX_RETRANSMIT; i++) {
+				store.process(1000000 * (i + 1), channel);
+			}
+			THEN("every message is resent and then expires")
+			{
+				REQUIRE(channel.sent==10 * CoAPMessage::MAX_RETRANSMIT);
+				REQUIRE_FALSE(store.has_messages());
+			}
+		}
+	}
+}
+
+TEST_CASE("Benchmark ACK matching and processing of the message store", "[.][benchmark]")
+{
+	const unsigned iterations = 20000;
+	for (unsigned outstanding : { 1, 16, 256 }) {
+		CountingChannel channel;
+		uint8_t buf[4];
+		double list_ack, list_process, store_ack, store_process;
+		{
+			ListMessageStore list;
+			for (unsigned id = 0; id < outstanding; id++) {
+				Message msg = confirmable(buf, id);
+				list.send(msg, 0);
+			}
+			// acknowledge the oldest message and send a new one in its place
+			list_ack = nanoseconds_per_op(iterations, [&]() {
+				for (unsigned i = 0; i < iterations; i++) {
+					uint8_t ack[4];
+					Message msg(ack, sizeof(ack));
+					msg.set_length(Messages::empty_ack(ack, (i >> 8) & 0xFF, i & 0xFF));
+					msg.decode_id();
+					list.acknowledge(msg.get_id());
+					msg = confirmable(buf, i + outstanding);
+					list.send(msg, 0);
+				}
+			});
+			list_process = nanoseconds_per_op(iterations, [&]() {
+				for (unsigned i = 0; i < iterations; i++) {
+					list.process(1, channel);
+				}
+			});
+		}
+		{
+			CoAPMessageStore store;
+			for (unsigned id = 0; id < outstanding; id++) {
+				send_confirmable(store, id, 0);
+			}
+			store_ack = nanoseconds_per_op(iterations, [&]() {
+				for (unsigned i = 0; i < iterations; i++) {
+					receive_ack(store, channel, i);
+					send_confirmable(store, i + outstanding, 0);
+				}
+			});
+			store_process = nanoseconds_per_op(iterations, [&]() {
+				for (unsigned i = 0; i < iterations; i++) {
+					store.process(1, channel);
+				}
+			});
+			REQUIRE(CoAPMessage::messages()==outstanding);
+		}
+		WARN(outstanding << " outstanding messages: "
+				<< "list ACK+send " << list_ack << " ns, indexed ACK+send " << store_ack << " ns; "
+				<< "list process " << list_process << " ns, indexed process " << store_process << " ns");
+	}
+}
@@ -201,7 +201,7 @@ SCENARIO("a message can be added to a message store with the same id more than o
 
 }
 
-SCENARIO("multiple messages are stored in a list in the order they are added, most recent first")
+SCENARIO("multiple messages with distinct IDs are stored independently")
 {
 	const message_id_t id1 = 456;
 	const message_id_t id2 = 345;
@@ -221,9 +221,9 @@ SCENARIO("multiple messages are stored in a list in the order they are added, mo
 			REQUIRE(store.add(m1)==NO_ERROR);
 			REQUIRE(store.add(m2)==NO_ERROR);
 
-			THEN("the second message points to the first")
+			THEN("both messages are stored")
 			{
-				REQUIRE(m2->get_next()==m1);
+				REQUIRE(store.has_messages());
 				AND_THEN("both messages can be retrieved")
 				{
 					REQUIRE(store.from_id(id1)==m1);
@@ -0,0 +1,292 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <deque>
+
+#include "coap_channel.h"
+#include "forward_message_channel.h"
+#include "messages.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+namespace {
+
+/**
+ * A message channel that simulates a link with a fixed round trip time to a server
+ * that acknowledges every confirmable message it receives.
+ */
+class SimulatedLinkChannel : public MessageChannel
+{
+	struct Ack
+	{
+		system_tick_t arrival;
+		message_id_t id;
+	};
+
+	std::deque<Ack> acks;
+	uint8_t buffer[PROTOCOL_BUFFER_SIZE];
+
+public:
+	system_tick_t now;
+	system_tick_t rtt;
+	unsigned sent;
+	unsigned drop_count;			// number of transmissions to drop
+	unsigned fail_count;			// number of transmissions to fail with an error
+	std::deque<message_id_t> sent_ids;
+
+	SimulatedLinkChannel(system_tick_t rtt_) : now(0), rtt(rtt_), sent(0), drop_count(0), fail_count(0) {}
+
+	bool is_unreliable() override { return true; }
+
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+
+	ProtocolError create(Message& msg, size_t minimum_size) override
+	{
+		msg.set_buffer(buffer, sizeof(buffer));
+		return NO_ERROR;
+	}
+
+	ProtocolError response(Message& original, Message& response, size_t required) override
+	{
+		return NOT_IMPLEMENTED;
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		if (fail_count) {
+			fail_count--;
+			return IO_ERROR_GENERIC_SEND;
+		}
+		sent++;
+		sent_ids.push_back(CoAP::message_id(msg.buf()));
+		if (drop_count) {
+			drop_count--;
+		} else if (msg.get_type()==CoAPType::CON) {
+			acks.push_back({ now+rtt, CoAP::message_id(msg.buf()) });
+		}
+		return NO_ERROR;
+	}
+
+	ProtocolError receive(Message& msg) override
+	{
+		msg.set_length(0);
+		if (!acks.empty() && time_has_passed(now, acks.front().arrival)) {
+			const message_id_t id = acks.front().id;
+			acks.pop_front();
+			msg.set_length(Messages::empty_ack(msg.buf(), id >> 8, id & 0xFF));
+		}
+		return NO_ERROR;
+	}
+
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+
+	ProtocolError notify_established() override { return NO_ERROR; }
+
+	void notify_client_messages_processed() override {}
+};
+
+/**
+ * A reliable channel over the simulated link, with the time provided by the link.
+ */
+class WindowedChannel : public CoAPReliableChannel<ForwardMessageChannel, std::function<system_tick_t()>>
+{
+	using super = CoAPReliableChannel<ForwardMessageChannel, std::function<system_tick_t()>>;
+
+public:
+	WindowedChannel(SimulatedLinkChannel& link) : super([&link]() { return link.now; })
+	{
+		setForward(&link);
+	}
+};
+
+ProtocolError send_confirmable(WindowedChannel& channel, message_id_t id)
+{
+	uint8_t buf[] = { 0x40, 0x02, uint8_t(id >> 8), uint8_t(id & 0xFF), 0xFF, 1, 2, 3 };
+	Message msg(buf, sizeof(buf), sizeof(buf));
+	msg.decode_id();
+	return channel.send(msg);
+}
+
+/**
+ * Sends the given number of confirmable messages and runs the channel until all of them are
+ * acknowledged. Returns the simulated time taken.
+ */
+system_tick_t transfer(SimulatedLinkChannel& link, WindowedChannel& channel, unsigned count)
+{
+	const system_tick_t start = link.now;
+	for (unsigned i = 0; i < count; i++) {
+		REQUIRE(send_confirmable(channel, i + 1)==NO_ERROR);
+	}
+	uint8_t buf[PROTOCOL_BUFFER_SIZE];
+	Message msg(buf, sizeof(buf));
+	while (channel.has_unacknowledged_client_requests()) {
+		REQUIRE(channel.receive(msg)==NO_ERROR);
+		link.now++;
+	}
+	return link.now - start;
+}
+
+} // namespace
+
+SCENARIO("a message store with a window limits the number of messages in flight")
+{
+	GIVEN("a reliable channel with a window of 4 messages")
+	{
+		SimulatedLinkChannel link(1000);
+		WindowedChannel channel(link);
+		channel.set_window_size(4);
+		const CoAPMessageStore& store = channel.client_messages();
+
+		WHEN("10 confirmable messages are sent")
+		{
+			for (message_id_t id = 1; id <= 10; id++) {
+				REQUIRE(send_confirmable(channel, id)==NO_ERROR);
+			}
+			THEN("only 4 messages are transmitted and the rest are held in the store")
+			{
+				REQUIRE(link.sent==4);
+				REQUIRE(store.get_in_flight()==4);
+				REQUIRE(store.from_id(10)!=nullptr);
+				REQUIRE(store.from_id(10)->is_deferred());
+			}
+			AND_WHEN("the first acknowledgements arrive")
+			{
+				uint8_t buf[PROTOCOL_BUFFER_SIZE];
+				Message msg(buf, sizeof(buf));
+				link.now = 1000;
+				REQUIRE(channel.receive(msg)==NO_ERROR);
+				THEN("a held message is sent in place of the acknowledged one")
+				{
+					REQUIRE(link.sent==5);
+					REQUIRE(store.get_in_flight()==4);
+					REQUIRE(store.from_id(1)==nullptr);
+					REQUIRE_FALSE(store.from_id(5)->is_deferred());
+				}
+			}
+			AND_WHEN("sending a held message fails")
+			{
+				uint8_t buf[PROTOCOL_BUFFER_SIZE];
+				Message msg(buf, sizeof(buf));
+				link.now = 1000;
+				link.fail_count = 1;
+				REQUIRE(channel.receive(msg)==NO_ERROR);
+				THEN("the message stays held and is sent on the next call")
+				{
+					REQUIRE(link.sent==4);
+					REQUIRE(store.from_id(5)->is_deferred());
+					REQUIRE(store.get_in_flight()==3);
+					REQUIRE(channel.receive(msg)==NO_ERROR);
+					REQUIRE(link.sent>=5);
+					REQUIRE(link.sent_ids[4]==5);
+					REQUIRE_FALSE(store.from_id(5)->is_deferred());
+					REQUIRE(store.get_in_flight()==4);
+				}
+				AND_WHEN("a new message is sent while messages are held")
+				{
+					REQUIRE(store.can_transmit());
+					REQUIRE(send_confirmable(channel, 11)==NO_ERROR);
+					THEN("it is sent after the messages held before it")
+					{
+						REQUIRE(store.from_id(11)->is_deferred());
+						REQUIRE(link.sent==4);
+						while (channel.has_unacknowledged_client_requests()) {
+							REQUIRE(channel.receive(msg)==NO_ERROR);
+							link.now++;
+						}
+						REQUIRE(std::is_sorted(link.sent_ids.begin(), link.sent_ids.end()));
+					}
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("a message store reduces the congestion window when messages time out")
+{
+	GIVEN("a reliable channel with a window of 8 messages")
+	{
+		SimulatedLinkChannel link(1000);
+		WindowedChannel channel(link);
+		channel.set_window_size(8);
+		const CoAPMessageStore& store = channel.client_messages();
+
+		WHEN("the whole window of messages is lost")
+		{
+			link.drop_count = 8;
+			uint8_t buf[PROTOCOL_BUFFER_SIZE];
+			Message msg(buf, sizeof(buf));
+			for (message_id_t id = 1; id <= 8; id++) {
+				REQUIRE(send_confirmable(channel, id)==NO_ERROR);
+			}
+			link.now += CoAPMessage::ACK_TIMEOUT * 2;
+			REQUIRE(channel.receive(msg)==NO_ERROR);
+			THEN("the congestion window is reduced once for the window")
+			{
+				REQUIRE(store.get_congestion_window()==4);
+			}
+			AND_WHEN("the retransmitted messages are acknowledged")
+			{
+				while (channel.has_unacknowledged_client_requests()) {
+					REQUIRE(channel.receive(msg)==NO_ERROR);
+					link.now++;
+				}
+				THEN("the congestion window grows again")
+				{
+					REQUIRE(store.get_congestion_window()>4);
+					REQUIRE(store.get_congestion_window()<=8);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("a wider window increases throughput over a high latency link")
+{
+	const unsigned message_count = 64;
+	const system_tick_t rtt = 800;		// typical for a cellular link
+
+	SimulatedLinkChannel link1(rtt);
+	WindowedChannel channel1(link1);
+	channel1.set_window_size(1);
+	const system_tick_t time1 = transfer(link1, channel1, message_count);
+
+	SimulatedLinkChannel link4(rtt);
+	WindowedChannel channel4(link4);
+	channel4.set_window_size(4);
+	const system_tick_t time4 = transfer(link4, channel4, message_count);
+
+	SimulatedLinkChannel link16(rtt);
+	WindowedChannel channel16(link16);
+	channel16.set_window_size(16);
+	const system_tick_t time16 = transfer(link16, channel16, message_count);
+
+	INFO("window 1: " << message_count * 1000.0 / time1 << " msg/s");
+	INFO("window 4: " << message_count * 1000.0 / time4 << " msg/s");
+	INFO("window 16: " << message_count * 1000.0 / time16 << " msg/s");
+	CHECK(time1 >= message_count * rtt);
+	CHECK(time4 * 3 < time1);
+	CHECK(time16 * 3 < time4);
+	// no retransmissions are needed
+	CHECK(link1.sent==message_count);
+	CHECK(link4.sent==message_count);
+	CHECK(link16.sent==message_count);
+}
@@ -19,6 +19,12 @@
 
 #include "protocol.h"
 
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdio>
+
 #include <catch2/catch.hpp>
 #include "fakeit.hpp"
 using namespace fakeit;
@@ -71,11 +77,11 @@ void event_handler(const char* event, const char* data)
 {
 }
 
-SCENARIO("6 subscribe messages are registered")
+SCENARIO("MAX_SUBSCRIPTIONS subscribe messages are registered")
 {
 	MessageChannel* channel = nullptr;
 	AbstractProtocol p(*channel);	// channel is not used
-	for (int i=0; i<6; i++) {
+	for (int i=0; i<MAX_SUBSCRIPTIONS; i++) {
 		INFO("adding event " << i);
 		char buf[2];
 		buf[1] = 0;
@@ -238,3 +244,533 @@ SCENARIO("Events are non-confirmable over an unreliable channel with the NO_ACK
 {
 	verify_event_type_with_flags(EventType::NO_ACK, CoAPType::NON);
 }
+
+namespace {
+
+/**
+ * A channel that feeds describe requests to the protocol and records its responses.
+ */
+class DescribeChannel : public MessageChannel
+{
+	uint8_t request_buf[32];
+	uint8_t buffer[PROTOCOL_BUFFER_SIZE];
+	Message request;
+
+public:
+	std::vector<std::vector<uint8_t>> sent;
+	std::deque<std::vector<uint8_t>> requests;
+
+	DescribeChannel()
+	{
+		request.set_buffer(request_buf, sizeof(request_buf));
+	}
+
+	/**
+	 * Queues a GET describe request, optionally with a Block2 option and describe flags.
+	 */
+	void describe(message_id_t id, token_t token, const CoAPBlock* block=nullptr, const uint32_t* etag=nullptr, int flags=-1)
+	{
+		uint8_t request_buf[32];
+		size_t len = CoAP::header(request_buf, CoAPType::CON, CoAPCode::GET, 1, &token, id);
+		CoAPOption::Enum previous = CoAPOption::NONE;
+		if (etag) {
+			const uint8_t value[4] = { uint8_t(*etag >> 24), uint8_t(*etag >> 16), uint8_t(*etag >> 8), uint8_t(*etag) };
+			len += CoAP::add_option(request_buf+len, previous, CoAPOption::ETAG, value, sizeof(value));
+			previous = CoAPOption::ETAG;
+		}
+		len += CoAP::uri_path(request_buf+len, previous, "d");
+		previous = CoAPOption::URI_PATH;
+		if (flags >= 0) {
+			const uint8_t query = flags;
+			len += CoAP::add_option(request_buf+len, previous, CoAPOption::URI_QUERY, &query, 1);
+			previous = CoAPOption::URI_QUERY;
+		}
+		if (block) {
+			uint8_t value[3];
+			const size_t value_len = CoAP::block_value(value, *block);
+			len += CoAP::add_option(request_buf+len, previous, CoAPOption::BLOCK2, value, value_len);
+		}
+		requests.push_back(std::vector<uint8_t>(request_buf, request_buf + len));
+	}
+
+	ProtocolError receive(Message& msg) override
+	{
+		request.set_length(0);
+		if (!requests.empty()) {
+			memcpy(request_buf, requests.front().data(), requests.front().size());
+			request.set_length(requests.front().size());
+			request.decode_id();
+			requests.pop_front();
+		}
+		msg = request;
+		return NO_ERROR;
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		sent.push_back(std::vector<uint8_t>(msg.buf(), msg.buf() + msg.length()));
+		return NO_ERROR;
+	}
+
+	ProtocolError create(Message& msg, size_t size) override
+	{
+		msg.set_buffer(buffer, sizeof(buffer));
+		return NO_ERROR;
+	}
+
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+	bool is_unreliable() override { return true; }
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+	ProtocolError response(Message& original, Message& response, size_t required) override { return NO_ERROR; }
+	ProtocolError notify_established() override { return NO_ERROR; }
+	void notify_client_messages_processed() override {}
+};
+
+int describe_function_count = 0;
+int describe_persist_count = 0;
+int describe_build_count = 0;
+
+int num_functions()
+{
+	describe_build_count++;
+	return describe_function_count;
+}
+
+const char* get_function_key(int index)
+{
+	static char key[16];
+	sprintf(key, "function_%03d", index);
+	return key;
+}
+
+int num_variables()
+{
+	return 0;
+}
+
+uint32_t app_state_selector_info(SparkAppStateSelector::Enum selector, SparkAppStateUpdate::Enum operation, uint32_t data, void* reserved)
+{
+	if (selector == SparkAppStateSelector::DESCRIBE_APP && operation == SparkAppStateUpdate::COMPUTE_AND_PERSIST)
+		describe_persist_count++;
+	if (selector == SparkAppStateSelector::DESCRIBE_APP && operation == SparkAppStateUpdate::COMPUTE)
+		return describe_function_count;
+	return 0;
+}
+
+std::string expected_description(int functions)
+{
+	std::string desc = "{\"f\":[";
+	for (int i=0; i<functions; i++) {
+		if (i)
+			desc += ",";
+		desc += std::string("\"") + get_function_key(i) + "\"";
+	}
+	return desc + "],\"v\":{}}";
+}
+
+std::string payload(const std::vector<uint8_t>& response)
+{
+	// skip the options that precede the payload marker
+	size_t i = 5;
+	while (i < response.size() && response[i] != 0xff) {
+		const uint8_t delta = response[i] >> 4;
+		const uint8_t length = response[i] & 0x0F;
+		REQUIRE(delta < 14);
+		REQUIRE(length < 13);
+		i += 1 + (delta == 13 ? 1 : 0) + length;
+	}
+	REQUIRE(i < response.size());
+	return std::string(response.begin() + i + 1, response.end());
+}
+
+size_t size2_of(const std::vector<uint8_t>& response)
+{
+	const uint8_t* value = nullptr;
+	size_t length = 0;
+	REQUIRE(CoAP::find_option(response.data(), response.size(), CoAPOption::SIZE2, &value, &length));
+	REQUIRE(length <= 4);
+	size_t size = 0;
+	while (length--)
+		size = (size << 8) | *value++;
+	return size;
+}
+
+uint32_t sum_crc(const uint8_t* data, uint32_t length)
+{
+	uint32_t crc = 0;
+	while (length--)
+		crc = crc * 31 + *data++;
+	return crc;
+}
+
+struct DescribeFixture
+{
+	ProtocolBuilder builder;
+	DescribeChannel channel;
+	AbstractProtocol p;
+
+	DescribeFixture(int functions) : p(channel)
+	{
+		describe_function_count = functions;
+		describe_persist_count = 0;
+		describe_build_count = 0;
+		builder.callbacks.millis = &fake_millis;
+		builder.descriptor.size = sizeof(builder.descriptor);
+		builder.descriptor.num_functions = &num_functions;
+		builder.descriptor.get_function_key = &get_function_key;
+		builder.descriptor.num_variables = &num_variables;
+		builder.descriptor.app_state_selector_info = &app_state_selector_info;
+		builder.callbacks.calculate_crc = &sum_crc;
+		builder.build(p);
+	}
+
+	const std::vector<uint8_t>& describe(message_id_t id, const CoAPBlock* block=nullptr, const uint32_t* etag=nullptr, int flags=-1)
+	{
+		channel.describe(id, 0x42, block, etag, flags);
+		REQUIRE(p.event_loop());
+		REQUIRE(channel.sent.size());
+		const std::vector<uint8_t>& response = channel.sent.back();
+		REQUIRE(CoAP::type(response.data())==CoAPType::ACK);
+		REQUIRE(CoAP::message_id((uint8_t*)response.data())==id);
+		REQUIRE(response[4]==0x42);
+		return response;
+	}
+};
+
+} // namespace
+
+SCENARIO("a description that fits in a single message is sent without a Block2 option")
+{
+	DescribeFixture fixture(3);
+	const std::vector<uint8_t>& response = fixture.describe(0x100);
+	CoAPBlock block;
+	REQUIRE(CoAP::code(response.data())==CoAPCode::CONTENT);
+	REQUIRE_FALSE(CoAP::block(response.data(), response.size(), CoAPOption::BLOCK2, block));
+	REQUIRE(payload(response)==expected_description(3));
+	REQUIRE(describe_persist_count==1);
+}
+
+SCENARIO("a large description is sent block-wise")
+{
+	GIVEN("a description several times larger than a message")
+	{
+		const int functions = 400;
+		const std::string expected = expected_description(functions);
+		REQUIRE(expected.size() > 6*PROTOCOL_BUFFER_SIZE);
+		DescribeFixture fixture(functions);
+
+		WHEN("the server requests the description without a Block2 option")
+		{
+			const std::vector<uint8_t>& response = fixture.describe(0x100);
+
+			THEN("the first block is sent with the largest block size that fits in a message")
+			{
+				CoAPBlock block;
+				REQUIRE(CoAP::block(response.data(), response.size(), CoAPOption::BLOCK2, block));
+				REQUIRE(block.num==0);
+				REQUIRE(block.more);
+				REQUIRE(block.size() <= PROTOCOL_BUFFER_SIZE);
+				REQUIRE(block.size()*2 > PROTOCOL_BUFFER_SIZE - Messages::description_header_size);
+				REQUIRE(payload(response)==expected.substr(0, block.size()));
+				REQUIRE(response.size() <= PROTOCOL_BUFFER_SIZE);
+				REQUIRE(size2_of(response)==expected.size());
+				REQUIRE(describe_persist_count==0);
+			}
+
+			THEN("the description is generated only once")
+			{
+				REQUIRE(describe_build_count==1);
+			}
+		}
+
+		WHEN("the server fetches the remaining blocks")
+		{
+			CoAPBlock block;
+			std::string received = payload(fixture.describe(0x100));
+			REQUIRE(CoAP::block(fixture.channel.sent.back().data(), fixture.channel.sent.back().size(), CoAPOption::BLOCK2, block));
+			int count = 1;
+			while (block.more) {
+				CoAPBlock request = { block.num + 1, false, block.szx };
+				const std::vector<uint8_t>& response = fixture.describe(0x101 + block.num, &request);
+				REQUIRE(CoAP::block(response.data(), response.size(), CoAPOption::BLOCK2, block));
+				REQUIRE(block.num==request.num);
+				REQUIRE(block.szx==request.szx);
+				REQUIRE(size2_of(response)==expected.size());
+				REQUIRE(response.size() <= PROTOCOL_BUFFER_SIZE);
+				if (block.more)
+					REQUIRE(describe_persist_count==0);
+				received += payload(response);
+				count++;
+			}
+
+			THEN("the blocks make up the whole description")
+			{
+				REQUIRE(received==expected);
+				REQUIRE(count==int((expected.size() + block.size() - 1) / block.size()));
+			}
+
+			THEN("the description state is persisted once the last block has been sent")
+			{
+				REQUIRE(describe_persist_count==1);
+			}
+		}
+
+		WHEN("the server requests a smaller block size")
+		{
+			CoAPBlock request = { 3, false, 2 };	// 64 byte blocks
+			const std::vector<uint8_t>& response = fixture.describe(0x100, &request);
+
+			THEN("the block is sent with the requested size")
+			{
+				CoAPBlock block;
+				REQUIRE(CoAP::block(response.data(), response.size(), CoAPOption::BLOCK2, block));
+				REQUIRE(block.num==3);
+				REQUIRE(block.szx==2);
+				REQUIRE(block.more);
+				REQUIRE(payload(response)==expected.substr(3*64, 64));
+			}
+		}
+
+		WHEN("the server requests a block size larger than a message")
+		{
+			CoAPBlock request = { 1, false, 6 };	// 1024 byte blocks
+			const std::vector<uint8_t>& response = fixture.describe(0x100, &request);
+
+			THEN("the block is sent with a smaller size at the same offset")
+			{
+				CoAPBlock block;
+				REQUIRE(CoAP::block(response.data(), response.size(), CoAPOption::BLOCK2, block));
+				REQUIRE(block.szx < 6);
+				REQUIRE(block.offset()==1024);
+				REQUIRE(payload(response)==expected.substr(1024, block.size()));
+			}
+		}
+
+		WHEN("the server requests a block past the end of the description")
+		{
+			CoAPBlock request = { 1000, false, 2 };
+			const std::vector<uint8_t>& response = fixture.describe(0x100, &request);
+
+			THEN("the request is rejected")
+			{
+				REQUIRE(response.size()==5);
+				REQUIRE(response[1]==CoAPCode::BAD_OPTION);
+				REQUIRE(describe_persist_count==0);
+			}
+		}
+	}
+}
+
+SCENARIO("a description without a hash is not sent block-wise")
+{
+	GIVEN("a protocol that can't hash its description")
+	{
+		DescribeFixture fixture(3);
+		fixture.builder.callbacks.calculate_crc = nullptr;
+		fixture.builder.build(fixture.p);
+
+		WHEN("the server requests the description")
+		{
+			const std::vector<uint8_t>& response = fixture.describe(0x100);
+
+			THEN("the description is sent in a single message without an ETag")
+			{
+				REQUIRE(CoAP::code(response.data())==CoAPCode::CONTENT);
+				CoAPBlock block;
+				REQUIRE_FALSE(CoAP::block(response.data(), response.size(), CoAPOption::BLOCK2, block));
+				const uint8_t* value = nullptr;
+				size_t length = 0;
+				REQUIRE_FALSE(CoAP::find_option(response.data(), response.size(), CoAPOption::ETAG, &value, &length));
+				REQUIRE(payload(response)==expected_description(3));
+			}
+		}
+
+		WHEN("the server requests a block of the description")
+		{
+			CoAPBlock request = { 1, false, 2 };
+			const std::vector<uint8_t>& response = fixture.describe(0x100, &request);
+
+			THEN("the request is rejected")
+			{
+				REQUIRE(response.size()==5);
+				REQUIRE(response[1]==CoAPCode::BAD_OPTION);
+			}
+		}
+	}
+
+	GIVEN("a protocol that can hash its description")
+	{
+		DescribeFixture fixture(3);
+
+		WHEN("the server requests a block of the metrics")
+		{
+			CoAPBlock request = { 0, false, 2 };
+			const std::vector<uint8_t>& response = fixture.describe(0x100, &request, nullptr, DESCRIBE_METRICS);
+
+			THEN("the request is rejected since the metrics have no ETag")
+			{
+				REQUIRE(response.size()==5);
+				REQUIRE(response[1]==CoAPCode::BAD_OPTION);
+			}
+		}
+	}
+}
+
+uint32_t etag_of(const std::vector<uint8_t>& response)
+{
+	const uint8_t* value = nullptr;
+	size_t length = 0;
+	REQUIRE(CoAP::find_option(response.data(), response.size(), CoAPOption::ETAG, &value, &length));
+	REQUIRE(length==4);
+	return (value[0] << 24) | (value[1] << 16) | (value[2] << 8) | value[3];
+}
+
+SCENARIO("a description is validated by its ETag")
+{
+	GIVEN("a protocol that can hash its description")
+	{
+		DescribeFixture fixture(3);
+		fixture.builder.callbacks.calculate_crc = &sum_crc;
+		fixture.builder.build(fixture.p);
+		const std::string expected = expected_description(3);
+
+		WHEN("the server requests the description without an ETag")
+		{
+			const std::vector<uint8_t>& response = fixture.describe(0x100);
+
+			THEN("the description is sent with its hash as the ETag")
+			{
+				REQUIRE(CoAP::code(response.data())==CoAPCode::CONTENT);
+				etag_of(response);
+				REQUIRE(payload(response)==expected);
+				REQUIRE(describe_persist_count==1);
+			}
+		}
+
+		WHEN("the server requests the description with the ETag of the current description")
+		{
+			const uint32_t etag = etag_of(fixture.describe(0x100));
+			const std::vector<uint8_t>& response = fixture.describe(0x101, nullptr, &etag);
+
+			THEN("only the ETag is sent back")
+			{
+				REQUIRE(response[1]==CoAPCode::NOT_MODIFIED);
+				REQUIRE(etag_of(response)==etag);
+				REQUIRE(response.size()==10);
+				REQUIRE(describe_persist_count==2);
+			}
+		}
+
+		WHEN("the description changes after the server fetched it")
+		{
+			const uint32_t etag = etag_of(fixture.describe(0x100));
+			describe_function_count = 4;
+			const std::vector<uint8_t>& response = fixture.describe(0x101, nullptr, &etag);
+
+			THEN("the new description is sent with a new ETag")
+			{
+				REQUIRE(CoAP::code(response.data())==CoAPCode::CONTENT);
+				REQUIRE(etag_of(response)!=etag);
+				REQUIRE(payload(response)==expected_description(4));
+			}
+		}
+
+		WHEN("a large description is sent block-wise")
+		{
+			describe_function_count = 400;
+			const std::vector<uint8_t>& first = fixture.describe(0x100);
+			const uint32_t etag = etag_of(first);
+			CoAPBlock request = { 1, false, 5 };
+			const std::vector<uint8_t>& second = fixture.describe(0x101, &request);
+
+			THEN("each block carries the ETag of the description")
+			{
+				CoAPBlock block;
+				REQUIRE(CoAP::block(second.data(), second.size(), CoAPOption::BLOCK2, block));
+				REQUIRE(block.num==1);
+				REQUIRE(etag_of(second)==etag);
+				REQUIRE(payload(second)==expected_description(400).substr(512, 512));
+			}
+		}
+	}
+}
+
+void record_completion(int error, const void* data, void* callback_data, void* reserved)
+{
+	*(int*)callback_data = error;
+}
+
+SCENARIO("events waiting to be sent are cancelled when a new session begins")
+{
+	DescribeFixture f(0);
+	f.builder.callbacks.calculate_crc = &sum_crc;
+	f.builder.descriptor.was_ota_upgrade_successful = []() { return false; };
+	f.builder.build(f.p);
+	int result = 1;
+	// the event waits for more events to be sent in the same batch
+	REQUIRE(f.p.send_event("e", "data", 60, EventType::PRIVATE, 0,
+			CompletionHandler(record_completion, &result)));
+	REQUIRE(result==1);
+	f.p.begin();
+	REQUIRE(result==SYSTEM_ERROR_CANCELLED);
+}
+
+SCENARIO("the event loop handles the messages that are ready in one iteration")
+{
+	DescribeFixture fixture(3);
+
+	WHEN("a few messages are ready")
+	{
+		for (int i=0; i<5; i++)
+			fixture.channel.describe(0x100 + i, 0x42);
+		REQUIRE(fixture.p.event_loop());
+
+		THEN("they are all handled")
+		{
+			REQUIRE(fixture.channel.sent.size()==5);
+			REQUIRE(fixture.channel.requests.empty());
+			REQUIRE(fixture.p.event_loop_stats().messages()[EventLoopStats::bucket(5)]==1);
+			REQUIRE(fixture.p.event_loop_stats().latency()[0]==1);
+		}
+	}
+
+	WHEN("more messages are ready than an iteration handles")
+	{
+		const int count = PROTOCOL_EVENT_LOOP_MAX_MESSAGES + 4;
+		for (int i=0; i<count; i++)
+			fixture.channel.describe(0x100 + i, 0x42);
+		REQUIRE(fixture.p.event_loop());
+
+		THEN("the rest are handled in the next iteration")
+		{
+			REQUIRE(fixture.channel.sent.size()==PROTOCOL_EVENT_LOOP_MAX_MESSAGES);
+			REQUIRE(fixture.p.event_loop());
+			REQUIRE(fixture.channel.sent.size()==count);
+			REQUIRE(fixture.p.event_loop_stats().messages()[EventLoopStats::bucket(PROTOCOL_EVENT_LOOP_MAX_MESSAGES)]==1);
+			REQUIRE(fixture.p.event_loop_stats().messages()[EventLoopStats::bucket(4)]==1);
+		}
+	}
+
+	WHEN("no messages are ready")
+	{
+		REQUIRE(fixture.p.event_loop());
+
+		THEN("the iteration is counted with no messages")
+		{
+			REQUIRE(fixture.channel.sent.empty());
+			REQUIRE(fixture.p.event_loop_stats().messages()[0]==1);
+		}
+	}
+}
+
+SCENARIO("event loop histogram buckets")
+{
+	REQUIRE(EventLoopStats::bucket(0)==0);
+	REQUIRE(EventLoopStats::bucket(1)==1);
+	REQUIRE(EventLoopStats::bucket(2)==2);
+	REQUIRE(EventLoopStats::bucket(3)==2);
+	REQUIRE(EventLoopStats::bucket(4)==3);
+	REQUIRE(EventLoopStats::bucket(63)==6);
+	REQUIRE(EventLoopStats::bucket(64)==EventLoopStats::HISTOGRAM_SIZE-1);
+	REQUIRE(EventLoopStats::bucket(1000000)==EventLoopStats::HISTOGRAM_SIZE-1);
+}
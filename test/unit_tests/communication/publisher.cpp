@@ -18,11 +18,76 @@
  */
 
 #include "publisher.h"
+#include "forward_message_channel.h"
+
+#include <vector>
 
 #include <catch2/catch.hpp>
 
+using namespace particle;
 using namespace particle::protocol;
 
+namespace {
+
+/**
+ * A message channel that records the events sent.
+ */
+class EventChannel : public ForwardMessageChannel
+{
+	uint8_t buffer[PROTOCOL_BUFFER_SIZE];
+
+public:
+	std::vector<std::string> sent;
+	std::vector<std::string> data;	// the data of each event
+	std::vector<int> batches;		// the number of events sent in each batch
+	bool batching = false;
+	int buffers = -1;				// the number of messages that can be created, unlimited if negative
+
+	ProtocolError create(Message& msg, size_t size) override
+	{
+		if (!buffers) {
+			return INSUFFICIENT_STORAGE;
+		}
+		if (buffers > 0) {
+			buffers--;
+		}
+		msg.set_buffer(buffer, sizeof(buffer));
+		return NO_ERROR;
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		// the event name follows the 'e' Uri-Path option
+		const uint8_t* name = msg.buf() + 7;
+		sent.push_back(std::string((const char*)name, msg.buf()[6] & 0x0F));
+		const std::string contents((const char*)msg.buf(), msg.length());
+		data.push_back(contents.substr(contents.find('\xff') + 1));
+		if (batching) {
+			batches.back()++;
+		}
+		return NO_ERROR;
+	}
+
+	ProtocolError command(Command cmd, void* arg) override
+	{
+		if (cmd==BEGIN_BATCH) {
+			batching = true;
+			batches.push_back(0);
+		} else if (cmd==END_BATCH) {
+			batching = false;
+		}
+		return NO_ERROR;
+	}
+};
+
+void count_completion(int error, const void* data, void* callback_data, void* reserved)
+{
+	int* results = (int*)callback_data;
+	results[error ? 1 : 0]++;
+}
+
+} // namespace
+
 SCENARIO("publisher")
 {
 	GIVEN("a publisher")
@@ -91,3 +156,222 @@ SCENARIO("publisher")
 		}
 	}
 }
+
+SCENARIO("deferred events keep a copy of their data")
+{
+	GIVEN("a publisher")
+	{
+		Protocol* protocol = nullptr;
+		Publisher publisher(protocol);
+		EventChannel channel;
+		int results[2] = { 0, 0 };	// completed, failed
+
+		WHEN("an event is deferred")
+		{
+			for (const char* data : { "d1", "d2", "d3", "d4", "d5" }) {
+				std::string copy(data);
+				REQUIRE(publisher.send_event(channel, "e", copy.c_str(), 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+			}
+			REQUIRE(publisher.process(channel, 2000)==NO_ERROR);
+			THEN("its data is copied when it is stored")
+			{
+				REQUIRE(channel.data==std::vector<std::string>({ "d1", "d2", "d3", "d4", "d5" }));
+			}
+		}
+	}
+}
+
+SCENARIO("rate limited events are deferred until they can be sent")
+{
+	GIVEN("a publisher with a queue for rate limited events")
+	{
+		REQUIRE(PUBLISH_EVENT_QUEUE_SIZE>=2);
+		int results[2] = { 0, 0 };	// completed, failed
+		Protocol* protocol = nullptr;
+		Publisher publisher(protocol);
+		EventChannel channel;
+		const int deferred = g_deferredEventsCounter;
+		const int dropped = g_rateLimitedEventsCounter;
+
+		WHEN("a burst of application events larger than the rate limit is sent")
+		{
+			const char* names[] = { "e1", "e2", "e3", "e4", "e5", "e6" };
+			for (const char* name : names) {
+				REQUIRE(publisher.send_event(channel, name, "data", 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+			}
+			THEN("the events over the limit are deferred")
+			{
+				REQUIRE(channel.sent==std::vector<std::string>({ "e1", "e2", "e3", "e4" }));
+				REQUIRE(publisher.deferred_events()==2);
+				REQUIRE(int(g_deferredEventsCounter)==deferred + 2);
+				REQUIRE(results[0]==4);
+			}
+			AND_WHEN("a system event is sent")
+			{
+				REQUIRE(publisher.send_event(channel, "spark/status", "online", 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+				THEN("it is not held behind the deferred application events")
+				{
+					REQUIRE(channel.sent.back()=="spark/status");
+				}
+			}
+			AND_WHEN("the publisher is processed as time passes")
+			{
+				REQUIRE(publisher.process(channel, 1500)==NO_ERROR);
+				REQUIRE(channel.sent.size()==4);
+				REQUIRE(publisher.process(channel, 2000)==NO_ERROR);
+				REQUIRE(channel.sent.size()==6);
+				REQUIRE(publisher.send_event(channel, "e7", "data", 60, EventType::PRIVATE, 0, 2500,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+				REQUIRE(publisher.process(channel, 3000)==NO_ERROR);
+				REQUIRE(publisher.process(channel, 4000)==NO_ERROR);
+				THEN("the deferred events are sent in order as the rate limit allows")
+				{
+					REQUIRE(channel.sent==std::vector<std::string>({ "e1", "e2", "e3", "e4", "e5", "e6", "e7" }));
+					REQUIRE(publisher.deferred_events()==0);
+					REQUIRE(results[0]==7);
+				}
+			}
+			AND_WHEN("the channel runs out of messages while the deferred events are sent")
+			{
+				channel.buffers = 0;
+				THEN("the events stay deferred without using up the rate limit")
+				{
+					for (int i=0; i<PUBLISH_EVENT_BURST; i++) {
+						REQUIRE(publisher.process(channel, 2000)==NO_ERROR);
+					}
+					REQUIRE(publisher.deferred_events()==2);
+					channel.buffers = -1;
+					REQUIRE(publisher.process(channel, 2000)==NO_ERROR);
+					REQUIRE(channel.sent==std::vector<std::string>({ "e1", "e2", "e3", "e4", "e5", "e6" }));
+					REQUIRE(publisher.deferred_events()==0);
+				}
+			}
+			AND_WHEN("more events are sent than the queue can hold")
+			{
+				for (int i=2; i<PUBLISH_EVENT_QUEUE_SIZE; i++) {
+					REQUIRE(publisher.send_event(channel, "e", "data", 60, EventType::PRIVATE, 0, 1000,
+							CompletionHandler(count_completion, results))==NO_ERROR);
+				}
+				REQUIRE(publisher.send_event(channel, "e", "data", 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==BANDWIDTH_EXCEEDED);
+				THEN("the event is dropped")
+				{
+					REQUIRE(int(g_rateLimitedEventsCounter)==dropped + 1);
+				}
+			}
+			AND_WHEN("the deferred events are discarded")
+			{
+				publisher.clear();
+				THEN("their completion handlers are notified")
+				{
+					REQUIRE(results[1]==2);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("events are sent together in batches")
+{
+	GIVEN("a publisher that sends up to 3 events in a batch")
+	{
+		REQUIRE(PUBLISH_EVENT_BATCH_SIZE>=3);
+		int results[2] = { 0, 0 };	// completed, failed
+		Protocol* protocol = nullptr;
+		Publisher publisher(protocol);
+		publisher.set_batch_size(3);
+		EventChannel channel;
+
+		WHEN("fewer events than the batch size are published")
+		{
+			REQUIRE(publisher.send_event(channel, "particle/a", "data", 60, EventType::PRIVATE, 0, 1000,
+					CompletionHandler(count_completion, results))==NO_ERROR);
+			REQUIRE(publisher.send_event(channel, "particle/b", "data", 60, EventType::PRIVATE, 0, 1200,
+					CompletionHandler(count_completion, results))==NO_ERROR);
+			THEN("they are held until the batch window elapses")
+			{
+				REQUIRE(channel.sent.empty());
+				REQUIRE(publisher.batched_events()==2);
+				REQUIRE(publisher.process(channel, 1000 + PUBLISH_EVENT_BATCH_WINDOW - 1)==NO_ERROR);
+				REQUIRE(channel.sent.empty());
+				REQUIRE(publisher.process(channel, 1000 + PUBLISH_EVENT_BATCH_WINDOW)==NO_ERROR);
+				REQUIRE(channel.sent==std::vector<std::string>({ "particle/a", "particle/b" }));
+				REQUIRE(channel.batches==std::vector<int>({ 2 }));
+				REQUIRE(results[0]==2);
+			}
+		}
+		AND_WHEN("as many events as the batch size are published")
+		{
+			for (const char* name : { "particle/a", "particle/b", "particle/c" }) {
+				REQUIRE(publisher.send_event(channel, name, "data", 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+			}
+			THEN("they are sent straight away in one batch")
+			{
+				REQUIRE(channel.sent.size()==3);
+				REQUIRE(channel.batches==std::vector<int>({ 3 }));
+				REQUIRE(publisher.batched_events()==0);
+				REQUIRE(results[0]==3);
+			}
+		}
+		AND_WHEN("events too large to fit in a datagram together are published")
+		{
+			const std::string data(400, 'x');
+			for (const char* name : { "particle/a", "particle/b" }) {
+				REQUIRE(publisher.send_event(channel, name, data.c_str(), 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+			}
+			THEN("the batch is sent before it grows larger than a datagram")
+			{
+				REQUIRE(channel.batches==std::vector<int>({ 1 }));
+				REQUIRE(publisher.batched_events()==1);
+			}
+		}
+		AND_WHEN("the channel runs out of messages while the batch is sent")
+		{
+			for (const char* name : { "particle/a", "particle/b" }) {
+				REQUIRE(publisher.send_event(channel, name, "data", 60, EventType::PRIVATE, 0, 1000,
+						CompletionHandler(count_completion, results))==NO_ERROR);
+			}
+			channel.buffers = 1;
+			REQUIRE(publisher.process(channel, 1000 + PUBLISH_EVENT_BATCH_WINDOW)==NO_ERROR);
+			THEN("the events that were not sent stay in the batch")
+			{
+				REQUIRE(channel.sent==std::vector<std::string>({ "particle/a" }));
+				REQUIRE(publisher.batched_events()==1);
+				REQUIRE(results[0]==1);
+				REQUIRE(results[1]==0);
+				channel.buffers = -1;
+				REQUIRE(publisher.process(channel, 1000 + PUBLISH_EVENT_BATCH_WINDOW + 1)==NO_ERROR);
+				REQUIRE(channel.sent==std::vector<std::string>({ "particle/a", "particle/b" }));
+				REQUIRE(publisher.batched_events()==0);
+				REQUIRE(results[0]==2);
+			}
+		}
+		AND_WHEN("no message can be created for an event")
+		{
+			channel.buffers = 0;
+			REQUIRE(publisher.send_event(channel, "particle/a", "data", 60, EventType::PRIVATE, 0, 1000,
+					CompletionHandler(count_completion, results))==INSUFFICIENT_STORAGE);
+			THEN("the event fails")
+			{
+				REQUIRE(publisher.batched_events()==0);
+				REQUIRE(results[1]==1);
+			}
+		}
+		AND_WHEN("the batched events are discarded")
+		{
+			REQUIRE(publisher.send_event(channel, "particle/a", "data", 60, EventType::PRIVATE, 0, 1000,
+					CompletionHandler(count_completion, results))==NO_ERROR);
+			publisher.clear();
+			THEN("their completion handlers are notified")
+			{
+				REQUIRE(channel.sent.empty());
+				REQUIRE(results[1]==1);
+			}
+		}
+	}
+}
@@ -0,0 +1,259 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "messages.h"
+#include "message_channel.h"
+#include "subscriptions.h"
+#include "forward_message_channel.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+namespace {
+
+/**
+ * Records the events received by a handler.
+ */
+struct Received
+{
+	std::vector<std::string> events;
+	int id = 0;
+};
+
+std::vector<int> call_order;
+
+void record_event(void* data, const char* event_name, const char* event_data)
+{
+	Received* received = (Received*)data;
+	received->events.push_back(event_name);
+	call_order.push_back(received->id);
+}
+
+Subscriptions* unsubscribing = nullptr;
+
+/**
+ * Records the event and removes its own filter, which shifts the handlers subscribed after it.
+ */
+void unsubscribe_event(void* data, const char* event_name, const char* event_data)
+{
+	record_event(data, event_name, event_data);
+	unsubscribing->remove_event_handlers("a/");
+}
+
+void ignore_event(const char* event_name, const char* event_data)
+{
+}
+
+ProtocolError subscribe(Subscriptions& subscriptions, const char* filter, Received& received)
+{
+	return subscriptions.add_event_handler(filter, (EventHandler)record_event, &received,
+			SubscriptionScope::MY_DEVICES, nullptr);
+}
+
+ProtocolError dispatch(Subscriptions& subscriptions, const char* event_name)
+{
+	uint8_t buf[PROTOCOL_BUFFER_SIZE];
+	Message message(buf, sizeof(buf));
+	message.set_length(Messages::event(buf, 0x1234, event_name, "data", 60, EventType::PUBLIC, false));
+	ForwardMessageChannel channel;
+	return subscriptions.handle_event(message, nullptr, channel);
+}
+
+/**
+ * The linear scan of the subscription filters used before the filters were indexed.
+ * Kept here as a baseline for the benchmark below.
+ */
+unsigned linear_match(const FilteringEventHandler* handlers, size_t count, const char* name, size_t length)
+{
+	unsigned matches = 0;
+	for (size_t i = 0; i < count && handlers[i].handler; i++)
+	{
+		const size_t filter_length = strnlen(handlers[i].filter, sizeof(handlers[i].filter));
+		if (length >= filter_length && !memcmp(handlers[i].filter, name, filter_length))
+			matches++;
+	}
+	return matches;
+}
+
+} // namespace
+
+SCENARIO("events are dispatched to the handlers with a matching filter prefix")
+{
+	GIVEN("subscriptions with overlapping filters")
+	{
+		Subscriptions subscriptions;
+		Received all, temp, temp_inside, tempest, humidity;
+		REQUIRE(subscribe(subscriptions, "", all)==NO_ERROR);
+		REQUIRE(subscribe(subscriptions, "temp", temp)==NO_ERROR);
+		REQUIRE(subscribe(subscriptions, "temp/inside", temp_inside)==NO_ERROR);
+		REQUIRE(subscribe(subscriptions, "tempest", tempest)==NO_ERROR);
+		REQUIRE(subscribe(subscriptions, "humidity", humidity)==NO_ERROR);
+
+		WHEN("events are received")
+		{
+			REQUIRE(dispatch(subscriptions, "temp/inside/kitchen")==NO_ERROR);
+			REQUIRE(dispatch(subscriptions, "tempe")==NO_ERROR);
+			REQUIRE(dispatch(subscriptions, "tem")==NO_ERROR);
+			REQUIRE(dispatch(subscriptions, "humidity")==NO_ERROR);
+
+			THEN("each handler receives the events that start with its filter")
+			{
+				REQUIRE(all.events==std::vector<std::string>({ "temp/inside/kitchen", "tempe", "tem", "humidity" }));
+				REQUIRE(temp.events==std::vector<std::string>({ "temp/inside/kitchen", "tempe" }));
+				REQUIRE(temp_inside.events==std::vector<std::string>({ "temp/inside/kitchen" }));
+				REQUIRE(tempest.events.empty());
+				REQUIRE(humidity.events==std::vector<std::string>({ "humidity" }));
+			}
+		}
+		AND_WHEN("a filter is removed")
+		{
+			subscriptions.remove_event_handlers("temp");
+			REQUIRE(dispatch(subscriptions, "tempest")==NO_ERROR);
+
+			THEN("only the remaining handlers receive the event")
+			{
+				REQUIRE(all.events.size()==1);
+				REQUIRE(temp.events.empty());
+				REQUIRE(tempest.events.size()==1);
+			}
+		}
+	}
+}
+
+SCENARIO("handlers are called in the order they were subscribed")
+{
+	Subscriptions subscriptions;
+	Received first, second, third;
+	first.id = 1;
+	second.id = 2;
+	third.id = 3;
+	REQUIRE(subscribe(subscriptions, "a/long/filter", first)==NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "a/", second)==NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "a/long", third)==NO_ERROR);
+	call_order.clear();
+	REQUIRE(dispatch(subscriptions, "a/long/filter")==NO_ERROR);
+	REQUIRE(call_order==std::vector<int>({ 1, 2, 3 }));
+}
+
+SCENARIO("handlers can unsubscribe while an event is dispatched")
+{
+	Subscriptions subscriptions;
+	unsubscribing = &subscriptions;
+	Received first, second, third;
+	first.id = 1;
+	second.id = 2;
+	third.id = 3;
+	REQUIRE(subscriptions.add_event_handler("a/", (EventHandler)unsubscribe_event, &first,
+			SubscriptionScope::MY_DEVICES, nullptr)==NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "a/b", second)==NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "a/b/c", third)==NO_ERROR);
+	call_order.clear();
+	REQUIRE(dispatch(subscriptions, "a/b/c")==NO_ERROR);
+
+	THEN("each of the other handlers is called once")
+	{
+		REQUIRE(call_order==std::vector<int>({ 1, 2, 3 }));
+	}
+	AND_THEN("the remaining handlers are compacted once the event is dispatched")
+	{
+		Received fourth;
+		fourth.id = 4;
+		REQUIRE(subscribe(subscriptions, "a/", fourth)==NO_ERROR);
+		call_order.clear();
+		REQUIRE(dispatch(subscriptions, "a/b/c")==NO_ERROR);
+		REQUIRE(call_order==std::vector<int>({ 2, 3, 4 }));
+	}
+}
+
+SCENARIO("the number of subscriptions is limited by MAX_SUBSCRIPTIONS")
+{
+	Subscriptions subscriptions;
+	std::vector<Received> received(MAX_SUBSCRIPTIONS + 1);
+	for (int i = 0; i < MAX_SUBSCRIPTIONS; i++)
+	{
+		const std::string filter = "event" + std::to_string(i);
+		REQUIRE(subscribe(subscriptions, filter.c_str(), received[i])==NO_ERROR);
+	}
+	REQUIRE(subscribe(subscriptions, "another", received[MAX_SUBSCRIPTIONS])==INSUFFICIENT_STORAGE);
+
+	// every filter has a common prefix with the others
+	REQUIRE(dispatch(subscriptions, "event12345")==NO_ERROR);
+	for (int i = 0; i < MAX_SUBSCRIPTIONS; i++)
+	{
+		const std::string filter = "event" + std::to_string(i);
+		INFO("filter " << filter);
+		REQUIRE(received[i].events.size()==(std::string("event12345").compare(0, filter.size(), filter)==0 ? 1 : 0));
+	}
+}
+
+SCENARIO("the subscriptions checksum depends only on the subscriptions")
+{
+	uint32_t (*crc)(const unsigned char*, uint32_t) = [](const unsigned char* buf, uint32_t len) {
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < len; i++)
+			sum = sum * 31 + buf[i];
+		return sum;
+	};
+	Subscriptions s1, s2;
+	s1.add_event_handler("a", ignore_event, nullptr, SubscriptionScope::MY_DEVICES, nullptr);
+	s1.add_event_handler("b", ignore_event, nullptr, SubscriptionScope::FIREHOSE, nullptr);
+	s2.add_event_handler("a", ignore_event, nullptr, SubscriptionScope::MY_DEVICES, nullptr);
+	s2.add_event_handler("c", ignore_event, nullptr, SubscriptionScope::MY_DEVICES, nullptr);
+	s2.add_event_handler("b", ignore_event, nullptr, SubscriptionScope::FIREHOSE, nullptr);
+	REQUIRE(s1.compute_subscriptions_checksum(crc)!=s2.compute_subscriptions_checksum(crc));
+	s2.remove_event_handlers("c");
+	REQUIRE(s1.compute_subscriptions_checksum(crc)==s2.compute_subscriptions_checksum(crc));
+}
+
+TEST_CASE("Benchmark subscription filter matching", "[.][benchmark]")
+{
+	const unsigned iterations = 100000;
+	FilteringEventHandler handlers[MAX_SUBSCRIPTIONS] = {};
+	const char* name = "device/sensor/temperature/12";
+	const size_t length = strlen(name);
+	for (unsigned count : { 1, MAX_SUBSCRIPTIONS / 2, MAX_SUBSCRIPTIONS }) {
+		for (unsigned i = 0; i < count; i++) {
+			snprintf(handlers[i].filter, sizeof(handlers[i].filter), "device/sensor/%s/%u",
+					i % 2 ? "humidity" : "temperature", i);
+			handlers[i].handler = ignore_event;
+		}
+		SubscriptionIndex index;
+		index.build(handlers, MAX_SUBSCRIPTIONS);
+
+		unsigned linear_matches = 0, indexed_matches = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i < iterations; i++) {
+			linear_matches += linear_match(handlers, MAX_SUBSCRIPTIONS, name, length);
+		}
+		const double linear = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+		start = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i < iterations; i++) {
+			index.match(handlers, name, length, [&indexed_matches](unsigned) { indexed_matches++; });
+		}
+		const double indexed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+		REQUIRE(linear_matches==indexed_matches);
+		WARN(count << " subscriptions: linear scan " << linear << " ns, indexed " << indexed << " ns");
+	}
+}
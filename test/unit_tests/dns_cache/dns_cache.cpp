@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_cache.h"
+
+#include "lwip/dns.h"
+#include "timer_hal.h"
+#include "system_error.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+using particle::net::DnsCache;
+
+namespace {
+
+std::recursive_mutex g_coreMutex;
+std::atomic<system_tick_t> g_now(0);
+
+// Stands in for lwIP's DNS client, which resolves the names the tests ask it to
+class FakeDns {
+public:
+    struct Query {
+        std::string name;
+        uint8_t type;
+        dns_found_callback callback;
+        void* arg;
+    };
+
+    FakeDns() :
+            ret_(ERR_INPROGRESS) {
+        instance_ = this;
+    }
+
+    ~FakeDns() {
+        instance_ = nullptr;
+    }
+
+    // Answers the oldest query for the name, as the lwIP thread would
+    bool answer(const std::string& name, uint8_t type, const ip_addr_t* addr) {
+        std::lock_guard<std::recursive_mutex> lock(g_coreMutex);
+        for (auto it = queries_.begin(); it != queries_.end(); ++it) {
+            if (it->name == name && it->type == type) {
+                const Query q = *it;
+                queries_.erase(it);
+                q.callback(q.name.c_str(), addr, q.arg);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Makes dns_gethostbyname_addrtype() fail or answer from lwIP's table
+    void returnCode(err_t ret) {
+        ret_ = ret;
+    }
+
+    int queryCount(const std::string& name, uint8_t type) const {
+        std::lock_guard<std::recursive_mutex> lock(g_coreMutex);
+        int n = 0;
+        for (const auto& q: sent_) {
+            if (q.name == name && q.type == type) {
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    size_t pendingCount() const {
+        std::lock_guard<std::recursive_mutex> lock(g_coreMutex);
+        return queries_.size();
+    }
+
+    void failAll() {
+        std::lock_guard<std::recursive_mutex> lock(g_coreMutex);
+        while (!queries_.empty()) {
+            const Query q = queries_.front();
+            answer(q.name, q.type, nullptr);
+        }
+    }
+
+    static FakeDns* instance() {
+        return instance_;
+    }
+
+    err_t query(const char* name, ip_addr_t* addr, dns_found_callback callback, void* arg, uint8_t type) {
+        const Query q = { name, type, callback, arg };
+        sent_.push_back(q);
+        if (ret_ == ERR_INPROGRESS) {
+            queries_.push_back(q);
+        } else if (ret_ == ERR_OK) {
+            *addr = (type == LWIP_DNS_ADDRTYPE_IPV4) ? ip4(1) : ip6(1);
+        }
+        return ret_;
+    }
+
+    static ip_addr_t ip4(uint32_t host) {
+        ip_addr_t a = {};
+        a.type = IPADDR_TYPE_V4;
+        a.u_addr.ip4.addr = host;
+        return a;
+    }
+
+    static ip_addr_t ip6(uint32_t host) {
+        ip_addr_t a = {};
+        a.type = IPADDR_TYPE_V6;
+        a.u_addr.ip6.addr[0] = 0x20010db8;
+        a.u_addr.ip6.addr[3] = host;
+        return a;
+    }
+
+private:
+    std::vector<Query> queries_;
+    std::vector<Query> sent_;
+    err_t ret_;
+
+    static FakeDns* instance_;
+};
+
+FakeDns* FakeDns::instance_ = nullptr;
+
+// Records the results passed to the lookup callback
+struct Completion {
+    int count = 0;
+    int error = 0;
+    DnsCache::Result result = {};
+
+    static void callback(int error, const char* name, const DnsCache::Result& result, void* data) {
+        const auto c = static_cast<Completion*>(data);
+        ++c->count;
+        c->error = error;
+        c->result = result;
+    }
+};
+
+class Fixture {
+public:
+    Fixture() :
+            cache(DnsCache::instance()) {
+        g_now = 0;
+    }
+
+    ~Fixture() {
+        dns.failAll();
+        cache->clear();
+    }
+
+    int lookup(const char* name, unsigned types, Completion* c, unsigned preferred = 0) {
+        DnsCache::Result result = {};
+        const int ret = cache->lookup(name, types, &result, Completion::callback, c, preferred);
+        if (ret == DnsCache::DONE) {
+            c->error = 0;
+            c->result = result;
+        } else if (ret < 0) {
+            c->error = ret;
+            c->result = result;
+        }
+        return ret;
+    }
+
+    // The lookups that are still waiting are completed when the fixture is destroyed
+    Completion& completion() {
+        completions_.emplace_back();
+        return completions_.back();
+    }
+
+    FakeDns dns;
+    DnsCache* const cache;
+
+private:
+    std::deque<Completion> completions_;
+};
+
+bool isIp4(const ip_addr_t& a, uint32_t host) {
+    return a.type == IPADDR_TYPE_V4 && a.u_addr.ip4.addr == host;
+}
+
+bool isIp6(const ip_addr_t& a, uint32_t host) {
+    return a.type == IPADDR_TYPE_V6 && a.u_addr.ip6.addr[3] == host;
+}
+
+} // namespace
+
+extern "C" {
+
+void sys_lock_tcpip_core() {
+    g_coreMutex.lock();
+}
+
+void sys_unlock_tcpip_core() {
+    g_coreMutex.unlock();
+}
+
+err_t dns_gethostbyname_addrtype(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg,
+        uint8_t dns_addrtype) {
+    return FakeDns::instance()->query(hostname, addr, found, callback_arg, dns_addrtype);
+}
+
+system_tick_t HAL_Timer_Get_Milli_Seconds() {
+    return g_now;
+}
+
+} // extern "C"
+
+TEST_CASE("DnsCache") {
+    Fixture f;
+    auto& dns = f.dns;
+    const auto v4 = LWIP_DNS_ADDRTYPE_IPV4;
+    const auto v6 = LWIP_DNS_ADDRTYPE_IPV6;
+    const auto a4 = FakeDns::ip4(0x01020304);
+    const auto a6 = FakeDns::ip6(0x05060708);
+
+    SECTION("queries both address types in parallel and caches the answers") {
+        auto& c = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c) == DnsCache::PENDING);
+        CHECK(dns.pendingCount() == 2);
+        REQUIRE(dns.answer("host", v6, &a6));
+        CHECK(c.count == 0);
+        REQUIRE(dns.answer("host", v4, &a4));
+        REQUIRE(c.count == 1);
+        CHECK(c.error == 0);
+        CHECK(c.result.types == DnsCache::ANY);
+        CHECK(isIp4(c.result.addr4, 0x01020304));
+        CHECK(isIp6(c.result.addr6, 0x05060708));
+        // Answered from the cache, regardless of the case of the name
+        g_now = DnsCache::POSITIVE_TTL - 1;
+        auto& c2 = f.completion();
+        REQUIRE(f.lookup("HOST", DnsCache::IPV6, &c2) == DnsCache::DONE);
+        CHECK(isIp6(c2.result.addr6, 0x05060708));
+        CHECK(c2.result.ttl == 1);
+        CHECK(dns.queryCount("host", v6) == 1);
+        // Queried again once expired
+        g_now = DnsCache::POSITIVE_TTL;
+        CHECK(f.lookup("host", DnsCache::IPV6, &c2) == DnsCache::PENDING);
+        CHECK(dns.queryCount("host", v6) == 2);
+    }
+
+    SECTION("concurrent lookups of a host wait for the queries in flight") {
+        auto& c1 = f.completion();
+        auto& c2 = f.completion();
+        auto& c3 = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c1) == DnsCache::PENDING);
+        REQUIRE(f.lookup("host", DnsCache::IPV4, &c2) == DnsCache::PENDING);
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c3) == DnsCache::PENDING);
+        CHECK(dns.pendingCount() == 2);
+        REQUIRE(dns.answer("host", v4, &a4));
+        // Only the lookup of the IPv4 address is complete
+        CHECK(c1.count == 0);
+        CHECK(c2.count == 1);
+        CHECK(c2.result.types == DnsCache::IPV4);
+        CHECK(c3.count == 0);
+        REQUIRE(dns.answer("host", v6, &a6));
+        CHECK(c1.count == 1);
+        CHECK(c1.result.types == DnsCache::ANY);
+        CHECK(c2.count == 1);
+        CHECK(c3.count == 1);
+        CHECK(dns.queryCount("host", v4) == 1);
+        CHECK(dns.queryCount("host", v6) == 1);
+    }
+
+    SECTION("a lookup completes as soon as the preferred address type is found") {
+        auto& c = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c, DnsCache::IPV4) == DnsCache::PENDING);
+        REQUIRE(dns.answer("host", v4, &a4));
+        REQUIRE(c.count == 1);
+        CHECK(c.error == 0);
+        CHECK(c.result.types == DnsCache::IPV4);
+        CHECK(c.result.ttl == DnsCache::POSITIVE_TTL);
+        // The other query is still running and its answer is cached
+        CHECK(dns.pendingCount() == 1);
+        REQUIRE(dns.answer("host", v6, &a6));
+        CHECK(c.count == 1);
+        auto& c2 = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c2) == DnsCache::DONE);
+        CHECK(c2.result.types == DnsCache::ANY);
+    }
+
+    SECTION("a lookup waits for the other address types if the preferred one is not found") {
+        auto& c = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c, DnsCache::IPV4) == DnsCache::PENDING);
+        REQUIRE(dns.answer("host", v4, nullptr));
+        CHECK(c.count == 0);
+        REQUIRE(dns.answer("host", v6, &a6));
+        REQUIRE(c.count == 1);
+        CHECK(c.error == 0);
+        CHECK(c.result.types == DnsCache::IPV6);
+    }
+
+    SECTION("a negative answer from the server is cached") {
+        auto& c = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::IPV4, &c) == DnsCache::PENDING);
+        g_now = 500;
+        REQUIRE(dns.answer("host", v4, nullptr));
+        REQUIRE(c.count == 1);
+        CHECK(c.error == SYSTEM_ERROR_NOT_FOUND);
+        g_now = 500 + DnsCache::NEGATIVE_TTL - 1;
+        auto& c2 = f.completion();
+        CHECK(f.lookup("host", DnsCache::IPV4, &c2) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(dns.queryCount("host", v4) == 1);
+        g_now = 500 + DnsCache::NEGATIVE_TTL;
+        CHECK(f.lookup("host", DnsCache::IPV4, &c2) == DnsCache::PENDING);
+        CHECK(dns.queryCount("host", v4) == 2);
+    }
+
+    SECTION("a query that timed out is not cached") {
+        auto& c = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::IPV4, &c) == DnsCache::PENDING);
+        // lwIP gives up on the server after 3 retries
+        g_now = 4000;
+        REQUIRE(dns.answer("host", v4, nullptr));
+        REQUIRE(c.count == 1);
+        CHECK(c.error == SYSTEM_ERROR_NOT_FOUND);
+        auto& c2 = f.completion();
+        CHECK(f.lookup("host", DnsCache::IPV4, &c2) == DnsCache::PENDING);
+        CHECK(dns.queryCount("host", v4) == 2);
+    }
+
+    SECTION("a failure to send the query is not cached") {
+        dns.returnCode(ERR_VAL);
+        auto& c = f.completion();
+        CHECK(f.lookup("host", DnsCache::IPV4, &c) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(f.lookup("host", DnsCache::IPV4, &c) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(dns.queryCount("host", v4) == 2);
+    }
+
+    SECTION("an address in lwIP's table is returned immediately") {
+        dns.returnCode(ERR_OK);
+        auto& c = f.completion();
+        REQUIRE(f.lookup("host", DnsCache::ANY, &c) == DnsCache::DONE);
+        CHECK(c.result.types == DnsCache::ANY);
+        CHECK(c.count == 0);
+    }
+
+    SECTION("the oldest entry that is not in use is evicted") {
+        auto& c = f.completion();
+        // The oldest entry has a query in flight
+        REQUIRE(f.lookup("host0", DnsCache::IPV4, &c) == DnsCache::PENDING);
+        char name[16] = {};
+        for (unsigned i = 1; i <= DnsCache::MAX_ENTRIES; ++i) {
+            snprintf(name, sizeof(name), "host%u", i);
+            auto& c2 = f.completion();
+            REQUIRE(f.lookup(name, DnsCache::IPV4, &c2) == DnsCache::PENDING);
+            REQUIRE(dns.answer(name, v4, &a4));
+            REQUIRE(c2.count == 1);
+        }
+        // host1 was evicted for host8
+        REQUIRE(dns.answer("host0", v4, &a4));
+        CHECK(c.count == 1);
+        CHECK(c.error == 0);
+        for (unsigned i = 2; i <= DnsCache::MAX_ENTRIES; ++i) {
+            snprintf(name, sizeof(name), "host%u", i);
+            auto& c2 = f.completion();
+            CHECK(f.lookup(name, DnsCache::IPV4, &c2) == DnsCache::DONE);
+        }
+        CHECK(f.lookup("host0", DnsCache::IPV4, &c) == DnsCache::DONE);
+        CHECK(dns.queryCount("host0", v4) == 1);
+        CHECK(f.lookup("host1", DnsCache::IPV4, &c) == DnsCache::PENDING);
+        CHECK(dns.queryCount("host1", v4) == 2);
+    }
+
+    SECTION("clearing the cache doesn't affect the lookups in progress") {
+        auto& c1 = f.completion();
+        auto& c2 = f.completion();
+        REQUIRE(f.lookup("cached", DnsCache::IPV4, &c1) == DnsCache::PENDING);
+        REQUIRE(dns.answer("cached", v4, &a4));
+        REQUIRE(f.lookup("pending", DnsCache::ANY, &c2) == DnsCache::PENDING);
+        REQUIRE(dns.answer("pending", v4, &a4));
+        f.cache->clear();
+        // The lookup in progress still gets the results of its queries
+        REQUIRE(dns.answer("pending", v6, &a6));
+        REQUIRE(c2.count == 1);
+        CHECK(c2.error == 0);
+        CHECK(c2.result.types == DnsCache::ANY);
+        // None of the results obtained before the cache was cleared are used
+        auto& c3 = f.completion();
+        CHECK(f.lookup("cached", DnsCache::IPV4, &c3) == DnsCache::PENDING);
+        CHECK(dns.queryCount("cached", v4) == 2);
+        CHECK(f.lookup("pending", DnsCache::ANY, &c3) == DnsCache::PENDING);
+        CHECK(dns.queryCount("pending", v4) == 2);
+        CHECK(dns.queryCount("pending", v6) == 2);
+    }
+
+    SECTION("a lookup that blocks is completed by the lwIP thread") {
+        std::atomic<bool> done(false);
+        std::thread lwip([&dns, &done, &a4, &a6]() {
+            while (!dns.answer("host", LWIP_DNS_ADDRTYPE_IPV4, &a4)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            // Don't leave the lookup blocked if it waits for the other address type
+            for (int i = 0; i < 1000 && !done; ++i) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (!done) {
+                dns.answer("host", LWIP_DNS_ADDRTYPE_IPV6, &a6);
+            }
+        });
+        DnsCache::Result result = {};
+        const int ret = f.cache->lookup("host", DnsCache::ANY, &result, DnsCache::IPV4);
+        done = true;
+        lwip.join();
+        CHECK(ret == 0);
+        CHECK(result.types == DnsCache::IPV4);
+        CHECK(isIp4(result.addr4, 0x01020304));
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* The subset of the lwIP options used by the resolver cache, so that it can be tested without lwIP */
+
+#include <stdint.h>
+
+#define DNS_MAX_RETRIES 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Implemented by the test */
+void sys_lock_tcpip_core(void);
+void sys_unlock_tcpip_core(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define LOCK_TCPIP_CORE() sys_lock_tcpip_core()
+#define UNLOCK_TCPIP_CORE() sys_unlock_tcpip_core()
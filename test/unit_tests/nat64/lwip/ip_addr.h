@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* The subset of the lwIP address types and macros used by the NAT64 tables, so that they can be
+ * tested without lwIP. The layout and the semantics follow lwIP with IPv4, IPv6 and scopes enabled */
+
+#include <stdint.h>
+#include <string.h>
+
+struct ip4_addr {
+    uint32_t addr;
+};
+
+typedef struct ip4_addr ip4_addr_t;
+
+struct ip6_addr {
+    uint32_t addr[4];
+    uint8_t zone;
+};
+
+typedef struct ip6_addr ip6_addr_t;
+
+enum lwip_ip_addr_type {
+    IPADDR_TYPE_V4 = 0U,
+    IPADDR_TYPE_V6 = 6U
+};
+
+typedef struct ip_addr {
+    union {
+        ip6_addr_t ip6;
+        ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} ip_addr_t;
+
+#define IP_IS_V4_VAL(ipaddr) ((ipaddr).type == IPADDR_TYPE_V4)
+#define IP_IS_V6_VAL(ipaddr) ((ipaddr).type == IPADDR_TYPE_V6)
+
+#define ip_2_ip4(ipaddr) (&((ipaddr)->u_addr.ip4))
+#define ip_2_ip6(ipaddr) (&((ipaddr)->u_addr.ip6))
+
+#define ip4_addr_cmp(addr1, addr2) ((addr1)->addr == (addr2)->addr)
+#define ip6_addr_cmp_zoneless(addr1, addr2) (memcmp((addr1)->addr, (addr2)->addr, sizeof((addr1)->addr)) == 0)
+#define ip_addr_cmp_zoneless(addr1, addr2) \
+        ((addr1)->type == (addr2)->type && (IP_IS_V6_VAL(*(addr1)) ? \
+                ip6_addr_cmp_zoneless(ip_2_ip6(addr1), ip_2_ip6(addr2)) : \
+                ip4_addr_cmp(ip_2_ip4(addr1), ip_2_ip4(addr2))))
+
+#define ip4_addr_copy(dest, src) ((dest).addr = (src).addr)
+#define ip6_addr_copy(dest, src) ((dest) = (src))
+#define ip_addr_copy_from_ip4(dest, src) \
+        do { (dest).u_addr.ip4 = (src); (dest).type = IPADDR_TYPE_V4; } while (0)
+#define ip_addr_copy_from_ip6(dest, src) \
+        do { (dest).u_addr.ip6 = (src); (dest).type = IPADDR_TYPE_V6; } while (0)
+
+/* The IPv4 address is embedded in the last word of an IPv4-mapped or a Pref64 address */
+#define unmap_ipv4_mapped_ipv6(ip4addr, ip6addr) ((ip4addr)->addr = (ip6addr)->addr[3])
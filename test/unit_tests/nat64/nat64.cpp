@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nat64.h"
+
+#include <algorithm>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+using namespace particle::net::nat;
+
+namespace {
+
+// Enough buckets to have several entries in each of them
+const unsigned ENTRY_COUNT = NAT64_HASH_SIZE * 8;
+
+const uint16_t OUTSIDE_PORT = 53;
+
+ip6_addr_t insideAddr(uint32_t host) {
+    return ip6_addr_t{ { 0xfd000000, 0, 0, host }, 0 };
+}
+
+ip4_addr_t natAddr() {
+    return ip4_addr_t{ 0x0a000001 };
+}
+
+// The IPv4 address of the outside host is embedded in the last word of its Pref64 address
+ip6_addr_t outsideAddr6(uint32_t host) {
+    return ip6_addr_t{ { 0x0064ff9b, 0, 0, host }, 0 };
+}
+
+ip4_addr_t outsideAddr4(uint32_t host) {
+    return ip4_addr_t{ host };
+}
+
+class Fixture {
+public:
+    Fixture() :
+            pool(ENTRY_COUNT * 4 * NAT64_ENTRY_SIZE) {
+    }
+
+    ~Fixture() {
+        bibs.removeEmpty([this](BibEntry* bib) {
+            pool.free(bib);
+        });
+    }
+
+    BibEntry* addBib(unsigned i) {
+        auto bib = static_cast<BibEntry*>(pool.alloc(NAT64_ENTRY_SIZE));
+        REQUIRE(bib);
+        new(bib) BibEntry(Ip6TransportAddress(insideAddr(i), 1000 + i % 5),
+                Ip4TransportAddress(natAddr(), NAT64_UDP_MIN_PORT + i));
+        bibs.add(bib);
+        return bib;
+    }
+
+    SimpleAllocedPool pool;
+    BibTable bibs;
+    SessionTable sessions;
+};
+
+} // namespace
+
+TEST_CASE("L4IdBitmap") {
+    L4IdBitmap<NAT64_UDP_MIN_PORT, NAT64_UDP_MAX_PORT> ids;
+
+    SECTION("the range includes both of its ends") {
+        CHECK(ids.findFree(NAT64_UDP_MIN_PORT) == NAT64_UDP_MIN_PORT);
+        CHECK(ids.findFree(NAT64_UDP_MAX_PORT) == NAT64_UDP_MAX_PORT);
+        ids.set(NAT64_UDP_MAX_PORT, true);
+        CHECK(ids.findFree(NAT64_UDP_MAX_PORT) == NAT64_UDP_MIN_PORT);
+        ids.set(NAT64_UDP_MAX_PORT, false);
+        CHECK(ids.findFree(NAT64_UDP_MAX_PORT) == NAT64_UDP_MAX_PORT);
+    }
+
+    SECTION("the search wraps around the range") {
+        for (unsigned id = NAT64_UDP_MIN_PORT; id <= NAT64_UDP_MAX_PORT; ++id) {
+            ids.set(id, true);
+        }
+        ids.set(NAT64_UDP_MIN_PORT + 1, false);
+        // The only free ID is found from anywhere in the range, including the same word
+        for (unsigned id = NAT64_UDP_MIN_PORT; id <= NAT64_UDP_MAX_PORT; ++id) {
+            REQUIRE(ids.findFree(id) == NAT64_UDP_MIN_PORT + 1);
+        }
+        ids.set(NAT64_UDP_MAX_PORT - 1, false);
+        CHECK(ids.findFree(45000) == NAT64_UDP_MAX_PORT - 1);
+        CHECK(ids.findFree(NAT64_UDP_MAX_PORT) == NAT64_UDP_MIN_PORT + 1);
+    }
+
+    SECTION("the IDs past the end of the range are never returned") {
+        for (unsigned id = NAT64_UDP_MIN_PORT; id <= NAT64_UDP_MAX_PORT; ++id) {
+            ids.set(id, true);
+        }
+        CHECK(ids.findFree(NAT64_UDP_MIN_PORT) == -1);
+        CHECK(ids.findFree(NAT64_UDP_MAX_PORT) == -1);
+    }
+}
+
+TEST_CASE("BibTable") {
+    Fixture f;
+    std::vector<BibEntry*> bibs;
+    for (unsigned i = 0; i < ENTRY_COUNT; ++i) {
+        bibs.push_back(f.addBib(i));
+    }
+
+    SECTION("an entry is found by either of its transport addresses") {
+        for (auto bib: bibs) {
+            REQUIRE(f.bibs.lookup(IpTransportAddress(bib->src6())) == bib);
+            REQUIRE(f.bibs.lookup(IpTransportAddress(bib->dst4())) == bib);
+        }
+        CHECK(f.bibs.lookup(IpTransportAddress(Ip6TransportAddress(insideAddr(0), 999))) == nullptr);
+        CHECK(f.bibs.lookup(IpTransportAddress(Ip4TransportAddress(natAddr(), NAT64_UDP_MAX_PORT))) == nullptr);
+    }
+
+    SECTION("the entries without sessions are unlinked from both indexes") {
+        // Keep every other entry
+        for (unsigned i = 0; i < ENTRY_COUNT; i += 2) {
+            bibs[i]->sessionAdded();
+        }
+        std::vector<BibEntry*> removed;
+        f.bibs.removeEmpty([&](BibEntry* bib) {
+            removed.push_back(bib);
+        });
+        REQUIRE(removed.size() == ENTRY_COUNT / 2);
+        for (unsigned i = 0; i < ENTRY_COUNT; ++i) {
+            const Ip6TransportAddress src6(insideAddr(i), 1000 + i % 5);
+            const Ip4TransportAddress dst4(natAddr(), NAT64_UDP_MIN_PORT + i);
+            if (i % 2) {
+                REQUIRE(std::count(removed.begin(), removed.end(), bibs[i]) == 1);
+                REQUIRE(f.bibs.lookup(IpTransportAddress(src6)) == nullptr);
+                REQUIRE(f.bibs.lookup(IpTransportAddress(dst4)) == nullptr);
+            } else {
+                REQUIRE(f.bibs.lookup(IpTransportAddress(src6)) == bibs[i]);
+                REQUIRE(f.bibs.lookup(IpTransportAddress(dst4)) == bibs[i]);
+            }
+        }
+        for (auto bib: removed) {
+            f.pool.free(bib);
+        }
+        for (unsigned i = 0; i < ENTRY_COUNT; i += 2) {
+            bibs[i]->sessionRemoved();
+        }
+    }
+}
+
+TEST_CASE("SessionTable") {
+    Fixture f;
+    std::vector<BibEntry*> bibs;
+    for (unsigned i = 0; i < ENTRY_COUNT; ++i) {
+        bibs.push_back(f.addBib(i));
+    }
+    const uint32_t outside = 0x08080808;
+    const IpTransportAddress out6(Ip6TransportAddress(outsideAddr6(outside), OUTSIDE_PORT));
+    const IpTransportAddress out4(Ip4TransportAddress(outsideAddr4(outside), OUTSIDE_PORT));
+    std::vector<SessionEntry*> sessions;
+    for (unsigned i = 0; i < ENTRY_COUNT; ++i) {
+        auto s = f.sessions.add(bibs[i], Ip6TransportAddress(outsideAddr6(outside), OUTSIDE_PORT),
+                (i % 2) ? 1000 : 3000, f.pool);
+        REQUIRE(s);
+        sessions.push_back(s);
+    }
+
+    SECTION("a session is found from both sides") {
+        for (unsigned i = 0; i < ENTRY_COUNT; ++i) {
+            const IpTransportAddress in6(bibs[i]->src6());
+            const IpTransportAddress in4(bibs[i]->dst4());
+            // The outside host is the destination on the IPv6 side and the source on the IPv4 side
+            REQUIRE(f.sessions.lookup(bibs[i], in6, out6) == sessions[i]);
+            REQUIRE(f.sessions.lookup(bibs[i], out4, in4) == sessions[i]);
+        }
+    }
+
+    SECTION("a session isn't found for another outside host or another BIB entry") {
+        const IpTransportAddress in6(bibs[0]->src6());
+        const IpTransportAddress in4(bibs[0]->dst4());
+        // Only the last word of the IPv6 address is hashed, the other ones still have to match
+        auto other = outsideAddr6(outside);
+        other.addr[0] = 0xfd000000;
+        CHECK(f.sessions.lookup(bibs[0], in6, IpTransportAddress(Ip6TransportAddress(other, OUTSIDE_PORT))) == nullptr);
+        CHECK(f.sessions.lookup(bibs[0], in6, IpTransportAddress(Ip6TransportAddress(outsideAddr6(outside + 1), OUTSIDE_PORT))) == nullptr);
+        CHECK(f.sessions.lookup(bibs[0], in6, IpTransportAddress(Ip6TransportAddress(outsideAddr6(outside), OUTSIDE_PORT + 1))) == nullptr);
+        CHECK(f.sessions.lookup(bibs[0], IpTransportAddress(Ip4TransportAddress(outsideAddr4(outside + 1), OUTSIDE_PORT)), in4) == nullptr);
+        CHECK(f.sessions.lookup(bibs[0], IpTransportAddress(Ip4TransportAddress(outsideAddr4(outside), OUTSIDE_PORT + 1)), in4) == nullptr);
+        CHECK(f.sessions.lookup(bibs[1], in6, out6) == nullptr);
+        CHECK(f.sessions.lookup(bibs[1], out4, in4) == nullptr);
+    }
+
+    SECTION("the expired sessions are removed from the table and their BIB entries") {
+        f.sessions.timeout(2000, f.pool);
+        unsigned removed = 0;
+        f.bibs.removeEmpty([&](BibEntry* bib) {
+            ++removed;
+            f.pool.free(bib);
+        });
+        CHECK(removed == ENTRY_COUNT / 2);
+        for (unsigned i = 0; i < ENTRY_COUNT; i += 2) {
+            REQUIRE(f.sessions.lookup(bibs[i], IpTransportAddress(bibs[i]->src6()), out6) == sessions[i]);
+            REQUIRE(sessions[i]->lifetime() == 1000);
+        }
+        f.sessions.timeout(1000, f.pool);
+    }
+
+    // Expire the remaining sessions, so that the fixture releases their BIB entries
+    f.sessions.timeout(3000, f.pool);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "crc32.h"
+
+#include <catch2/catch.hpp>
+
+namespace {
+
+/**
+ * Bitwise CRC32, used as the reference for the table driven implementation.
+ */
+uint32_t reference_crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xffffffff;
+    while (size--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * The byte-at-a-time CRC32 that was used before the shared implementation.
+ * Kept here as a baseline for the benchmark below.
+ */
+class ByteTableCrc32 {
+public:
+    ByteTableCrc32() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; ++j) {
+                c = (c >> 1) ^ (0xedb88320 & -(c & 1));
+            }
+            table_[i] = c;
+        }
+    }
+
+    uint32_t operator()(const uint8_t* data, size_t size) const {
+        uint32_t crc = ~0U;
+        while (size--) {
+            crc = table_[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+private:
+    uint32_t table_[256];
+};
+
+std::vector<uint8_t> randomData(size_t size) {
+    std::vector<uint8_t> data(size);
+    uint32_t x = 0x12345678;
+    for (auto& b: data) {
+        x = x * 1103515245 + 12345;
+        b = x >> 16;
+    }
+    return data;
+}
+
+} // namespace
+
+TEST_CASE("crc32_compute()") {
+    SECTION("matches the IEEE 802.3 check value") {
+        const char* s = "123456789";
+        CHECK(crc32_compute(s, strlen(s)) == 0xcbf43926);
+    }
+    SECTION("returns 0 for empty data") {
+        CHECK(crc32_compute(nullptr, 0) == 0);
+    }
+    SECTION("matches the bitwise implementation for any length and alignment") {
+        const auto data = randomData(256);
+        for (size_t offset = 0; offset < 8; ++offset) {
+            for (size_t size = 0; size + offset <= data.size(); ++size) {
+                const uint8_t* p = data.data() + offset;
+                REQUIRE(crc32_compute(p, size) == reference_crc32(p, size));
+            }
+        }
+    }
+}
+
+TEST_CASE("crc32_update()") {
+    SECTION("computes the same CRC when the data is processed in parts") {
+        const auto data = randomData(1000);
+        const uint32_t expected = crc32_compute(data.data(), data.size());
+        for (size_t part: { 1, 3, 7, 8, 13, 64, 999 }) {
+            uint32_t crc = 0;
+            for (size_t offs = 0; offs < data.size(); offs += part) {
+                crc = crc32_update(crc, data.data() + offs, std::min(part, data.size() - offs));
+            }
+            REQUIRE(crc == expected);
+        }
+    }
+}
+
+TEST_CASE("Benchmark CRC32 throughput", "[.][benchmark]") {
+    const size_t size = 1024 * 1024;
+    const unsigned iterations = 20;
+    const auto data = randomData(size);
+    const ByteTableCrc32 byte_table;
+    uint32_t baseline_crc = 0, crc = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i) {
+        baseline_crc ^= byte_table(data.data(), data.size());
+    }
+    const double baseline = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i) {
+        crc ^= crc32_compute(data.data(), data.size());
+    }
+    const double sliced = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(crc == baseline_crc);
+    const double mb = double(size) * iterations / (1024 * 1024);
+    WARN("byte table " << mb / baseline << " MB/s, slice-by-" << CRC32_SLICES << " " << mb / sliced << " MB/s");
+}
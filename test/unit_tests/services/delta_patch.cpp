@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "delta_patch.h"
+#include "crc32.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+using particle::DeltaPatch;
+using particle::DeltaPatchHandler;
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+// Reads the source from memory and collects the target, as the system does with the installed
+// module and the OTA region
+class TestHandler: public DeltaPatchHandler {
+public:
+    explicit TestHandler(const Bytes& source) :
+            source(source),
+            sourceCrc(crc32_compute(source.data(), source.size())),
+            targetSize(0),
+            maxRead(0) {
+    }
+
+    int begin(uint32_t sourceSize, uint32_t sourceCrc, uint32_t targetSize) override {
+        if (sourceSize != source.size() || sourceCrc != this->sourceCrc) {
+            return SYSTEM_ERROR_NOT_FOUND;
+        }
+        this->targetSize = targetSize;
+        return 0;
+    }
+
+    int read(uint32_t offset, uint8_t* data, size_t size) override {
+        REQUIRE(offset + size <= source.size());
+        memcpy(data, source.data() + offset, size);
+        maxRead = std::max(maxRead, size);
+        return 0;
+    }
+
+    int write(const uint8_t* data, size_t size) override {
+        target.insert(target.end(), data, data + size);
+        REQUIRE(target.size() <= targetSize);
+        return 0;
+    }
+
+    const Bytes source;
+    const uint32_t sourceCrc;
+    Bytes target;
+    uint32_t targetSize;
+    size_t maxRead;
+};
+
+// Builds a patch and the target it produces, one command at a time
+class PatchBuilder {
+public:
+    explicit PatchBuilder(const Bytes& source) :
+            source_(source),
+            sourceEnd_(0) {
+    }
+
+    PatchBuilder& copy(uint32_t offset, uint32_t length) {
+        commands_.push_back(DeltaPatch::COPY);
+        const int32_t delta = (int32_t)offset - (int32_t)sourceEnd_;
+        varint((delta >= 0) ? (uint32_t)delta << 1 : ((uint32_t)-delta << 1) - 1);
+        varint(length);
+        target_.insert(target_.end(), source_.begin() + offset, source_.begin() + offset + length);
+        sourceEnd_ = offset + length;
+        return *this;
+    }
+
+    PatchBuilder& insert(const Bytes& data) {
+        commands_.push_back(DeltaPatch::INSERT);
+        varint(data.size());
+        commands_.insert(commands_.end(), data.begin(), data.end());
+        target_.insert(target_.end(), data.begin(), data.end());
+        return *this;
+    }
+
+    Bytes patch(uint32_t sourceCrc) const {
+        Bytes p;
+        uint32le(p, DeltaPatch::MAGIC);
+        p.push_back(DeltaPatch::VERSION);
+        p.insert(p.end(), 3, 0);
+        uint32le(p, source_.size());
+        uint32le(p, sourceCrc);
+        uint32le(p, target_.size());
+        uint32le(p, crc32_compute(target_.data(), target_.size()));
+        p.insert(p.end(), commands_.begin(), commands_.end());
+        return p;
+    }
+
+    Bytes patch() const {
+        return patch(crc32_compute(source_.data(), source_.size()));
+    }
+
+    const Bytes& target() const {
+        return target_;
+    }
+
+private:
+    const Bytes& source_;
+    Bytes commands_;
+    Bytes target_;
+    uint32_t sourceEnd_;
+
+    void varint(uint32_t value) {
+        while (value >= 0x80) {
+            commands_.push_back((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        commands_.push_back(value);
+    }
+
+    static void uint32le(Bytes& p, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            p.push_back(value >> (i * 8));
+        }
+    }
+};
+
+Bytes makeSource(size_t size) {
+    Bytes b(size);
+    for (size_t i = 0; i < size; ++i) {
+        b[i] = i * 7 + (i >> 5);
+    }
+    return b;
+}
+
+// Applies the patch in parts of the given size
+int applyPatch(DeltaPatch& patch, const Bytes& data, size_t partSize) {
+    for (size_t offs = 0; offs < data.size(); offs += partSize) {
+        const int ret = patch.update(data.data() + offs, std::min(partSize, data.size() - offs));
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return patch.finish();
+}
+
+} // namespace
+
+TEST_CASE("DeltaPatch") {
+    const Bytes source = makeSource(1000);
+    TestHandler handler(source);
+    DeltaPatch patch(&handler);
+
+    SECTION("applies a patch created by build/create_patch.py") {
+        // create_patch.py for a module with the source data, and the same data with "hello"
+        // inserted at offset 100, 10 bytes cleared at offset 500 and "trailer" appended
+        const Bytes p = {
+            0x50, 0x44, 0x4c, 0x54, 0x01, 0x00, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x55, 0xd5,
+            0xa0, 0x9d, 0xf4, 0x03, 0x00, 0x00, 0x74, 0xa8, 0xd1, 0x8a, 0x01, 0x00, 0x64, 0x02,
+            0x05, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x01, 0x00, 0x8b, 0x03, 0x02, 0x0a, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x14, 0xef, 0x03, 0x02, 0x07,
+            0x74, 0x72, 0x61, 0x69, 0x6c, 0x65, 0x72
+        };
+        Bytes expected = source;
+        const char hello[] = "hello";
+        expected.insert(expected.begin() + 100, hello, hello + 5);
+        std::fill(expected.begin() + 500, expected.begin() + 510, 0);
+        const char trailer[] = "trailer";
+        expected.insert(expected.end(), trailer, trailer + 7);
+
+        CHECK(DeltaPatch::isPatch(p.data(), p.size()));
+        CHECK(applyPatch(patch, p, p.size()) == 0);
+        CHECK(handler.target == expected);
+        CHECK(patch.patchSize() == p.size());
+        CHECK(patch.targetWritten() == expected.size());
+    }
+
+    SECTION("produces the same target regardless of how the patch is split") {
+        std::mt19937 gen(1);
+        for (size_t partSize: { 1, 2, 7, 24, 25, 512 }) {
+            // Build a target from random parts of the source, in any order, and random data
+            PatchBuilder b(source);
+            for (int i = 0; i < 50; ++i) {
+                if (gen() % 3) {
+                    const uint32_t offs = gen() % source.size();
+                    b.copy(offs, 1 + gen() % (source.size() - offs));
+                } else {
+                    Bytes data(1 + gen() % 300);
+                    for (auto& v: data) {
+                        v = gen();
+                    }
+                    b.insert(data);
+                }
+            }
+            TestHandler h(source);
+            DeltaPatch p(&h);
+            INFO("part size " << partSize);
+            CHECK(applyPatch(p, b.patch(), partSize) == 0);
+            CHECK(h.target == b.target());
+            // The source is read through the fixed buffer
+            CHECK(h.maxRead <= DeltaPatch::BUFFER_SIZE);
+        }
+    }
+
+    SECTION("fails if the source module isn't installed") {
+        PatchBuilder b(source);
+        b.copy(0, source.size());
+        CHECK(applyPatch(patch, b.patch(0x12345678), 1) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(handler.target.empty());
+    }
+
+    SECTION("fails if a command copies data outside of the source") {
+        PatchBuilder b(source);
+        b.copy(900, 100);
+        Bytes p = b.patch();
+        p.back() = 101; // COPY length
+        p[16] = 101; // Target size
+        CHECK(applyPatch(patch, p, p.size()) == SYSTEM_ERROR_OUT_OF_RANGE);
+    }
+
+    SECTION("fails if a command produces more data than the target size") {
+        PatchBuilder b(source);
+        b.copy(0, 10);
+        Bytes p = b.patch();
+        p[16] = 9; // Target size
+        CHECK(applyPatch(patch, p, p.size()) == SYSTEM_ERROR_BAD_DATA);
+    }
+
+    SECTION("fails if the patch is incomplete") {
+        PatchBuilder b(source);
+        b.copy(0, 10).insert({ 1, 2, 3 });
+        Bytes p = b.patch();
+        p.pop_back();
+        CHECK(applyPatch(patch, p, p.size()) == SYSTEM_ERROR_BAD_DATA);
+    }
+
+    SECTION("fails if there is data after the last command") {
+        PatchBuilder b(source);
+        b.copy(0, 10);
+        Bytes p = b.patch();
+        p.push_back(DeltaPatch::COPY);
+        CHECK(applyPatch(patch, p, p.size()) == SYSTEM_ERROR_TOO_LARGE);
+    }
+
+    SECTION("fails if the target doesn't match its CRC") {
+        PatchBuilder b(source);
+        b.insert({ 1, 2, 3 });
+        Bytes p = b.patch();
+        p.back() = 4;
+        CHECK(applyPatch(patch, p, p.size()) == SYSTEM_ERROR_BAD_DATA);
+    }
+
+    SECTION("rejects data that isn't a patch") {
+        const Bytes module = makeSource(DeltaPatch::HEADER_SIZE);
+        CHECK_FALSE(DeltaPatch::isPatch(module.data(), module.size()));
+        CHECK(applyPatch(patch, module, module.size()) == SYSTEM_ERROR_BAD_DATA);
+    }
+}
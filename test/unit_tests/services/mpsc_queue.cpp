@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle;
+
+TEST_CASE("MpscQueue") {
+    MpscQueue<int, 4> q;
+
+    SECTION("is empty initially") {
+        CHECK(q.front() == nullptr);
+    }
+
+    SECTION("returns the committed elements in the order they were reserved") {
+        auto a = q.reserve();
+        auto b = q.reserve();
+        REQUIRE(a != nullptr);
+        REQUIRE(b != nullptr);
+        a->value = 1;
+        b->value = 2;
+        q.commit(b);
+        // The front element isn't committed yet
+        CHECK(q.front() == nullptr);
+        q.commit(a);
+        REQUIRE(q.front() == &a->value);
+        CHECK(*q.front() == 1);
+        q.pop();
+        REQUIRE(q.front() == &b->value);
+        CHECK(*q.front() == 2);
+        q.pop();
+        CHECK(q.front() == nullptr);
+    }
+
+    SECTION("can't reserve more elements than its size") {
+        for (size_t i = 0; i < q.size(); ++i) {
+            auto v = q.reserve();
+            REQUIRE(v != nullptr);
+            v->value = i;
+            q.commit(v);
+        }
+        CHECK(q.reserve() == nullptr);
+        q.pop();
+        auto v = q.reserve();
+        REQUIRE(v != nullptr);
+        v->value = 100;
+        q.commit(v);
+        for (int i = 1; i < (int)q.size(); ++i) {
+            REQUIRE(q.front() != nullptr);
+            CHECK(*q.front() == i);
+            q.pop();
+        }
+        REQUIRE(q.front() != nullptr);
+        CHECK(*q.front() == 100);
+        q.pop();
+        CHECK(q.front() == nullptr);
+    }
+}
+
+TEST_CASE("MpscQueue with concurrent producers") {
+    struct Item {
+        unsigned producer;
+        unsigned seq;
+    };
+    MpscQueue<Item, 16> q;
+    const unsigned producerCount = 4;
+    const unsigned itemCount = 20000;
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < producerCount; ++p) {
+        producers.emplace_back([&q, p, itemCount]() {
+            for (unsigned i = 0; i < itemCount; ++i) {
+                MpscQueue<Item, 16>::Element* elem;
+                while (!(elem = q.reserve())) {
+                    std::this_thread::yield();
+                }
+                elem->value.producer = p;
+                elem->value.seq = i;
+                q.commit(elem);
+            }
+        });
+    }
+    // Elements of each producer are received in order, without losses
+    std::vector<unsigned> next(producerCount, 0);
+    unsigned received = 0;
+    bool ordered = true;
+    while (received < producerCount * itemCount) {
+        Item* item = q.front();
+        if (!item) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (item->seq != next[item->producer]++) {
+            ordered = false;
+        }
+        q.pop();
+        ++received;
+    }
+    for (auto& t: producers) {
+        t.join();
+    }
+    CHECK(ordered);
+    CHECK(q.front() == nullptr);
+}
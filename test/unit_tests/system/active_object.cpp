@@ -0,0 +1,340 @@
+#include "active_object.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+namespace {
+
+std::atomic<bool> g_countAllocs(false);
+std::atomic<int> g_allocCount(0);
+
+// Counts heap allocations made while it's in scope
+class AllocCounter {
+public:
+    AllocCounter() {
+        g_allocCount = 0;
+        g_countAllocs = true;
+    }
+
+    ~AllocCounter() {
+        g_countAllocs = false;
+    }
+
+    int count() const {
+        return g_allocCount;
+    }
+};
+
+// Active object processing its queue on a separate thread until destroyed
+class TestActiveObject: public ActiveObjectQueue {
+public:
+    explicit TestActiveObject(uint16_t queueSize = 4) :
+            ActiveObjectQueue(ActiveObjectConfiguration([]() {}, 10 /* take_wait */, CONCURRENT_WAIT_FOREVER /* put_wait */,
+                    queueSize)),
+            stop_(false) {
+        createQueue();
+        std::atomic<bool> ready(false);
+        thread_ = std::thread([this, &ready]() {
+            setCurrentThread();
+            ready = true;
+            while (!stop_) {
+                process();
+            }
+        });
+        while (!ready) {
+            std::this_thread::yield();
+        }
+    }
+
+    ~TestActiveObject() {
+        stop_ = true;
+        thread_.join();
+    }
+
+    using ActiveObjectQueue::put;
+
+private:
+    std::thread thread_;
+    std::atomic<bool> stop_;
+};
+
+// Counts live instances of a function object
+template<size_t SizeT>
+struct Counted {
+    static std::atomic<int> instances;
+
+    char data[SizeT];
+    std::atomic<int>* calls;
+
+    explicit Counted(std::atomic<int>* calls) :
+            data(),
+            calls(calls) {
+        ++instances;
+    }
+
+    Counted(const Counted& c) :
+            data(),
+            calls(c.calls) {
+        ++instances;
+    }
+
+    ~Counted() {
+        --instances;
+    }
+
+    void operator()() {
+        ++*calls;
+    }
+};
+
+template<size_t SizeT>
+std::atomic<int> Counted<SizeT>::instances(0);
+
+template<typename PredicateT>
+bool waitUntil(PredicateT pred) {
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > timeout) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// Heap-allocated task with its own completion semaphore, as ActiveObjectBase used to create
+// for every synchronous call
+class HeapPromise: public Message {
+public:
+    explicit HeapPromise(const std::function<int()>& fn) :
+            fn_(fn),
+            sem_(nullptr),
+            result_(0) {
+        os_semaphore_create(&sem_, 1, 0);
+    }
+
+    ~HeapPromise() {
+        os_semaphore_destroy(sem_);
+    }
+
+    void operator()() override {
+        result_ = fn_();
+        os_semaphore_give(sem_, false);
+    }
+
+    int get() {
+        os_semaphore_take(sem_, CONCURRENT_WAIT_FOREVER, false);
+        return result_;
+    }
+
+private:
+    std::function<int()> fn_;
+    os_semaphore_t sem_;
+    int result_;
+};
+
+// Heap-allocated asynchronous task, as ActiveObjectBase used to create for every asynchronous call
+class HeapTask: public Message {
+public:
+    explicit HeapTask(const std::function<void()>& fn) :
+            fn_(fn) {
+    }
+
+    void operator()() override {
+        fn_();
+        delete this;
+    }
+
+private:
+    std::function<void()> fn_;
+};
+
+template<typename FunctionT>
+double callsPerSecond(int iterations, FunctionT fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    return iterations / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+    if (g_countAllocs) {
+        ++g_allocCount;
+    }
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+TEST_CASE("ActiveObjectSlots") {
+    ActiveObjectSlots<3> slots;
+    CHECK(slots.acquire() == 0);
+    CHECK(slots.acquire() == 1);
+    CHECK(slots.acquire() == 2);
+    CHECK(slots.acquire() == -1);
+    slots.release(1);
+    CHECK(slots.acquire() == 1);
+    CHECK(slots.acquire() == -1);
+}
+
+TEST_CASE("ActiveObjectBase") {
+    TestActiveObject obj;
+
+    SECTION("invoke_async() runs functions on the active object's thread in order") {
+        std::vector<int> calls;
+        std::atomic<int> done(0);
+        for (int i = 0; i < 20; ++i) {
+            obj.invoke_async([&calls, &done, &obj, i]() {
+                CHECK(obj.isCurrentThread());
+                calls.push_back(i);
+                ++done;
+            });
+        }
+        REQUIRE(waitUntil([&]() { return done == 20; }));
+        REQUIRE(calls.size() == 20);
+        for (int i = 0; i < 20; ++i) {
+            CHECK(calls[i] == i);
+        }
+    }
+
+    SECTION("invoke_async() destroys function objects stored inline and on the heap") {
+        std::atomic<int> calls(0);
+        for (int i = 0; i < 10; ++i) {
+            obj.invoke_async(Counted<8>(&calls));
+            obj.invoke_async(Counted<ACTIVE_OBJECT_TASK_STORAGE_SIZE * 2>(&calls));
+        }
+        REQUIRE(waitUntil([&]() { return calls == 20; }));
+        REQUIRE(waitUntil([]() { return Counted<8>::instances == 0; }));
+        REQUIRE(waitUntil([]() { return Counted<ACTIVE_OBJECT_TASK_STORAGE_SIZE * 2>::instances == 0; }));
+    }
+
+    SECTION("invoke_sync() returns the function result") {
+        auto fn = [&obj]() {
+            return obj.isCurrentThread() ? 42 : -1;
+        };
+        CHECK(obj.invoke_sync(fn) == 42);
+        bool called = false;
+        auto voidFn = [&called]() {
+            called = true;
+        };
+        obj.invoke_sync(voidFn);
+        CHECK(called);
+    }
+
+    SECTION("invoke_sync() can be called from more threads than there are pooled semaphores") {
+        std::atomic<int> sum(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < ACTIVE_OBJECT_SEMAPHORE_POOL_SIZE * 2; ++i) {
+            threads.emplace_back([&obj, &sum, i]() {
+                for (int j = 0; j < 100; ++j) {
+                    auto fn = [i]() {
+                        return i;
+                    };
+                    sum += obj.invoke_sync(fn);
+                }
+            });
+        }
+        for (auto& t: threads) {
+            t.join();
+        }
+        const int n = ACTIVE_OBJECT_SEMAPHORE_POOL_SIZE * 2;
+        CHECK(sum == 100 * n * (n - 1) / 2);
+    }
+
+    SECTION("invoke_async() allocates tasks on the heap once the task pool is exhausted") {
+        // Large enough to queue every task
+        TestActiveObject queued(ACTIVE_OBJECT_TASK_POOL_SIZE + 2);
+        std::atomic<bool> release(false);
+        std::atomic<int> calls(0);
+        // Keeps the queued tasks from running
+        queued.invoke_async([&release]() {
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        AllocCounter allocs;
+        for (int i = 0; i < ACTIVE_OBJECT_TASK_POOL_SIZE + 1; ++i) {
+            queued.invoke_async([&calls]() {
+                ++calls;
+            });
+        }
+        // The blocking task holds one pooled task, if there is a pool
+        CHECK(allocs.count() == (ACTIVE_OBJECT_TASK_POOL_SIZE ? 2 : 1));
+        release = true;
+        REQUIRE(waitUntil([&]() { return calls == ACTIVE_OBJECT_TASK_POOL_SIZE + 1; }));
+    }
+
+    SECTION("steady-state calls don't allocate memory unless the task pool is disabled") {
+        int value = 0;
+        auto fn = [&value]() {
+            return ++value;
+        };
+        obj.invoke_sync(fn); // Creates a pooled semaphore
+        std::atomic<int> calls(0);
+        AllocCounter allocs;
+        for (int i = 0; i < 100; ++i) {
+            CHECK(obj.invoke_sync(fn) == i + 2);
+            obj.invoke_async([&calls]() {
+                ++calls;
+            });
+        }
+        REQUIRE(waitUntil([&]() { return calls == 100; }));
+        // Each asynchronous task has completed before the next synchronous call returns
+        CHECK(allocs.count() == (ACTIVE_OBJECT_TASK_POOL_SIZE ? 0 : 100));
+    }
+}
+
+TEST_CASE("Benchmark ActiveObjectBase calls", "[.][benchmark]") {
+    TestActiveObject obj;
+    const int iterations = 100000;
+
+    int value = 0;
+    auto fn = [&value]() {
+        return ++value;
+    };
+
+    const double heapSync = callsPerSecond(iterations, [&]() {
+        auto promise = new HeapPromise(fn);
+        ActiveObjectBase::Item item = promise;
+        obj.put(item);
+        promise->get();
+        delete promise;
+    });
+    const double stackSync = callsPerSecond(iterations, [&]() {
+        obj.invoke_sync(fn);
+    });
+    WARN("Synchronous calls per second: heap-allocated promise " << (int)heapSync << ", on the stack " << (int)stackSync);
+
+    auto sync = []() {
+        return 0;
+    };
+    const double heapAsync = callsPerSecond(iterations, [&]() {
+        ActiveObjectBase::Item item = new HeapTask(fn);
+        obj.put(item);
+    });
+    obj.invoke_sync(sync); // Wait until the queue is drained
+    const double pooledAsync = callsPerSecond(iterations, [&]() {
+        obj.invoke_async(fn);
+    });
+    obj.invoke_sync(sync);
+    WARN("Asynchronous calls per second: heap-allocated task " << (int)heapAsync << ", pooled " << (int)pooledAsync);
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Minimal implementation of the concurrency HAL on top of the standard library. The virtual
+// device doesn't support threading, so the tests provide the primitives used by the system and wiring code
+
+#include "concurrent_hal.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Thread {
+    std::thread::id id;
+    std::thread thread;
+};
+
+struct Queue {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<char> data;
+    size_t itemSize;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+struct Semaphore {
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned maxCount;
+    unsigned count;
+};
+
+// Waits for a condition for at most `delay` milliseconds
+template<typename PredicateT>
+bool waitFor(std::condition_variable& cond, std::unique_lock<std::mutex>& lock, system_tick_t delay, PredicateT pred) {
+    if (delay == CONCURRENT_WAIT_FOREVER) {
+        cond.wait(lock, pred);
+        return true;
+    }
+    return cond.wait_for(lock, std::chrono::milliseconds(delay), pred);
+}
+
+} // namespace
+
+os_result_t os_thread_create(os_thread_t* result, const char* name, os_thread_prio_t priority, os_thread_fn_t fun,
+        void* thread_param, size_t stack_size) {
+    const auto t = new Thread();
+    t->thread = std::thread(fun, thread_param);
+    t->id = t->thread.get_id();
+    *result = t;
+    return 0;
+}
+
+os_result_t os_thread_join(os_thread_t thread) {
+    const auto t = static_cast<Thread*>(thread);
+    if (!t || !t->thread.joinable()) {
+        return 1;
+    }
+    t->thread.join();
+    return 0;
+}
+
+os_result_t os_thread_exit(os_thread_t thread) {
+    // The thread function returns right after this call
+    return 0;
+}
+
+os_result_t os_thread_cleanup(os_thread_t thread) {
+    const auto t = static_cast<Thread*>(thread);
+    if (t->thread.joinable()) {
+        t->thread.detach();
+    }
+    delete t;
+    return 0;
+}
+
+os_thread_t os_thread_current(void* reserved) {
+    static thread_local Thread current = { std::this_thread::get_id(), std::thread() };
+    return &current;
+}
+
+bool os_thread_is_current(os_thread_t thread) {
+    return thread && static_cast<Thread*>(thread)->id == std::this_thread::get_id();
+}
+
+os_result_t os_thread_yield(void) {
+    std::this_thread::yield();
+    return 0;
+}
+
+int os_queue_create(os_queue_t* queue, size_t item_size, size_t item_count, void* reserved) {
+    const auto q = new Queue();
+    q->data.resize(item_size * item_count);
+    q->itemSize = item_size;
+    q->capacity = item_count;
+    q->head = 0;
+    q->count = 0;
+    *queue = q;
+    return 0;
+}
+
+int os_queue_put(os_queue_t queue, const void* item, system_tick_t delay, void* reserved) {
+    const auto q = static_cast<Queue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->cond, lock, delay, [q]() { return q->count < q->capacity; })) {
+        return 1;
+    }
+    const size_t index = (q->head + q->count) % q->capacity;
+    memcpy(&q->data[index * q->itemSize], item, q->itemSize);
+    ++q->count;
+    q->cond.notify_all();
+    return 0;
+}
+
+int os_queue_take(os_queue_t queue, void* item, system_tick_t delay, void* reserved) {
+    const auto q = static_cast<Queue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->cond, lock, delay, [q]() { return q->count > 0; })) {
+        return 1;
+    }
+    memcpy(item, &q->data[q->head * q->itemSize], q->itemSize);
+    q->head = (q->head + 1) % q->capacity;
+    --q->count;
+    q->cond.notify_all();
+    return 0;
+}
+
+int os_queue_destroy(os_queue_t queue, void* reserved) {
+    delete static_cast<Queue*>(queue);
+    return 0;
+}
+
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max_count, unsigned initial_count) {
+    const auto s = new Semaphore();
+    s->maxCount = max_count;
+    s->count = initial_count;
+    *semaphore = s;
+    return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+    delete static_cast<Semaphore*>(semaphore);
+    return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    const auto s = static_cast<Semaphore*>(semaphore);
+    std::unique_lock<std::mutex> lock(s->mutex);
+    if (!waitFor(s->cond, lock, timeout, [s]() { return s->count > 0; })) {
+        return 1;
+    }
+    --s->count;
+    return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    const auto s = static_cast<Semaphore*>(semaphore);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->count >= s->maxCount) {
+        return 1;
+    }
+    ++s->count;
+    s->cond.notify_one();
+    return 0;
+}
+
+int os_mutex_recursive_create(os_mutex_recursive_t* mutex) {
+    *mutex = new std::recursive_mutex();
+    return 0;
+}
+
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex) {
+    delete static_cast<std::recursive_mutex*>(mutex);
+    return 0;
+}
+
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex) {
+    static_cast<std::recursive_mutex*>(mutex)->lock();
+    return 0;
+}
+
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex) {
+    return static_cast<std::recursive_mutex*>(mutex)->try_lock() ? 0 : 1;
+}
+
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex) {
+    static_cast<std::recursive_mutex*>(mutex)->unlock();
+    return 0;
+}
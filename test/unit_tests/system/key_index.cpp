@@ -0,0 +1,133 @@
+#include "key_index.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+using particle::KeyIndex;
+
+namespace {
+
+const size_t MAX_KEY_LENGTH = 64;
+
+// A list of keys in the layout of the registered cloud functions and variables
+class KeyList {
+public:
+    explicit KeyList(size_t maxKeyLength = MAX_KEY_LENGTH) :
+            index_(maxKeyLength) {
+    }
+
+    void add(const std::string& key) {
+        keys_.push_back(key);
+        const auto keyAt = [this](size_t i) {
+            return keys_[i].c_str();
+        };
+        REQUIRE(index_.add(keys_.size() - 1, keys_.size(), keyAt));
+    }
+
+    int find(const char* key) const {
+        const auto keyAt = [this](size_t i) {
+            return keys_[i].c_str();
+        };
+        return index_.find(key, keys_.size(), keyAt);
+    }
+
+    // Finds a key the way the system did before the index, by comparing it with each key in turn
+    int findLinear(const char* key) const {
+        for (int i = keys_.size(); i-- > 0;) {
+            if (strncmp(keys_[i].c_str(), key, MAX_KEY_LENGTH) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    const std::vector<std::string>& keys() const {
+        return keys_;
+    }
+
+private:
+    std::vector<std::string> keys_;
+    KeyIndex index_;
+};
+
+std::string keyName(int i) {
+    char name[32];
+    snprintf(name, sizeof(name), "key_%d", i);
+    return name;
+}
+
+template<typename FunctionT>
+double callsPerSecond(int iterations, FunctionT fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn(i);
+    }
+    return iterations / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+TEST_CASE("KeyIndex") {
+    SECTION("finds nothing in an empty list") {
+        KeyList list;
+        CHECK(list.find("a") == -1);
+    }
+
+    SECTION("finds each key that has been added") {
+        KeyList list;
+        for (int i = 0; i < 255; ++i) {
+            list.add(keyName(i));
+            CHECK(list.find(keyName(i).c_str()) == i);
+        }
+        for (int i = 0; i < 255; ++i) {
+            CHECK(list.find(keyName(i).c_str()) == i);
+        }
+        CHECK(list.find("key_255") == -1);
+        CHECK(list.find("key_") == -1);
+        CHECK(list.find("") == -1);
+    }
+
+    SECTION("compares only the significant characters of a key") {
+        KeyList list(4);
+        list.add("abcd");
+        CHECK(list.find("abcd") == 0);
+        CHECK(list.find("abcdef") == 0);
+        CHECK(list.find("abc") == -1);
+    }
+
+    SECTION("finds the same keys as a linear search") {
+        KeyList list;
+        for (int i = 0; i < 100; ++i) {
+            list.add(keyName(i * 7));
+        }
+        for (int i = 0; i < 700; ++i) {
+            const std::string key = keyName(i);
+            CHECK(list.find(key.c_str()) == list.findLinear(key.c_str()));
+        }
+    }
+}
+
+TEST_CASE("Benchmark KeyIndex lookups", "[.][benchmark]") {
+    const int iterations = 1000000;
+    for (int count: { 15, 30, 50, 100 }) {
+        KeyList list;
+        for (int i = 0; i < count; ++i) {
+            // Registered names often share a prefix, which is the worst case for strncmp()
+            list.add("function_or_variable_" + keyName(i));
+        }
+        const auto& keys = list.keys();
+        int found = 0;
+        const double linear = callsPerSecond(iterations, [&](int i) {
+            found += list.findLinear(keys[i % count].c_str());
+        });
+        const double indexed = callsPerSecond(iterations, [&](int i) {
+            found -= list.find(keys[i % count].c_str());
+        });
+        CHECK(found == 0);
+        WARN(count << " keys, lookups per second: linear search " << (int)linear << ", hash index " << (int)indexed);
+    }
+}
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streamed_update.h"
+
+#include "ota_flash_hal.h"
+#include "hal_platform.h"
+#include "endian_util.h"
+#include "crc32.h"
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+#include <zlib.h>
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+#include <catch2/catch.hpp>
+
+using particle::DeltaPatch;
+using particle::nativeToBigEndian;
+using particle::system::FirmwarePatch;
+using particle::system::StreamedUpdate;
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+using particle::system::FirmwareInflater;
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+const uint32_t OTA_ADDRESS = 0x80000;
+const uint32_t OTA_LENGTH = 0x10000;
+
+// The OTA region, written by the code under test through the flash HAL
+struct FakeFlash {
+    Bytes data;
+    uint32_t beginAddress;
+    uint32_t beginLength;
+    unsigned beginCount;
+
+    void reset() {
+        data.assign(OTA_LENGTH, 0x00);
+        beginAddress = 0;
+        beginLength = 0;
+        beginCount = 0;
+    }
+} g_flash;
+
+// An installed module, as reported by HAL_System_Info()
+struct FakeModule {
+    Bytes data;
+    module_info_t info;
+    module_info_crc_t crc;
+    module_store_t store;
+    uint8_t mcu;
+
+    FakeModule(const Bytes& data, module_store_t store = MODULE_STORE_MAIN, uint8_t mcu = HAL_PLATFORM_MCU_DEFAULT) :
+            data(data),
+            info(),
+            crc(),
+            store(store),
+            mcu(mcu) {
+        info.module_start_address = this->data.data();
+        info.module_end_address = this->data.data() + this->data.size();
+        crc.crc32 = nativeToBigEndian(crc32_compute(this->data.data(), this->data.size()));
+    }
+};
+
+std::vector<const FakeModule*> g_modules;
+
+Bytes randomBytes(size_t size, uint32_t seed) {
+    Bytes b(size);
+    for (auto& v: b) {
+        seed = seed * 1103515245 + 12345;
+        v = seed >> 16;
+    }
+    return b;
+}
+
+void varint(Bytes& b, uint32_t v) {
+    while (v >= 0x80) {
+        b.push_back((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    b.push_back(v);
+}
+
+void uint32le(Bytes& b, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        b.push_back(v >> (i * 8));
+    }
+}
+
+// Builds a patch that copies the parts of the source around an inserted block of data
+Bytes makePatch(const Bytes& source, const Bytes& insert, Bytes* target) {
+    const uint32_t half = source.size() / 2;
+    Bytes commands;
+    commands.push_back(DeltaPatch::COPY);
+    varint(commands, 0);
+    varint(commands, half);
+    commands.push_back(DeltaPatch::INSERT);
+    varint(commands, insert.size());
+    commands.insert(commands.end(), insert.begin(), insert.end());
+    commands.push_back(DeltaPatch::COPY);
+    varint(commands, 0);
+    varint(commands, source.size() - half);
+    target->assign(source.begin(), source.begin() + half);
+    target->insert(target->end(), insert.begin(), insert.end());
+    target->insert(target->end(), source.begin() + half, source.end());
+    Bytes p;
+    uint32le(p, DeltaPatch::MAGIC);
+    p.push_back(DeltaPatch::VERSION);
+    p.insert(p.end(), 3, 0);
+    uint32le(p, source.size());
+    uint32le(p, crc32_compute(source.data(), source.size()));
+    uint32le(p, target->size());
+    uint32le(p, crc32_compute(target->data(), target->size()));
+    p.insert(p.end(), commands.begin(), commands.end());
+    return p;
+}
+
+FileTransfer::Descriptor chunkDescriptor(uint32_t offset, size_t size, size_t fileLength) {
+    FileTransfer::Descriptor d;
+    d.file_address = OTA_ADDRESS;
+    d.file_length = fileLength;
+    d.chunk_address = OTA_ADDRESS + offset;
+    d.chunk_size = size;
+    d.store = FileTransfer::Store::FIRMWARE;
+    return d;
+}
+
+// Sends the binary as chunks, in the given order
+int saveChunks(StreamedUpdate& update, const Bytes& binary, size_t chunkSize, const std::vector<unsigned>& order) {
+    for (const unsigned i: order) {
+        const size_t offset = i * chunkSize;
+        const size_t size = std::min(chunkSize, binary.size() - offset);
+        const auto d = chunkDescriptor(offset, size, binary.size());
+        const int ret = update.save(d, binary.data() + offset);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+std::vector<unsigned> chunkOrder(size_t size, size_t chunkSize) {
+    std::vector<unsigned> order((size + chunkSize - 1) / chunkSize);
+    for (unsigned i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    return order;
+}
+
+Bytes written(size_t size) {
+    return Bytes(g_flash.data.begin(), g_flash.data.begin() + size);
+}
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+
+// Compresses the data with the raw deflate format and the dictionary size used by the device,
+// ending a deflate block every `blockSize` bytes of input
+Bytes deflateData(const Bytes& data, size_t blockSize) {
+    z_stream strm = {};
+    REQUIRE(deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -10, 9, Z_DEFAULT_STRATEGY) == Z_OK);
+    Bytes out(deflateBound(&strm, data.size()) + data.size() / blockSize * 16 + 16);
+    strm.next_out = out.data();
+    strm.avail_out = out.size();
+    for (size_t offs = 0; offs < data.size(); offs += blockSize) {
+        const size_t n = std::min(blockSize, data.size() - offs);
+        strm.next_in = const_cast<uint8_t*>(data.data() + offs);
+        strm.avail_in = n;
+        const bool last = (offs + n == data.size());
+        REQUIRE(deflate(&strm, last ? Z_FINISH : Z_FULL_FLUSH) == (last ? Z_STREAM_END : Z_OK));
+    }
+    out.resize(strm.total_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+// Data with repeated runs at distances of up to the dictionary size
+Bytes compressibleData(size_t size) {
+    Bytes data = randomBytes(256, 5);
+    uint32_t seed = 6;
+    while (data.size() < size) {
+        seed = seed * 1103515245 + 12345;
+        const size_t dist = 1 + (seed >> 8) % std::min<size_t>(data.size(), TINFL_LZ_DICT_SIZE);
+        const size_t len = 3 + (seed >> 20) % 60;
+        for (size_t i = 0; i < len && data.size() < size; ++i) {
+            data.push_back(data[data.size() - dist]);
+        }
+        data.push_back(seed >> 24);
+    }
+    data.resize(size);
+    return data;
+}
+
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+
+struct Fixture {
+    Fixture() {
+        g_flash.reset();
+        g_modules.clear();
+    }
+};
+
+} // namespace
+
+bool HAL_FLASH_Begin(uint32_t address, uint32_t length, void* reserved) {
+    g_flash.beginAddress = address;
+    g_flash.beginLength = length;
+    ++g_flash.beginCount;
+    return true;
+}
+
+int HAL_FLASH_Update(const uint8_t* buffer, uint32_t address, uint32_t length, void* reserved) {
+    REQUIRE(address >= OTA_ADDRESS);
+    REQUIRE(address + length <= OTA_ADDRESS + OTA_LENGTH);
+    // Only the erased part of the region can be written
+    REQUIRE(address + length <= g_flash.beginAddress + g_flash.beginLength);
+    memcpy(g_flash.data.data() + address - OTA_ADDRESS, buffer, length);
+    return 0;
+}
+
+uint32_t HAL_OTA_FlashLength() {
+    return OTA_LENGTH;
+}
+
+void HAL_System_Info(hal_system_info_t* info, bool construct, void* reserved) {
+    if (construct) {
+        info->module_count = g_modules.size();
+        info->modules = new hal_module_t[g_modules.size()]();
+        for (unsigned i = 0; i < g_modules.size(); ++i) {
+            hal_module_t& m = info->modules[i];
+            m.info = &g_modules[i]->info;
+            m.crc = &g_modules[i]->crc;
+            m.bounds.store = g_modules[i]->store;
+            m.bounds.mcu_identifier = g_modules[i]->mcu;
+        }
+    } else {
+        delete[] info->modules;
+        info->modules = nullptr;
+        info->module_count = 0;
+    }
+}
+
+TEST_CASE("FirmwarePatch") {
+    Fixture f;
+    const Bytes source = randomBytes(3000, 1);
+    const FakeModule installed(source);
+    g_modules.push_back(&installed);
+    Bytes target;
+    const Bytes patch = makePatch(source, randomBytes(500, 2), &target);
+    REQUIRE(target.size() > patch.size());
+    // The OTA region is erased for the size of the patch before the transfer
+    HAL_FLASH_Begin(OTA_ADDRESS, patch.size(), nullptr);
+    FirmwarePatch update(chunkDescriptor(0, 0, patch.size()));
+
+    SECTION("produces the patched module in the OTA region") {
+        CHECK(saveChunks(update, patch, 64, chunkOrder(patch.size(), 64)) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(target.size()) == target);
+    }
+
+    SECTION("erases the OTA region again for the size of the patched module") {
+        CHECK(saveChunks(update, patch, 64, { 0 }) == 0);
+        CHECK(g_flash.beginCount == 2);
+        CHECK(g_flash.beginAddress == OTA_ADDRESS);
+        CHECK(g_flash.beginLength == target.size());
+    }
+
+    SECTION("fails if the patched module doesn't fit in the OTA region") {
+        const Bytes large = randomBytes(OTA_LENGTH, 3);
+        Bytes largeTarget;
+        const Bytes largePatch = makePatch(source, large, &largeTarget);
+        FirmwarePatch largeUpdate(chunkDescriptor(0, 0, largePatch.size()));
+        CHECK(saveChunks(largeUpdate, largePatch, 64, { 0 }) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(g_flash.beginCount == 1);
+    }
+
+    SECTION("finds the installed module the patch applies to") {
+        // Modules with the same contents that are not in the main store or for another MCU
+        // are skipped
+        const FakeModule factory(source, MODULE_STORE_FACTORY);
+        const FakeModule otherMcu(source, MODULE_STORE_MAIN, HAL_PLATFORM_MCU_DEFAULT + 1);
+        const FakeModule other(randomBytes(3000, 4));
+        g_modules = { &factory, &otherMcu, &other, &installed };
+        CHECK(saveChunks(update, patch, 64, chunkOrder(patch.size(), 64)) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(target.size()) == target);
+    }
+
+    SECTION("fails if the module the patch applies to isn't installed") {
+        const FakeModule factory(source, MODULE_STORE_FACTORY);
+        const FakeModule truncated(Bytes(source.begin(), source.end() - 1));
+        g_modules = { &factory, &truncated };
+        CHECK(saveChunks(update, patch, 64, { 0 }) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(g_flash.beginCount == 1);
+    }
+
+    SECTION("ignores the chunks that were sent again") {
+        CHECK(saveChunks(update, patch, 64, { 0, 1, 0, 1, 2, 1 }) == 0);
+        // A chunk of a different size overlapping the data processed so far
+        const auto d = chunkDescriptor(150, 100, patch.size());
+        CHECK(update.save(d, patch.data() + 150) == 0);
+        std::vector<unsigned> rest;
+        for (unsigned i = 250 / 50; i < (patch.size() + 49) / 50; ++i) {
+            rest.push_back(i);
+        }
+        CHECK(saveChunks(update, patch, 50, rest) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(target.size()) == target);
+    }
+
+    SECTION("keeps the chunks received ahead of a lost chunk") {
+        auto order = chunkOrder(patch.size(), 64);
+        // Chunk 2 is lost and sent again after the chunks that follow it
+        order.erase(order.begin() + 2);
+        order.insert(order.begin() + 2 + StreamedUpdate::MAX_STAGED_CHUNKS, 2);
+        CHECK(saveChunks(update, patch, 64, order) == 0);
+        CHECK(update.stagedChunks() == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(target.size()) == target);
+    }
+
+    SECTION("rejects a chunk received too far ahead of a lost chunk") {
+        CHECK(saveChunks(update, patch, 64, { 0, 2, 3, 4, 5 }) == 0);
+        CHECK(update.stagedChunks() == StreamedUpdate::MAX_STAGED_CHUNKS);
+        // The transfer requests the rejected chunk again with the lost one
+        CHECK(saveChunks(update, patch, 64, { 6 }) == SYSTEM_ERROR_INVALID_STATE);
+        std::vector<unsigned> rest = { 1 };
+        for (unsigned i = 6; i < (patch.size() + 63) / 64; ++i) {
+            rest.push_back(i);
+        }
+        CHECK(saveChunks(update, patch, 64, rest) == 0);
+        CHECK(update.stagedChunks() == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(target.size()) == target);
+    }
+
+    SECTION("doesn't complete while chunks are missing") {
+        auto order = chunkOrder(patch.size(), 64);
+        order.erase(order.begin() + 1);
+        CHECK(saveChunks(update, patch, 64, order) == SYSTEM_ERROR_INVALID_STATE);
+        CHECK(update.finish() < 0);
+    }
+}
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+
+TEST_CASE("FirmwareInflater") {
+    Fixture f;
+    const Bytes module = compressibleData(20 * TINFL_LZ_DICT_SIZE + 123);
+    const Bytes compressed = deflateData(module, 3000);
+    REQUIRE(compressed.size() < module.size() / 2);
+    // The size of the decompressed module isn't known, so the entire OTA region is erased
+    HAL_FLASH_Begin(OTA_ADDRESS, OTA_LENGTH, nullptr);
+    FirmwareInflater update(chunkDescriptor(0, 0, compressed.size()));
+    REQUIRE(update.init() == 0);
+
+    SECTION("decompresses chunks split across the deflate blocks") {
+        // Neither the chunk boundaries nor the blocks are aligned with each other
+        CHECK(saveChunks(update, compressed, 100, chunkOrder(compressed.size(), 100)) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(module.size()) == module);
+    }
+
+    SECTION("wraps the output buffer around past the dictionary size") {
+        // A single chunk produces the module in several parts
+        CHECK(saveChunks(update, compressed, compressed.size(), { 0 }) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(module.size()) == module);
+        // Nothing is written past the end of the module
+        CHECK(std::all_of(g_flash.data.begin() + module.size(), g_flash.data.end(), [](uint8_t b) {
+            return b == 0x00;
+        }));
+    }
+
+    SECTION("decompresses chunks of one byte") {
+        CHECK(saveChunks(update, compressed, 1, chunkOrder(compressed.size(), 1)) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(module.size()) == module);
+    }
+
+    SECTION("fails to finish a truncated stream") {
+        auto order = chunkOrder(compressed.size(), 100);
+        order.pop_back();
+        CHECK(saveChunks(update, compressed, 100, order) == 0);
+        CHECK(update.finish() == SYSTEM_ERROR_BAD_DATA);
+    }
+
+    SECTION("fails on corrupted data") {
+        Bytes corrupted = compressed;
+        // Invalid block type
+        corrupted[0] |= 0x06;
+        CHECK(saveChunks(update, corrupted, 100, chunkOrder(corrupted.size(), 100)) == SYSTEM_ERROR_BAD_DATA);
+        CHECK(update.finish() == SYSTEM_ERROR_BAD_DATA);
+    }
+
+    SECTION("rejects the data past the file length") {
+        Bytes longer = compressed;
+        longer.push_back(0);
+        CHECK(saveChunks(update, longer, 100, chunkOrder(longer.size(), 100)) == SYSTEM_ERROR_TOO_LARGE);
+    }
+
+    SECTION("rejects a chunk received too far ahead of the stream") {
+        CHECK(saveChunks(update, compressed, 100, { 0, 2, 3, 4, 5 }) == 0);
+        CHECK(update.stagedChunks() == StreamedUpdate::MAX_STAGED_CHUNKS);
+        CHECK(saveChunks(update, compressed, 100, { 6 }) == SYSTEM_ERROR_INVALID_STATE);
+        // Nothing past the missing chunk has been decompressed
+        CHECK(update.finish() == SYSTEM_ERROR_BAD_DATA);
+        std::vector<unsigned> rest = { 1 };
+        for (unsigned i = 6; i < (compressed.size() + 99) / 100; ++i) {
+            rest.push_back(i);
+        }
+        CHECK(saveChunks(update, compressed, 100, rest) == 0);
+        CHECK(update.finish() == 0);
+        CHECK(written(module.size()) == module);
+    }
+
+    SECTION("accepts the data of a firmware update control request") {
+        // firmwareUpdateDataRequest() passes the data as received, with the compressed size as
+        // the file length
+        FileTransfer::Descriptor d = chunkDescriptor(0, 0, compressed.size());
+        size_t left = compressed.size();
+        while (left > 0) {
+            d.chunk_size = std::min<size_t>(left, 1024);
+            REQUIRE(update.save(d, compressed.data() + d.chunk_address - d.file_address) == 0);
+            d.chunk_address += d.chunk_size;
+            left -= d.chunk_size;
+        }
+        CHECK(update.finish() == 0);
+        CHECK(written(module.size()) == module);
+    }
+}
+
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
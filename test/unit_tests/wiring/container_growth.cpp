@@ -0,0 +1,127 @@
+#include "spark_wiring_string.h"
+#include "spark_wiring_vector.h"
+
+#include <chrono>
+
+#include "catch2/catch.hpp"
+
+namespace {
+
+using namespace spark;
+
+// Appends elements to a vector growing its capacity by one element at a time, as the vector did
+// before it started to grow geometrically
+template<typename VectorT>
+void appendExact(VectorT& v, int n) {
+    for (int i = 0; i < n; ++i) {
+        v.reserve(v.size() + 1);
+        v.append(i);
+    }
+}
+
+template<typename VectorT>
+void append(VectorT& v, int n) {
+    for (int i = 0; i < n; ++i) {
+        v.append(i);
+    }
+}
+
+template<typename FunctionT>
+double measure(int iterations, FunctionT fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+} // namespace
+
+TEST_CASE("Vector") {
+    SECTION("capacity grows geometrically") {
+        Vector<int> v;
+        int reallocs = 0;
+        for (int i = 0; i < 1000; ++i) {
+            const int c = v.capacity();
+            REQUIRE(v.append(i));
+            if (v.capacity() != c) {
+                ++reallocs;
+            }
+        }
+        CHECK(reallocs < 20);
+        CHECK(v.capacity() < 1500);
+        REQUIRE(v.trimToSize());
+        CHECK(v.capacity() == 1000);
+        CHECK(v.last() == 999);
+    }
+
+    SECTION("inline storage is used for small vectors") {
+        Vector<int, DefaultAllocator, 8> v;
+        const int* const inlineData = v.data();
+        append(v, 8);
+        CHECK(v.data() == inlineData);
+        CHECK(v.capacity() == 8);
+        append(v, 1);
+        CHECK(v.data() != inlineData);
+        v.removeAt(4, 5);
+        REQUIRE(v.trimToSize());
+        CHECK(v.data() == inlineData);
+        CHECK(v == (Vector<int, DefaultAllocator, 8>({ 0, 1, 2, 3 })));
+    }
+}
+
+TEST_CASE("String") {
+    SECTION("characters can be appended one at a time") {
+        String s;
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(s.concat((char)('0' + i % 10)));
+        }
+        CHECK(s.length() == 1000);
+        CHECK(s.substring(990) == "0123456789");
+        REQUIRE(s.trimToSize());
+        CHECK(s.length() == 1000);
+        CHECK(s.endsWith("789"));
+    }
+}
+
+TEST_CASE("Benchmark Vector and String growth", "[.][benchmark]") {
+    const int iterations = 1000;
+    const int n = 1000;
+
+    const double vectorExact = measure(iterations, [=]() {
+        Vector<int> v;
+        appendExact(v, n);
+    });
+    const double vectorGeometric = measure(iterations, [=]() {
+        Vector<int> v;
+        append(v, n);
+    });
+    WARN("Appending " << n << " elements to Vector<int>: exact growth " << vectorExact / 1000 << " us, geometric growth " <<
+            vectorGeometric / 1000 << " us");
+
+    const double vectorHeap = measure(iterations * 100, []() {
+        Vector<int> v;
+        append(v, 4);
+    });
+    const double vectorInline = measure(iterations * 100, []() {
+        Vector<int, DefaultAllocator, 4> v;
+        append(v, 4);
+    });
+    WARN("Appending 4 elements to Vector<int>: " << vectorHeap << " ns, Vector<int, DefaultAllocator, 4>: " << vectorInline << " ns");
+
+    const double stringExact = measure(iterations, [=]() {
+        String s;
+        for (int i = 0; i < n; ++i) {
+            s.reserve(s.length() + 1);
+            s.concat('a');
+        }
+    });
+    const double stringGeometric = measure(iterations, [=]() {
+        String s;
+        for (int i = 0; i < n; ++i) {
+            s.concat('a');
+        }
+    });
+    WARN("Appending " << n << " characters to String: exact growth " << stringExact / 1000 << " us, geometric growth " <<
+            stringGeometric / 1000 << " us");
+}
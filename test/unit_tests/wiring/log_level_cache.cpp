@@ -0,0 +1,145 @@
+#include "spark_wiring_log_level_cache.h"
+#include "spark_wiring_logging.h"
+#include "spark_wiring_thread.h"
+
+#include "logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+namespace {
+
+using namespace spark;
+using namespace spark::detail;
+
+// Handler that only filters the messages
+class NullLogHandler: public LogHandler {
+public:
+    NullLogHandler(LogLevel level, LogCategoryFilters filters) :
+            LogHandler(level, filters) {
+    }
+
+protected:
+    void logMessage(const char* msg, LogLevel level, const char* category, const LogAttributes& attr) override {
+    }
+};
+
+LogCategoryFilters categoryFilters() {
+    return {
+        { "app", LOG_LEVEL_INFO },
+        { "comm", LOG_LEVEL_WARN },
+        { "comm.protocol", LOG_LEVEL_TRACE },
+        { "net.ppp", LOG_LEVEL_ERROR },
+        { "system", LOG_LEVEL_WARN }
+    };
+}
+
+} // namespace
+
+TEST_CASE("LogLevelCache") {
+    LogLevelCache<8> cache;
+
+    SECTION("levels are cached per category") {
+        const char* const app = "app";
+        const char* const net = "app.network";
+        CHECK(cache.level(app) == 0);
+        CHECK(cache.update(app, LOG_LEVEL_INFO));
+        CHECK(cache.update(net, LOG_LEVEL_WARN));
+        CHECK(cache.update(nullptr, LOG_LEVEL_ERROR));
+        CHECK(cache.level(app) == LOG_LEVEL_INFO);
+        CHECK(cache.level(net) == LOG_LEVEL_WARN);
+        CHECK(cache.level(nullptr) == LOG_LEVEL_ERROR);
+        CHECK(cache.update(app, LOG_LEVEL_TRACE));
+        CHECK(cache.level(app) == LOG_LEVEL_TRACE);
+    }
+
+    SECTION("clearing the cache invalidates all levels") {
+        const char* const app = "app";
+        cache.update(app, LOG_LEVEL_INFO);
+        cache.update(nullptr, LOG_LEVEL_INFO);
+        cache.clear();
+        CHECK(cache.level(app) == 0);
+        CHECK(cache.level(nullptr) == 0);
+        CHECK(cache.update(app, LOG_LEVEL_WARN));
+        CHECK(cache.level(app) == LOG_LEVEL_WARN);
+    }
+
+    SECTION("categories that don't fit the cache are not cached") {
+        std::vector<std::string> cats;
+        for (size_t i = 0; i < cache.size() + 1; ++i) {
+            cats.push_back("category" + std::to_string(i));
+        }
+        for (size_t i = 0; i < cache.size(); ++i) {
+            CHECK(cache.update(cats[i].c_str(), LOG_LEVEL_INFO + i));
+        }
+        CHECK_FALSE(cache.update(cats.back().c_str(), LOG_LEVEL_INFO));
+        CHECK(cache.level(cats.back().c_str()) == 0);
+        for (size_t i = 0; i < cache.size(); ++i) {
+            CHECK(cache.level(cats[i].c_str()) == (int)(LOG_LEVEL_INFO + i));
+        }
+    }
+}
+
+TEST_CASE("LogManager caches the levels of the categories") {
+    const auto mgr = LogManager::instance();
+    NullLogHandler h1(LOG_LEVEL_WARN, categoryFilters());
+    REQUIRE(mgr->addHandler(&h1));
+    CHECK(log_enabled(LOG_LEVEL_TRACE, "comm.protocol.handshake", nullptr));
+    CHECK_FALSE(log_enabled(LOG_LEVEL_INFO, "net.ppp.client", nullptr));
+    CHECK_FALSE(log_enabled(LOG_LEVEL_INFO, "sys.power", nullptr));
+    CHECK(log_enabled(LOG_LEVEL_INFO, "app", nullptr));
+    // Adding a handler invalidates the cached levels
+    NullLogHandler h2(LOG_LEVEL_ALL, LogCategoryFilters());
+    REQUIRE(mgr->addHandler(&h2));
+    CHECK(log_enabled(LOG_LEVEL_INFO, "net.ppp.client", nullptr));
+    CHECK(log_enabled(LOG_LEVEL_INFO, "sys.power", nullptr));
+    // And so does removing one
+    mgr->removeHandler(&h2);
+    CHECK_FALSE(log_enabled(LOG_LEVEL_INFO, "net.ppp.client", nullptr));
+    CHECK_FALSE(log_enabled(LOG_LEVEL_INFO, "sys.power", nullptr));
+    mgr->removeHandler(&h1);
+}
+
+TEST_CASE("Benchmark log level lookup", "[.][benchmark]") {
+    const int iterations = 1000000;
+    // Two handlers, as with a serial and a cloud log handler
+    NullLogHandler h1(LOG_LEVEL_WARN, categoryFilters());
+    NullLogHandler h2(LOG_LEVEL_ERROR, categoryFilters());
+    const LogHandler* const handlers[] = { &h1, &h2 };
+    const auto mgr = LogManager::instance();
+    REQUIRE(mgr->addHandler(&h1));
+    REQUIRE(mgr->addHandler(&h2));
+    const char* const categories[] = { "comm.protocol.handshake", "net.ppp.client", "app", "sys.power" };
+
+    // Lookup done by the log manager without the cache: the category filters of all handlers are
+    // walked while holding the manager's mutex
+    RecursiveMutex mutex;
+    int enabled = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        const char* const category = categories[i & 3];
+        int minLevel = LOG_LEVEL_NONE;
+        mutex.lock();
+        for (const LogHandler* h: handlers) {
+            minLevel = std::min<int>(minLevel, h->level(category));
+        }
+        mutex.unlock();
+        enabled += (LOG_LEVEL_TRACE >= minLevel);
+    }
+    const double filter = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        enabled -= log_enabled(LOG_LEVEL_TRACE, categories[i & 3], nullptr);
+    }
+    const double cached = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    mgr->removeHandler(&h2);
+    mgr->removeHandler(&h1);
+    CHECK(enabled == 0);
+    WARN("Disabled TRACE message: filter walk " << filter << " ns, log_enabled() " << cached << " ns");
+}
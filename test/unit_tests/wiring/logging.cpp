@@ -0,0 +1,150 @@
+#include "spark_wiring_logging.h"
+
+#include "diagnostics.h"
+#include "system_control.h"
+#include "delay_hal.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+
+namespace {
+
+using namespace spark;
+
+// Counts the messages logged by each of the producer threads
+class CountingHandler: public LogHandler {
+public:
+    explicit CountingHandler(int threads) :
+            LogHandler(LOG_LEVEL_ALL),
+            counts_(threads, std::vector<int>()),
+            total_(0),
+            invalid_(0) {
+    }
+
+    int count(int thread, int msg) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto& c = counts_.at(thread);
+        return (msg < (int)c.size()) ? c.at(msg) : 0;
+    }
+
+    int total() const {
+        return total_;
+    }
+
+    int invalid() const {
+        return invalid_;
+    }
+
+protected:
+    void logMessage(const char* msg, LogLevel level, const char* category, const LogAttributes& attr) override {
+        int thread = 0, n = 0;
+        // Catch assertions can only be used on the main thread
+        if (sscanf(msg, "%d %d", &thread, &n) != 2 || thread < 0 || thread >= (int)counts_.size() || n < 0) {
+            ++invalid_;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& c = counts_.at(thread);
+        if (n >= (int)c.size()) {
+            c.resize(n + 1);
+        }
+        ++c.at(n);
+        ++total_;
+    }
+
+private:
+    std::vector<std::vector<int>> counts_;
+    mutable std::mutex mutex_;
+    std::atomic<int> total_;
+    std::atomic<int> invalid_;
+};
+
+int32_t diagValue(uint16_t id) {
+    const diag_source* src = nullptr;
+    REQUIRE(diag_get_source(id, &src, nullptr) == 0);
+    int32_t val = 0;
+    diag_source_get_cmd_data d = {};
+    d.size = sizeof(d);
+    d.data = &val;
+    d.data_size = sizeof(val);
+    REQUIRE(src->callback(src, DIAG_SOURCE_CMD_GET, &d) == 0);
+    return val;
+}
+
+} // namespace
+
+void HAL_Delay_Milliseconds(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Control requests are not used by the tests
+int system_ctrl_alloc_reply_data(ctrl_request* req, size_t size, void* reserved) {
+    return SYSTEM_ERROR_NOT_SUPPORTED;
+}
+
+void system_ctrl_set_result(ctrl_request* req, int result, ctrl_completion_handler_fn handler, void* data, void* reserved) {
+}
+
+TEST_CASE("LogManager asynchronous output") {
+    diag_command(DIAG_SERVICE_CMD_START, nullptr, nullptr);
+    const auto mgr = LogManager::instance();
+
+    SECTION("no messages are lost when the output is stopped and restarted") {
+        const int THREADS = 4;
+        const int MESSAGES = 2000;
+        CountingHandler handler(THREADS);
+        REQUIRE(mgr->addHandler(&handler));
+        const int32_t dropped = diagValue(DIAG_ID_LOG_DROPPED_MESSAGES);
+        REQUIRE(mgr->startAsyncOutput());
+        const Logger log("test");
+        std::atomic<int> running(THREADS);
+        std::atomic<int> logged(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < THREADS; ++i) {
+            threads.emplace_back([&log, &running, &logged, i]() {
+                for (int j = 0; j < MESSAGES; ++j) {
+                    log.info("%d %d", i, j);
+                    ++logged;
+                }
+                --running;
+            });
+        }
+        // Switch between the asynchronous and direct output while the messages are being logged.
+        // Once the output is stopped, every message logged so far has been passed to the handler
+        int pending = 0;
+        while (running > 0) {
+            mgr->stopAsyncOutput();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            const int n = logged;
+            if (handler.total() + (diagValue(DIAG_ID_LOG_DROPPED_MESSAGES) - dropped) < n) {
+                ++pending;
+            }
+            REQUIRE(mgr->startAsyncOutput());
+            std::this_thread::yield();
+        }
+        CHECK(pending == 0);
+        for (auto& t: threads) {
+            t.join();
+        }
+        mgr->stopAsyncOutput();
+        mgr->removeHandler(&handler);
+        // The messages that didn't fit in the queue are the only ones missing
+        int received = 0;
+        for (int i = 0; i < THREADS; ++i) {
+            for (int j = 0; j < MESSAGES; ++j) {
+                const int n = handler.count(i, j);
+                CHECK(n <= 1);
+                received += n;
+            }
+        }
+        CHECK(received + (diagValue(DIAG_ID_LOG_DROPPED_MESSAGES) - dropped) == THREADS * MESSAGES);
+        CHECK(received > 0);
+        CHECK(handler.invalid() == 0);
+    }
+}
@@ -0,0 +1,191 @@
+#include "binary_log.h"
+
+#include "tools/catch.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace particle;
+
+std::string encode(int level, const char* category, uint32_t time, const char* fmt, ...) {
+    char buf[LOG_MAX_STRING_LENGTH];
+    va_list args;
+    va_start(args, fmt);
+    const int n = log_binary_encode(buf, sizeof(buf), level, category, time, fmt, args);
+    va_end(args);
+    REQUIRE(n > 0);
+    return std::string(buf, n);
+}
+
+int encodeTo(char* buf, size_t size, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const int n = log_binary_encode(buf, size, LOG_LEVEL_INFO, nullptr, 0, fmt, args);
+    va_end(args);
+    return n;
+}
+
+std::string decode(const std::string& rec, log_binary_info* info = nullptr) {
+    char buf[LOG_MAX_STRING_LENGTH];
+    const int n = log_binary_decode(rec.data(), rec.size(), buf, sizeof(buf), info, nullptr, nullptr);
+    REQUIRE(n >= 0);
+    REQUIRE(strlen(buf) == (size_t)n);
+    return buf;
+}
+
+std::string format(const char* fmt, ...) {
+    char buf[LOG_MAX_STRING_LENGTH];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return buf;
+}
+
+#define CHECK_ROUND_TRIP(_fmt, ...) \
+        CHECK(decode(encode(LOG_LEVEL_INFO, nullptr, 0, _fmt, ##__VA_ARGS__)) == format(_fmt, ##__VA_ARGS__))
+
+struct TestQueue {
+    std::vector<std::string> entries;
+
+    int pushBack(void* data, uint16_t size) {
+        entries.push_back(std::string((const char*)data, size));
+        return 0;
+    }
+};
+
+} // namespace
+
+TEST_CASE("Binary log records") {
+    SECTION("arguments are formatted the same way as by vsnprintf()") {
+        CHECK_ROUND_TRIP("no arguments");
+        CHECK_ROUND_TRIP("%d %i %u %x %X %o %c", -1, 123456, 4000000000u, 0xbeef, 0xBEEF, 8, 'z');
+        CHECK_ROUND_TRIP("%hhd %hd %ld %lld %llu %jd %zu %td", (signed char)-5, (short)-300, -100000L,
+                -5000000000LL, 18000000000000000000ULL, (intmax_t)-7, (size_t)42, (ptrdiff_t)-3);
+        CHECK_ROUND_TRIP("%08.3f %e %g %.0f %+5.1f", 3.14159, 1e-10, 2.5, 9.5, -0.25);
+        CHECK_ROUND_TRIP("[%s] [%10s] [%-10s] [%.3s] [%*s] [%-*.*s]", "str", "right", "left", "truncated",
+                6, "star", 8, 2, "precision");
+        CHECK_ROUND_TRIP("%*d %-*d %.*d", -4, 1, 3, 2, 5, 3);
+        CHECK_ROUND_TRIP("100%% %s", "done");
+        CHECK_ROUND_TRIP("%p", (void*)0x1234);
+    }
+
+    SECTION("attributes are stored in the record") {
+        const char* const category = "app.binary";
+        log_binary_info info = {};
+        const std::string rec = encode(LOG_LEVEL_WARN, category, 12345, "%d", 1);
+        CHECK(decode(rec, &info) == "1");
+        CHECK(info.level == LOG_LEVEL_WARN);
+        CHECK(info.time == 12345);
+        CHECK(info.category == category);
+        // Header, format string and category addresses, one integer
+        CHECK(rec.size() == sizeof(log_binary_header) + sizeof(void*) * 2 + 4);
+    }
+
+    SECTION("record is truncated if the arguments don't fit") {
+        const std::string str(100, 'a');
+        char buf[80];
+        const int n = encodeTo(buf, sizeof(buf), "%d %s %d", 1, str.c_str(), 2);
+        REQUIRE(n > 0);
+        CHECK(n <= (int)sizeof(buf));
+        CHECK(decode(std::string(buf, n)) == "1 ~");
+    }
+
+    SECTION("strings are resolved via callback") {
+        const std::string rec = encode(LOG_LEVEL_INFO, "cat", 0, "value: %d", 5);
+        std::map<uint64_t, std::string> strings;
+        uint64_t fmt = 0, cat = 0;
+        memcpy(&fmt, rec.data() + sizeof(log_binary_header), sizeof(void*));
+        memcpy(&cat, rec.data() + sizeof(log_binary_header) + sizeof(void*), sizeof(void*));
+        strings[fmt] = "resolved: %d";
+        strings[cat] = "resolved.cat";
+        char buf[LOG_MAX_STRING_LENGTH];
+        log_binary_info info = {};
+        const int n = log_binary_decode(rec.data(), rec.size(), buf, sizeof(buf), &info, [](uint64_t addr, void* data) {
+            auto& strings = *(std::map<uint64_t, std::string>*)data;
+            return strings.count(addr) ? strings[addr].c_str() : (const char*)nullptr;
+        }, &strings);
+        CHECK(n == 11);
+        CHECK(std::string(buf) == "resolved: 5");
+        CHECK(std::string(info.category) == "resolved.cat");
+    }
+}
+
+TEST_CASE("Binary log buffer") {
+    char data[64];
+    BinaryLogBuffer buffer(data, sizeof(data));
+    char rec[LOG_MAX_STRING_LENGTH];
+
+    SECTION("log messages are stored as binary records") {
+        buffer.start(LOG_LEVEL_INFO);
+        CHECK(log_enabled(LOG_LEVEL_INFO, nullptr, nullptr));
+        CHECK_FALSE(log_enabled(LOG_LEVEL_TRACE, nullptr, nullptr));
+        LogAttributes attr = {};
+        attr.size = sizeof(LogAttributes);
+        log_message(LOG_LEVEL_TRACE, "app", &attr, nullptr, "filtered %d", 1);
+        log_message(LOG_LEVEL_INFO, "app", &attr, nullptr, "stored %d", 2);
+        buffer.stop();
+        log_message(LOG_LEVEL_INFO, "app", &attr, nullptr, "stopped %d", 3);
+
+        const int n = buffer.read(rec, sizeof(rec));
+        REQUIRE(n > 0);
+        log_binary_info info = {};
+        CHECK(decode(std::string(rec, n), &info) == "stored 2");
+        CHECK(std::string(info.category) == "app");
+        CHECK(buffer.read(rec, sizeof(rec)) == 0);
+    }
+
+    SECTION("oldest records are discarded when the buffer is full") {
+        std::vector<std::string> recs;
+        for (int i = 0; i < 10; ++i) {
+            recs.push_back(encode(LOG_LEVEL_INFO, nullptr, i, "%d", i));
+            buffer.write(recs.back().data(), recs.back().size());
+        }
+        const size_t count = sizeof(data) / recs.front().size();
+        CHECK(buffer.dropped() == 10 - count);
+        CHECK(buffer.size() == count * recs.front().size());
+        for (size_t i = 10 - count; i < 10; ++i) {
+            const int n = buffer.read(rec, sizeof(rec));
+            REQUIRE(n > 0);
+            CHECK(std::string(rec, n) == recs[i]);
+        }
+        CHECK(buffer.size() == 0);
+    }
+
+    SECTION("records can be moved to a queue") {
+        const std::string r1 = encode(LOG_LEVEL_INFO, nullptr, 0, "first");
+        const std::string r2 = encode(LOG_LEVEL_INFO, nullptr, 0, "second %s", "2");
+        buffer.write(r1.data(), r1.size());
+        buffer.write(r2.data(), r2.size());
+        TestQueue queue;
+        CHECK(buffer.flush(queue) == 0);
+        REQUIRE(queue.entries.size() == 2);
+        CHECK(decode(queue.entries[0]) == "first");
+        CHECK(decode(queue.entries[1]) == "second 2");
+    }
+}
+
+TEST_CASE("Benchmark binary log records", "[.][benchmark]") {
+    const int iterations = 100000;
+    char buf[LOG_MAX_STRING_LENGTH];
+    int total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        total += snprintf(buf, sizeof(buf), "Connected to %s:%u, rssi %d, took %.2f s", "device.spark.io", 5684, -i, 1.5);
+    }
+    const double text = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        total += encodeTo(buf, sizeof(buf), "Connected to %s:%u, rssi %d, took %.2f s", "device.spark.io", 5684, -i, 1.5);
+    }
+    const double binary = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    CHECK(total > 0);
+    // WARN() is taken by the logging macros
+    std::cout << "snprintf() " << text << " ns, binary record " << binary << " ns" << std::endl;
+}
@@ -4,6 +4,7 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <chrono>
 #include "eeprom_emulation.h"
 #include "flash_storage.h"
 
@@ -19,6 +20,8 @@ const size_t PageSize2 = TestPageSize / 4;
 
 using TestStore = RAMFlashStorage<TestBase, TestPageCount, TestPageSize>;
 using TestEEPROM = EEPROMEmulation<TestStore, PageBase1, PageSize1, PageBase2, PageSize2>;
+// Reads and writes by scanning the active page, without the RAM index
+using ScanningEEPROM = EEPROMEmulation<TestStore, PageBase1, PageSize1, PageBase2, PageSize2, false>;
 using Record = TestEEPROM::Record;
 
 // Alias some constants, otherwise the linker is having issues when
@@ -1338,3 +1341,92 @@ TEST_CASE("Page swap with data in multiple batches", "[eeprom]")
         REQUIRE(dataRead == data);
     }
 }
+
+TEST_CASE("Index matches the records in flash", "[eeprom]")
+{
+    TestEEPROM eeprom;
+    eeprom.init();
+
+    // Write enough to go through several page swaps, including partial
+    // writes that leave invalid records behind
+    for(int i = 0; i < 5000; i++)
+    {
+        uint16_t index = rand() % eeprom.capacity();
+        uint8_t values[4];
+        uint16_t length = std::min<uint16_t>(1 + rand() % sizeof(values), eeprom.capacity() - index);
+        for(auto &value: values)
+        {
+            value = rand();
+        }
+
+        if(i % 100 == 99)
+        {
+            eeprom.store.discardWritesAfter(1, [&] {
+                eeprom.put(index, values, length);
+            });
+        }
+        else
+        {
+            eeprom.put(index, values, length);
+        }
+    }
+
+    // Scan a copy of the flash contents
+    ScanningEEPROM scanning;
+    scanning.store = eeprom.store;
+    scanning.init();
+
+    REQUIRE(scanning.getPageBegin(scanning.getActivePage()) == eeprom.getPageBegin(eeprom.getActivePage()));
+    for(uint16_t index = 0; index < eeprom.capacity(); index++)
+    {
+        uint8_t indexed, scanned;
+        eeprom.get(index, indexed);
+        scanning.get(index, scanned);
+        CAPTURE(index);
+        REQUIRE(indexed == scanned);
+    }
+}
+
+template <typename EEPROM>
+void benchmarkEEPROM(const char *name)
+{
+    EEPROM eeprom;
+    eeprom.init();
+
+    // Fill half of the active page, as a long running application would
+    const uint16_t count = PageSize2 / sizeof(Record) / 2;
+    for(uint16_t i = 0; i < count; i++)
+    {
+        eeprom.put(i % 256, (uint8_t)(i / 256 + 1));
+    }
+
+    const int iterations = 10000;
+    uint8_t value = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++)
+    {
+        uint8_t data;
+        eeprom.get(i % 256, data);
+        value += data;
+    }
+    double read = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    // Writing the same value doesn't append records, so this measures
+    // finding the existing values and the end of the records
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++)
+    {
+        uint8_t data = 0;
+        eeprom.get(i % 256, data);
+        eeprom.put(i % 256, data);
+    }
+    double write = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    WARN(name << " with " << count << " records: read " << read << " ns, unchanged write " << write << " ns (" << (int)value << ")");
+}
+
+TEST_CASE("Benchmark EEPROM reads and writes", "[.][benchmark]")
+{
+    benchmarkEEPROM<ScanningEEPROM>("page scan");
+    benchmarkEEPROM<TestEEPROM>("index");
+}
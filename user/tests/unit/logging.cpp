@@ -662,6 +662,15 @@ TEST_CASE("Basic filtering") {
         LOG_PRINT(TRACE, "a"); LOG_PRINT(INFO, "b"); LOG_PRINT(WARN, "c"); LOG_PRINT(ERROR, "d");
         check(log.stream()).isEmpty();
     }
+    SECTION("levels are updated when handlers are added and removed") {
+        DefaultLogHandler log1(LOG_LEVEL_WARN);
+        CHECK((!LOG_ENABLED(INFO) && LOG_ENABLED(WARN)));
+        {
+            DefaultLogHandler log2(LOG_LEVEL_INFO);
+            CHECK(LOG_ENABLED(INFO));
+        }
+        CHECK((!LOG_ENABLED(INFO) && LOG_ENABLED(WARN)));
+    }
 }
 /*
 TEST_CASE("Basic filtering (compatibility callback)") {
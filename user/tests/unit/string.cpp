@@ -77,3 +77,19 @@ TEST_CASE("Can format a string using printf like syntax") {
 TEST_CASE("Can convert a string to lowercase") {
     REQUIRE(String("In LOWERCAse").toLowerCase()==String("in lowercase"));
 }
+
+TEST_CASE("Can append to a string one character at a time") {
+    String s;
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        const char c = 'a' + i % 26;
+        REQUIRE(s.concat(c));
+        expected += c;
+    }
+    REQUIRE(s.length() == expected.size());
+    REQUIRE(expected == s.c_str());
+    REQUIRE(s.trimToSize());
+    REQUIRE(expected == s.c_str());
+    REQUIRE(s.concat("z"));
+    REQUIRE((expected + "z") == s.c_str());
+}
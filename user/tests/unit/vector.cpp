@@ -148,11 +148,32 @@ size_t NonTrivialInt::s_count = 0;
 
 static_assert(!PARTICLE_VECTOR_TRIVIALLY_COPYABLE_TRAIT<NonTrivialInt>::value, "NonTrivialInt is too trivial!");
 
-template<typename T, typename AllocatorT>
-inline Checker<spark::Vector<T, AllocatorT>> check(const spark::Vector<T, AllocatorT> &vector) {
-    return Checker<spark::Vector<T, AllocatorT>>(vector);
+template<typename T, typename AllocatorT, int N>
+inline Checker<spark::Vector<T, AllocatorT, N>> check(const spark::Vector<T, AllocatorT, N> &vector) {
+    return Checker<spark::Vector<T, AllocatorT, N>>(vector);
 }
 
+// Allocator counting the number of allocations
+struct CountingAllocator {
+    static void* malloc(size_t size) {
+        ++s_count;
+        return test::DefaultAllocator::malloc(size);
+    }
+
+    static void* realloc(void* ptr, size_t size) {
+        ++s_count;
+        return test::DefaultAllocator::realloc(ptr, size);
+    }
+
+    static void free(void* ptr) {
+        test::DefaultAllocator::free(ptr);
+    }
+
+    static size_t s_count;
+};
+
+size_t CountingAllocator::s_count = 0;
+
 template<typename VectorT>
 void testVector() {
     using Vector = VectorT;
@@ -314,7 +335,7 @@ void testVector() {
             REQUIRE(a.insert(0, 1)); // i = 0
             check(a).values(1, 2, 4, 5).capacity(4);
             REQUIRE(a.insert(4, 6)); // i = size()
-            check(a).values(1, 2, 4, 5, 6).capacity(5);
+            check(a).values(1, 2, 4, 5, 6).capacity(6); // capacity grows by a factor of 1.5
             REQUIRE(a.insert(2, 3)); // i = size() / 2
             check(a).values(1, 2, 3, 4, 5, 6).capacity(6);
             Vector b;
@@ -650,6 +671,53 @@ void testVector() {
     }
 }
 
+template<typename T>
+void testInlineVector() {
+    using Vector = spark::Vector<T, CountingAllocator, 4>;
+    CountingAllocator::s_count = 0;
+
+    SECTION("elements are stored inline until the inline capacity is exceeded") {
+        Vector a;
+        check(a).size(0).capacity(4);
+        REQUIRE(a.append(1));
+        REQUIRE(a.append(3, 2));
+        check(a).values(1, 2, 2, 2).capacity(4);
+        REQUIRE(CountingAllocator::s_count == 0);
+        REQUIRE(a.append(3));
+        check(a).values(1, 2, 2, 2, 3).capacity(6);
+        REQUIRE(CountingAllocator::s_count == 1);
+        a.removeAt(1, 3);
+        REQUIRE(a.trimToSize()); // elements are moved back to the inline storage
+        check(a).values(1, 3).capacity(4);
+        REQUIRE(a.trimToSize());
+        check(a).values(1, 3).capacity(4);
+        REQUIRE(CountingAllocator::s_count == 1);
+    }
+
+    SECTION("copying, moving and swapping") {
+        Vector a({ 1, 2 }); // inline
+        Vector b({ 3, 4, 5, 6, 7 }); // heap
+        Vector c(a);
+        check(c).values(1, 2).capacity(4);
+        Vector d(std::move(a));
+        check(d).values(1, 2).capacity(4);
+        check(a).size(0).capacity(4);
+        Vector e(std::move(b));
+        check(e).values(3, 4, 5, 6, 7).capacity(5);
+        check(b).size(0).capacity(4);
+        swap(d, e);
+        check(d).values(3, 4, 5, 6, 7).capacity(5);
+        check(e).values(1, 2).capacity(4);
+        swap(c, e);
+        check(c).values(1, 2).capacity(4);
+        check(e).values(1, 2).capacity(4);
+        a = d;
+        check(a).values(3, 4, 5, 6, 7).capacity(5);
+        a = c;
+        check(a).values(1, 2).capacity(4);
+    }
+}
+
 } // namespace
 
 TEST_CASE("Vector<int>") {
@@ -670,3 +738,35 @@ TEST_CASE("Vector<NonTrivialInt>") {
     test::DefaultAllocator::check();
     CHECK(NonTrivialInt::instanceCount() == 0);
 }
+
+TEST_CASE("Vector with inline storage") {
+    test::DefaultAllocator::reset();
+
+    SECTION("Vector<int, AllocatorT, 4>") {
+        testInlineVector<int>();
+    }
+    SECTION("Vector<NonTrivialInt, AllocatorT, 4>") {
+        testInlineVector<NonTrivialInt>();
+    }
+
+    test::DefaultAllocator::check();
+    CHECK(NonTrivialInt::instanceCount() == 0);
+}
+
+TEST_CASE("Vector growth") {
+    test::DefaultAllocator::reset();
+    CountingAllocator::s_count = 0;
+
+    spark::Vector<int, CountingAllocator> a;
+    for (int i = 0; i < 1000; ++i) {
+        REQUIRE(a.append(i));
+    }
+    CHECK(a.size() == 1000);
+    CHECK(a.capacity() < 1500);
+    CHECK(CountingAllocator::s_count < 20); // capacity grows geometrically
+    REQUIRE(a.trimToSize());
+    CHECK(a.capacity() == 1000);
+    a = spark::Vector<int, CountingAllocator>();
+
+    test::DefaultAllocator::check();
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2019 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Maximum number of categories whose logging level can be cached by the log manager
+#ifndef LOG_LEVEL_CACHE_SIZE
+#define LOG_LEVEL_CACHE_SIZE 32
+#endif
+
+namespace spark {
+
+namespace detail {
+
+/*
+    Cache of the effective logging levels of categories.
+
+    A category is interned on first use by taking a free slot of a hash table keyed by the
+    address of its name, so the category names are expected to be static strings, such as the
+    ones used by LOG_CATEGORY() and Logger. Looking up a level doesn't take any locks and can be
+    done from an interrupt handler.
+
+    Levels are only stored and cleared by one thread at a time (the log manager does it while
+    holding its mutex), so a level computed for an outdated set of handlers can't be stored
+    after the cache is cleared.
+*/
+template<size_t SizeT>
+class LogLevelCache {
+public:
+    static_assert(SizeT > 0 && (SizeT & (SizeT - 1)) == 0, "Cache size must be a power of 2");
+
+    LogLevelCache() :
+            nullLevel_(0) {
+        for (size_t i = 0; i < SizeT; ++i) {
+            entries_[i].category.store(nullptr, std::memory_order_relaxed);
+            entries_[i].level.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns the cached level of a category, or 0 if the level is not cached
+    int level(const char* category) const {
+        if (!category) {
+            return nullLevel_.load(std::memory_order_relaxed);
+        }
+        size_t i = hash(category);
+        for (size_t n = 0; n < SizeT; ++n, i = (i + 1) & (SizeT - 1)) {
+            const char* const c = entries_[i].category.load(std::memory_order_acquire);
+            if (c == category) {
+                return entries_[i].level.load(std::memory_order_relaxed);
+            }
+            if (!c) {
+                break;
+            }
+        }
+        return 0;
+    }
+
+    // Stores the level of a category. Returns `false` if the cache is full
+    bool update(const char* category, int level) {
+        if (!category) {
+            nullLevel_.store(level, std::memory_order_relaxed);
+            return true;
+        }
+        size_t i = hash(category);
+        for (size_t n = 0; n < SizeT; ++n, i = (i + 1) & (SizeT - 1)) {
+            Entry& e = entries_[i];
+            const char* const c = e.category.load(std::memory_order_relaxed);
+            if (c == category) {
+                e.level.store(level, std::memory_order_relaxed);
+                return true;
+            }
+            if (!c) {
+                e.level.store(level, std::memory_order_relaxed);
+                e.category.store(category, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Clears the cached levels. The categories keep their slots
+    void clear() {
+        nullLevel_.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < SizeT; ++i) {
+            entries_[i].level.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static constexpr size_t size() {
+        return SizeT;
+    }
+
+private:
+    struct Entry {
+        std::atomic<const char*> category;
+        std::atomic<int> level;
+    };
+
+    Entry entries_[SizeT];
+    std::atomic<int> nullLevel_;
+
+    static size_t hash(const char* category) {
+        // Fibonacci hashing of the address
+        const uint32_t h = (uint32_t)(uintptr_t)category * 2654435769u;
+        return (h >> 16) & (SizeT - 1);
+    }
+};
+
+} // namespace spark::detail
+
+} // namespace spark
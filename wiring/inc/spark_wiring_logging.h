@@ -18,12 +18,14 @@
 #ifndef SPARK_WIRING_LOGGING_H
 #define SPARK_WIRING_LOGGING_H
 
+#include <atomic>
 #include <cstring>
 #include <cstdarg>
 
 #include "logging.h"
 
 #include "spark_wiring_json.h"
+#include "spark_wiring_log_level_cache.h"
 #include "spark_wiring_print.h"
 #include "spark_wiring_string.h"
 #include "spark_wiring_thread.h"
@@ -34,6 +36,25 @@
 #include "system_control.h"
 #endif
 
+#if PLATFORM_THREADING
+
+// Number of messages that can be queued for asynchronous output (must be a power of 2)
+#ifndef LOG_ASYNC_QUEUE_SIZE
+#define LOG_ASYNC_QUEUE_SIZE 16
+#endif
+
+// Priority of the thread running the log handlers in asynchronous mode
+#ifndef LOG_ASYNC_THREAD_PRIORITY
+#define LOG_ASYNC_THREAD_PRIORITY (OS_THREAD_PRIORITY_DEFAULT - 1)
+#endif
+
+// Stack size of the thread running the log handlers in asynchronous mode
+#ifndef LOG_ASYNC_THREAD_STACK_SIZE
+#define LOG_ASYNC_THREAD_STACK_SIZE OS_THREAD_STACK_SIZE_DEFAULT
+#endif
+
+#endif // PLATFORM_THREADING
+
 namespace spark {
 
 class LogCategoryFilter;
@@ -563,6 +584,34 @@ public:
 
 #endif // Wiring_LogConfig
 
+#if PLATFORM_THREADING
+
+    /*!
+        \brief Starts asynchronous output.
+
+        Logged messages, including the ones logged from interrupt handlers, are copied to a queue
+        of `LOG_ASYNC_QUEUE_SIZE` entries and passed to the handlers by a separate thread. Messages
+        that don't fit in the queue are dropped and counted by the `log:ovf` and `log:drop`
+        diagnostics.
+
+        \param priority Priority of the output thread.
+        \return `false` in case of error.
+
+        \note Category names are not copied to the queue and must remain valid until the messages
+               are output.
+    */
+    bool startAsyncOutput(os_thread_prio_t priority = LOG_ASYNC_THREAD_PRIORITY);
+    /*!
+        \brief Stops asynchronous output.
+
+        Waits until the threads that are queueing messages and the output thread have finished, and
+        passes the queued messages to the handlers. Messages logged from then on are passed to the
+        handlers directly.
+    */
+    void stopAsyncOutput();
+
+#endif // PLATFORM_THREADING
+
     /*!
         \brief Returns log manager's instance.
     */
@@ -576,6 +625,7 @@ private:
     struct FactoryHandler;
 
     Vector<LogHandler*> activeHandlers_;
+    detail::LogLevelCache<LOG_LEVEL_CACHE_SIZE> levelCache_; // Levels returned by logEnabled()
 
     bool outputActive_;
 
@@ -586,7 +636,13 @@ private:
 #endif
 
 #if PLATFORM_THREADING
+    struct AsyncEntry;
+    struct AsyncOutput;
+
     RecursiveMutex mutex_; // TODO: Use read-write lock?
+    AsyncOutput *async_; // Allocated when asynchronous output is started for the first time
+    std::atomic<bool> asyncActive_;
+    std::atomic<int> asyncProducers_; // Number of threads queueing a message
 #endif
 
     // This class can be instantiated only via instance() method
@@ -605,6 +661,20 @@ private:
     static void logWrite(const char *data, size_t size, int level, const char *category, void *reserved);
     static int logEnabled(int level, const char *category, void *reserved);
 
+    int minLevel(const char *category) const;
+
+#if PLATFORM_THREADING
+    bool beginAsyncEntries();
+    void endAsyncEntries();
+    template<typename FillFn>
+    void queueEntry(FillFn fill);
+    bool queueMessage(const char *msg, int level, const char *category, const LogAttributes *attr);
+    bool queueWrite(const char *data, size_t size, int level, const char *category);
+    void processAsyncOutput();
+
+    static os_thread_return_t asyncOutputThread(void *data);
+#endif
+
     bool isActive() const;
     void setActive(bool output_active);
 };
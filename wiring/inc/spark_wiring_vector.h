@@ -46,8 +46,47 @@ struct DefaultAllocator {
     static void free(void* ptr);
 };
 
-template<typename T, typename AllocatorT = DefaultAllocator>
-class Vector {
+namespace detail {
+
+// Storage for the elements of a vector that have to be kept inline
+template<typename T, int N>
+class VectorStorage {
+protected:
+    T* inlineData() {
+        return reinterpret_cast<T*>(&data_);
+    }
+
+    bool isInline(const T* data) const {
+        return data == reinterpret_cast<const T*>(&data_);
+    }
+
+private:
+    typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type data_;
+};
+
+template<typename T>
+class VectorStorage<T, 0> {
+protected:
+    T* inlineData() {
+        return nullptr;
+    }
+
+    bool isInline(const T*) const {
+        return false;
+    }
+};
+
+} // namespace detail
+
+/*
+    Dynamic array.
+
+    The capacity of the array grows geometrically as elements are added to it, so appending an
+    element takes amortized constant time. If N is not 0, the array can hold up to N elements
+    without allocating memory on the heap.
+*/
+template<typename T, typename AllocatorT = DefaultAllocator, int N = 0>
+class Vector: private detail::VectorStorage<T, N> {
 public:
     typedef T ValueType;
     typedef AllocatorT AllocatorType;
@@ -57,24 +96,24 @@ public:
     Vector(int n, const T& value);
     Vector(const T* values, int n);
     Vector(std::initializer_list<T> values);
-    Vector(const Vector<T, AllocatorT>& vector);
-    Vector(Vector<T, AllocatorT>&& vector);
+    Vector(const Vector<T, AllocatorT, N>& vector);
+    Vector(Vector<T, AllocatorT, N>&& vector);
     ~Vector();
 
     bool append(T value);
     bool append(int n, const T& value);
     bool append(const T* values, int n);
-    bool append(const Vector<T, AllocatorT>& vector);
+    bool append(const Vector<T, AllocatorT, N>& vector);
 
     bool prepend(T value);
     bool prepend(int n, const T& value);
     bool prepend(const T* values, int n);
-    bool prepend(const Vector<T, AllocatorT>& vector);
+    bool prepend(const Vector<T, AllocatorT, N>& vector);
 
     bool insert(int i, T value);
     bool insert(int i, int n, const T& value);
     bool insert(int i, const T* values, int n);
-    bool insert(int i, const Vector<T, AllocatorT>& vector);
+    bool insert(int i, const Vector<T, AllocatorT, N>& vector);
 
     void removeAt(int i, int n = 1);
     bool removeOne(const T& value);
@@ -91,7 +130,7 @@ public:
     T& at(int i);
     const T& at(int i) const;
 
-    Vector<T, AllocatorT> copy(int i, int n) const;
+    Vector<T, AllocatorT, N> copy(int i, int n) const;
 
     int indexOf(const T& value, int i = 0) const;
     int lastIndexOf(const T& value) const;
@@ -99,7 +138,7 @@ public:
 
     bool contains(const T& value) const;
 
-    Vector<T, AllocatorT>& fill(const T& value);
+    Vector<T, AllocatorT, N>& fill(const T& value);
 
     bool resize(int n);
     int size() const;
@@ -122,25 +161,48 @@ public:
     T& operator[](int i);
     const T& operator[](int i) const;
 
-    bool operator==(const Vector<T, AllocatorT> &vector) const;
-    bool operator!=(const Vector<T, AllocatorT> &vector) const;
+    bool operator==(const Vector<T, AllocatorT, N> &vector) const;
+    bool operator!=(const Vector<T, AllocatorT, N> &vector) const;
 
-    Vector<T, AllocatorT>& operator=(Vector<T, AllocatorT> vector);
+    Vector<T, AllocatorT, N>& operator=(Vector<T, AllocatorT, N> vector);
 
 private:
     T* data_;
     int size_, capacity_;
 
+    // Grows the capacity by a factor of 1.5 or to n elements, whichever is larger
+    bool grow(int n) {
+        if (n <= capacity_) {
+            return true;
+        }
+        const int c = capacity_ + capacity_ / 2;
+        if (c > n && realloc(c)) {
+            return true;
+        }
+        return realloc(n); // Try to allocate as little memory as possible
+    }
+
     template<PARTICLE_VECTOR_ENABLE_IF_TRIVIALLY_COPYABLE(T)>
     bool realloc(int n) {
         T* d = nullptr;
-        if (n > 0) {
-            d = (T*)AllocatorT::realloc(data_, n * sizeof(T));
+        if (n <= N) {
+            d = this->inlineData();
+            n = N;
+            if (d != data_) {
+                move(d, data_, data_ + size_);
+                AllocatorT::free(data_);
+            }
+        } else if (this->isInline(data_)) {
+            d = (T*)AllocatorT::malloc(n * sizeof(T));
             if (!d) {
                 return false;
             }
+            move(d, data_, data_ + size_);
         } else {
-            AllocatorT::free(data_);
+            d = (T*)AllocatorT::realloc(data_, n * sizeof(T));
+            if (!d) {
+                return false;
+            }
         }
         data_ = d;
         capacity_ = n;
@@ -150,19 +212,41 @@ private:
     template<PARTICLE_VECTOR_ENABLE_IF_NOT_TRIVIALLY_COPYABLE(T)>
     bool realloc(int n) {
         T* d = nullptr;
-        if (n > 0) {
+        if (n <= N) {
+            d = this->inlineData();
+            n = N;
+        } else {
             d = (T*)AllocatorT::malloc(n * sizeof(T));
             if (!d) {
                 return false;
             }
+        }
+        if (d != data_) {
             move(d, data_, data_ + size_);
+            if (!this->isInline(data_)) {
+                AllocatorT::free(data_);
+            }
         }
-        AllocatorT::free(data_);
         data_ = d;
         capacity_ = n;
         return true;
     }
 
+    // Takes the elements of another vector. This vector is expected to be empty and to not
+    // have any memory allocated
+    void take(Vector<T, AllocatorT, N>& vector) {
+        if (vector.isInline(vector.data_)) {
+            move(data_, vector.data_, vector.data_ + vector.size_);
+        } else {
+            data_ = vector.data_;
+            capacity_ = vector.capacity_;
+            vector.data_ = vector.inlineData();
+            vector.capacity_ = N;
+        }
+        size_ = vector.size_;
+        vector.size_ = 0;
+    }
+
     // TODO: Use standard algorithms like std::uninitialized_copy() and std::uninitialized_move()
     // instead of custom implementations
     template<PARTICLE_VECTOR_ENABLE_IF_TRIVIALLY_COPYABLE(T)>
@@ -239,12 +323,12 @@ private:
         }
     }
 
-    template<typename V, typename A>
-    friend void swap(Vector<V, A>& vector, Vector<V, A>& vector2);
+    template<typename V, typename A, int M>
+    friend void swap(Vector<V, A, M>& vector, Vector<V, A, M>& vector2);
 };
 
-template<typename T, typename AllocatorT>
-void swap(Vector<T, AllocatorT>& vector, Vector<T, AllocatorT>& vector2);
+template<typename T, typename AllocatorT, int N>
+void swap(Vector<T, AllocatorT, N>& vector, Vector<T, AllocatorT, N>& vector2);
 
 } // spark
 
@@ -268,39 +352,39 @@ inline void spark::DefaultAllocator::free(void* ptr) {
 }
 
 // spark::Vector
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector() :
-        data_(nullptr),
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector() :
+        data_(this->inlineData()),
         size_(0),
-        capacity_(0) {
+        capacity_(N) {
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector(int n) : Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector(int n) : Vector() {
     if (n > 0 && realloc(n)) {
         construct(data_, data_ + n);
         size_ = n;
     }
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector(int n, const T& value) : Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector(int n, const T& value) : Vector() {
     if (n > 0 && realloc(n)) {
         construct(data_, data_ + n, value);
         size_ = n;
     }
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector(const T* values, int n) : Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector(const T* values, int n) : Vector() {
     if (n > 0 && realloc(n)) {
         copy(data_, values, values + n);
         size_ = n;
     }
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector(std::initializer_list<T> values) : Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector(std::initializer_list<T> values) : Vector() {
     const size_t n = values.size();
     if (n > 0 && realloc(n)) {
         copy(data_, values.begin(), values.end());
@@ -308,68 +392,70 @@ inline spark::Vector<T, AllocatorT>::Vector(std::initializer_list<T> values) : V
     }
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector(const Vector<T, AllocatorT>& vector) : Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector(const Vector<T, AllocatorT, N>& vector) : Vector() {
     if (vector.size_ > 0 && realloc(vector.size_)) {
         copy(data_, vector.data_, vector.data_ + vector.size_);
         size_ = vector.size_;
     }
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::Vector(Vector<T, AllocatorT>&& vector) : Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::Vector(Vector<T, AllocatorT, N>&& vector) : Vector() {
     swap(*this, vector);
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>::~Vector() {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>::~Vector() {
     destruct(data_, data_ + size_);
-    AllocatorT::free(data_);
+    if (!this->isInline(data_)) {
+        AllocatorT::free(data_);
+    }
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::append(T value) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::append(T value) {
     return insert(size_, std::move(value));
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::append(int n, const T& value) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::append(int n, const T& value) {
     return insert(size_, n, value);
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::append(const T* values, int n) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::append(const T* values, int n) {
     return insert(size_, values, n);
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::append(const Vector<T, AllocatorT> &vector) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::append(const Vector<T, AllocatorT, N> &vector) {
     return insert(size_, vector);
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::prepend(T value) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::prepend(T value) {
     return insert(0, std::move(value));
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::prepend(int n, const T& value) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::prepend(int n, const T& value) {
     return insert(0, n, value);
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::prepend(const T* values, int n) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::prepend(const T* values, int n) {
     return insert(0, values, n);
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::prepend(const Vector<T, AllocatorT> &vector) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::prepend(const Vector<T, AllocatorT, N> &vector) {
     return insert(0, vector);
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::insert(int i, T value) {
-    if (size_ + 1 > capacity_ && !realloc(size_ + 1)) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::insert(int i, T value) {
+    if (!grow(size_ + 1)) {
         return false;
     }
     T* const p = data_ + i;
@@ -379,9 +465,9 @@ inline bool spark::Vector<T, AllocatorT>::insert(int i, T value) {
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::insert(int i, int n, const T& value) {
-    if (size_ + n > capacity_ && !realloc(size_ + n)) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::insert(int i, int n, const T& value) {
+    if (!grow(size_ + n)) {
         return false;
     }
     T* const p = data_ + i;
@@ -391,9 +477,9 @@ inline bool spark::Vector<T, AllocatorT>::insert(int i, int n, const T& value) {
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::insert(int i, const T* values, int n) {
-    if (size_ + n > capacity_ && !realloc(size_ + n)) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::insert(int i, const T* values, int n) {
+    if (!grow(size_ + n)) {
         return false;
     }
     T* const p = data_ + i;
@@ -403,13 +489,13 @@ inline bool spark::Vector<T, AllocatorT>::insert(int i, const T* values, int n)
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::insert(int i, const Vector<T, AllocatorT> &vector) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::insert(int i, const Vector<T, AllocatorT, N> &vector) {
     return insert(i, vector.data_, vector.size_);
 }
 
-template<typename T, typename AllocatorT>
-inline void spark::Vector<T, AllocatorT>::removeAt(int i, int n) {
+template<typename T, typename AllocatorT, int N>
+inline void spark::Vector<T, AllocatorT, N>::removeAt(int i, int n) {
     if (n < 0 || i + n > size_) {
         n = size_ - i;
     }
@@ -419,8 +505,8 @@ inline void spark::Vector<T, AllocatorT>::removeAt(int i, int n) {
     size_ -= n;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::removeOne(const T &value) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::removeOne(const T &value) {
     T* const p = find(data_, data_ + size_, value);
     if (!p) {
         return false;
@@ -431,8 +517,8 @@ inline bool spark::Vector<T, AllocatorT>::removeOne(const T &value) {
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline int spark::Vector<T, AllocatorT>::removeAll(const T &value) {
+template<typename T, typename AllocatorT, int N>
+inline int spark::Vector<T, AllocatorT, N>::removeAll(const T &value) {
     T* p = data_;
     T* end = p + size_;
     while ((p = find(p, end, value))) {
@@ -445,18 +531,18 @@ inline int spark::Vector<T, AllocatorT>::removeAll(const T &value) {
     return n;
 }
 
-template<typename T, typename AllocatorT>
-inline T spark::Vector<T, AllocatorT>::takeFirst() {
+template<typename T, typename AllocatorT, int N>
+inline T spark::Vector<T, AllocatorT, N>::takeFirst() {
     return takeAt(0);
 }
 
-template<typename T, typename AllocatorT>
-inline T spark::Vector<T, AllocatorT>::takeLast() {
+template<typename T, typename AllocatorT, int N>
+inline T spark::Vector<T, AllocatorT, N>::takeLast() {
     return takeAt(size_ - 1);
 }
 
-template<typename T, typename AllocatorT>
-inline T spark::Vector<T, AllocatorT>::takeAt(int i) {
+template<typename T, typename AllocatorT, int N>
+inline T spark::Vector<T, AllocatorT, N>::takeAt(int i) {
     T* const p = data_ + i;
     T v(std::move(*p));
     p->~T();
@@ -465,42 +551,42 @@ inline T spark::Vector<T, AllocatorT>::takeAt(int i) {
     return std::move(v);
 }
 
-template<typename T, typename AllocatorT>
-inline T& spark::Vector<T, AllocatorT>::first() {
+template<typename T, typename AllocatorT, int N>
+inline T& spark::Vector<T, AllocatorT, N>::first() {
     return data_[0];
 }
 
-template<typename T, typename AllocatorT>
-inline const T& spark::Vector<T, AllocatorT>::first() const {
+template<typename T, typename AllocatorT, int N>
+inline const T& spark::Vector<T, AllocatorT, N>::first() const {
     return data_[0];
 }
 
-template<typename T, typename AllocatorT>
-inline T& spark::Vector<T, AllocatorT>::last() {
+template<typename T, typename AllocatorT, int N>
+inline T& spark::Vector<T, AllocatorT, N>::last() {
     return data_[size_ - 1];
 }
 
-template<typename T, typename AllocatorT>
-inline const T& spark::Vector<T, AllocatorT>::last() const {
+template<typename T, typename AllocatorT, int N>
+inline const T& spark::Vector<T, AllocatorT, N>::last() const {
     return data_[size_ - 1];
 }
 
-template<typename T, typename AllocatorT>
-inline T& spark::Vector<T, AllocatorT>::at(int i) {
+template<typename T, typename AllocatorT, int N>
+inline T& spark::Vector<T, AllocatorT, N>::at(int i) {
     return data_[i];
 }
 
-template<typename T, typename AllocatorT>
-inline const T& spark::Vector<T, AllocatorT>::at(int i) const {
+template<typename T, typename AllocatorT, int N>
+inline const T& spark::Vector<T, AllocatorT, N>::at(int i) const {
     return data_[i];
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT> spark::Vector<T, AllocatorT>::copy(int i, int n) const {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N> spark::Vector<T, AllocatorT, N>::copy(int i, int n) const {
     if (n < 0 || i + n > size_) {
         n = size_ - i;
     }
-    Vector<T, AllocatorT> v;
+    Vector<T, AllocatorT, N> v;
     if (n > 0 && v.realloc(n)) {
         const T* const p = data_ + i;
         copy(v.data_, p, p + n);
@@ -509,8 +595,8 @@ inline spark::Vector<T, AllocatorT> spark::Vector<T, AllocatorT>::copy(int i, in
     return v;
 }
 
-template<typename T, typename AllocatorT>
-inline int spark::Vector<T, AllocatorT>::indexOf(const T &value, int i) const {
+template<typename T, typename AllocatorT, int N>
+inline int spark::Vector<T, AllocatorT, N>::indexOf(const T &value, int i) const {
     const T* const p = find(data_ + i, data_ + size_, value);
     if (!p) {
         return -1;
@@ -518,13 +604,13 @@ inline int spark::Vector<T, AllocatorT>::indexOf(const T &value, int i) const {
     return p - data_;
 }
 
-template<typename T, typename AllocatorT>
-inline int spark::Vector<T, AllocatorT>::lastIndexOf(const T &value) const {
+template<typename T, typename AllocatorT, int N>
+inline int spark::Vector<T, AllocatorT, N>::lastIndexOf(const T &value) const {
     return lastIndexOf(value, size_ - 1);
 }
 
-template<typename T, typename AllocatorT>
-inline int spark::Vector<T, AllocatorT>::lastIndexOf(const T &value, int i) const {
+template<typename T, typename AllocatorT, int N>
+inline int spark::Vector<T, AllocatorT, N>::lastIndexOf(const T &value, int i) const {
     const T* const p = rfind(data_ + i, data_ - 1, value);
     if (!p) {
         return -1;
@@ -532,20 +618,20 @@ inline int spark::Vector<T, AllocatorT>::lastIndexOf(const T &value, int i) cons
     return p - data_;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::contains(const T &value) const {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::contains(const T &value) const {
     return find(data_, data_ + size_, value);
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>& spark::Vector<T, AllocatorT>::fill(const T& value) {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>& spark::Vector<T, AllocatorT, N>::fill(const T& value) {
     destruct(data_, data_ + size_);
     construct(data_, data_ + size_, value);
     return *this;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::resize(int n) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::resize(int n) {
     if (n > size_) {
         if (n > capacity_ && !realloc(n)) {
             return false;
@@ -559,85 +645,85 @@ inline bool spark::Vector<T, AllocatorT>::resize(int n) {
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline int spark::Vector<T, AllocatorT>::size() const {
+template<typename T, typename AllocatorT, int N>
+inline int spark::Vector<T, AllocatorT, N>::size() const {
     return size_;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::isEmpty() const {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::isEmpty() const {
     return size_ == 0;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::reserve(int n) {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::reserve(int n) {
     if (n > capacity_ && !realloc(n)) {
         return false;
     }
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline int spark::Vector<T, AllocatorT>::capacity() const {
+template<typename T, typename AllocatorT, int N>
+inline int spark::Vector<T, AllocatorT, N>::capacity() const {
     return capacity_;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::trimToSize() {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::trimToSize() {
     if (capacity_ > size_ && !realloc(size_)) {
         return false;
     }
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline void spark::Vector<T, AllocatorT>::clear() {
+template<typename T, typename AllocatorT, int N>
+inline void spark::Vector<T, AllocatorT, N>::clear() {
     destruct(data_, data_ + size_);
     size_ = 0;
 }
 
-template<typename T, typename AllocatorT>
-inline T* spark::Vector<T, AllocatorT>::data() {
+template<typename T, typename AllocatorT, int N>
+inline T* spark::Vector<T, AllocatorT, N>::data() {
     return data_;
 }
 
-template<typename T, typename AllocatorT>
-inline const T* spark::Vector<T, AllocatorT>::data() const {
+template<typename T, typename AllocatorT, int N>
+inline const T* spark::Vector<T, AllocatorT, N>::data() const {
     return data_;
 }
 
-template<typename T, typename AllocatorT>
-inline T* spark::Vector<T, AllocatorT>::begin() {
+template<typename T, typename AllocatorT, int N>
+inline T* spark::Vector<T, AllocatorT, N>::begin() {
     return data_;
 }
 
-template<typename T, typename AllocatorT>
-const T* spark::Vector<T, AllocatorT>::begin() const {
+template<typename T, typename AllocatorT, int N>
+const T* spark::Vector<T, AllocatorT, N>::begin() const {
     return data_;
 }
 
-template<typename T, typename AllocatorT>
-T* spark::Vector<T, AllocatorT>::end() {
+template<typename T, typename AllocatorT, int N>
+T* spark::Vector<T, AllocatorT, N>::end() {
     return data_ + size_;
 }
 
-template<typename T, typename AllocatorT>
-const T* spark::Vector<T, AllocatorT>::end() const {
+template<typename T, typename AllocatorT, int N>
+const T* spark::Vector<T, AllocatorT, N>::end() const {
     return data_ + size_;
 }
 
-template<typename T, typename AllocatorT>
-inline T& spark::Vector<T, AllocatorT>::operator[](int i) {
+template<typename T, typename AllocatorT, int N>
+inline T& spark::Vector<T, AllocatorT, N>::operator[](int i) {
     return data_[i];
 }
 
-template<typename T, typename AllocatorT>
-inline const T& spark::Vector<T, AllocatorT>::operator[](int i) const {
+template<typename T, typename AllocatorT, int N>
+inline const T& spark::Vector<T, AllocatorT, N>::operator[](int i) const {
     return data_[i];
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::operator==(const Vector<T, AllocatorT> &vector) const {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::operator==(const Vector<T, AllocatorT, N> &vector) const {
     if (size_ != vector.size_) {
         return false;
     }
@@ -652,24 +738,32 @@ inline bool spark::Vector<T, AllocatorT>::operator==(const Vector<T, AllocatorT>
     return true;
 }
 
-template<typename T, typename AllocatorT>
-inline bool spark::Vector<T, AllocatorT>::operator!=(const Vector<T, AllocatorT> &vector) const {
+template<typename T, typename AllocatorT, int N>
+inline bool spark::Vector<T, AllocatorT, N>::operator!=(const Vector<T, AllocatorT, N> &vector) const {
     return !(*this == vector);
 }
 
-template<typename T, typename AllocatorT>
-inline spark::Vector<T, AllocatorT>& spark::Vector<T, AllocatorT>::operator=(Vector<T, AllocatorT> vector) {
+template<typename T, typename AllocatorT, int N>
+inline spark::Vector<T, AllocatorT, N>& spark::Vector<T, AllocatorT, N>::operator=(Vector<T, AllocatorT, N> vector) {
     swap(*this, vector);
     return *this;
 }
 
 // spark::
-template<typename T, typename AllocatorT>
-inline void spark::swap(Vector<T, AllocatorT>& vector, Vector<T, AllocatorT>& vector2) {
+template<typename T, typename AllocatorT, int N>
+inline void spark::swap(Vector<T, AllocatorT, N>& vector, Vector<T, AllocatorT, N>& vector2) {
     using std::swap;
-    swap(vector.data_, vector2.data_);
-    swap(vector.size_, vector2.size_);
-    swap(vector.capacity_, vector2.capacity_);
+    if (!vector.isInline(vector.data_) && !vector2.isInline(vector2.data_)) {
+        swap(vector.data_, vector2.data_);
+        swap(vector.size_, vector2.size_);
+        swap(vector.capacity_, vector2.capacity_);
+    } else {
+        // Elements stored inline can't be exchanged by swapping the pointers
+        Vector<T, AllocatorT, N> v;
+        v.take(vector);
+        vector.take(vector2);
+        vector2.take(v);
+    }
 }
 
 #endif // SPARK_WIRING_VECTOR_H
@@ -25,11 +25,18 @@
 #include <algorithm>
 #include <cinttypes>
 #include <memory>
+#include <new>
 
 #include "spark_wiring_network.h"
 #include "spark_wiring_usbserial.h"
 #include "spark_wiring_usartserial.h"
 #include "spark_wiring_interrupts.h"
+#include "spark_wiring_diagnostics.h"
+
+#if PLATFORM_THREADING
+#include "mpsc_queue.h"
+#include "delay_hal.h"
+#endif
 
 // Uncomment to enable logging in interrupt handlers
 // #define LOG_FROM_ISR
@@ -46,6 +53,11 @@ namespace {
 
 using namespace spark;
 
+// Number of times a message didn't fit in the asynchronous output queue
+particle::AtomicIntegerDiagnosticData g_logQueueOverflows(DIAG_ID_LOG_QUEUE_OVERFLOWS, DIAG_NAME_LOG_QUEUE_OVERFLOWS);
+// Number of messages that were not passed to the handlers
+particle::AtomicIntegerDiagnosticData g_logDroppedMessages(DIAG_ID_LOG_DROPPED_MESSAGES, DIAG_NAME_LOG_DROPPED_MESSAGES);
+
 #if Wiring_LogConfig
 
 /*
@@ -684,16 +696,53 @@ struct spark::LogManager::FactoryHandler {
 
 #endif // Wiring_LogConfig
 
+#if PLATFORM_THREADING
+
+struct spark::LogManager::AsyncEntry {
+    enum Type {
+        MESSAGE,
+        WRITE
+    };
+
+    uint8_t type;
+    uint8_t level;
+    uint16_t size; // Size of the written data
+    const char *category;
+    LogAttributes attr; // Message attributes. Details, if any, are stored after the message text
+    char data[LOG_MAX_STRING_LENGTH]; // Message text or written data
+};
+
+struct spark::LogManager::AsyncOutput {
+    particle::MpscQueue<AsyncEntry, LOG_ASYNC_QUEUE_SIZE> queue;
+    os_thread_t thread;
+    os_semaphore_t sem; // Given when an entry is committed to the queue
+    std::atomic<bool> stop;
+};
+
+#endif // PLATFORM_THREADING
+
 spark::LogManager::LogManager() {
 #if Wiring_LogConfig
     handlerFactory_ = DefaultLogHandlerFactory::instance();
     streamFactory_ = DefaultOutputStreamFactory::instance();
+#endif
+#if PLATFORM_THREADING
+    async_ = nullptr;
+    asyncActive_ = false;
+    asyncProducers_ = 0;
 #endif
     outputActive_ = false;
 }
 
 spark::LogManager::~LogManager() {
     resetSystemCallbacks();
+#if PLATFORM_THREADING
+    stopAsyncOutput();
+    if (async_) {
+        os_semaphore_destroy(async_->sem);
+        delete async_;
+    }
+#endif
 #if Wiring_LogConfig
     LOG_WITH_LOCK(mutex_) {
          destroyFactoryHandlers();
@@ -706,6 +755,7 @@ bool spark::LogManager::addHandler(LogHandler *handler) {
         if (activeHandlers_.contains(handler) || !activeHandlers_.append(handler)) {
             return false;
         }
+        levelCache_.clear();
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
@@ -715,7 +765,11 @@ bool spark::LogManager::addHandler(LogHandler *handler) {
 
 void spark::LogManager::removeHandler(LogHandler *handler) {
     LOG_WITH_LOCK(mutex_) {
-        if (activeHandlers_.removeOne(handler) && activeHandlers_.isEmpty()) {
+        if (!activeHandlers_.removeOne(handler)) {
+            return;
+        }
+        levelCache_.clear();
+        if (activeHandlers_.isEmpty()) {
             resetSystemCallbacks();
         }
     }
@@ -764,6 +818,7 @@ bool spark::LogManager::addFactoryHandler(const char *id, const char *handlerTyp
             factoryHandlers_.takeLast(); // Revert factoryHandlers_.append()
             return false;
         }
+        levelCache_.clear();
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
@@ -810,6 +865,7 @@ void spark::LogManager::destroyFactoryHandler(const char *id) {
         const FactoryHandler &h = factoryHandlers_.at(i);
         if (h.id == id) {
             activeHandlers_.removeOne(h.handler);
+            levelCache_.clear();
             if (activeHandlers_.isEmpty()) {
                 resetSystemCallbacks();
             }
@@ -835,6 +891,7 @@ void spark::LogManager::destroyFactoryHandlers() {
         }
     }
     factoryHandlers_.clear();
+    levelCache_.clear();
 }
 
 #endif // Wiring_LogConfig
@@ -848,15 +905,22 @@ void spark::LogManager::resetSystemCallbacks() {
 }
 
 void spark::LogManager::logMessage(const char *msg, int level, const char *category, const LogAttributes *attr, void *reserved) {
+    LogManager *that = instance();
+#if PLATFORM_THREADING
+    if (that->queueMessage(msg, level, category, attr)) {
+        return;
+    }
+#endif
 #ifndef LOG_FROM_ISR
     if (HAL_IsISR()) {
+        ++g_logDroppedMessages;
         return;
     }
 #endif
-    LogManager *that = instance();
     LOG_WITH_LOCK(that->mutex_) {
         // prevent re-entry
         if (that->isActive()) {
+            ++g_logDroppedMessages;
             return;
         }
         that->setActive(true);
@@ -868,15 +932,22 @@ void spark::LogManager::logMessage(const char *msg, int level, const char *categ
 }
 
 void spark::LogManager::logWrite(const char *data, size_t size, int level, const char *category, void *reserved) {
+    LogManager *that = instance();
+#if PLATFORM_THREADING
+    if (that->queueWrite(data, size, level, category)) {
+        return;
+    }
+#endif
 #ifndef LOG_FROM_ISR
     if (HAL_IsISR()) {
+        ++g_logDroppedMessages;
         return;
     }
 #endif
-    LogManager *that = instance();
     LOG_WITH_LOCK(that->mutex_) {
         // prevent re-entry
         if (that->isActive()) {
+            ++g_logDroppedMessages;
             return;
         }
         that->setActive(true);
@@ -888,24 +959,210 @@ void spark::LogManager::logWrite(const char *data, size_t size, int level, const
 }
 
 int spark::LogManager::logEnabled(int level, const char *category, void *reserved) {
+    LogManager *that = instance();
+#if PLATFORM_THREADING
+    if (that->asyncActive_) {
+        // Don't wait for the output thread to release the mutex. If the level can't be checked
+        // now, the handlers will filter the message when it is output
+        const int cachedLevel = that->levelCache_.level(category);
+        if (cachedLevel) {
+            return (level >= cachedLevel);
+        }
+        if (HAL_IsISR() || !that->mutex_.trylock()) {
+            return 1;
+        }
+        const int minLevel = that->minLevel(category);
+        that->levelCache_.update(category, minLevel);
+        that->mutex_.unlock();
+        return (level >= minLevel);
+    }
+#endif
 #ifndef LOG_FROM_ISR
     if (HAL_IsISR()) {
         return 0;
     }
 #endif
-    LogManager *that = instance();
-    int minLevel = LOG_LEVEL_NONE;
+    int minLevel = that->levelCache_.level(category);
+    if (minLevel) {
+        return (level >= minLevel);
+    }
     LOG_WITH_LOCK(that->mutex_) {
-        for (LogHandler *handler: that->activeHandlers_) {
-            const int level = handler->level(category);
-            if (level < minLevel) {
-                minLevel = level;
+        minLevel = that->minLevel(category);
+        // The cache is cleared while holding the mutex, so the level can't be outdated here
+        that->levelCache_.update(category, minLevel);
+    }
+    return (level >= minLevel);
+}
+
+int spark::LogManager::minLevel(const char *category) const {
+    int minLevel = LOG_LEVEL_NONE;
+    for (LogHandler *handler: activeHandlers_) {
+        const int level = handler->level(category);
+        if (level < minLevel) {
+            minLevel = level;
+        }
+    }
+    return minLevel;
+}
+
+#if PLATFORM_THREADING
+
+bool spark::LogManager::startAsyncOutput(os_thread_prio_t priority) {
+    LOG_WITH_LOCK(mutex_) {
+        if (asyncActive_) {
+            return true;
+        }
+        if (!async_) {
+            std::unique_ptr<AsyncOutput> async(new(std::nothrow) AsyncOutput());
+            if (!async || os_semaphore_create(&async->sem, 1, 0) != 0) {
+                return false;
             }
+            async_ = async.release();
+        }
+        async_->stop = false;
+        if (os_thread_create(&async_->thread, "log", priority, asyncOutputThread, this, LOG_ASYNC_THREAD_STACK_SIZE) != 0) {
+            return false;
         }
+        asyncActive_ = true;
     }
-    return (level >= minLevel);
+    return true;
+}
+
+void spark::LogManager::stopAsyncOutput() {
+    LOG_WITH_LOCK(mutex_) {
+        if (!asyncActive_) {
+            return;
+        }
+        asyncActive_ = false;
+    }
+    // Threads that saw the asynchronous mode still active may be filling in an entry. Let them
+    // finish, so that the last of their messages are in the queue before it's drained. New
+    // messages go to the handlers directly
+    while (asyncProducers_ > 0) {
+        HAL_Delay_Milliseconds(1);
+    }
+    // The output thread needs the mutex to finish processing the queue
+    async_->stop = true;
+    os_semaphore_give(async_->sem, false);
+    os_thread_join(async_->thread);
+    os_thread_cleanup(async_->thread);
+    processAsyncOutput();
+}
+
+bool spark::LogManager::beginAsyncEntries() {
+    // stopAsyncOutput() waits for the producers counted here before it drains the queue
+    ++asyncProducers_;
+    if (!asyncActive_) {
+        --asyncProducers_;
+        return false;
+    }
+    return true;
 }
 
+void spark::LogManager::endAsyncEntries() {
+    --asyncProducers_;
+}
+
+template<typename FillFn>
+void spark::LogManager::queueEntry(FillFn fill) {
+    // Messages logged by the handlers themselves would never leave the queue
+    if (!HAL_IsISR() && os_thread_is_current(async_->thread)) {
+        ++g_logDroppedMessages;
+        return;
+    }
+    const auto elem = async_->queue.reserve();
+    if (!elem) {
+        ++g_logQueueOverflows;
+        ++g_logDroppedMessages;
+        return;
+    }
+    fill(&elem->value);
+    async_->queue.commit(elem);
+    os_semaphore_give(async_->sem, false);
+}
+
+bool spark::LogManager::queueMessage(const char *msg, int level, const char *category, const LogAttributes *attr) {
+    if (!beginAsyncEntries()) {
+        return false;
+    }
+    queueEntry([=](AsyncEntry *entry) {
+        entry->type = AsyncEntry::MESSAGE;
+        entry->level = level;
+        entry->size = 0;
+        entry->category = category;
+        // The caller may have been built with an older version of the attributes structure
+        memset(&entry->attr, 0, sizeof(entry->attr));
+        memcpy(&entry->attr, attr, std::min(attr->size, sizeof(entry->attr)));
+        entry->attr.size = sizeof(entry->attr);
+        size_t n = strnlen(msg, sizeof(entry->data) - 1);
+        memcpy(entry->data, msg, n);
+        entry->data[n++] = '\0';
+        if (entry->attr.has_details) {
+            // Copy as much of the details as fits after the message text
+            if (n < sizeof(entry->data)) {
+                char *details = entry->data + n;
+                const size_t len = strnlen(entry->attr.details, sizeof(entry->data) - n - 1);
+                memcpy(details, entry->attr.details, len);
+                details[len] = '\0';
+                entry->attr.details = details;
+            } else {
+                entry->attr.has_details = 0;
+            }
+        }
+    });
+    endAsyncEntries();
+    return true;
+}
+
+bool spark::LogManager::queueWrite(const char *data, size_t size, int level, const char *category) {
+    if (!beginAsyncEntries()) {
+        return false;
+    }
+    while (size > 0) {
+        const size_t n = std::min(size, sizeof(AsyncEntry::data));
+        queueEntry([=](AsyncEntry *entry) {
+            entry->type = AsyncEntry::WRITE;
+            entry->level = level;
+            entry->size = n;
+            entry->category = category;
+            memcpy(entry->data, data, n);
+        });
+        data += n;
+        size -= n;
+    }
+    endAsyncEntries();
+    return true;
+}
+
+void spark::LogManager::processAsyncOutput() {
+    AsyncEntry *entry = nullptr;
+    while ((entry = async_->queue.front())) {
+        LOG_WITH_LOCK(mutex_) {
+            setActive(true);
+            for (LogHandler *handler: activeHandlers_) {
+                if (entry->type == AsyncEntry::MESSAGE) {
+                    handler->message(entry->data, (LogLevel)entry->level, entry->category, entry->attr);
+                } else {
+                    handler->write(entry->data, entry->size, (LogLevel)entry->level, entry->category);
+                }
+            }
+            setActive(false);
+        }
+        async_->queue.pop();
+    }
+}
+
+os_thread_return_t spark::LogManager::asyncOutputThread(void *data) {
+    LogManager *that = static_cast<LogManager*>(data);
+    while (!that->async_->stop) {
+        os_semaphore_take(that->async_->sem, CONCURRENT_WAIT_FOREVER, false);
+        that->processAsyncOutput();
+    }
+    os_thread_exit(nullptr);
+}
+
+#endif // PLATFORM_THREADING
+
 inline bool spark::LogManager::isActive() const {
     return outputActive_;
 }
@@ -202,6 +202,22 @@ unsigned char String::reserve(unsigned int size)
 	return 0;
 }
 
+unsigned char String::trimToSize(void)
+{
+	if (!buffer || capacity == len) return 1;
+	return changeBuffer(len);
+}
+
+// grows the buffer by a factor of 1.5, so that appending to a string takes
+// amortized constant time. falls back to the exact size if that fails
+unsigned char String::grow(unsigned int size)
+{
+	if (buffer && capacity >= size) return 1;
+	unsigned int newCapacity = capacity + capacity / 2;
+	if (buffer && newCapacity > size && changeBuffer(newCapacity)) return 1;
+	return reserve(size);
+}
+
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
 	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
@@ -309,7 +325,7 @@ unsigned char String::concat(const char *cstr, unsigned int length)
 	unsigned int newlen = len + length;
 	if (!cstr) return 0;
 	if (length == 0) return 1;
-	if (!reserve(newlen)) return 0;
+	if (!grow(newlen)) return 0;
 	strcpy(buffer + len, cstr);
 	len = newlen;
 	return 1;